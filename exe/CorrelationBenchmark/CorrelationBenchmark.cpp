@@ -0,0 +1,148 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace: an open source facial behavior analysis toolkit
+//       Tadas Baltruaitis, Peter Robinson, and Louis-Philippe Morency
+//       in IEEE Winter Conference on Applications of Computer Vision, 2016  
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltruaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-speci?c normalisation for automatic Action Unit detection
+//       Tadas Baltruaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+//       Constrained Local Neural Fields for robust facial landmark detection in the wild.
+//       Tadas Baltruaitis, Peter Robinson, and Louis-Philippe Morency. 
+//       in IEEE Int. Conference on Computer Vision Workshops, 300 Faces in-the-Wild Challenge, 2013.    
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// CorrelationBenchmark.cpp : Defines the entry point for the console application timing the direct and the DFT based correlation used by the patch experts.
+// It reports for which template and response sizes the direct correlation is faster, and the matching threshold for LandmarkDetector::SetDirectCorrelationThreshold.
+// Usage: CorrelationBenchmark [-iters <number of repetitions per size>]
+
+#include "LandmarkCoreIncludes.h"
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+using namespace std;
+
+vector<string> get_arguments(int argc, char **argv)
+{
+
+	vector<string> arguments;
+
+	for(int i = 0; i < argc; ++i)
+	{
+		arguments.push_back(string(argv[i]));
+	}
+	return arguments;
+}
+
+// Average time of a single correlation in microseconds, using the given method
+// share_image_dft reuses the image dft between the calls (as done between the neurons of a patch expert), otherwise it is recomputed for every call
+double time_correlation(const cv::Mat_<float>& img, const cv::Mat_<float>& templ, const map<int, cv::Mat_<double> >& templ_dfts, LandmarkDetector::CorrelationMethod method, bool share_image_dft, int iterations, cv::Mat_<float>& result)
+{
+	LandmarkDetector::SetCorrelationMethod(method);
+
+	cv::Mat_<double> img_dft;
+	cv::Mat integral_img, integral_img_sq;
+
+	int64 start_ticks = cv::getTickCount();
+	for(int i = 0; i < iterations; ++i)
+	{
+		if(!share_image_dft)
+		{
+			img_dft = cv::Mat_<double>();
+		}
+		LandmarkDetector::matchTemplate_m(img, img_dft, integral_img, integral_img_sq, templ, templ_dfts, result, CV_TM_CCORR);
+	}
+	return 1e6 * (cv::getTickCount() - start_ticks) / cv::getTickFrequency() / iterations;
+}
+
+int main (int argc, char **argv)
+{
+
+	vector<string> arguments = get_arguments(argc, argv);
+
+	int iterations = 2000;
+
+	for (size_t i = 1; i < arguments.size(); ++i)
+	{
+		if (arguments[i].compare("-iters") == 0 && i + 1 < arguments.size())
+		{
+			iterations = stoi(arguments[i + 1]);
+			i++;
+		}
+	}
+
+	// The template sizes of the patch experts and validator kernels, and the response sizes from the window sizes up to the validator images
+	int templ_sizes[] = {3, 5, 7, 9, 11, 13, 15};
+	int response_sizes[] = {3, 5, 7, 9, 11, 13, 15, 19, 23, 31, 47, 63};
+
+	cv::RNG rng(0);
+
+	// The measurements sorted by the number of multiply-adds of the direct correlation
+	vector<pair<double, bool> > direct_faster;
+
+	cout << "template response multiply-adds direct(us) dft_shared(us) dft(us) max_difference" << endl;
+
+	for(int t : templ_sizes)
+	{
+		for(int r : response_sizes)
+		{
+			cv::Mat_<float> img(r + t - 1, r + t - 1);
+			cv::Mat_<float> templ(t, t);
+			rng.fill(img, cv::RNG::UNIFORM, -1, 1);
+			rng.fill(templ, cv::RNG::UNIFORM, -1, 1);
+
+			map<int, cv::Mat_<double> > templ_dfts;
+			LandmarkDetector::computeTemplateDFT_m(templ, img.size(), templ_dfts);
+
+			cv::Mat_<float> result_direct(r, r), result_dft(r, r);
+
+			double time_direct = time_correlation(img, templ, templ_dfts, LandmarkDetector::CORRELATION_DIRECT, false, iterations, result_direct);
+			double time_dft_shared = time_correlation(img, templ, templ_dfts, LandmarkDetector::CORRELATION_DFT, true, iterations, result_dft);
+			double time_dft = time_correlation(img, templ, templ_dfts, LandmarkDetector::CORRELATION_DFT, false, iterations, result_dft);
+
+			double multiply_adds = (double)t * t * r * r;
+			double max_difference = cv::norm(result_direct, result_dft, cv::NORM_INF);
+
+			cout << t << "x" << t << " " << r << "x" << r << " " << multiply_adds << " " << time_direct << " " << time_dft_shared << " " << time_dft << " " << max_difference << endl;
+
+			direct_faster.push_back(pair<double, bool>(multiply_adds, time_direct < time_dft_shared));
+		}
+	}
+
+	LandmarkDetector::SetCorrelationMethod(LandmarkDetector::CORRELATION_AUTO);
+
+	// The crossover is the largest number of multiply-adds below which the direct correlation always wins (compared to the DFT with a shared image dft)
+	std::sort(direct_faster.begin(), direct_faster.end());
+	double threshold = 0;
+	for(size_t i = 0; i < direct_faster.size() && direct_faster[i].second; ++i)
+	{
+		threshold = direct_faster[i].first;
+	}
+
+	cout << "Direct correlation is faster up to " << threshold << " multiply-adds (current threshold " << LandmarkDetector::GetDirectCorrelationThreshold() << ")" << endl;
+
+	return 0;
+}
+
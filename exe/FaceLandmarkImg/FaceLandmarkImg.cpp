@@ -176,7 +176,7 @@ void write_out_landmarks(const string& outfeatures, const LandmarkDetector::CLNF
 
 	if (featuresFile.is_open())
 	{
-		int n = clnf_model.patch_experts.visibilities[0][0].rows;
+		int n = clnf_model.model->patch_experts.visibilities[0][0].rows;
 		featuresFile << "version: 1" << endl;
 		featuresFile << "npoints: " << n << endl;
 		featuresFile << "{" << endl;
@@ -331,7 +331,7 @@ int main (int argc, char **argv)
 
 	// The modules that are being used for tracking
 	cout << "Loading the model" << endl;
-	LandmarkDetector::CLNF clnf_model(det_parameters.model_location);
+	LandmarkDetector::CLNF clnf_model(det_parameters.model_location, det_parameters);
 	cout << "Model loaded" << endl;
 	
 	cv::CascadeClassifier classifier(det_parameters.face_detector_location);
@@ -341,15 +341,15 @@ int main (int argc, char **argv)
 	string au_loc = "AU_predictors/AU_all_static.txt";
 
 	boost::filesystem::path au_loc_path = boost::filesystem::path(au_loc);
-	if (boost::filesystem::exists(au_loc_path))
+	if (LandmarkDetector::ModelFileExists(au_loc_path.string()))
 	{
 		au_loc = au_loc_path.string();
 	}
-	else if (boost::filesystem::exists(parent_path/au_loc_path))
+	else if (LandmarkDetector::ModelFileExists((parent_path/au_loc_path).string()))
 	{
 		au_loc = (parent_path/au_loc_path).string();
 	}
-	else if (boost::filesystem::exists(config_path/au_loc_path))
+	else if (LandmarkDetector::ModelFileExists((config_path/au_loc_path).string()))
 	{
 		au_loc = (config_path/au_loc_path).string();
 	}
@@ -362,15 +362,15 @@ int main (int argc, char **argv)
 	// Used for image masking for AUs
 	string tri_loc;
 	boost::filesystem::path tri_loc_path = boost::filesystem::path("model/tris_68_full.txt");
-	if (boost::filesystem::exists(tri_loc_path))
+	if (LandmarkDetector::ModelFileExists(tri_loc_path.string()))
 	{
 		tri_loc = tri_loc_path.string();
 	}
-	else if (boost::filesystem::exists(parent_path/tri_loc_path))
+	else if (LandmarkDetector::ModelFileExists((parent_path/tri_loc_path).string()))
 	{
 		tri_loc = (parent_path/tri_loc_path).string();
 	}
-	else if (boost::filesystem::exists(config_path/tri_loc_path))
+	else if (LandmarkDetector::ModelFileExists((config_path/tri_loc_path).string()))
 	{
 		tri_loc = (config_path/tri_loc_path).string();
 	}
@@ -440,11 +440,11 @@ int main (int argc, char **argv)
 			if(det_parameters.curr_face_detector == LandmarkDetector::FaceModelParameters::HOG_SVM_DETECTOR)
 			{
 				vector<double> confidences;
-				LandmarkDetector::DetectFacesHOG(face_detections, grayscale_image, face_detector_hog, confidences);
+				LandmarkDetector::DetectFacesHOG(face_detections, grayscale_image, face_detector_hog, confidences, det_parameters.min_face_size);
 			}
 			else
 			{
-				LandmarkDetector::DetectFaces(face_detections, grayscale_image, classifier);
+				LandmarkDetector::DetectFaces(face_detections, grayscale_image, classifier, det_parameters.min_face_size);
 			}
 
 			// Detect landmarks around detected faces
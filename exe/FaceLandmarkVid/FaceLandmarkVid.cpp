@@ -128,7 +128,7 @@ void visualise_tracking(cv::Mat& captured_image, cv::Mat_<float>& depth_image, c
 		LandmarkDetector::DrawBox(captured_image, pose_estimate_to_draw, cv::Scalar((1 - vis_certainty)*255.0, 0, vis_certainty * 255), thickness, fx, fy, cx, cy);
 
 		//Draw Gaze
-		if (det_parameters.track_gaze && detection_success && face_model.eye_model)
+		if (det_parameters.track_gaze && detection_success && face_model.model->eye_model)
 		{
 			FaceAnalysis::DrawGaze(captured_image, face_model, gazeDirection0, gazeDirection1, fx, fy, cx, cy);
 		}
@@ -150,6 +150,13 @@ void visualise_tracking(cv::Mat& captured_image, cv::Mat_<float>& depth_image, c
 	fpsSt += fpsC;
 	cv::putText(captured_image, fpsSt, cv::Point(10, 20), CV_FONT_HERSHEY_SIMPLEX, 0.5, CV_RGB(255, 0, 0));
 
+	// Report the stages that had to be dropped to stay within the frame budget
+	string dropped_stages = face_model.GetDroppedStages();
+	if (!dropped_stages.empty())
+	{
+		cv::putText(captured_image, "Dropped: " + dropped_stages, cv::Point(10, 40), CV_FONT_HERSHEY_SIMPLEX, 0.5, CV_RGB(255, 0, 0));
+	}
+
 	if (!det_parameters.quiet_mode)
 	{
 		cv::namedWindow("tracking_result", 1);
@@ -186,7 +193,10 @@ int main (int argc, char **argv)
 	LandmarkDetector::get_video_input_output_params(files, depth_directories, out_dummy, output_video_files, u, output_codec, arguments);
 	
 	// The modules that are being used for tracking
-	LandmarkDetector::CLNF clnf_model(det_parameters.model_location);	
+	LandmarkDetector::CLNF clnf_model(det_parameters.model_location, det_parameters);
+
+	// Face detection for (re)initialisation is done on a worker thread so that it does not stall the tracking
+	LandmarkDetector::FaceDetectorWorker face_detector(det_parameters);
 
 	// Grab camera parameters, if they are not defined (approximate values will be used)
 	float fx = 0, fy = 0, cx = 0, cy = 0;
@@ -229,15 +239,15 @@ int main (int argc, char **argv)
 	//Load triangulation files, Used for image masking
 	string tri_loc;
 	boost::filesystem::path tri_loc_path = boost::filesystem::path("model/tris_68_full.txt");
-	if (boost::filesystem::exists(tri_loc_path))
+	if (LandmarkDetector::ModelFileExists(tri_loc_path.string()))
 	{
 		tri_loc = tri_loc_path.string();
 	}
-	else if (boost::filesystem::exists(parent_path / tri_loc_path))
+	else if (LandmarkDetector::ModelFileExists((parent_path / tri_loc_path).string()))
 	{
 		tri_loc = (parent_path / tri_loc_path).string();
 	}
-	else if (boost::filesystem::exists(config_path / tri_loc_path))
+	else if (LandmarkDetector::ModelFileExists((config_path / tri_loc_path).string()))
 	{
 		tri_loc = (config_path / tri_loc_path).string();
 	}
@@ -259,15 +269,15 @@ int main (int argc, char **argv)
 	}
 
 	boost::filesystem::path au_loc_path = boost::filesystem::path(au_loc_local);
-	if (boost::filesystem::exists(au_loc_path))
+	if (LandmarkDetector::ModelFileExists(au_loc_path.string()))
 	{
 		au_loc = au_loc_path.string();
 	}
-	else if (boost::filesystem::exists(parent_path/au_loc_path))
+	else if (LandmarkDetector::ModelFileExists((parent_path/au_loc_path).string()))
 	{
 		au_loc = (parent_path/au_loc_path).string();
 	}
-	else if (boost::filesystem::exists(config_path/au_loc_path))
+	else if (LandmarkDetector::ModelFileExists((config_path/au_loc_path).string()))
 	{
 		au_loc = (config_path/au_loc_path).string();
 	}
@@ -283,6 +293,9 @@ int main (int argc, char **argv)
 
 	//Create face Action Units (AU) analyser 
 	FaceAnalysis::FaceAnalyser face_analyser(vector<cv::Vec3d>(), sim_scale, sim_size, sim_size, au_loc, tri_loc);
+
+	// Only the current AUs are used here, so keep the history bounded for long (live) sessions
+	face_analyser.SetStreaming(true);
 	
 	//End of Action Units Extraction
 
@@ -416,7 +429,7 @@ int main (int argc, char **argv)
 			}
 			
 			// The actual facial landmark detection / tracking
-			bool detection_success = LandmarkDetector::DetectLandmarksInVideo(grayscale_image, depth_image, clnf_model, det_parameters);
+			bool detection_success = LandmarkDetector::DetectLandmarksInVideo(grayscale_image, depth_image, clnf_model, det_parameters, face_detector);
 			
 			// Visualising the results
 			// Drawing the facial landmarks on the face and the bounding box around it if tracking is successful and initialised
@@ -426,7 +439,7 @@ int main (int argc, char **argv)
 			cv::Point3f gazeDirection0(0, 0, -1);
 			cv::Point3f gazeDirection1(0, 0, -1);
 
-			if (det_parameters.track_gaze && detection_success && clnf_model.eye_model)
+			if (det_parameters.track_gaze && detection_success && clnf_model.model->eye_model)
 			{
 				FaceAnalysis::EstimateGaze(clnf_model, gazeDirection0, fx, fy, cx, cy, true);
 				FaceAnalysis::EstimateGaze(clnf_model, gazeDirection1, fx, fy, cx, cy, false);
@@ -469,6 +482,11 @@ int main (int argc, char **argv)
 			frame_count++;
 
 		}
+
+		if (det_parameters.validation_gate_every > 1)
+		{
+			INFO_STREAM("Validations skipped by the temporal gating: " << clnf_model.skipped_validations << " in " << frame_count << " frames");
+		}
 		
 		frame_count = 0;
 
@@ -143,18 +143,23 @@ int main (int argc, char **argv)
 
 	int num_faces_max = 4;
 
-	LandmarkDetector::CLNF clnf_model(det_parameters[0].model_location);
-	clnf_model.face_detector_HAAR.load(det_parameters[0].face_detector_location);
-	clnf_model.face_detector_location = det_parameters[0].face_detector_location;
+	// The model is only loaded once and is shared by all of the trackers
+	std::shared_ptr<LandmarkDetector::CLNFModel> clnf_model(new LandmarkDetector::CLNFModel(det_parameters[0].model_location));
+
+	// Precompute everything the trackers need before they start sharing the model in parallel
+	clnf_model->WarmUp(det_parameters[0]);
+
+	// The face detector used for finding new faces to track, running on a worker thread so that it does not stall the tracking
+	LandmarkDetector::FaceDetectorWorker face_detector(det_parameters[0]);
 	
 	clnf_models.reserve(num_faces_max);
 
-	clnf_models.push_back(clnf_model);
+	clnf_models.push_back(LandmarkDetector::CLNF(clnf_model));
 	active_models.push_back(false);
 
 	for (int i = 1; i < num_faces_max; ++i)
 	{
-		clnf_models.push_back(clnf_model);
+		clnf_models.push_back(LandmarkDetector::CLNF(clnf_model));
 		active_models.push_back(false);
 		det_parameters.push_back(det_params);
 	}
@@ -292,19 +297,24 @@ int main (int argc, char **argv)
 				}
 			}
 						
-			// Get the detections (every 8th frame and when there are free models available for tracking)
-			if(frame_count % 8 == 0 && !all_models_active)
-			{				
-				if(det_parameters[0].curr_face_detector == LandmarkDetector::FaceModelParameters::HOG_SVM_DETECTOR)
+			// Get the detections when there are free models available for tracking, the detector works on the latest frame it was given
+			// and its detections are used once ready (so they can be a few frames old)
+			if(!all_models_active)
+			{
+				vector<double> confidences;
+				int detection_frame = frame_count;
+				face_detector.GetDetections(face_detections, confidences, detection_frame);
+
+				// Detections more than a few frames old (e.g. that arrived while all models were active) are not used to start tracking
+				if(frame_count - detection_frame > 5 || detection_frame > frame_count)
 				{
-					vector<double> confidences;
-					LandmarkDetector::DetectFacesHOG(face_detections, grayscale_image, clnf_models[0].face_detector_HOG, confidences);
+					face_detections.clear();
 				}
-				else
+
+				if(!face_detector.Busy())
 				{
-					LandmarkDetector::DetectFaces(face_detections, grayscale_image, clnf_models[0].face_detector_HAAR);
+					face_detector.SubmitFrame(grayscale_image, frame_count);
 				}
-
 			}
 
 			// Keep only non overlapping detections (also convert to a concurrent vector
@@ -391,7 +401,7 @@ int main (int argc, char **argv)
 					cv::Point3f gazeDirection0(0, 0, -1);
 					cv::Point3f gazeDirection1(0, 0, -1);
 
-					if (det_parameters[model].track_gaze && detection_success && clnf_model.eye_model)
+					if (det_parameters[model].track_gaze && detection_success && clnf_model->eye_model)
 					{
 						FaceAnalysis::EstimateGaze(clnf_models[model], gazeDirection0, fx, fy, cx, cy, true);
 						FaceAnalysis::EstimateGaze(clnf_models[model], gazeDirection1, fx, fy, cx, cy, false);
@@ -489,6 +499,9 @@ int main (int argc, char **argv)
 		
 		frame_count = 0;
 
+		// Detections of the previous video should not be used in the next one
+		face_detector.DiscardDetections();
+
 		// Reset the model, for the next video
 		for(size_t model=0; model < clnf_models.size(); ++model)
 		{
@@ -174,7 +174,7 @@ void visualise_tracking(cv::Mat& captured_image, const LandmarkDetector::CLNF& f
 		// Draw it in reddish if uncertain, blueish if certain
 		LandmarkDetector::DrawBox(captured_image, pose_estimate_to_draw, cv::Scalar((1 - vis_certainty)*255.0, 0, vis_certainty * 255), thickness, fx, fy, cx, cy);
 
-		if (det_parameters.track_gaze && detection_success && face_model.eye_model)
+		if (det_parameters.track_gaze && detection_success && face_model.model->eye_model)
 		{
 			FaceAnalysis::DrawGaze(captured_image, face_model, gazeDirection0, gazeDirection1, fx, fy, cx, cy);
 		}
@@ -279,7 +279,7 @@ int main (int argc, char **argv)
 	}
 
 	// The modules that are being used for tracking
-	LandmarkDetector::CLNF face_model(det_parameters.model_location);	
+	LandmarkDetector::CLNF face_model(det_parameters.model_location, det_parameters);
 
 	vector<string> output_similarity_align;
 	vector<string> output_hog_align_files;
@@ -307,15 +307,15 @@ int main (int argc, char **argv)
 	// Used for image masking
 	string tri_loc;
 	boost::filesystem::path tri_loc_path = boost::filesystem::path("model/tris_68_full.txt");
-	if (boost::filesystem::exists(tri_loc_path))
+	if (LandmarkDetector::ModelFileExists(tri_loc_path.string()))
 	{
 		tri_loc = tri_loc_path.string();
 	}
-	else if (boost::filesystem::exists(parent_path/tri_loc_path))
+	else if (LandmarkDetector::ModelFileExists((parent_path/tri_loc_path).string()))
 	{
 		tri_loc = (parent_path/tri_loc_path).string();
 	}
-	else if (boost::filesystem::exists(config_path/tri_loc_path))
+	else if (LandmarkDetector::ModelFileExists((config_path/tri_loc_path).string()))
 	{
 		tri_loc = (config_path/tri_loc_path).string();
 	}
@@ -326,7 +326,7 @@ int main (int argc, char **argv)
 	}
 
 	// Will warp to scaled mean shape
-	cv::Mat_<double> similarity_normalised_shape = face_model.pdm.mean_shape * sim_scale;
+	cv::Mat_<double> similarity_normalised_shape = face_model.model->pdm.mean_shape * sim_scale;
 	// Discard the z component
 	similarity_normalised_shape = similarity_normalised_shape(cv::Rect(0, 0, 1, 2*similarity_normalised_shape.rows/3)).clone();
 
@@ -348,15 +348,15 @@ int main (int argc, char **argv)
 	}
 
 	boost::filesystem::path au_loc_path = boost::filesystem::path(au_loc_local);
-	if (boost::filesystem::exists(au_loc_path))
+	if (LandmarkDetector::ModelFileExists(au_loc_path.string()))
 	{
 		au_loc = au_loc_path.string();
 	}
-	else if (boost::filesystem::exists(parent_path/au_loc_path))
+	else if (LandmarkDetector::ModelFileExists((parent_path/au_loc_path).string()))
 	{
 		au_loc = (parent_path/au_loc_path).string();
 	}
-	else if (boost::filesystem::exists(config_path/au_loc_path))
+	else if (LandmarkDetector::ModelFileExists((config_path/au_loc_path).string()))
 	{
 		au_loc = (config_path/au_loc_path).string();
 	}
@@ -466,7 +466,7 @@ int main (int argc, char **argv)
 		if (!output_files.empty())
 		{
 			output_file.open(output_files[f_n], ios_base::out);
-			prepareOutputFile(&output_file, output_2D_landmarks, output_3D_landmarks, output_model_params, output_pose, output_AUs, output_gaze, face_model.pdm.NumberOfPoints(), face_model.pdm.NumberOfModes(), face_analyser.GetAUClassNames(), face_analyser.GetAURegNames());
+			prepareOutputFile(&output_file, output_2D_landmarks, output_3D_landmarks, output_model_params, output_pose, output_AUs, output_gaze, face_model.model->pdm.NumberOfPoints(), face_model.model->pdm.NumberOfModes(), face_analyser.GetAUClassNames(), face_analyser.GetAURegNames());
 		}
 
 		// Saving the HOG features
@@ -551,7 +551,7 @@ int main (int argc, char **argv)
 			cv::Point3f gazeDirection0(0, 0, -1);
 			cv::Point3f gazeDirection1(0, 0, -1);
 
-			if (det_parameters.track_gaze && detection_success && face_model.eye_model)
+			if (det_parameters.track_gaze && detection_success && face_model.model->eye_model)
 			{
 				FaceAnalysis::EstimateGaze(face_model, gazeDirection0, fx, fy, cx, cy, true);
 				FaceAnalysis::EstimateGaze(face_model, gazeDirection1, fx, fy, cx, cy, false);
@@ -833,7 +833,7 @@ void outputAllFeatures(std::ofstream* output_file, bool output_2D_landmarks, boo
 	// Output the detected 2D facial landmarks
 	if (output_2D_landmarks)
 	{
-		for (int i = 0; i < face_model.pdm.NumberOfPoints() * 2; ++i)
+		for (int i = 0; i < face_model.model->pdm.NumberOfPoints() * 2; ++i)
 		{
 			if(face_model.tracking_initialised)
 			{
@@ -850,7 +850,7 @@ void outputAllFeatures(std::ofstream* output_file, bool output_2D_landmarks, boo
 	if (output_3D_landmarks)
 	{
 		cv::Mat_<double> shape_3D = face_model.GetShape(fx, fy, cx, cy);
-		for (int i = 0; i < face_model.pdm.NumberOfPoints() * 3; ++i)
+		for (int i = 0; i < face_model.model->pdm.NumberOfPoints() * 3; ++i)
 		{
 			if (face_model.tracking_initialised)
 			{
@@ -876,7 +876,7 @@ void outputAllFeatures(std::ofstream* output_file, bool output_2D_landmarks, boo
 				*output_file << ", 0";
 			}
 		}
-		for (int i = 0; i < face_model.pdm.NumberOfModes(); ++i)
+		for (int i = 0; i < face_model.model->pdm.NumberOfModes(); ++i)
 		{
 			if(face_model.tracking_initialised)
 			{
@@ -0,0 +1,166 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace: an open source facial behavior analysis toolkit
+//       Tadas Baltruaitis, Peter Robinson, and Louis-Philippe Morency
+//       in IEEE Winter Conference on Applications of Computer Vision, 2016  
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltruaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-speci?c normalisation for automatic Action Unit detection
+//       Tadas Baltruaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+//       Constrained Local Neural Fields for robust facial landmark detection in the wild.
+//       Tadas Baltruaitis, Peter Robinson, and Louis-Philippe Morency. 
+//       in IEEE Int. Conference on Computer Vision Workshops, 300 Faces in-the-Wild Challenge, 2013.    
+//
+///////////////////////////////////////////////////////////////////////////////
+// ModelBundler.cpp : Defines the entry point for the console application for packing the model files into a single binary bundle.
+// The resulting bundle can be used by the other executables with -bundle <location>, the model files are then memory mapped instead of parsed.
+// Usage: ModelBundler [-of <bundle location>] [-mloc <main model file>]* [-au <AU predictor list>]* [-tri <triangulation file>]*
+// All of the model files have to be in the directory of the bundle (or its subdirectories), by default the executable's directory.
+
+#include "LandmarkCoreIncludes.h"
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
+// Boost includes
+#include <filesystem.hpp>
+#include <filesystem/fstream.hpp>
+
+#include <FaceAnalyser.h>
+
+using namespace std;
+
+vector<string> get_arguments(int argc, char **argv)
+{
+
+	vector<string> arguments;
+
+	for(int i = 0; i < argc; ++i)
+	{
+		arguments.push_back(string(argv[i]));
+	}
+	return arguments;
+}
+
+// Model files are looked for in the working directory and then in the executable's directory
+string find_model_file(const string& location, const boost::filesystem::path& parent_path)
+{
+	boost::filesystem::path model_path = boost::filesystem::path(location);
+	if (boost::filesystem::exists(model_path))
+	{
+		return model_path.string();
+	}
+	else if (boost::filesystem::exists(parent_path/model_path))
+	{
+		return (parent_path/model_path).string();
+	}
+	cout << "Could not find the model file " << location << endl;
+	return "";
+}
+
+int main (int argc, char **argv)
+{
+
+	vector<string> arguments = get_arguments(argc, argv);
+
+	boost::filesystem::path parent_path = boost::filesystem::path(arguments[0]).parent_path();
+
+	string bundle_location = (parent_path/"openface.bundle").string();
+	vector<string> model_locations, au_locations, tri_locations;
+
+	for (size_t i = 1; i < arguments.size(); ++i)
+	{
+		if (i + 1 >= arguments.size())
+		{
+			break;
+		}
+
+		if (arguments[i].compare("-of") == 0)
+		{
+			bundle_location = arguments[i + 1];
+			i++;
+		}
+		else if (arguments[i].compare("-mloc") == 0)
+		{
+			model_locations.push_back(arguments[i + 1]);
+			i++;
+		}
+		else if (arguments[i].compare("-au") == 0)
+		{
+			au_locations.push_back(arguments[i + 1]);
+			i++;
+		}
+		else if (arguments[i].compare("-tri") == 0)
+		{
+			tri_locations.push_back(arguments[i + 1]);
+			i++;
+		}
+	}
+
+	// By default bundle the models used by the executables
+	if (model_locations.empty())
+	{
+		model_locations.push_back("model/main_clnf_general.txt");
+		model_locations.push_back("model/main_clnf_wild.txt");
+	}
+	if (au_locations.empty())
+	{
+		au_locations.push_back("AU_predictors/AU_all_best.txt");
+		au_locations.push_back("AU_predictors/AU_all_static.txt");
+	}
+	if (tri_locations.empty())
+	{
+		tri_locations.push_back("model/tris_68_full.txt");
+	}
+
+	// Every model file read from now on (under the bundle directory) is recorded
+	boost::filesystem::path root = boost::filesystem::path(bundle_location).parent_path();
+	LandmarkDetector::StartModelBundleRecording(root.empty() ? string(".") : root.string());
+
+	for (size_t i = 0; i < model_locations.size(); ++i)
+	{
+		string model_location = find_model_file(model_locations[i], parent_path);
+		if (!model_location.empty())
+		{
+			LandmarkDetector::CLNFModel model(model_location);
+		}
+	}
+
+	// The AU predictors and the triangulations are read together by the face analyser (files read more than once are only bundled once)
+	for (size_t i = 0; i < max(au_locations.size(), tri_locations.size()); ++i)
+	{
+		string au_location = find_model_file(au_locations[min(i, au_locations.size() - 1)], parent_path);
+		string tri_location = find_model_file(tri_locations[min(i, tri_locations.size() - 1)], parent_path);
+
+		if (!au_location.empty() && !tri_location.empty())
+		{
+			FaceAnalysis::FaceAnalyser face_analyser(vector<cv::Vec3d>(), 0.7, 112, 112, au_location, tri_location);
+		}
+	}
+
+	if (!LandmarkDetector::WriteModelBundle(bundle_location))
+	{
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,141 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace: an open source facial behavior analysis toolkit
+//       Tadas Baltruaitis, Peter Robinson, and Louis-Philippe Morency
+//       in IEEE Winter Conference on Applications of Computer Vision, 2016  
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltruaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-speci?c normalisation for automatic Action Unit detection
+//       Tadas Baltruaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+//       Constrained Local Neural Fields for robust facial landmark detection in the wild.
+//       Tadas Baltruaitis, Peter Robinson, and Louis-Philippe Morency. 
+//       in IEEE Int. Conference on Computer Vision Workshops, 300 Faces in-the-Wild Challenge, 2013.    
+//
+///////////////////////////////////////////////////////////////////////////////
+// ValidatorBenchmark.cpp : Defines the entry point for the console application timing the landmark detection validator on frames of different resolutions.
+// It compares warping the face out of a frame converted to double as a whole (as the validator used to) to warping it from the face region of the 8 bit frame.
+// Usage: ValidatorBenchmark [-mloc <model location>] [-iters <number of repetitions per frame size>]
+
+#include "LandmarkCoreIncludes.h"
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+using namespace std;
+
+vector<string> get_arguments(int argc, char **argv)
+{
+
+	vector<string> arguments;
+
+	for(int i = 0; i < argc; ++i)
+	{
+		arguments.push_back(string(argv[i]));
+	}
+	return arguments;
+}
+
+int main (int argc, char **argv)
+{
+
+	vector<string> arguments = get_arguments(argc, argv);
+
+	int iterations = 200;
+
+	for (size_t i = 1; i < arguments.size(); ++i)
+	{
+		if (arguments[i].compare("-iters") == 0 && i + 1 < arguments.size())
+		{
+			iterations = stoi(arguments[i + 1]);
+			i++;
+		}
+	}
+
+	LandmarkDetector::FaceModelParameters det_parameters(arguments);
+	LandmarkDetector::CLNF clnf_model(det_parameters.model_location, det_parameters);
+
+	const LandmarkDetector::DetectionValidator& validator = clnf_model.model->landmark_validator;
+	if(validator.paws.empty())
+	{
+		cout << "No landmark detection validator in the model" << endl;
+		return 1;
+	}
+
+	// A frontal face about 200 pixels across in the middle of every frame
+	cv::Vec3d orientation(0, 0, 0);
+	int view_id = validator.GetViewId(orientation);
+
+	cv::Size frame_sizes[] = {cv::Size(640, 480), cv::Size(1280, 720), cv::Size(1920, 1080), cv::Size(3840, 2160)};
+
+	cv::RNG rng(0);
+
+	cout << "frame whole_frame_warp(us) face_region_warp(us) check(us) saving_per_face(us) max_difference" << endl;
+
+	for(const cv::Size& frame_size : frame_sizes)
+	{
+		cv::Mat_<uchar> frame(frame_size);
+		rng.fill(frame, cv::RNG::UNIFORM, 0, 256);
+
+		cv::Mat_<double> landmarks;
+		cv::Mat_<double> params_local(clnf_model.model->pdm.NumberOfModes(), 1, 0.0);
+		cv::Vec6d params_global(1.3, 0, 0, 0, frame_size.width / 2.0, frame_size.height / 2.0);
+		clnf_model.model->pdm.CalcShape2D(landmarks, params_local, params_global);
+
+		// How the face used to be warped, converting the whole frame to double first
+		cv::Mat_<double> warped_double;
+		int64 start_ticks = cv::getTickCount();
+		for(int i = 0; i < iterations; ++i)
+		{
+			cv::Mat_<double> frame_double;
+			frame.convertTo(frame_double, CV_64F);
+			validator.paws[view_id].Warp(frame_double, warped_double, landmarks);
+		}
+		double time_whole = 1e6 * (cv::getTickCount() - start_ticks) / cv::getTickFrequency() / iterations;
+
+		// Warping from the face region of the frame only
+		cv::Mat_<float> warped_float;
+		start_ticks = cv::getTickCount();
+		for(int i = 0; i < iterations; ++i)
+		{
+			validator.paws[view_id].WarpFromROI(frame, warped_float, landmarks);
+		}
+		double time_region = 1e6 * (cv::getTickCount() - start_ticks) / cv::getTickFrequency() / iterations;
+
+		// The whole validator
+		start_ticks = cv::getTickCount();
+		for(int i = 0; i < iterations; ++i)
+		{
+			validator.Check(orientation, frame, landmarks);
+		}
+		double time_check = 1e6 * (cv::getTickCount() - start_ticks) / cv::getTickFrequency() / iterations;
+
+		// Only the pixels within the face mask are used
+		cv::Mat_<float> warped_reference;
+		warped_double.convertTo(warped_reference, CV_32F);
+		double max_difference = cv::norm(warped_reference, warped_float, cv::NORM_INF, validator.paws[view_id].pixel_mask);
+
+		cout << frame_size.width << "x" << frame_size.height << " " << time_whole << " " << time_region << " " << time_check << " " << time_whole - time_region << " " << max_difference << endl;
+	}
+
+	return 0;
+}
@@ -14,6 +14,8 @@
 #include "../simd/simd4i.h"
 #include "../simd/simd4f.h"
 
+#include <tbb/tbb.h>
+
 namespace dlib
 {
 
@@ -386,213 +388,279 @@ namespace dlib
             const int visible_nr = std::min((long)cells_nr*cell_size,img.nr())-1;
             const int visible_nc = std::min((long)cells_nc*cell_size,img.nc())-1;
 
-            // First populate the gradient histograms
-            for (int y = 1; y < visible_nr; y++) 
+            // Large images are processed in horizontal strips in parallel (the image pyramid levels are
+            // done in parallel as well, but the finest level takes far longer than the others)
+            const int strip_cells = 16;
+            const bool parallel = cells_nr >= 4*strip_cells;
+
+            // First populate the gradient histograms, the image rows from y_begin to y_end vote into h,
+            // which holds the rows of hist from row_offset on
+            auto accumulate_histograms = [&](int y_begin, int y_end, array2d<matrix<float,18,1> >& h, int row_offset)
             {
-                const double yp = ((double)y+0.5)/(double)cell_size - 0.5;
-                const int iyp = (int)std::floor(yp);
-                const double vy0 = yp-iyp;
-                const double vy1 = 1.0-vy0;
-                int x;
-                for (x = 1; x < visible_nc-3; x+=4) 
+                for (int y = y_begin; y < y_end; y++) 
                 {
-                    simd4f xx(x,x+1,x+2,x+3);
-                    // v will be the length of the gradient vectors.
-                    simd4f grad_x, grad_y, v;
-                    get_gradient(y,x,img,grad_x,grad_y,v);
-
-                    // We will use bilinear interpolation to add into the histogram bins.
-                    // So first we precompute the values needed to determine how much each
-                    // pixel votes into each bin.
-                    simd4f xp = (xx+0.5)/(float)cell_size + 0.5;
-                    simd4i ixp = simd4i(xp);
-                    simd4f vx0 = xp-ixp;
-                    simd4f vx1 = 1.0f-vx0;
-
-                    v = sqrt(v);
-
-					// TODO this should/cood be optimised
-
-                    // Now snap the gradient to one of 18 orientations
-                    simd4f best_dot = 0;
-                    simd4f best_o = 0;
-                    for (int o = 0; o < 9; o++) 
+                    const double yp = ((double)y+0.5)/(double)cell_size - 0.5;
+                    const int iyp = (int)std::floor(yp);
+                    const double vy0 = yp-iyp;
+                    const double vy1 = 1.0-vy0;
+                    int x;
+                    for (x = 1; x < visible_nc-3; x+=4) 
                     {
-                        simd4f dot = grad_x*directions[o](0) + grad_y*directions[o](1);
-                        simd4f_bool cmp = dot>best_dot;
-                        best_dot = select(cmp,dot,best_dot); 
-                        dot *= -1;
-                        best_o = select(cmp,o,best_o);
-
-                        cmp = dot>best_dot;
-                        best_dot = select(cmp,dot,best_dot);
-                        best_o = select(cmp,o+9,best_o);
-                    }
+                        simd4f xx(x,x+1,x+2,x+3);
+                        // v will be the length of the gradient vectors.
+                        simd4f grad_x, grad_y, v;
+                        get_gradient(y,x,img,grad_x,grad_y,v);
+
+                        // We will use bilinear interpolation to add into the histogram bins.
+                        // So first we precompute the values needed to determine how much each
+                        // pixel votes into each bin.
+                        simd4f xp = (xx+0.5)/(float)cell_size + 0.5;
+                        simd4i ixp = simd4i(xp);
+                        simd4f vx0 = xp-ixp;
+                        simd4f vx1 = 1.0f-vx0;
+
+                        v = sqrt(v);
+
+    					// TODO this should/cood be optimised
+
+                        // Now snap the gradient to one of 18 orientations
+                        simd4f best_dot = 0;
+                        simd4f best_o = 0;
+                        for (int o = 0; o < 9; o++) 
+                        {
+                            simd4f dot = grad_x*directions[o](0) + grad_y*directions[o](1);
+                            simd4f_bool cmp = dot>best_dot;
+                            best_dot = select(cmp,dot,best_dot); 
+                            dot *= -1;
+                            best_o = select(cmp,o,best_o);
+
+                            cmp = dot>best_dot;
+                            best_dot = select(cmp,dot,best_dot);
+                            best_o = select(cmp,o+9,best_o);
+                        }
 
 
-                    // Add the gradient magnitude, v, to 4 histograms around pixel using
-                    // bilinear interpolation.
-                    vx1 *= v;
-                    vx0 *= v;
-                    // The amounts for each bin
-                    simd4f v11 = vy1*vx1;
-                    simd4f v01 = vy0*vx1;
-                    simd4f v10 = vy1*vx0;
-                    simd4f v00 = vy0*vx0;
-
-                    int32 _best_o[4]; simd4i(best_o).store(_best_o);
-                    int32 _ixp[4];    ixp.store(_ixp);
-                    float _v11[4];    v11.store(_v11);
-                    float _v01[4];    v01.store(_v01);
-                    float _v10[4];    v10.store(_v10);
-                    float _v00[4];    v00.store(_v00);
-
-                    hist[iyp+1]  [_ixp[0]  ](_best_o[0]) += _v11[0];
-                    hist[iyp+1+1][_ixp[0]  ](_best_o[0]) += _v01[0];
-                    hist[iyp+1]  [_ixp[0]+1](_best_o[0]) += _v10[0];
-                    hist[iyp+1+1][_ixp[0]+1](_best_o[0]) += _v00[0];
-
-                    hist[iyp+1]  [_ixp[1]  ](_best_o[1]) += _v11[1];
-                    hist[iyp+1+1][_ixp[1]  ](_best_o[1]) += _v01[1];
-                    hist[iyp+1]  [_ixp[1]+1](_best_o[1]) += _v10[1];
-                    hist[iyp+1+1][_ixp[1]+1](_best_o[1]) += _v00[1];
-
-                    hist[iyp+1]  [_ixp[2]  ](_best_o[2]) += _v11[2];
-                    hist[iyp+1+1][_ixp[2]  ](_best_o[2]) += _v01[2];
-                    hist[iyp+1]  [_ixp[2]+1](_best_o[2]) += _v10[2];
-                    hist[iyp+1+1][_ixp[2]+1](_best_o[2]) += _v00[2];
-
-                    hist[iyp+1]  [_ixp[3]  ](_best_o[3]) += _v11[3];
-                    hist[iyp+1+1][_ixp[3]  ](_best_o[3]) += _v01[3];
-                    hist[iyp+1]  [_ixp[3]+1](_best_o[3]) += _v10[3];
-                    hist[iyp+1+1][_ixp[3]+1](_best_o[3]) += _v00[3];
+                        // Add the gradient magnitude, v, to 4 histograms around pixel using
+                        // bilinear interpolation.
+                        vx1 *= v;
+                        vx0 *= v;
+                        // The amounts for each bin
+                        simd4f v11 = vy1*vx1;
+                        simd4f v01 = vy0*vx1;
+                        simd4f v10 = vy1*vx0;
+                        simd4f v00 = vy0*vx0;
+
+                        int32 _best_o[4]; simd4i(best_o).store(_best_o);
+                        int32 _ixp[4];    ixp.store(_ixp);
+                        float _v11[4];    v11.store(_v11);
+                        float _v01[4];    v01.store(_v01);
+                        float _v10[4];    v10.store(_v10);
+                        float _v00[4];    v00.store(_v00);
+
+                        h[iyp+1-row_offset]  [_ixp[0]  ](_best_o[0]) += _v11[0];
+                        h[iyp+1+1-row_offset][_ixp[0]  ](_best_o[0]) += _v01[0];
+                        h[iyp+1-row_offset]  [_ixp[0]+1](_best_o[0]) += _v10[0];
+                        h[iyp+1+1-row_offset][_ixp[0]+1](_best_o[0]) += _v00[0];
+
+                        h[iyp+1-row_offset]  [_ixp[1]  ](_best_o[1]) += _v11[1];
+                        h[iyp+1+1-row_offset][_ixp[1]  ](_best_o[1]) += _v01[1];
+                        h[iyp+1-row_offset]  [_ixp[1]+1](_best_o[1]) += _v10[1];
+                        h[iyp+1+1-row_offset][_ixp[1]+1](_best_o[1]) += _v00[1];
+
+                        h[iyp+1-row_offset]  [_ixp[2]  ](_best_o[2]) += _v11[2];
+                        h[iyp+1+1-row_offset][_ixp[2]  ](_best_o[2]) += _v01[2];
+                        h[iyp+1-row_offset]  [_ixp[2]+1](_best_o[2]) += _v10[2];
+                        h[iyp+1+1-row_offset][_ixp[2]+1](_best_o[2]) += _v00[2];
+
+                        h[iyp+1-row_offset]  [_ixp[3]  ](_best_o[3]) += _v11[3];
+                        h[iyp+1+1-row_offset][_ixp[3]  ](_best_o[3]) += _v01[3];
+                        h[iyp+1-row_offset]  [_ixp[3]+1](_best_o[3]) += _v10[3];
+                        h[iyp+1+1-row_offset][_ixp[3]+1](_best_o[3]) += _v00[3];
+                    }
+                    // Now process the right columns that don't fit into simd registers.
+                    for (; x < visible_nc; x++) 
+                    {
+                        matrix<double,2,1> grad;
+                        double v;
+                        get_gradient(y,x,img,grad,v);
+
+                        // snap to one of 18 orientations
+                        double best_dot = 0;
+                        int best_o = 0;
+                        for (int o = 0; o < 9; o++) 
+                        {
+                            const double dot = dlib::dot(directions[o], grad); 
+                            if (dot > best_dot) 
+                            {
+                                best_dot = dot;
+                                best_o = o;
+                            } 
+                            else if (-dot > best_dot) 
+                            {
+                                best_dot = -dot;
+                                best_o = o+9;
+                            }
+                        }
+
+                        v = std::sqrt(v);
+                        // add to 4 histograms around pixel using bilinear interpolation
+                        const double xp = ((double)x+0.5)/(double)cell_size - 0.5;
+                        const int ixp = (int)std::floor(xp);
+                        const double vx0 = xp-ixp;
+                        const double vx1 = 1.0-vx0;
+
+                        h[iyp+1-row_offset][ixp+1](best_o) += vy1*vx1*v;
+                        h[iyp+1+1-row_offset][ixp+1](best_o) += vy0*vx1*v;
+                        h[iyp+1-row_offset][ixp+1+1](best_o) += vy1*vx0*v;
+                        h[iyp+1+1-row_offset][ixp+1+1](best_o) += vy0*vx0*v;
+                    }
                 }
-                // Now process the right columns that don't fit into simd registers.
-                for (; x < visible_nc; x++) 
+            };
+
+            if (parallel)
+            {
+                // Each strip owns a range of histogram rows and goes over all the image rows voting into
+                // them, in the same order as the serial loop so the histograms are identical to it.  The
+                // votes into the neighbouring rows (owned by other strips) go to a scratch border and
+                // are discarded.
+                tbb::parallel_for(tbb::blocked_range<int>(0, hist.nr(), strip_cells), [&](const tbb::blocked_range<int>& strip)
                 {
-                    matrix<double,2,1> grad;
-                    double v;
-                    get_gradient(y,x,img,grad,v);
-
-                    // snap to one of 18 orientations
-                    double best_dot = 0;
-                    int best_o = 0;
-                    for (int o = 0; o < 9; o++) 
+                    const int row_offset = strip.begin()-3;
+                    array2d<matrix<float,18,1> > strip_hist(strip.end()-strip.begin()+6, hist.nc());
+                    for (long r = 0; r < strip_hist.nr(); ++r)
                     {
-                        const double dot = dlib::dot(directions[o], grad); 
-                        if (dot > best_dot) 
-                        {
-                            best_dot = dot;
-                            best_o = o;
-                        } 
-                        else if (-dot > best_dot) 
+                        for (long c = 0; c < strip_hist.nc(); ++c)
                         {
-                            best_dot = -dot;
-                            best_o = o+9;
+                            strip_hist[r][c] = 0;
                         }
                     }
 
-                    v = std::sqrt(v);
-                    // add to 4 histograms around pixel using bilinear interpolation
-                    const double xp = ((double)x+0.5)/(double)cell_size - 0.5;
-                    const int ixp = (int)std::floor(xp);
-                    const double vx0 = xp-ixp;
-                    const double vx1 = 1.0-vx0;
-
-                    hist[iyp+1][ixp+1](best_o) += vy1*vx1*v;
-                    hist[iyp+1+1][ixp+1](best_o) += vy0*vx1*v;
-                    hist[iyp+1][ixp+1+1](best_o) += vy1*vx0*v;
-                    hist[iyp+1+1][ixp+1+1](best_o) += vy0*vx0*v;
-                }
+                    accumulate_histograms(std::max(1, (strip.begin()-2)*cell_size), std::min(visible_nr, (strip.end()+1)*cell_size), strip_hist, row_offset);
+
+                    for (int r = strip.begin(); r < strip.end(); ++r)
+                    {
+                        for (long c = 0; c < hist.nc(); ++c)
+                        {
+                            hist[r][c] = strip_hist[r-row_offset][c];
+                        }
+                    }
+                });
+            }
+            else
+            {
+                accumulate_histograms(1, visible_nr, hist, 0);
             }
 
             // compute energy in each block by summing over orientations
-            for (int r = 0; r < cells_nr; ++r)
+            auto compute_norms = [&](int r_begin, int r_end)
             {
-                for (int c = 0; c < cells_nc; ++c)
+                for (int r = r_begin; r < r_end; ++r)
                 {
-                    for (int o = 0; o < 9; o++) 
+                    for (int c = 0; c < cells_nc; ++c)
                     {
-                        norm[r][c] += (hist[r+1][c+1](o) + hist[r+1][c+1](o+9)) * (hist[r+1][c+1](o) + hist[r+1][c+1](o+9));
+                        for (int o = 0; o < 9; o++) 
+                        {
+                            norm[r][c] += (hist[r+1][c+1](o) + hist[r+1][c+1](o+9)) * (hist[r+1][c+1](o) + hist[r+1][c+1](o+9));
+                        }
                     }
                 }
-            }
+            };
 
             const double eps = 0.0001;
             // compute features
-            for (int y = 0; y < hog_nr; y++) 
+            auto compute_features = [&](int y_begin, int y_end)
             {
-                const int yy = y+padding_rows_offset; 
-                for (int x = 0; x < hog_nc; x++) 
+                for (int y = y_begin; y < y_end; y++) 
                 {
-                    const simd4f z1(norm[y+1][x+1],
-                                    norm[y][x+1], 
-                                    norm[y+1][x],  
-                                    norm[y][x]);
+                    const int yy = y+padding_rows_offset; 
+                    for (int x = 0; x < hog_nc; x++) 
+                    {
+                        const simd4f z1(norm[y+1][x+1],
+                                        norm[y][x+1], 
+                                        norm[y+1][x],  
+                                        norm[y][x]);
 
-                    const simd4f z2(norm[y+1][x+2],
-                                    norm[y][x+2],
-                                    norm[y+1][x+1],
-                                    norm[y][x+1]);
+                        const simd4f z2(norm[y+1][x+2],
+                                        norm[y][x+2],
+                                        norm[y+1][x+1],
+                                        norm[y][x+1]);
 
-                    const simd4f z3(norm[y+2][x+1],
-                                    norm[y+1][x+1],
-                                    norm[y+2][x],
-                                    norm[y+1][x]);
+                        const simd4f z3(norm[y+2][x+1],
+                                        norm[y+1][x+1],
+                                        norm[y+2][x],
+                                        norm[y+1][x]);
 
-                    const simd4f z4(norm[y+2][x+2],
-                                    norm[y+1][x+2],
-                                    norm[y+2][x+1],
-                                    norm[y+1][x+1]);
+                        const simd4f z4(norm[y+2][x+2],
+                                        norm[y+1][x+2],
+                                        norm[y+2][x+1],
+                                        norm[y+1][x+1]);
 
-                    const simd4f nn = 0.2*sqrt(z1+z2+z3+z4+eps);
-                    const simd4f n = 0.1/nn;
+                        const simd4f nn = 0.2*sqrt(z1+z2+z3+z4+eps);
+                        const simd4f n = 0.1/nn;
 
-                    simd4f t = 0;
+                        simd4f t = 0;
 
-                    const int xx = x+padding_cols_offset; 
+                        const int xx = x+padding_cols_offset; 
 
-                    // contrast-sensitive features
-                    for (int o = 0; o < 18; o+=3) 
-                    {
-                        simd4f temp0(hist[y+1+1][x+1+1](o));
-                        simd4f temp1(hist[y+1+1][x+1+1](o+1));
-                        simd4f temp2(hist[y+1+1][x+1+1](o+2));
-                        simd4f h0 = min(temp0,nn)*n;
-                        simd4f h1 = min(temp1,nn)*n;
-                        simd4f h2 = min(temp2,nn)*n;
-                        set_hog(hog,o,xx,yy,   sum(h0));
-                        set_hog(hog,o+1,xx,yy, sum(h1));
-                        set_hog(hog,o+2,xx,yy, sum(h2));
-                        t += h0+h1+h2;
-                    }
+                        // contrast-sensitive features
+                        for (int o = 0; o < 18; o+=3) 
+                        {
+                            simd4f temp0(hist[y+1+1][x+1+1](o));
+                            simd4f temp1(hist[y+1+1][x+1+1](o+1));
+                            simd4f temp2(hist[y+1+1][x+1+1](o+2));
+                            simd4f h0 = min(temp0,nn)*n;
+                            simd4f h1 = min(temp1,nn)*n;
+                            simd4f h2 = min(temp2,nn)*n;
+                            set_hog(hog,o,xx,yy,   sum(h0));
+                            set_hog(hog,o+1,xx,yy, sum(h1));
+                            set_hog(hog,o+2,xx,yy, sum(h2));
+                            t += h0+h1+h2;
+                        }
 
-                    t *= 2*0.2357;
+                        t *= 2*0.2357;
 
-                    // contrast-insensitive features
-                    for (int o = 0; o < 9; o+=3) 
-                    {
-                        simd4f temp0 = hist[y+1+1][x+1+1](o)   + hist[y+1+1][x+1+1](o+9);
-                        simd4f temp1 = hist[y+1+1][x+1+1](o+1) + hist[y+1+1][x+1+1](o+9+1);
-                        simd4f temp2 = hist[y+1+1][x+1+1](o+2) + hist[y+1+1][x+1+1](o+9+2);
-                        simd4f h0 = min(temp0,nn)*n;
-                        simd4f h1 = min(temp1,nn)*n;
-                        simd4f h2 = min(temp2,nn)*n;
-                        set_hog(hog,o+18,xx,yy, sum(h0));
-                        set_hog(hog,o+18+1,xx,yy, sum(h1));
-                        set_hog(hog,o+18+2,xx,yy, sum(h2));
-                    }
+                        // contrast-insensitive features
+                        for (int o = 0; o < 9; o+=3) 
+                        {
+                            simd4f temp0 = hist[y+1+1][x+1+1](o)   + hist[y+1+1][x+1+1](o+9);
+                            simd4f temp1 = hist[y+1+1][x+1+1](o+1) + hist[y+1+1][x+1+1](o+9+1);
+                            simd4f temp2 = hist[y+1+1][x+1+1](o+2) + hist[y+1+1][x+1+1](o+9+2);
+                            simd4f h0 = min(temp0,nn)*n;
+                            simd4f h1 = min(temp1,nn)*n;
+                            simd4f h2 = min(temp2,nn)*n;
+                            set_hog(hog,o+18,xx,yy, sum(h0));
+                            set_hog(hog,o+18+1,xx,yy, sum(h1));
+                            set_hog(hog,o+18+2,xx,yy, sum(h2));
+                        }
 
 
-                    float temp[4];
-                    t.store(temp);
+                        float temp[4];
+                        t.store(temp);
 
-                    // texture features
-                    set_hog(hog,27,xx,yy, temp[0]);
-                    set_hog(hog,28,xx,yy, temp[1]);
-                    set_hog(hog,29,xx,yy, temp[2]);
-                    set_hog(hog,30,xx,yy, temp[3]);
+                        // texture features
+                        set_hog(hog,27,xx,yy, temp[0]);
+                        set_hog(hog,28,xx,yy, temp[1]);
+                        set_hog(hog,29,xx,yy, temp[2]);
+                        set_hog(hog,30,xx,yy, temp[3]);
+                    }
                 }
+            };
+
+            if (parallel)
+            {
+                tbb::parallel_for(tbb::blocked_range<int>(0, cells_nr, strip_cells), [&](const tbb::blocked_range<int>& rows)
+                {
+                    compute_norms(rows.begin(), rows.end());
+                });
+                tbb::parallel_for(tbb::blocked_range<int>(0, hog_nr, strip_cells), [&](const tbb::blocked_range<int>& rows)
+                {
+                    compute_features(rows.begin(), rows.end());
+                });
+            }
+            else
+            {
+                compute_norms(0, cells_nr);
+                compute_features(0, hog_nr);
             }
         }
 
@@ -39,14 +39,18 @@
 #include "SVR_static_lin_regressors.h"
 #include "SVM_static_lin.h"
 #include "SVM_dynamic_lin.h"
+#include "Stacked_lin_models.h"
 
 #include <string>
 #include <vector>
+#include <deque>
 
 #include <opencv2/core/core.hpp>
 
 #include "LandmarkCoreIncludes.h"
 
+#include "Face_utils.h"
+
 namespace FaceAnalysis
 {
 
@@ -81,6 +85,12 @@ namespace FaceAnalysis
 
 		void Reset();
 
+		// Streaming mode for long (live) sessions: only a window of the most recent frames is kept for the offline outputs, sized so that
+		// their history (timestamps, confidences, successes and AU predictions) stays under max_history_bytes, and no frames are kept for
+		// postprocessing, the running medians and the online AU correction are of fixed size and carry on over the whole session
+		// The mode can only be changed before the first frame or after a Reset (the history size can be changed at any time)
+		void SetStreaming(bool streaming, size_t max_history_bytes = 8 * 1024 * 1024);
+
 		void GetLatestHOG(cv::Mat_<double>& hog_descriptor, int& num_rows, int& num_cols);
 		void GetLatestAlignedFace(cv::Mat& image);
 
@@ -114,11 +124,16 @@ namespace FaceAnalysis
 		std::vector<std::pair<std::string, double>> AU_predictions_combined;
 
 		// Keeping track of AU predictions over time (useful for post-processing)
-		vector<double> timestamps;
-		std::map<std::string, vector<double>> AU_predictions_reg_all_hist;
-		std::map<std::string, vector<double>> AU_predictions_class_all_hist;
-		std::vector<double> confidences;
-		std::vector<bool> valid_preds;
+		std::deque<double> timestamps;
+		std::map<std::string, std::deque<double>> AU_predictions_reg_all_hist;
+		std::map<std::string, std::deque<double>> AU_predictions_class_all_hist;
+		std::deque<double> confidences;
+		std::deque<bool> valid_preds;
+
+		// In streaming mode the history above is limited to the most recent max_history_frames
+		bool streaming = false;
+		size_t max_history_frames = 0;
+		void TrimHistory();
 
 		int frames_tracking;
 
@@ -128,18 +143,17 @@ namespace FaceAnalysis
 		cv::Mat hog_descriptor_visualisation;
 
 		// Private members to be used for predictions
-		// The HOG descriptor of the last frame
-		cv::Mat_<double> hog_desc_frame;
+		// The HOG descriptor of the last frame (in single precision, as extracted, and reused from frame to frame)
+		cv::Mat_<float> hog_desc_frame;
 		int num_hog_rows;
 		int num_hog_cols;
 
 		// Keep a running median of the hog descriptors and a aligned images
-		cv::Mat_<double> hog_desc_median;
+		cv::Mat_<float> hog_desc_median;
 		cv::Mat_<double> face_image_median;
 
-		// Use histograms for quick (but approximate) median computation
-		// Use the same for
-		vector<cv::Mat_<unsigned int> > hog_desc_hist;
+		// Use histograms for quick (but approximate) median computation, one for each of the views
+		vector<RunningMedian> hog_desc_running_median;
 
 		// This is not being used at the moment as it is a bit slow
 		vector<cv::Mat_<unsigned int> > face_image_hist;
@@ -150,15 +164,13 @@ namespace FaceAnalysis
 		int num_bins_hog;
 		double min_val_hog;
 		double max_val_hog;
-		vector<int> hog_hist_sum;
 		int view_used;
 
 		// The geometry descriptor (rigid followed by non-rigid shape parameters from CLNF)
 		cv::Mat_<double> geom_descriptor_frame;
 		cv::Mat_<double> geom_descriptor_median;
 
-		int geom_hist_sum;
-		cv::Mat_<unsigned int> geom_desc_hist;
+		RunningMedian geom_desc_running_median;
 		int num_bins_geom;
 		double min_val_geom;
 		double max_val_geom;
@@ -167,20 +179,20 @@ namespace FaceAnalysis
 		cv::Rect_<double> face_bounding_box;
 
 		// The AU predictions internally
-		std::vector<std::pair<std::string, double>> PredictCurrentAUs(int view);
-		std::vector<std::pair<std::string, double>> PredictCurrentAUsClass(int view);
+		void PredictCurrentAUs(int view, std::vector<std::pair<std::string, double>>& intensities, std::vector<std::pair<std::string, double>>& presences);
 
 		// special step for online (rather than offline AU prediction)
 		std::vector<pair<string, double>> CorrectOnlineAUs(std::vector<std::pair<std::string, double>> predictions_orig, int view, bool dyn_shift = false, bool dyn_scale = false, bool update_track = true, bool clip_values = false);
 
 		void ReadAU(std::string au_location);
 
-		void ReadRegressor(std::string fname, const vector<string>& au_names);
+		// Reading a single regressor file into whichever of the models matches its type (the others are left empty)
+		void ReadRegressor(std::string fname, const vector<string>& au_names, SVR_static_lin_regressors& svr_static, SVR_dynamic_lin_regressors& svr_dynamic, SVM_static_lin& svm_static, SVM_dynamic_lin& svm_dynamic);
 
-		// A utility function for keeping track of approximate running medians used for AU and emotion inference using a set of histograms (the histograms are evenly spaced from min_val to max_val)
+		// A utility function for keeping track of approximate running medians used for AU and emotion inference (see RunningMedian)
 		// Descriptor has to be a row vector
 		// TODO this duplicates some other code
-		void UpdateRunningMedian(cv::Mat_<unsigned int>& histogram, int& hist_sum, cv::Mat_<double>& median, const cv::Mat_<double>& descriptor, bool update, int num_bins, double min_val, double max_val);
+		template <typename T> void UpdateRunningMedian(RunningMedian& running_median, cv::Mat_<T>& median, const cv::Mat_<T>& descriptor, bool update);
 		void ExtractMedian(cv::Mat_<unsigned int>& histogram, int hist_count, cv::Mat_<double>& median, int num_bins, double min_val, double max_val);
 
 		// The linear SVR regressors
@@ -191,6 +203,9 @@ namespace FaceAnalysis
 		SVM_static_lin AU_SVM_static_appearance_lin;
 		SVM_dynamic_lin AU_SVM_dynamic_appearance_lin;
 
+		// All of the above stacked together, so that every AU is predicted with one matrix product
+		Stacked_lin_models AU_lin_models;
+
 		// The AUs predicted by the model are not always 0 calibrated to a person. That is they don't always predict 0 for a neutral expression
 		// Keeping track of the predictions we can correct for this, by assuming that at least "ratio" of frames are neutral and subtract that value of prediction, only perform the correction after min_frames
 		void UpdatePredictionTrack(cv::Mat_<unsigned int>& prediction_corr_histogram, int& prediction_correction_count, vector<double>& correction, const vector<pair<string, double>>& predictions, double ratio = 0.25, int num_bins = 200, double min_val = -3, double max_val = 5, int min_frames = 10);
@@ -218,11 +233,11 @@ namespace FaceAnalysis
 		int align_width;
 		int align_height;
 
-		// Useful placeholder for renormalizing the initial frames of shorter videos
+		// Useful placeholder for renormalizing the initial frames of shorter videos, the descriptors of all the frames are kept
+		// contiguously, the HOG quantised (within the range of the HOG running median) and the geometry as a row per frame
 		int max_init_frames = 3000;
-		vector<cv::Mat_<double>> hog_desc_frames_init;
-		vector<cv::Mat_<double>> geom_descriptor_frames_init;
-		vector<int> views;
+		QuantisedDescriptors hog_desc_frames_init;
+		cv::Mat_<float> geom_descriptor_frames_init;
 		bool postprocessed = false;
 		int frames_tracking_succ = 0;
 
@@ -40,6 +40,8 @@
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
 
+#include <vector>
+
 namespace FaceAnalysis
 {
 	//===========================================================================	
@@ -49,13 +51,100 @@ namespace FaceAnalysis
 	void AlignFace(cv::Mat& aligned_face, const cv::Mat& frame, const LandmarkDetector::CLNF& clnf_model, bool rigid = true, double scale = 0.6, int width = 96, int height = 96);
 	void AlignFaceMask(cv::Mat& aligned_face, const cv::Mat& frame, const LandmarkDetector::CLNF& clnf_model, const cv::Mat_<int>& triangulation, bool rigid = true, double scale = 0.6, int width = 96, int height = 96);
 
+	// Aligning a face to two reference frames that differ only in scale and size (finding the alignment once, and sharing the image if they are the same)
+	void AlignFaceMask(cv::Mat& aligned_face, cv::Mat& second_aligned_face, const cv::Mat& frame, const LandmarkDetector::CLNF& clnf_model, const cv::Mat_<int>& triangulation, bool rigid,
+		double scale, int width, int height, double second_scale, int second_width, int second_height);
+
 	void Extract_FHOG_descriptor(cv::Mat_<double>& descriptor, const cv::Mat& image, int& num_rows, int& num_cols, int cell_size = 8);
 
+	// Writes the features straight into the descriptor (reusing its memory if it already has the right size)
+	void Extract_FHOG_descriptor(cv::Mat_<float>& descriptor, const cv::Mat& image, int& num_rows, int& num_cols, int cell_size = 8);
+
 	void Visualise_FHOG(const cv::Mat_<double>& descriptor, int num_rows, int num_cols, cv::Mat& visualisation);
 
 	// The following two methods go hand in hand
 	void ExtractSummaryStatistics(const cv::Mat_<double>& descriptors, cv::Mat_<double>& sum_stats, bool mean, bool stdev, bool max_min);
 	void AddDescriptor(cv::Mat_<double>& descriptors, cv::Mat_<double> new_descriptor, int curr_frame, int num_frames_to_keep = 120);
 
+	//===========================================================================
+	// An approximate running median of every dimension of a descriptor, using histograms evenly spaced from min_val to max_val
+	// The median bin of each dimension (and the count below it) is kept and moved as values are added, adding a value moves it to at most
+	// the neighbouring occupied bin, walking over the empty bins in between. That is cheap when the values are dense around the median
+	// (as for HOG and geometry descriptors), but the bound is still num_bins per dimension and update, as for searching the whole histogram
+	// (e.g. if the values split between two distant bins the median can jump across the gap on every other update)
+	class RunningMedian
+	{
+	public:
+
+		RunningMedian() : num_bins(0), min_val(0), max_val(0), count(0) {}
+
+		RunningMedian(int num_bins, double min_val, double max_val) : num_bins(num_bins), min_val(min_val), max_val(max_val), count(0) {}
+
+		// Add a descriptor (a row vector) if add is set, the histograms are created on the first call
+		void Update(const cv::Mat_<double>& descriptor, bool add);
+		void Update(const cv::Mat_<float>& descriptor, bool add);
+
+		// The centres of the median bins (the first bin for every dimension if nothing has been added)
+		void GetMedian(cv::Mat_<double>& median) const;
+		void GetMedian(cv::Mat_<float>& median) const;
+
+		// The number of descriptors added
+		int Count() const { return count; }
+
+		// Forget all the added descriptors
+		void Reset();
+
+	private:
+
+		template <typename T> void UpdateHistograms(const cv::Mat_<T>& descriptor, bool add);
+		template <typename T> void MedianBinCentres(cv::Mat_<T>& median) const;
+
+		int num_bins;
+		double min_val;
+		double max_val;
+
+		int count;
+
+		// A row of bin counts for each dimension
+		cv::Mat_<unsigned int> histogram;
+
+		// The median bin of each dimension and the number of values in the bins before it
+		std::vector<unsigned short> median_bin;
+		std::vector<unsigned int> below_median;
+	};
+
+	//===========================================================================
+	// Descriptors (row vectors of the same length) kept one after another in a single block of memory, quantised to 16 bits
+	// evenly spaced from min_val to max_val (values outside are capped), a quarter of the memory of double precision
+	class QuantisedDescriptors
+	{
+	public:
+
+		QuantisedDescriptors() : min_val(0), max_val(1), length(0) {}
+
+		QuantisedDescriptors(double min_val, double max_val) : min_val(min_val), max_val(max_val), length(0) {}
+
+		// Add a descriptor after the ones already stored
+		void Add(const cv::Mat_<float>& descriptor);
+
+		// Recover a descriptor into a row of Length() floats
+		void Get(int index, float* descriptor) const;
+
+		int Size() const { return length == 0 ? 0 : (int)(values.size() / length); }
+
+		int Length() const { return length; }
+
+		void Clear();
+
+	private:
+
+		double min_val;
+		double max_val;
+
+		int length;
+
+		std::vector<unsigned short> values;
+	};
+
 }
 #endif
@@ -43,6 +43,8 @@
 
 #include <opencv2/core/core.hpp>
 
+#include "Stacked_lin_models.h"
+
 namespace FaceAnalysis
 {
 
@@ -54,11 +56,14 @@ public:
 	SVR_dynamic_lin_regressors()
 	{}
 
-	// Predict the AU from HOG appearance of the face
-	void Predict(std::vector<double>& predictions, std::vector<std::string>& names, const cv::Mat_<double>& descriptor, const cv::Mat_<double>& geom_params, const cv::Mat_<double>& running_median, const cv::Mat_<double>& running_median_geom);
-
 	// Reading in the model (or adding to it)
-	void Read(std::ifstream& stream, const std::vector<std::string>& au_names);
+	void Read(std::istream& stream, const std::vector<std::string>& au_names);
+
+	// Adding the models of another (separately read in) instance after the ones already here
+	void Append(const SVR_dynamic_lin_regressors& other);
+
+	// Adding the models to the ones stacked for prediction in one go
+	void AddTo(Stacked_lin_models& stacked) const;
 
 	std::vector<std::string> GetAUNames() const
 	{
@@ -76,11 +81,11 @@ private:
 	std::vector<std::string> AU_names;
 
 	// For normalisation
-	cv::Mat_<double> means;
+	cv::Mat_<float> means;
 	
 	// For actual prediction
-	cv::Mat_<double> support_vectors;	
-	cv::Mat_<double> biases;
+	cv::Mat_<float> support_vectors;	
+	cv::Mat_<float> biases;
 
 	// For AU callibration (see the OpenFace paper)
 	std::vector<double> cutoffs;
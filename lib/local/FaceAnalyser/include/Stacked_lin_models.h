@@ -0,0 +1,134 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace: an open source facial behavior analysis toolkit
+//       Tadas Baltruaitis, Peter Robinson, and Louis-Philippe Morency
+//       in IEEE Winter Conference on Applications of Computer Vision, 2016  
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltruaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-speci?c normalisation for automatic Action Unit detection
+//       Tadas Baltruaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+//       Constrained Local Neural Fields for robust facial landmark detection in the wild.
+//       Tadas Baltruaitis, Peter Robinson, and Louis-Philippe Morency. 
+//       in IEEE Int. Conference on Computer Vision Workshops, 300 Faces in-the-Wild Challenge, 2013.    
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef __STACKEDLINMODELS_h_
+#define __STACKEDLINMODELS_h_
+
+#include <vector>
+#include <string>
+
+#include <opencv2/core/core.hpp>
+
+namespace FaceAnalysis
+{
+
+// All of the linear AU models (SVR regressors and SVM classifiers, static and dynamic) stacked into one weight matrix
+// with the means folded into the biases, so a single matrix-vector product gives every AU intensity and presence,
+// and a single matrix product gives them for many frames at once
+// The models are read in as single precision (like the HOG descriptors they are applied to), the classes reading them only load them for this
+class Stacked_lin_models{
+
+public:
+
+	Stacked_lin_models()
+	{}
+
+	// Add models applied as (descriptor - means [- running median]) * support_vectors + biases, a column of support vectors
+	// per model, the means can be shorter than the descriptor (HOG only models), classifiers are given the outputs for a positive
+	// and a negative score
+	void Add(const cv::Mat_<float>& means, const cv::Mat_<float>& support_vectors, const cv::Mat_<float>& biases, bool dynamic,
+		const std::vector<std::string>& au_names, const std::vector<double>& pos_classes = std::vector<double>(), const std::vector<double>& neg_classes = std::vector<double>());
+
+	// Predict the AU intensities and presences from the HOG and geometry descriptors (row vectors) of a frame and their running medians
+	void Predict(std::vector<std::pair<std::string, double>>& intensities, std::vector<std::pair<std::string, double>>& presences, const cv::Mat_<float>& fhog_descriptor,
+		const cv::Mat_<double>& geom_params, const cv::Mat_<float>& running_median, const cv::Mat_<double>& running_median_geom);
+
+	// Predict the outputs of all models (a column each, in the order they were added) for many frames, a row of descriptors each,
+	// that share the running medians
+	void PredictBatch(cv::Mat_<double>& predictions, const cv::Mat_<float>& fhog_descriptors, const cv::Mat_<float>& geom_params,
+		const cv::Mat_<float>& running_median, const cv::Mat_<double>& running_median_geom);
+
+	int NumOutputs() const
+	{
+		return (int)AU_names.size();
+	}
+
+	std::vector<std::string> GetAUNames() const
+	{
+		return AU_names;
+	}
+
+	bool IsClassifier(int output) const
+	{
+		return classifier[output];
+	}
+
+	void Clear();
+
+private:
+
+	// The names of Action Units of each output
+	std::vector<std::string> AU_names;
+
+	// A column of weights over the whole descriptor (HOG followed by geometry) for each model and the biases with the means folded in
+	cv::Mat_<float> weights;
+	cv::Mat_<float> biases;
+
+	// The weights of the dynamic models (zero for the static ones), as those are applied to the descriptor minus its running median
+	cv::Mat_<float> dynamic_weights;
+	bool has_dynamic = false;
+
+	// The classifier outputs
+	std::vector<bool> classifier;
+	std::vector<double> pos_classes;
+	std::vector<double> neg_classes;
+
+	// The running median the biases were last corrected for, the corrected biases only change when the median does
+	cv::Mat_<float> median;
+	cv::Mat_<float> median_biases;
+
+	// Reused between frames
+	cv::Mat_<float> input;
+	cv::Mat_<float> median_input;
+	cv::Mat_<float> scores;
+
+	// Put the HOG descriptors and the geometry (as far as the models use it) side by side
+	void AssembleInput(cv::Mat_<float>& input, const cv::Mat& fhog_descriptors, const cv::Mat& geom_params) const;
+
+	// Fold the running median into the biases of the dynamic models
+	void UpdateMedianBiases(const cv::Mat_<float>& running_median, const cv::Mat_<double>& running_median_geom);
+
+	double Output(int output, float score) const
+	{
+		if(!classifier[output])
+		{
+			return score;
+		}
+		return score > 0 ? pos_classes[output] : neg_classes[output];
+	}
+
+};
+  //===========================================================================
+}
+#endif
@@ -43,6 +43,7 @@
 #include <iostream>
 
 #include <string>
+#include <algorithm>
 
 // Boost includes
 #include <filesystem.hpp>
@@ -50,6 +51,9 @@
 #include <boost/algorithm/string.hpp>
 #include <boost/algorithm/string/split.hpp>
 
+// TBB includes
+#include <tbb/tbb.h>
+
 // Local includes
 #include "LandmarkCoreIncludes.h"
 #include "Face_utils.h"
@@ -89,10 +93,10 @@ FaceAnalyser::FaceAnalyser(vector<cv::Vec3d> orientation_bins, double scale, int
 	{
 		head_orientations = orientation_bins;
 	}
-	hog_hist_sum.resize(head_orientations.size());
 	face_image_hist_sum.resize(head_orientations.size());
-	hog_desc_hist.resize(head_orientations.size());
-	geom_hist_sum = 0;
+	hog_desc_running_median.resize(head_orientations.size(), RunningMedian(num_bins_hog, min_val_hog, max_val_hog));
+	geom_desc_running_median = RunningMedian(num_bins_geom, min_val_geom, max_val_geom);
+	hog_desc_frames_init = QuantisedDescriptors(min_val_hog, max_val_hog);
 	face_image_hist.resize(head_orientations.size());
 
 	au_prediction_correction_count.resize(head_orientations.size(), 0);
@@ -100,7 +104,7 @@ FaceAnalyser::FaceAnalyser(vector<cv::Vec3d> orientation_bins, double scale, int
 	dyn_scaling.resize(head_orientations.size());
 
 	// The triangulation used for masking out the non-face parts of aligned image
-	std::ifstream triangulation_file(tri_location);	
+	LandmarkDetector::ModelStream triangulation_file(tri_location);	
 	LandmarkDetector::ReadMat(triangulation_file, triangulation);
 
 }
@@ -186,7 +190,7 @@ cv::Mat_<int> FaceAnalyser::GetTriangulation()
 
 void FaceAnalyser::GetLatestHOG(cv::Mat_<double>& hog_descriptor, int& num_rows, int& num_cols)
 {
-	hog_descriptor = this->hog_desc_frame.clone();
+	this->hog_desc_frame.convertTo(hog_descriptor, CV_64F);
 
 	if(!hog_desc_frame.empty())
 	{
@@ -207,7 +211,7 @@ void FaceAnalyser::GetLatestAlignedFace(cv::Mat& image)
 
 void FaceAnalyser::GetLatestNeutralHOG(cv::Mat_<double>& hog_descriptor, int& num_rows, int& num_cols)
 {
-	hog_descriptor = this->hog_desc_median;
+	this->hog_desc_median.convertTo(hog_descriptor, CV_64F);
 	if(!hog_desc_median.empty())
 	{
 		num_rows = this->num_hog_rows;
@@ -249,12 +253,8 @@ std::pair<std::vector<std::pair<string, double>>, std::vector<std::pair<string,
 	// First align the face
 	AlignFaceMask(aligned_face_for_au, frame, clnf, triangulation, true, 0.7, 112, 112);
 
-	// Extract HOG descriptor from the frame and convert it to a useable format
-	cv::Mat_<double> hog_descriptor;
-	Extract_FHOG_descriptor(hog_descriptor, aligned_face_for_au, this->num_hog_rows, this->num_hog_cols);
-
-	// Store the descriptor
-	hog_desc_frame = hog_descriptor;
+	// Extract HOG descriptor from the frame straight into the stored one
+	Extract_FHOG_descriptor(hog_desc_frame, aligned_face_for_au, this->num_hog_rows, this->num_hog_cols);
 
 	cv::Vec3d curr_orient(clnf.params_global[1], clnf.params_global[2], clnf.params_global[3]);
 	int orientation_to_use = GetViewId(this->head_orientations, curr_orient);
@@ -263,7 +263,7 @@ std::pair<std::vector<std::pair<string, double>>, std::vector<std::pair<string,
 	geom_descriptor_frame = clnf.params_local.t();
 
 	// Stack with the actual feature point locations (without mean)
-	cv::Mat_<double> locs = clnf.pdm.princ_comp * geom_descriptor_frame.t();
+	cv::Mat_<double> locs = clnf.model->pdm.princ_comp * geom_descriptor_frame.t();
 
 	cv::hconcat(locs.t(), geom_descriptor_frame.clone(), geom_descriptor_frame);
 
@@ -275,12 +275,15 @@ std::pair<std::vector<std::pair<string, double>>, std::vector<std::pair<string,
 	// Visualising the median HOG
 	if (visualise)
 	{
+		cv::Mat_<double> hog_descriptor;
+		hog_desc_frame.convertTo(hog_descriptor, CV_64F);
 		FaceAnalysis::Visualise_FHOG(hog_descriptor, num_hog_rows, num_hog_cols, hog_descriptor_visualisation);
 	}
 
 	// Perform AU prediction	
-	auto AU_predictions_intensity = PredictCurrentAUs(orientation_to_use);
-	auto AU_predictions_occurence = PredictCurrentAUsClass(orientation_to_use);
+	std::vector<std::pair<std::string, double>> AU_predictions_intensity;
+	std::vector<std::pair<std::string, double>> AU_predictions_occurence;
+	PredictCurrentAUs(orientation_to_use, AU_predictions_intensity, AU_predictions_occurence);
 
 	// Make sure intensity is within range (0-5)
 	for (size_t au = 0; au < AU_predictions_intensity.size(); ++au)
@@ -305,18 +308,9 @@ void FaceAnalyser::AddNextFrame(const cv::Mat& frame, const LandmarkDetector::CL
 	if (clnf_model.detection_success)
 	{
 
-		// The aligned face requirement for AUs
-		AlignFaceMask(aligned_face_for_au, frame, clnf_model, triangulation, true, 0.7, 112, 112);
-
-		// If the output requirement matches use the already computed one, else compute it again
-		if (align_scale == 0.7 && align_width == 112 && align_height == 112)
-		{
-			aligned_face_for_output = aligned_face_for_au.clone();
-		}
-		else
-		{
-			AlignFaceMask(aligned_face_for_output, frame, clnf_model, triangulation, true, align_scale, align_width, align_height);
-		}
+		// The aligned face requirement for AUs and the output one, if the output requirement matches the same image is used for both
+		// (neither is modified after the alignment, and GetLatestAlignedFace returns a copy)
+		AlignFaceMask(aligned_face_for_au, aligned_face_for_output, frame, clnf_model, triangulation, true, 0.7, 112, 112, align_scale, align_width, align_height);
 	}
 	else
 	{
@@ -326,12 +320,8 @@ void FaceAnalyser::AddNextFrame(const cv::Mat& frame, const LandmarkDetector::CL
 		aligned_face_for_au.setTo(0);
 	}
 
-	// Extract HOG descriptor from the frame and convert it to a useable format
-	cv::Mat_<double> hog_descriptor;
-	Extract_FHOG_descriptor(hog_descriptor, aligned_face_for_au, this->num_hog_rows, this->num_hog_cols);
-
-	// Store the descriptor
-	hog_desc_frame = hog_descriptor;
+	// Extract HOG descriptor from the frame straight into the stored one
+	Extract_FHOG_descriptor(hog_desc_frame, aligned_face_for_au, this->num_hog_rows, this->num_hog_cols);
 
 	cv::Vec3d curr_orient(clnf_model.params_global[1], clnf_model.params_global[2], clnf_model.params_global[3]);
 	int orientation_to_use = GetViewId(this->head_orientations, curr_orient);
@@ -370,12 +360,9 @@ void FaceAnalyser::AddNextFrame(const cv::Mat& frame, const LandmarkDetector::CL
 	if (clnf_model.detection_success)
 		frames_tracking_succ++;
 
-	// A small speedup
-	if (frames_tracking % 2 == 1)
-	{
-		UpdateRunningMedian(this->hog_desc_hist[orientation_to_use], this->hog_hist_sum[orientation_to_use], this->hog_desc_median, hog_descriptor, update_median, this->num_bins_hog, this->min_val_hog, this->max_val_hog);
-		this->hog_desc_median.setTo(0, this->hog_desc_median < 0);
-	}
+	// The running median is cheap to update, so it is updated on every frame
+	UpdateRunningMedian(this->hog_desc_running_median[orientation_to_use], this->hog_desc_median, hog_desc_frame, update_median);
+	this->hog_desc_median.setTo(0, this->hog_desc_median < 0);
 
 	// Geom descriptor and its median
 	geom_descriptor_frame = clnf_model.params_local.t();
@@ -386,15 +373,11 @@ void FaceAnalyser::AddNextFrame(const cv::Mat& frame, const LandmarkDetector::CL
 	}
 
 	// Stack with the actual feature point locations (without mean)
-	cv::Mat_<double> locs = clnf_model.pdm.princ_comp * geom_descriptor_frame.t();
+	cv::Mat_<double> locs = clnf_model.model->pdm.princ_comp * geom_descriptor_frame.t();
 
 	cv::hconcat(locs.t(), geom_descriptor_frame.clone(), geom_descriptor_frame);
 
-	// A small speedup
-	if (frames_tracking % 2 == 1)
-	{
-		UpdateRunningMedian(this->geom_desc_hist, this->geom_hist_sum, this->geom_descriptor_median, geom_descriptor_frame, update_median, this->num_bins_geom, this->min_val_geom, this->max_val_geom);
-	}
+	UpdateRunningMedian(this->geom_desc_running_median, this->geom_descriptor_median, geom_descriptor_frame, update_median);
 
 	// First convert the face image to double representation as a row vector, TODO rem?
 	//cv::Mat_<uchar> aligned_face_cols(1, aligned_face.cols * aligned_face.rows * aligned_face.channels(), aligned_face.data, 1);
@@ -404,11 +387,13 @@ void FaceAnalyser::AddNextFrame(const cv::Mat& frame, const LandmarkDetector::CL
 	// Visualising the median HOG
 	if (visualise)
 	{
+		cv::Mat_<double> hog_descriptor;
+		hog_desc_frame.convertTo(hog_descriptor, CV_64F);
 		FaceAnalysis::Visualise_FHOG(hog_descriptor, num_hog_rows, num_hog_cols, hog_descriptor_visualisation);
 	}
 
 	// Perform AU prediction	
-	AU_predictions_reg = PredictCurrentAUs(orientation_to_use);
+	PredictCurrentAUs(orientation_to_use, AU_predictions_reg, AU_predictions_class);
 
 	std::vector<std::pair<std::string, double>> AU_predictions_reg_corrected;
 	if (online)
@@ -432,8 +417,6 @@ void FaceAnalyser::AddNextFrame(const cv::Mat& frame, const LandmarkDetector::CL
 		}
 	}
 
-	AU_predictions_class = PredictCurrentAUsClass(orientation_to_use);
-
 	for (size_t au = 0; au < AU_predictions_class.size(); ++au)
 	{
 
@@ -456,11 +439,13 @@ void FaceAnalyser::AddNextFrame(const cv::Mat& frame, const LandmarkDetector::CL
 	}
 	else
 	{
-		if (clnf_model.detection_success && frames_tracking_succ - 1 < max_init_frames)
+		if (clnf_model.detection_success && frames_tracking_succ - 1 < max_init_frames && !streaming)
 		{
-			hog_desc_frames_init.push_back(hog_descriptor);
-			geom_descriptor_frames_init.push_back(geom_descriptor_frame);
-			views.push_back(orientation_to_use);
+			hog_desc_frames_init.Add(hog_desc_frame);
+
+			cv::Mat_<float> geom_descriptor_float;
+			geom_descriptor_frame.convertTo(geom_descriptor_float, CV_32F);
+			geom_descriptor_frames_init.push_back(geom_descriptor_float);
 		}
 	}
 
@@ -474,6 +459,8 @@ void FaceAnalyser::AddNextFrame(const cv::Mat& frame, const LandmarkDetector::CL
 	valid_preds.push_back(success);
 	timestamps.push_back(timestamp_seconds);
 
+	TrimHistory();
+
 }
 
 void FaceAnalyser::GetGeomDescriptor(cv::Mat_<double>& geom_desc)
@@ -484,14 +471,14 @@ void FaceAnalyser::GetGeomDescriptor(cv::Mat_<double>& geom_desc)
 void FaceAnalyser::PredictAUs(const cv::Mat_<double>& hog_features, const cv::Mat_<double>& geom_features, const LandmarkDetector::CLNF& clnf_model, bool online)
 {
 	// Store the descriptor
-	hog_desc_frame = hog_features.clone();
+	hog_features.convertTo(hog_desc_frame, CV_32F);
 	this->geom_descriptor_frame = geom_features.clone();
 
 	cv::Vec3d curr_orient(clnf_model.params_global[1], clnf_model.params_global[2], clnf_model.params_global[3]);
 	int orientation_to_use = GetViewId(this->head_orientations, curr_orient);
 
 	// Perform AU prediction	
-	AU_predictions_reg = PredictCurrentAUs(orientation_to_use);
+	PredictCurrentAUs(orientation_to_use, AU_predictions_reg, AU_predictions_class);
 
 	std::vector<std::pair<std::string, double>> AU_predictions_reg_corrected;
 	if(online)
@@ -515,8 +502,6 @@ void FaceAnalyser::PredictAUs(const cv::Mat_<double>& hog_features, const cv::Ma
 		}
 	}
 
-	AU_predictions_class = PredictCurrentAUsClass(orientation_to_use);
-
 	for (size_t au = 0; au < AU_predictions_class.size(); ++au)
 	{
 
@@ -537,6 +522,7 @@ void FaceAnalyser::PredictAUs(const cv::Mat_<double>& hog_features, const cv::Ma
 		AU_predictions_reg = AU_predictions_reg_corrected;
 	}
 
+	AU_predictions_combined.clear();
 	for(size_t i = 0; i < AU_predictions_reg.size(); ++i)
 	{
 		AU_predictions_combined.push_back(AU_predictions_reg[i]);
@@ -552,50 +538,134 @@ void FaceAnalyser::PredictAUs(const cv::Mat_<double>& hog_features, const cv::Ma
 
 	confidences.push_back(clnf_model.detection_certainty);
 	valid_preds.push_back(success);
+
+	TrimHistory();
+}
+
+void FaceAnalyser::SetStreaming(bool streaming, size_t max_history_bytes)
+{
+	// Once the history has been trimmed (or the init frames dropped) it no longer lines up with the frames kept for postprocessing
+	if(streaming != this->streaming && !timestamps.empty())
+	{
+		cout << "Streaming can only be switched on or off before the first frame or after a Reset, keeping the current mode" << endl;
+		streaming = this->streaming;
+	}
+
+	this->streaming = streaming;
+
+	// A timestamp, a confidence, a success flag and every AU prediction per frame
+	size_t frame_bytes = 2 * sizeof(double) + sizeof(bool) + AU_lin_models.NumOutputs() * sizeof(double);
+	max_history_frames = std::max(max_history_bytes / frame_bytes, (size_t)1);
+
+	if(streaming)
+	{
+		// Nothing more is kept for postprocessing
+		hog_desc_frames_init.Clear();
+		geom_descriptor_frames_init = cv::Mat_<float>();
+		TrimHistory();
+	}
+}
+
+void FaceAnalyser::TrimHistory()
+{
+	if(!streaming)
+	{
+		return;
+	}
+
+	while(timestamps.size() > max_history_frames)
+	{
+		timestamps.pop_front();
+	}
+	while(confidences.size() > max_history_frames)
+	{
+		confidences.pop_front();
+	}
+	while(valid_preds.size() > max_history_frames)
+	{
+		valid_preds.pop_front();
+	}
+	for(auto au_iter = AU_predictions_reg_all_hist.begin(); au_iter != AU_predictions_reg_all_hist.end(); ++au_iter)
+	{
+		while(au_iter->second.size() > max_history_frames)
+		{
+			au_iter->second.pop_front();
+		}
+	}
+	for(auto au_iter = AU_predictions_class_all_hist.begin(); au_iter != AU_predictions_class_all_hist.end(); ++au_iter)
+	{
+		while(au_iter->second.size() > max_history_frames)
+		{
+			au_iter->second.pop_front();
+		}
+	}
 }
 
 // Perform prediction on initial n frames anew as the current neutral face estimate is better now
 void FaceAnalyser::PostprocessPredictions()
 {
-	if(!postprocessed)
+	if(!postprocessed && hog_desc_frames_init.Size() > 0)
 	{
+		// The frames are predicted in batches (a matrix product each), as they all share the final running median, going through
+		// the stored descriptors in order (consecutive successful frames are consecutive stored descriptors)
+		const int batch_size = 256;
+
+		int num_init = std::min(hog_desc_frames_init.Size(), geom_descriptor_frames_init.rows);
+		vector<string> au_names = AU_lin_models.GetAUNames();
+
+		cv::Mat_<float> hog_batch(batch_size, hog_desc_frames_init.Length());
+		vector<int> batch_frames;
+		int batch_start = 0;
+
+		auto predict_batch = [&]()
+		{
+			int num_frames = (int)batch_frames.size();
+
+			cv::Mat_<double> predictions;
+			AU_lin_models.PredictBatch(predictions, hog_batch.rowRange(0, num_frames), geom_descriptor_frames_init.rowRange(batch_start, batch_start + num_frames),
+				this->hog_desc_median, this->geom_descriptor_median);
+
+			// Modify the predictions to the historic data
+			for(int au = 0; au < predictions.cols; ++au)
+			{
+				std::deque<double>& hist = AU_lin_models.IsClassifier(au) ? AU_predictions_class_all_hist[au_names[au]] : AU_predictions_reg_all_hist[au_names[au]];
+				for(int i = 0; i < num_frames; ++i)
+				{
+					hist[batch_frames[i]] = predictions.at<double>(i, au);
+				}
+			}
+			batch_start += num_frames;
+			batch_frames.clear();
+		};
+
 		int success_ind = 0;
 		int all_ind = 0;
 		int all_frames_size = timestamps.size();
 		
-		while(all_ind < all_frames_size && success_ind < max_init_frames)
+		while(all_ind < all_frames_size && success_ind < num_init)
 		{
 		
 			if(valid_preds[all_ind])
 			{
+				int row = (int)batch_frames.size();
+				hog_desc_frames_init.Get(success_ind, hog_batch.ptr<float>(row));
+				batch_frames.push_back(all_ind);
 
-				this->hog_desc_frame = hog_desc_frames_init[success_ind];
-				this->geom_descriptor_frame = geom_descriptor_frames_init[success_ind];
-
-				// Perform AU prediction	
-				auto AU_predictions_reg = PredictCurrentAUs(views[success_ind]);								
-
-				// Modify the predictions to the historic data
-				for (size_t au = 0; au < AU_predictions_reg.size(); ++au)
+				if(row + 1 == batch_size)
 				{
-					// Find the appropriate AU (if not found add it)		
-					AU_predictions_reg_all_hist[AU_predictions_reg[au].first][all_ind] = AU_predictions_reg[au].second;
-
+					predict_batch();
 				}
 
-				auto AU_predictions_class = PredictCurrentAUsClass(views[success_ind]);
-
-				for (size_t au = 0; au < AU_predictions_class.size(); ++au)
-				{
-					// Find the appropriate AU (if not found add it)		
-					AU_predictions_class_all_hist[AU_predictions_class[au].first][all_ind] = AU_predictions_class[au].second;
-				}
-		
 				success_ind++;
 			}
 			all_ind++;
 
 		}
+
+		if(!batch_frames.empty())
+		{
+			predict_batch();
+		}
 		postprocessed = true;
 	}
 }
@@ -607,13 +677,13 @@ void FaceAnalyser::ExtractAllPredictionsOfflineReg(vector<std::pair<std::string,
 		PostprocessPredictions();
 	}
 
-	timestamps = this->timestamps;
+	timestamps.assign(this->timestamps.begin(), this->timestamps.end());
 	au_predictions.clear();
 	// First extract the valid AU values and put them in a different format
 	vector<vector<double>> aus_valid;
 	vector<double> offsets;
-	confidences = this->confidences;
-	successes = this->valid_preds;
+	confidences.assign(this->confidences.begin(), this->confidences.end());
+	successes.assign(this->valid_preds.begin(), this->valid_preds.end());
 	
 	vector<string> dyn_au_names = AU_SVR_dynamic_appearance_lin_regressors.GetAUNames();
 
@@ -622,7 +692,7 @@ void FaceAnalyser::ExtractAllPredictionsOfflineReg(vector<std::pair<std::string,
 	{
 		vector<double> au_good;
 		string au_name = au_iter->first;
-		vector<double> au_vals = au_iter->second;
+		vector<double> au_vals(au_iter->second.begin(), au_iter->second.end());
 		
 		au_predictions.push_back(std::pair<string,vector<double>>(au_name, au_vals));
 
@@ -730,13 +800,13 @@ void FaceAnalyser::ExtractAllPredictionsOfflineClass(vector<std::pair<std::strin
 		PostprocessPredictions();
 	}
 
-	timestamps = this->timestamps;
+	timestamps.assign(this->timestamps.begin(), this->timestamps.end());
 	au_predictions.clear();
 
 	for(auto au_iter = AU_predictions_class_all_hist.begin(); au_iter != AU_predictions_class_all_hist.end(); ++au_iter)
 	{
 		string au_name = au_iter->first;
-		vector<double> au_vals = au_iter->second;
+		vector<double> au_vals(au_iter->second.begin(), au_iter->second.end());
 		
 		// Perform a moving average of 7 frames on classifications
 		int window_size = 7;
@@ -763,8 +833,8 @@ void FaceAnalyser::ExtractAllPredictionsOfflineClass(vector<std::pair<std::strin
 
 	}
 
-	confidences = this->confidences;
-	successes = this->valid_preds;
+	confidences.assign(this->confidences.begin(), this->confidences.end());
+	successes.assign(this->valid_preds.begin(), this->valid_preds.end());
 }
 
 // Reset the models
@@ -775,10 +845,9 @@ void FaceAnalyser::Reset()
 	this->hog_desc_median.setTo(cv::Scalar(0));
 	this->face_image_median.setTo(cv::Scalar(0));
 
-	for( size_t i = 0; i < hog_desc_hist.size(); ++i)
+	for( size_t i = 0; i < hog_desc_running_median.size(); ++i)
 	{
-		this->hog_desc_hist[i] = cv::Mat_<unsigned int>(hog_desc_hist[i].rows, hog_desc_hist[i].cols, (unsigned int)0);
-		this->hog_hist_sum[i] = 0;
+		this->hog_desc_running_median[i].Reset();
 
 
 		this->face_image_hist[i] = cv::Mat_<unsigned int>(face_image_hist[i].rows, face_image_hist[i].cols, (unsigned int)0);
@@ -790,8 +859,7 @@ void FaceAnalyser::Reset()
 	}
 
 	this->geom_descriptor_median.setTo(cv::Scalar(0));
-	this->geom_desc_hist = cv::Mat_<unsigned int>(geom_desc_hist.rows, geom_desc_hist.cols, (unsigned int)0);
-	geom_hist_sum = 0;
+	this->geom_desc_running_median.Reset();
 
 	// Reset the predictions
 	AU_prediction_track = cv::Mat_<double>(AU_prediction_track.rows, AU_prediction_track.cols, 0.0);
@@ -810,68 +878,23 @@ void FaceAnalyser::Reset()
 	valid_preds.clear();
 
 	// Clean up the postprocessing data as well
-	hog_desc_frames_init.clear();
-	geom_descriptor_frames_init.clear();
+	hog_desc_frames_init.Clear();
+	geom_descriptor_frames_init = cv::Mat_<float>();
 	postprocessed = false;
 	frames_tracking_succ = 0;
 }
 
-void FaceAnalyser::UpdateRunningMedian(cv::Mat_<unsigned int>& histogram, int& hist_count, cv::Mat_<double>& median, const cv::Mat_<double>& descriptor, bool update, int num_bins, double min_val, double max_val)
+template <typename T> void FaceAnalyser::UpdateRunningMedian(RunningMedian& running_median, cv::Mat_<T>& median, const cv::Mat_<T>& descriptor, bool update)
 {
+	running_median.Update(descriptor, update);
 
-	double length = max_val - min_val;
-	if(length < 0)
-		length = -length;
-
-	// The median update
-	if(histogram.empty())
-	{
-		histogram = cv::Mat_<unsigned int>(descriptor.cols, num_bins, (unsigned int)0);
-		median = descriptor.clone();
-	}
-
-	if(update)
-	{
-		// Find the bins corresponding to the current descriptor
-		cv::Mat_<double> converted_descriptor = (descriptor - min_val)*((double)num_bins)/(length);
-
-		// Capping the top and bottom values
-		converted_descriptor.setTo(cv::Scalar(num_bins-1), converted_descriptor > num_bins - 1);
-		converted_descriptor.setTo(cv::Scalar(0), converted_descriptor < 0);
-
-		for(int i = 0; i < histogram.rows; ++i)
-		{
-			int index = (int)converted_descriptor.at<double>(i);
-			histogram.at<unsigned int>(i, index)++;
-		}
-
-		// Update the histogram count
-		hist_count++;
-	}
-
-	if(hist_count == 1)
+	if(running_median.Count() == 1)
 	{
 		median = descriptor.clone();
 	}
 	else
 	{
-		// Recompute the median
-		int cutoff_point = (hist_count + 1)/2;
-
-		// For each dimension
-		for(int i = 0; i < histogram.rows; ++i)
-		{
-			int cummulative_sum = 0;
-			for(int j = 0; j < histogram.cols; ++j)
-			{
-				cummulative_sum += histogram.at<unsigned int>(i, j);
-				if(cummulative_sum >= cutoff_point)
-				{
-					median.at<double>(i) = min_val + ((double)j) * (length/((double)num_bins)) + (0.5*(length)/ ((double)num_bins));
-					break;
-				}
-			}
-		}
+		running_median.GetMedian(median);
 	}
 }
 
@@ -914,37 +937,16 @@ void FaceAnalyser::ExtractMedian(cv::Mat_<unsigned int>& histogram, int hist_cou
 		}
 	}
 }
-// Apply the current predictors to the currently stored descriptors
-vector<pair<string, double>> FaceAnalyser::PredictCurrentAUs(int view)
+// Apply the current predictors to the currently stored descriptors (regression and classification)
+void FaceAnalyser::PredictCurrentAUs(int view, vector<pair<string, double>>& intensities, vector<pair<string, double>>& presences)
 {
-
-	vector<pair<string, double>> predictions;
+	intensities.clear();
+	presences.clear();
 
 	if(!hog_desc_frame.empty())
 	{
-		vector<string> svr_lin_stat_aus;
-		vector<double> svr_lin_stat_preds;
-
-		AU_SVR_static_appearance_lin_regressors.Predict(svr_lin_stat_preds, svr_lin_stat_aus, hog_desc_frame, geom_descriptor_frame);
-
-		for(size_t i = 0; i < svr_lin_stat_preds.size(); ++i)
-		{
-			predictions.push_back(pair<string, double>(svr_lin_stat_aus[i], svr_lin_stat_preds[i]));
-		}
-
-		vector<string> svr_lin_dyn_aus;
-		vector<double> svr_lin_dyn_preds;
-
-		AU_SVR_dynamic_appearance_lin_regressors.Predict(svr_lin_dyn_preds, svr_lin_dyn_aus, hog_desc_frame, geom_descriptor_frame,  this->hog_desc_median, this->geom_descriptor_median);
-
-		for(size_t i = 0; i < svr_lin_dyn_preds.size(); ++i)
-		{
-			predictions.push_back(pair<string, double>(svr_lin_dyn_aus[i], svr_lin_dyn_preds[i]));
-		}
-
+		AU_lin_models.Predict(intensities, presences, hog_desc_frame, geom_descriptor_frame, this->hog_desc_median, this->geom_descriptor_median);
 	}
-
-	return predictions;
 }
 
 vector<pair<string, double>> FaceAnalyser::CorrectOnlineAUs(std::vector<std::pair<std::string, double>> predictions_orig, int view, bool dyn_shift, bool dyn_scale, bool update_track, bool clip_values)
@@ -1009,39 +1011,6 @@ vector<pair<string, double>> FaceAnalyser::CorrectOnlineAUs(std::vector<std::pai
 	return predictions;
 }
 
-// Apply the current predictors to the currently stored descriptors (classification)
-vector<pair<string, double>> FaceAnalyser::PredictCurrentAUsClass(int view)
-{
-
-	vector<pair<string, double>> predictions;
-
-	if(!hog_desc_frame.empty())
-	{
-		vector<string> svm_lin_stat_aus;
-		vector<double> svm_lin_stat_preds;
-		
-		AU_SVM_static_appearance_lin.Predict(svm_lin_stat_preds, svm_lin_stat_aus, hog_desc_frame, geom_descriptor_frame);
-
-		for(size_t i = 0; i < svm_lin_stat_aus.size(); ++i)
-		{
-			predictions.push_back(pair<string, double>(svm_lin_stat_aus[i], svm_lin_stat_preds[i]));
-		}
-
-		vector<string> svm_lin_dyn_aus;
-		vector<double> svm_lin_dyn_preds;
-
-		AU_SVM_dynamic_appearance_lin.Predict(svm_lin_dyn_preds, svm_lin_dyn_aus, hog_desc_frame, geom_descriptor_frame, this->hog_desc_median, this->geom_descriptor_median);
-
-		for(size_t i = 0; i < svm_lin_dyn_aus.size(); ++i)
-		{
-			predictions.push_back(pair<string, double>(svm_lin_dyn_aus[i], svm_lin_dyn_preds[i]));
-		}
-		
-	}
-
-	return predictions;
-}
-
 cv::Mat FaceAnalyser::GetLatestHOGDescriptorVisualisation()
 {
 	return hog_descriptor_visualisation;
@@ -1067,7 +1036,7 @@ void FaceAnalyser::ReadAU(std::string au_model_location)
 {
 
 	// Open the list of the regressors in the file
-	ifstream locations(au_model_location.c_str(), ios::in);
+	LandmarkDetector::ModelStream locations(au_model_location);
 
 	if(!locations.is_open())
 	{
@@ -1076,10 +1045,15 @@ void FaceAnalyser::ReadAU(std::string au_model_location)
 		return;
 	}
 
+	int64 start_ticks = cv::getTickCount();
+
 	string line;
 	
 	// The other module locations should be defined as relative paths from the main model
 	boost::filesystem::path root = boost::filesystem::path(au_model_location).parent_path();		
+
+	vector<string> regressor_locations;
+	vector<vector<string> > regressor_au_names;
 	
 	// The main file contains the references to other files
 	while (!locations.eof())
@@ -1115,8 +1089,38 @@ void FaceAnalyser::ReadAU(std::string au_model_location)
 		// append the lovstion to root location (boost syntax)
 		location = (root / location).string();
 				
-		ReadRegressor(location, au_names);
+		regressor_locations.push_back(location);
+		regressor_au_names.push_back(au_names);
 	}
+
+	// The regressor files are independent, so read each into its own model in parallel and then combine them in the order they were listed
+	int num_regressors = (int)regressor_locations.size();
+
+	vector<SVR_static_lin_regressors> svr_static(num_regressors);
+	vector<SVR_dynamic_lin_regressors> svr_dynamic(num_regressors);
+	vector<SVM_static_lin> svm_static(num_regressors);
+	vector<SVM_dynamic_lin> svm_dynamic(num_regressors);
+
+	tbb::parallel_for(0, num_regressors, [&](int i){
+		ReadRegressor(regressor_locations[i], regressor_au_names[i], svr_static[i], svr_dynamic[i], svm_static[i], svm_dynamic[i]);
+	});
+
+	for(int i = 0; i < num_regressors; ++i)
+	{
+		AU_SVR_static_appearance_lin_regressors.Append(svr_static[i]);
+		AU_SVR_dynamic_appearance_lin_regressors.Append(svr_dynamic[i]);
+		AU_SVM_static_appearance_lin.Append(svm_static[i]);
+		AU_SVM_dynamic_appearance_lin.Append(svm_dynamic[i]);
+	}
+
+	// The regressors first and then the classifiers, in the order the predictions are reported
+	AU_lin_models.Clear();
+	AU_SVR_static_appearance_lin_regressors.AddTo(AU_lin_models);
+	AU_SVR_dynamic_appearance_lin_regressors.AddTo(AU_lin_models);
+	AU_SVM_static_appearance_lin.AddTo(AU_lin_models);
+	AU_SVM_dynamic_appearance_lin.AddTo(AU_lin_models);
+
+	LandmarkDetector::ReportLoadTime("AU prediction modules", au_model_location, start_ticks);
   
 }
 
@@ -1205,9 +1209,9 @@ void FaceAnalyser::GetSampleHist(cv::Mat_<unsigned int>& prediction_corr_histogr
 
 }
 
-void FaceAnalyser::ReadRegressor(std::string fname, const vector<string>& au_names)
+void FaceAnalyser::ReadRegressor(std::string fname, const vector<string>& au_names, SVR_static_lin_regressors& svr_static, SVR_dynamic_lin_regressors& svr_dynamic, SVM_static_lin& svm_static, SVM_dynamic_lin& svm_dynamic)
 {
-	ifstream regressor_stream(fname.c_str(), ios::in | ios::binary);
+	LandmarkDetector::ModelStream regressor_stream(fname);
 
 	// First read the input type
 	int regressor_type;
@@ -1215,19 +1219,19 @@ void FaceAnalyser::ReadRegressor(std::string fname, const vector<string>& au_nam
 
 	if(regressor_type == SVR_appearance_static_linear)
 	{
-		AU_SVR_static_appearance_lin_regressors.Read(regressor_stream, au_names);		
+		svr_static.Read(regressor_stream, au_names);		
 	}
 	else if(regressor_type == SVR_appearance_dynamic_linear)
 	{
-		AU_SVR_dynamic_appearance_lin_regressors.Read(regressor_stream, au_names);		
+		svr_dynamic.Read(regressor_stream, au_names);		
 	}
 	else if(regressor_type == SVM_linear_stat)
 	{
-		AU_SVM_static_appearance_lin.Read(regressor_stream, au_names);		
+		svm_static.Read(regressor_stream, au_names);		
 	}
 	else if(regressor_type == SVM_linear_dyn)
 	{
-		AU_SVM_dynamic_appearance_lin.Read(regressor_stream, au_names);		
+		svm_dynamic.Read(regressor_stream, au_names);		
 	}
 }
 
@@ -41,6 +41,10 @@
 // For FHOG visualisation
 #include <dlib/opencv.h>
 
+// System includes
+#include <algorithm>
+#include <cmath>
+
 using namespace std;
 
 namespace FaceAnalysis
@@ -115,7 +119,7 @@ namespace FaceAnalysis
 	void AlignFace(cv::Mat& aligned_face, const cv::Mat& frame, const LandmarkDetector::CLNF& clnf_model, bool rigid, double sim_scale, int out_width, int out_height)
 	{
 		// Will warp to scaled mean shape
-		cv::Mat_<double> similarity_normalised_shape = clnf_model.pdm.mean_shape * sim_scale;
+		cv::Mat_<double> similarity_normalised_shape = clnf_model.model->pdm.mean_shape * sim_scale;
 	
 		// Discard the z component
 		similarity_normalised_shape = similarity_normalised_shape(cv::Rect(0, 0, 1, 2*similarity_normalised_shape.rows/3)).clone();
@@ -150,11 +154,11 @@ namespace FaceAnalysis
 		cv::warpAffine(frame, aligned_face, warp_matrix, cv::Size(out_width, out_height), cv::INTER_LINEAR);
 	}
 
-	// Aligning a face to a common reference frame
-	void AlignFaceMask(cv::Mat& aligned_face, const cv::Mat& frame, const LandmarkDetector::CLNF& clnf_model, const cv::Mat_<int>& triangulation, bool rigid, double sim_scale, int out_width, int out_height)
+	// The similarity transform of a face to the scaled mean shape, as a scale and rotation and the rotated (and scaled) face translation
+	static void AlignmentTransform(cv::Matx22d& scale_rot_matrix, cv::Vec2d& T, const LandmarkDetector::CLNF& clnf_model, bool rigid, double sim_scale)
 	{
 		// Will warp to scaled mean shape
-		cv::Mat_<double> similarity_normalised_shape = clnf_model.pdm.mean_shape * sim_scale;
+		cv::Mat_<double> similarity_normalised_shape = clnf_model.model->pdm.mean_shape * sim_scale;
 	
 		// Discard the z component
 		similarity_normalised_shape = similarity_normalised_shape(cv::Rect(0, 0, 1, 2*similarity_normalised_shape.rows/3)).clone();
@@ -168,7 +172,18 @@ namespace FaceAnalysis
 			extract_rigid_points(source_landmarks, destination_landmarks);
 		}
 
-		cv::Matx22d scale_rot_matrix = LandmarkDetector::AlignShapesWithScale(source_landmarks, destination_landmarks);
+		scale_rot_matrix = LandmarkDetector::AlignShapesWithScale(source_landmarks, destination_landmarks);
+
+		double tx = clnf_model.params_global[4];
+		double ty = clnf_model.params_global[5];
+
+		T = cv::Vec2d(tx, ty);
+		T = scale_rot_matrix * T;
+	}
+
+	// Warping the face with the given similarity transform and masking out everything outside the face
+	static void WarpFaceMask(cv::Mat& aligned_face, const cv::Mat& frame, const LandmarkDetector::CLNF& clnf_model, const cv::Mat_<int>& triangulation, const cv::Matx22d& scale_rot_matrix, const cv::Vec2d& T, double sim_scale, int out_width, int out_height)
+	{
 		cv::Matx23d warp_matrix;
 
 		warp_matrix(0,0) = scale_rot_matrix(0,0);
@@ -176,12 +191,6 @@ namespace FaceAnalysis
 		warp_matrix(1,0) = scale_rot_matrix(1,0);
 		warp_matrix(1,1) = scale_rot_matrix(1,1);
 
-		double tx = clnf_model.params_global[4];
-		double ty = clnf_model.params_global[5];
-
-		cv::Vec2d T(tx, ty);
-		T = scale_rot_matrix * T;
-
 		// Make sure centering is correct
 		warp_matrix(0,2) = -T(0) + out_width/2;
 		warp_matrix(1,2) = -T(1) + out_height/2;
@@ -191,7 +200,7 @@ namespace FaceAnalysis
 		// Move the destination landmarks there as well
 		cv::Matx22d warp_matrix_2d(warp_matrix(0,0), warp_matrix(0,1), warp_matrix(1,0), warp_matrix(1,1));
 		
-		destination_landmarks = cv::Mat(clnf_model.detected_landmarks.reshape(1, 2).t()) * cv::Mat(warp_matrix_2d).t();
+		cv::Mat_<double> destination_landmarks = cv::Mat(clnf_model.detected_landmarks.reshape(1, 2).t()) * cv::Mat(warp_matrix_2d).t();
 
 		destination_landmarks.col(0) = destination_landmarks.col(0) + warp_matrix(0,2);
 		destination_landmarks.col(1) = destination_landmarks.col(1) + warp_matrix(1,2);
@@ -213,29 +222,57 @@ namespace FaceAnalysis
 
 		destination_landmarks = cv::Mat(destination_landmarks.t()).reshape(1, 1).t();
 
-		LandmarkDetector::PAW paw(destination_landmarks, triangulation, 0, 0, aligned_face.cols-1, aligned_face.rows-1);
-		
-		// Mask each of the channels (a bit of a roundabout way, but OpenCV 3.1 in debug mode doesn't seem to be able to handle a more direct way using split and merge)
-		vector<cv::Mat> aligned_face_channels(aligned_face.channels());
-		
-		for (int c = 0; c < aligned_face.channels(); ++c)
-		{
-			cv::extractChannel(aligned_face, aligned_face_channels[c], c);
-		}
+		// Only the mask of the warp to the destination landmarks is needed, not the warp itself
+		cv::Mat_<uchar> pixel_mask;
+		LandmarkDetector::PAW::ComputeMask(pixel_mask, destination_landmarks, triangulation, 0, 0, aligned_face.cols-1, aligned_face.rows-1);
 
-		for(size_t i = 0; i < aligned_face_channels.size(); ++i)
+		// The masked out pixels are cleared in place (all channels at once)
+		size_t pixel_size = aligned_face.elemSize();
+		for(int y = 0; y < aligned_face.rows; ++y)
 		{
-			cv::multiply(aligned_face_channels[i], paw.pixel_mask, aligned_face_channels[i], 1.0, CV_8U);
+			uchar* face_row = aligned_face.ptr<uchar>(y);
+			const uchar* mask_row = pixel_mask.ptr<uchar>(y);
+
+			for(int x = 0; x < aligned_face.cols; ++x)
+			{
+				if(!mask_row[x])
+				{
+					std::fill(face_row + x * pixel_size, face_row + (x + 1) * pixel_size, (uchar)0);
+				}
+			}
 		}
+	}
+
+	// Aligning a face to a common reference frame
+	void AlignFaceMask(cv::Mat& aligned_face, const cv::Mat& frame, const LandmarkDetector::CLNF& clnf_model, const cv::Mat_<int>& triangulation, bool rigid, double sim_scale, int out_width, int out_height)
+	{
+		cv::Matx22d scale_rot_matrix;
+		cv::Vec2d T;
+		AlignmentTransform(scale_rot_matrix, T, clnf_model, rigid, sim_scale);
+
+		WarpFaceMask(aligned_face, frame, clnf_model, triangulation, scale_rot_matrix, T, sim_scale, out_width, out_height);
+	}
+
+	// Aligning a face to two reference frames that differ only in scale and size
+	void AlignFaceMask(cv::Mat& aligned_face, cv::Mat& second_aligned_face, const cv::Mat& frame, const LandmarkDetector::CLNF& clnf_model, const cv::Mat_<int>& triangulation, bool rigid,
+		double sim_scale, int out_width, int out_height, double second_sim_scale, int second_out_width, int second_out_height)
+	{
+		cv::Matx22d scale_rot_matrix;
+		cv::Vec2d T;
+		AlignmentTransform(scale_rot_matrix, T, clnf_model, rigid, sim_scale);
 
-		if(aligned_face.channels() == 3)
+		WarpFaceMask(aligned_face, frame, clnf_model, triangulation, scale_rot_matrix, T, sim_scale, out_width, out_height);
+
+		if(second_sim_scale == sim_scale && second_out_width == out_width && second_out_height == out_height)
 		{
-			cv::Mat planes[] = { aligned_face_channels[0], aligned_face_channels[1], aligned_face_channels[2] };
-			cv::merge(planes, 3, aligned_face);
+			// The same alignment, so share the image
+			second_aligned_face = aligned_face;
 		}
 		else
 		{
-			aligned_face = aligned_face_channels[0];
+			// The alignment to the mean shape scales linearly with its scale, so it does not need to be found again
+			double scaling = second_sim_scale / sim_scale;
+			WarpFaceMask(second_aligned_face, frame, clnf_model, triangulation, scale_rot_matrix * scaling, T * scaling, second_sim_scale, second_out_width, second_out_height);
 		}
 	}
 
@@ -264,39 +301,69 @@ namespace FaceAnalysis
 	}
 
 	// Create a row vector Felzenszwalb HOG descriptor from a given image
-	void Extract_FHOG_descriptor(cv::Mat_<double>& descriptor, const cv::Mat& image, int& num_rows, int& num_cols, int cell_size)
+	// The output of dlib's FHOG extraction written straight into a descriptor row, in the order the AU predictors use
+	// (cells row by row, with the 31 features of each cell next to each other), dlib finds init_hog and set_hog for it below
+	struct FHOG_descriptor_writer
 	{
-		
-		dlib::array2d<dlib::matrix<float,31,1> > hog;
+		cv::Mat_<float>* descriptor;
+		float* data;
+		int num_rows;
+		int num_cols;
+
+		void clear()
+		{
+			num_rows = 0;
+			num_cols = 0;
+		}
+	};
+
+	void init_hog(FHOG_descriptor_writer& hog, int hog_nr, int hog_nc, int filter_rows_padding, int filter_cols_padding)
+	{
+		// Only used without filter padding, so every feature is written and nothing needs clearing (create keeps the memory if the size matches)
+		hog.num_rows = hog_nr + filter_rows_padding - 1;
+		hog.num_cols = hog_nc + filter_cols_padding - 1;
+		hog.descriptor->create(1, hog.num_rows * hog.num_cols * 31);
+		hog.data = hog.descriptor->ptr<float>(0);
+	}
+
+	inline void set_hog(FHOG_descriptor_writer& hog, int o, int x, int y, const double& value)
+	{
+		hog.data[(y * hog.num_cols + x) * 31 + o] = (float)value;
+	}
+
+	void Extract_FHOG_descriptor(cv::Mat_<float>& descriptor, const cv::Mat& image, int& num_rows, int& num_cols, int cell_size)
+	{
+		FHOG_descriptor_writer hog;
+		hog.descriptor = &descriptor;
+		hog.clear();
+
 		if(image.channels() == 1)
 		{
 			dlib::cv_image<uchar> dlib_warped_img(image);
-			dlib::extract_fhog_features(dlib_warped_img, hog, cell_size);
+			dlib::impl_fhog::impl_extract_fhog_features(dlib_warped_img, hog, cell_size, 1, 1);
 		}
 		else
 		{
 			dlib::cv_image<dlib::bgr_pixel> dlib_warped_img(image);
-			dlib::extract_fhog_features(dlib_warped_img, hog, cell_size);
+			dlib::impl_fhog::impl_extract_fhog_features(dlib_warped_img, hog, cell_size, 1, 1);
 		}
 
-		// Convert to a usable format
-		num_cols = hog.nc();
-		num_rows = hog.nr();
+		num_rows = hog.num_rows;
+		num_cols = hog.num_cols;
 
-		descriptor = cv::Mat_<double>(1, num_cols * num_rows * 31);
-		cv::MatIterator_<double> descriptor_it = descriptor.begin();
-		for(int y = 0; y < num_cols; ++y)
+		if(num_rows == 0 || num_cols == 0)
 		{
-			for(int x = 0; x < num_rows; ++x)
-			{
-				for(unsigned int o = 0; o < 31; ++o)
-				{
-					*descriptor_it++ = (double)hog[y][x](o);
-				}
-			}
+			descriptor = cv::Mat_<float>();
 		}
 	}
 
+	void Extract_FHOG_descriptor(cv::Mat_<double>& descriptor, const cv::Mat& image, int& num_rows, int& num_cols, int cell_size)
+	{
+		cv::Mat_<float> descriptor_float;
+		Extract_FHOG_descriptor(descriptor_float, image, num_rows, num_cols, cell_size);
+		descriptor_float.convertTo(descriptor, CV_64F);
+	}
+
 	// Extract summary statistics (mean, stdev, min, max) from each dimension of a descriptor, each row is a descriptor
 	void ExtractSummaryStatistics(const cv::Mat_<double>& descriptors, cv::Mat_<double>& sum_stats, bool use_mean, bool use_stdev, bool use_max_min)
 	{
@@ -355,4 +422,165 @@ namespace FaceAnalysis
 		new_descriptor.copyTo(descriptors.row(row_to_change));
 	}	
 
+	//===========================================================================
+	template <typename T> void RunningMedian::UpdateHistograms(const cv::Mat_<T>& descriptor, bool add)
+	{
+		if(histogram.empty())
+		{
+			histogram = cv::Mat_<unsigned int>(descriptor.cols, num_bins, (unsigned int)0);
+			median_bin.assign(descriptor.cols, 0);
+			below_median.assign(descriptor.cols, 0);
+		}
+
+		if(!add)
+		{
+			return;
+		}
+
+		double length = std::abs(max_val - min_val);
+
+		count++;
+
+		// The median is the first bin at which the cumulative count reaches the cutoff
+		unsigned int cutoff_point = (count + 1)/2;
+
+		for(int i = 0; i < histogram.rows; ++i)
+		{
+			// Find the bin corresponding to the value, capping the top and bottom values
+			double converted = ((double)descriptor(i) - min_val)*((double)num_bins)/(length);
+
+			if(converted > num_bins - 1)
+			{
+				converted = num_bins - 1;
+			}
+			if(converted < 0)
+			{
+				converted = 0;
+			}
+
+			int index = (int)converted;
+
+			unsigned int* bins = histogram.ptr<unsigned int>(i);
+			bins[index]++;
+
+			int median = median_bin[i];
+			unsigned int below = below_median[i];
+
+			if(index < median)
+			{
+				below++;
+			}
+
+			// Move the median down while too many values are below it, and up while it does not reach the cutoff
+			while(median > 0 && below >= cutoff_point)
+			{
+				median--;
+				below -= bins[median];
+			}
+			while(below + bins[median] < cutoff_point)
+			{
+				below += bins[median];
+				median++;
+			}
+
+			median_bin[i] = (unsigned short)median;
+			below_median[i] = below;
+		}
+	}
+
+	void RunningMedian::Update(const cv::Mat_<double>& descriptor, bool add)
+	{
+		UpdateHistograms(descriptor, add);
+	}
+
+	void RunningMedian::Update(const cv::Mat_<float>& descriptor, bool add)
+	{
+		UpdateHistograms(descriptor, add);
+	}
+
+	template <typename T> void RunningMedian::MedianBinCentres(cv::Mat_<T>& median) const
+	{
+		double length = std::abs(max_val - min_val);
+
+		median.create(1, (int)median_bin.size());
+
+		for(size_t i = 0; i < median_bin.size(); ++i)
+		{
+			median((int)i) = (T)(min_val + ((double)median_bin[i]) * (length/((double)num_bins)) + (0.5*(length)/ ((double)num_bins)));
+		}
+	}
+
+	void RunningMedian::GetMedian(cv::Mat_<double>& median) const
+	{
+		MedianBinCentres(median);
+	}
+
+	void RunningMedian::GetMedian(cv::Mat_<float>& median) const
+	{
+		MedianBinCentres(median);
+	}
+
+	void RunningMedian::Reset()
+	{
+		count = 0;
+
+		if(!histogram.empty())
+		{
+			histogram.setTo(0);
+			median_bin.assign(median_bin.size(), 0);
+			below_median.assign(below_median.size(), 0);
+		}
+	}
+
+	void QuantisedDescriptors::Add(const cv::Mat_<float>& descriptor)
+	{
+		if(values.empty())
+		{
+			length = descriptor.cols;
+		}
+
+		size_t offset = values.size();
+		values.resize(offset + length);
+
+		const float* descriptor_ptr = descriptor.ptr<float>(0);
+		unsigned short* values_ptr = &values[offset];
+
+		float scale = (float)(65535.0 / (max_val - min_val));
+		float min_val_f = (float)min_val;
+
+		for(int i = 0; i < length; ++i)
+		{
+			float quantised = (descriptor_ptr[i] - min_val_f) * scale;
+			if(quantised < 0)
+			{
+				quantised = 0;
+			}
+			if(quantised > 65535.0f)
+			{
+				quantised = 65535.0f;
+			}
+			values_ptr[i] = (unsigned short)(quantised + 0.5f);
+		}
+	}
+
+	void QuantisedDescriptors::Get(int index, float* descriptor) const
+	{
+		const unsigned short* values_ptr = &values[(size_t)index * length];
+
+		float step = (float)((max_val - min_val) / 65535.0);
+		float min_val_f = (float)min_val;
+
+		for(int i = 0; i < length; ++i)
+		{
+			descriptor[i] = min_val_f + values_ptr[i] * step;
+		}
+	}
+
+	void QuantisedDescriptors::Clear()
+	{
+		// Release the memory as well, as it can be large
+		std::vector<unsigned short>().swap(values);
+		length = 0;
+	}
+
 }
\ No newline at end of file
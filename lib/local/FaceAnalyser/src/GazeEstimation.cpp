@@ -95,11 +95,11 @@ void FaceAnalysis::EstimateGaze(const LandmarkDetector::CLNF& clnf_model, cv::Po
 	int part = -1;
 	for (size_t i = 0; i < clnf_model.hierarchical_models.size(); ++i)
 	{
-		if (left_eye && clnf_model.hierarchical_model_names[i].compare("left_eye_28") == 0)
+		if (left_eye && clnf_model.model->hierarchical_model_names[i].compare("left_eye_28") == 0)
 		{
 			part = i;
 		}
-		if (!left_eye && clnf_model.hierarchical_model_names[i].compare("right_eye_28") == 0)
+		if (!left_eye && clnf_model.model->hierarchical_model_names[i].compare("right_eye_28") == 0)
 		{
 			part = i;
 		}
@@ -143,11 +143,11 @@ void FaceAnalysis::DrawGaze(cv::Mat img, const LandmarkDetector::CLNF& clnf_mode
 	int part_right = -1;
 	for (size_t i = 0; i < clnf_model.hierarchical_models.size(); ++i)
 	{
-		if (clnf_model.hierarchical_model_names[i].compare("left_eye_28") == 0)
+		if (clnf_model.model->hierarchical_model_names[i].compare("left_eye_28") == 0)
 		{
 			part_left = i;
 		}
-		if (clnf_model.hierarchical_model_names[i].compare("right_eye_28") == 0)
+		if (clnf_model.model->hierarchical_model_names[i].compare("right_eye_28") == 0)
 		{
 			part_right = i;
 		}
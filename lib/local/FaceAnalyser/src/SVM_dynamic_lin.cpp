@@ -38,25 +38,30 @@
 
 using namespace FaceAnalysis;
 
-void SVM_dynamic_lin::Read(std::ifstream& stream, const std::vector<std::string>& au_names)
+void SVM_dynamic_lin::Read(std::istream& stream, const std::vector<std::string>& au_names)
 {
 
+	cv::Mat_<double> m_tmp;
+	LandmarkDetector::ReadMatBin(stream, m_tmp);
+	cv::Mat_<float> means_curr;
+	m_tmp.convertTo(means_curr, CV_32F);
+
 	if(this->means.empty())
 	{
-		LandmarkDetector::ReadMatBin(stream, this->means);
+		this->means = means_curr;
 	}
 	else
 	{
-		cv::Mat_<double> m_tmp;
-		LandmarkDetector::ReadMatBin(stream, m_tmp);
-		if(cv::norm(m_tmp - this->means > 0.00001))
+		if(cv::norm(means_curr - this->means > 0.00001))
 		{
 			cout << "Something went wrong with the SVM dynamic classifiers" << endl;
 		}
 	}
 
-	cv::Mat_<double> support_vectors_curr;
-	LandmarkDetector::ReadMatBin(stream, support_vectors_curr);
+	cv::Mat_<double> support_vectors_double;
+	LandmarkDetector::ReadMatBin(stream, support_vectors_double);
+	cv::Mat_<float> support_vectors_curr;
+	support_vectors_double.convertTo(support_vectors_curr, CV_32F);
 
 	double bias;
 	stream.read((char *)&bias, 8);
@@ -78,14 +83,14 @@ void SVM_dynamic_lin::Read(std::ifstream& stream, const std::vector<std::string>
 		cv::transpose(this->support_vectors, this->support_vectors);
 
 		cv::transpose(this->biases, this->biases);
-		this->biases.push_back(cv::Mat_<double>(1, 1, bias));
+		this->biases.push_back(cv::Mat_<float>(1, 1, (float)bias));
 		cv::transpose(this->biases, this->biases);
 
 	}
 	else
 	{
 		this->support_vectors.push_back(support_vectors_curr);
-		this->biases.push_back(cv::Mat_<double>(1, 1, bias));
+		this->biases.push_back(cv::Mat_<float>(1, 1, (float)bias));
 	}
 
 	this->pos_classes.push_back(pos_class);
@@ -97,39 +102,40 @@ void SVM_dynamic_lin::Read(std::ifstream& stream, const std::vector<std::string>
 	}
 }
 
-// Prediction using the HOG descriptor
-void SVM_dynamic_lin::Predict(std::vector<double>& predictions, std::vector<std::string>& names, const cv::Mat_<double>& fhog_descriptor, const cv::Mat_<double>& geom_params,  const cv::Mat_<double>& running_median,  const cv::Mat_<double>& running_median_geom)
+void SVM_dynamic_lin::Append(const SVM_dynamic_lin& other)
 {
-	if(AU_names.size() > 0)
+	if(other.support_vectors.empty())
 	{
-		cv::Mat_<double> preds;
-		if(fhog_descriptor.cols ==  this->means.cols)
-		{
-			preds = (fhog_descriptor - this->means - running_median) * this->support_vectors + this->biases;
-		}
-		else
-		{
-			cv::Mat_<double> input;
-			cv::hconcat(fhog_descriptor, geom_params, input);
+		return;
+	}
 
-			cv::Mat_<double> run_med;
-			cv::hconcat(running_median, running_median_geom, run_med);
+	if(this->means.empty())
+	{
+		this->means = other.means;
+	}
+	else if(cv::norm(other.means - this->means > 0.00001))
+	{
+		cout << "Something went wrong with the SVM dynamic classifiers" << endl;
+	}
 
-			preds = (input - this->means - run_med) * this->support_vectors + this->biases;
-		}
+	// Each column is a support vector (and each bias a column of the row vector)
+	if(!this->support_vectors.empty())
+	{
+		cv::hconcat(this->support_vectors, other.support_vectors, this->support_vectors);
+		cv::hconcat(this->biases, other.biases, this->biases);
+	}
+	else
+	{
+		this->support_vectors = other.support_vectors;
+		this->biases = other.biases;
+	}
 
-		for(int i = 0; i < preds.cols; ++i)
-		{		
-			if(preds.at<double>(i) > 0)
-			{
-				predictions.push_back(pos_classes[i]);
-			}
-			else
-			{
-				predictions.push_back(neg_classes[i]);
-			}
-		}
+	this->pos_classes.insert(this->pos_classes.end(), other.pos_classes.begin(), other.pos_classes.end());
+	this->neg_classes.insert(this->neg_classes.end(), other.neg_classes.begin(), other.neg_classes.end());
+	this->AU_names.insert(this->AU_names.end(), other.AU_names.begin(), other.AU_names.end());
+}
 
-		names = this->AU_names;
-	}
-}
\ No newline at end of file
+void SVM_dynamic_lin::AddTo(Stacked_lin_models& stacked) const
+{
+	stacked.Add(this->means, this->support_vectors, this->biases, true, this->AU_names, this->pos_classes, this->neg_classes);
+}
@@ -38,7 +38,7 @@
 
 using namespace FaceAnalysis;
 
-void SVR_dynamic_lin_regressors::Read(std::ifstream& stream, const std::vector<std::string>& au_names)
+void SVR_dynamic_lin_regressors::Read(std::istream& stream, const std::vector<std::string>& au_names)
 {
 	
 	// For person specific calibration in a video
@@ -47,22 +47,27 @@ void SVR_dynamic_lin_regressors::Read(std::ifstream& stream, const std::vector<s
 	cutoffs.push_back(cutoff);
 
 	// The feature normalization using the mean
+	cv::Mat_<double> m_tmp;
+	LandmarkDetector::ReadMatBin(stream, m_tmp);
+	cv::Mat_<float> means_curr;
+	m_tmp.convertTo(means_curr, CV_32F);
+
 	if(this->means.empty())
 	{
-		LandmarkDetector::ReadMatBin(stream, this->means);
+		this->means = means_curr;
 	}
 	else
 	{
-		cv::Mat_<double> m_tmp;
-		LandmarkDetector::ReadMatBin(stream, m_tmp);
-		if(cv::norm(m_tmp - this->means > 0.00001))
+		if(cv::norm(means_curr - this->means > 0.00001))
 		{
 			cout << "Something went wrong with the SVR dynamic regressors" << endl;
 		}
 	}
 
-	cv::Mat_<double> support_vectors_curr;
-	LandmarkDetector::ReadMatBin(stream, support_vectors_curr);
+	cv::Mat_<double> support_vectors_double;
+	LandmarkDetector::ReadMatBin(stream, support_vectors_double);
+	cv::Mat_<float> support_vectors_curr;
+	support_vectors_double.convertTo(support_vectors_curr, CV_32F);
 
 	double bias;
 	stream.read((char *)&bias, 8);
@@ -76,14 +81,14 @@ void SVR_dynamic_lin_regressors::Read(std::ifstream& stream, const std::vector<s
 		cv::transpose(this->support_vectors, this->support_vectors);
 
 		cv::transpose(this->biases, this->biases);
-		this->biases.push_back(cv::Mat_<double>(1, 1, bias));
+		this->biases.push_back(cv::Mat_<float>(1, 1, (float)bias));
 		cv::transpose(this->biases, this->biases);
 
 	}
 	else
 	{
 		this->support_vectors.push_back(support_vectors_curr);
-		this->biases.push_back(cv::Mat_<double>(1, 1, bias));
+		this->biases.push_back(cv::Mat_<float>(1, 1, (float)bias));
 	}
 	
 	for(size_t i=0; i < au_names.size(); ++i)
@@ -92,32 +97,39 @@ void SVR_dynamic_lin_regressors::Read(std::ifstream& stream, const std::vector<s
 	}
 }
 
-// Prediction using the HOG descriptor
-void SVR_dynamic_lin_regressors::Predict(std::vector<double>& predictions, std::vector<std::string>& names, const cv::Mat_<double>& fhog_descriptor, const cv::Mat_<double>& geom_params,  const cv::Mat_<double>& running_median,  const cv::Mat_<double>& running_median_geom)
+void SVR_dynamic_lin_regressors::Append(const SVR_dynamic_lin_regressors& other)
 {
-	if(AU_names.size() > 0)
+	if(other.support_vectors.empty())
 	{
-		cv::Mat_<double> preds;
-		if(fhog_descriptor.cols ==  this->means.cols)
-		{
-			preds = (fhog_descriptor - this->means - running_median) * this->support_vectors + this->biases;
-		}
-		else
-		{
-			cv::Mat_<double> input;
-			cv::hconcat(fhog_descriptor, geom_params, input);
-
-			cv::Mat_<double> run_med;
-			cv::hconcat(running_median, running_median_geom, run_med);
+		return;
+	}
 
-			preds = (input - this->means - run_med) * this->support_vectors + this->biases;
-		}
+	if(this->means.empty())
+	{
+		this->means = other.means;
+	}
+	else if(cv::norm(other.means - this->means > 0.00001))
+	{
+		cout << "Something went wrong with the SVR dynamic regressors" << endl;
+	}
 
-		for(cv::MatIterator_<double> pred_it = preds.begin(); pred_it != preds.end(); ++pred_it)
-		{		
-			predictions.push_back(*pred_it);
-		}
-		
-		names = this->AU_names;
+	// Each column is a support vector (and each bias a column of the row vector)
+	if(!this->support_vectors.empty())
+	{
+		cv::hconcat(this->support_vectors, other.support_vectors, this->support_vectors);
+		cv::hconcat(this->biases, other.biases, this->biases);
+	}
+	else
+	{
+		this->support_vectors = other.support_vectors;
+		this->biases = other.biases;
 	}
-}
\ No newline at end of file
+
+	this->cutoffs.insert(this->cutoffs.end(), other.cutoffs.begin(), other.cutoffs.end());
+	this->AU_names.insert(this->AU_names.end(), other.AU_names.begin(), other.AU_names.end());
+}
+
+void SVR_dynamic_lin_regressors::AddTo(Stacked_lin_models& stacked) const
+{
+	stacked.Add(this->means, this->support_vectors, this->biases, true, this->AU_names);
+}
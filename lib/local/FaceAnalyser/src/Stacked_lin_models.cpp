@@ -0,0 +1,209 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace: an open source facial behavior analysis toolkit
+//       Tadas Baltruaitis, Peter Robinson, and Louis-Philippe Morency
+//       in IEEE Winter Conference on Applications of Computer Vision, 2016  
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltruaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-speci?c normalisation for automatic Action Unit detection
+//       Tadas Baltruaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+//       Constrained Local Neural Fields for robust facial landmark detection in the wild.
+//       Tadas Baltruaitis, Peter Robinson, and Louis-Philippe Morency. 
+//       in IEEE Int. Conference on Computer Vision Workshops, 300 Faces in-the-Wild Challenge, 2013.    
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Stacked_lin_models.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace FaceAnalysis;
+
+void Stacked_lin_models::Add(const cv::Mat_<float>& means, const cv::Mat_<float>& support_vectors, const cv::Mat_<float>& biases, bool dynamic,
+	const std::vector<std::string>& au_names, const std::vector<double>& pos_classes, const std::vector<double>& neg_classes)
+{
+	if(support_vectors.empty())
+	{
+		return;
+	}
+
+	int num_models = support_vectors.cols;
+	int num_dims = std::max(this->weights.rows, support_vectors.rows);
+	int num_old = this->weights.cols;
+
+	// Models that do not use the end of the descriptor (the geometry) get zero weights for it
+	cv::Mat_<float> new_weights(num_dims, num_old + num_models, 0.0f);
+	cv::Mat_<float> new_dynamic_weights(num_dims, num_old + num_models, 0.0f);
+	if(num_old > 0)
+	{
+		this->weights.copyTo(new_weights(cv::Rect(0, 0, num_old, this->weights.rows)));
+		this->dynamic_weights.copyTo(new_dynamic_weights(cv::Rect(0, 0, num_old, this->weights.rows)));
+	}
+	support_vectors.copyTo(new_weights(cv::Rect(num_old, 0, num_models, support_vectors.rows)));
+	if(dynamic)
+	{
+		support_vectors.copyTo(new_dynamic_weights(cv::Rect(num_old, 0, num_models, support_vectors.rows)));
+		this->has_dynamic = true;
+	}
+	this->weights = new_weights;
+	this->dynamic_weights = new_dynamic_weights;
+
+	// (x - means) * w + b = x * w + (b - means * w)
+	cv::Mat_<float> folded_biases = biases - means * support_vectors;
+	if(num_old > 0)
+	{
+		cv::hconcat(this->biases, folded_biases, this->biases);
+	}
+	else
+	{
+		this->biases = folded_biases;
+	}
+
+	for(int i = 0; i < num_models; ++i)
+	{
+		this->AU_names.push_back(au_names[i]);
+		this->classifier.push_back(!pos_classes.empty());
+		this->pos_classes.push_back(pos_classes.empty() ? 0 : pos_classes[i]);
+		this->neg_classes.push_back(neg_classes.empty() ? 0 : neg_classes[i]);
+	}
+
+	// The median corrected biases have to be recomputed
+	this->median = cv::Mat_<float>();
+	this->median_biases = cv::Mat_<float>();
+}
+
+void Stacked_lin_models::Clear()
+{
+	AU_names.clear();
+	weights = cv::Mat_<float>();
+	biases = cv::Mat_<float>();
+	dynamic_weights = cv::Mat_<float>();
+	has_dynamic = false;
+	classifier.clear();
+	pos_classes.clear();
+	neg_classes.clear();
+	median = cv::Mat_<float>();
+	median_biases = cv::Mat_<float>();
+}
+
+void Stacked_lin_models::AssembleInput(cv::Mat_<float>& input, const cv::Mat& fhog_descriptors, const cv::Mat& geom_params) const
+{
+	int num_hog = std::min(fhog_descriptors.cols, this->weights.rows);
+
+	input.create(fhog_descriptors.rows, this->weights.rows);
+
+	cv::Mat input_hog = input.colRange(0, num_hog);
+	fhog_descriptors.colRange(0, num_hog).convertTo(input_hog, CV_32F);
+
+	if(num_hog < this->weights.rows)
+	{
+		cv::Mat input_geom = input.colRange(num_hog, this->weights.rows);
+		geom_params.colRange(0, this->weights.rows - num_hog).convertTo(input_geom, CV_32F);
+	}
+}
+
+void Stacked_lin_models::UpdateMedianBiases(const cv::Mat_<float>& running_median, const cv::Mat_<double>& running_median_geom)
+{
+	if(!has_dynamic)
+	{
+		this->median_biases = this->biases;
+		return;
+	}
+
+	// Without a median yet the dynamic models see the descriptor itself
+	if(running_median.empty() || (running_median.cols < this->weights.rows && running_median_geom.empty()))
+	{
+		this->median_input = cv::Mat_<float>(1, this->weights.rows, 0.0f);
+	}
+	else
+	{
+		AssembleInput(this->median_input, running_median, running_median_geom);
+	}
+
+	// The median does not move on most frames once enough of them have been seen
+	if(this->median_biases.empty() || this->median.empty() ||
+		std::memcmp(this->median_input.ptr<float>(0), this->median.ptr<float>(0), this->weights.rows * sizeof(float)) != 0)
+	{
+		this->median_input.copyTo(this->median);
+		cv::gemm(this->median, this->dynamic_weights, -1.0, this->biases, 1.0, this->median_biases);
+	}
+}
+
+void Stacked_lin_models::Predict(std::vector<std::pair<std::string, double>>& intensities, std::vector<std::pair<std::string, double>>& presences, const cv::Mat_<float>& fhog_descriptor,
+	const cv::Mat_<double>& geom_params, const cv::Mat_<float>& running_median, const cv::Mat_<double>& running_median_geom)
+{
+	intensities.clear();
+	presences.clear();
+
+	if(this->weights.empty())
+	{
+		return;
+	}
+
+	AssembleInput(this->input, fhog_descriptor, geom_params);
+	UpdateMedianBiases(running_median, running_median_geom);
+
+	cv::gemm(this->input, this->weights, 1.0, this->median_biases, 1.0, this->scores);
+
+	const float* scores_ptr = this->scores.ptr<float>(0);
+	for(int i = 0; i < this->scores.cols; ++i)
+	{
+		std::pair<std::string, double> prediction(AU_names[i], Output(i, scores_ptr[i]));
+		if(classifier[i])
+		{
+			presences.push_back(prediction);
+		}
+		else
+		{
+			intensities.push_back(prediction);
+		}
+	}
+}
+
+void Stacked_lin_models::PredictBatch(cv::Mat_<double>& predictions, const cv::Mat_<float>& fhog_descriptors, const cv::Mat_<float>& geom_params,
+	const cv::Mat_<float>& running_median, const cv::Mat_<double>& running_median_geom)
+{
+	if(this->weights.empty() || fhog_descriptors.empty())
+	{
+		predictions = cv::Mat_<double>();
+		return;
+	}
+
+	cv::Mat_<float> batch_input;
+	AssembleInput(batch_input, fhog_descriptors, geom_params);
+	UpdateMedianBiases(running_median, running_median_geom);
+
+	cv::Mat_<float> batch_scores;
+	cv::gemm(batch_input, this->weights, 1.0, cv::repeat(this->median_biases, batch_input.rows, 1), 1.0, batch_scores);
+
+	predictions.create(batch_scores.rows, batch_scores.cols);
+	for(int r = 0; r < batch_scores.rows; ++r)
+	{
+		const float* scores_ptr = batch_scores.ptr<float>(r);
+		double* predictions_ptr = predictions.ptr<double>(r);
+		for(int i = 0; i < batch_scores.cols; ++i)
+		{
+			predictions_ptr[i] = Output(i, scores_ptr[i]);
+		}
+	}
+}
@@ -63,7 +63,7 @@ public:
 	// Neural weights
 	cv::Mat_<float> weights; 
 
-	// can have neural weight dfts that are calculated on the go as needed, this allows us not to recompute
+	// neural weight dfts precomputed for the response sizes that will be used (see PrecomputeDFT), this allows us not to recompute
 	// the dft of the template each time, improving the speed of tracking
 	std::map<int, cv::Mat_<double> > weights_dfts;
 
@@ -76,10 +76,30 @@ public:
 	// Copy constructor
 	CCNF_neuron(const CCNF_neuron& other);
 
-	void Read(std::ifstream &stream);
+	void Read(std::istream &stream);
+
+	// Precompute the weight dft for an area of interest of a particular size
+	void PrecomputeDFT(const cv::Size& area_of_interest_size);
+
 	// The im_dft, integral_img, and integral_img_sq are precomputed images for convolution speedups (they get set if passed in empty values)
-	void Response(cv::Mat_<float> &im, cv::Mat_<double> &im_dft, cv::Mat &integral_img, cv::Mat &integral_img_sq, cv::Mat_<float> &resp);
+	void Response(const cv::Mat_<float> &im, cv::Mat_<double> &im_dft, cv::Mat &integral_img, cv::Mat &integral_img_sq, cv::Mat_<float> &resp) const;
+
+};
+
+//===========================================================================
+/**
+Buffers reused between the responses computed by one thread, so that computing a response does not allocate
+*/
+struct CCNF_response_buffers
+{
+	cv::Mat_<double>	integral_img;
+	cv::Mat_<double>	integral_img_sq;
 
+	// The neuron correlations at one location of the response
+	std::vector<float>	correlations;
+
+	// The summed neuron responses before the multiplication with Sigma
+	cv::Mat_<float>		neuron_response;
 };
 
 //===========================================================================
@@ -104,19 +124,44 @@ public:
 	// How confident we are in the patch
 	double   patch_confidence;
 
+	// The contributing neurons packed into one bank, so that all of their responses are computed in a single pass over the area of interest
+	// A row per template element (row major), with the zero mean weights of the neurons in the columns (padded with zeros to a multiple of 4)
+	// Empty if the neurons can't be packed (e.g. depth neurons that normalise the area of interest themselves)
+	cv::Mat_<float>	neuron_bank;
+
+	// The parameters of each packed neuron, rows are the norm of the zero mean weights, norm_weights, bias and 2 * alpha
+	cv::Mat_<float>	neuron_bank_params;
+
 	// Default constructor
 	CCNF_patch_expert(){;}
 
 	// Copy constructor		
 	CCNF_patch_expert(const CCNF_patch_expert& other);
 
-	void Read(std::ifstream &stream, std::vector<int> window_sizes, std::vector<std::vector<cv::Mat_<float> > > sigma_components);
+	void Read(std::istream &stream, std::vector<int> window_sizes, std::vector<std::vector<cv::Mat_<float> > > sigma_components);
+
+	// actual work (can pass in an image and a potential depth image, if the CCNF is trained with depth), Sigma is the one for the window size of the response
+	void Response(const cv::Mat_<float> &area_of_interest, cv::Mat_<float> &response, const cv::Mat_<float>& Sigma) const;
+
+	// The same, using the provided scratch buffers, the response is written in place if it is already of the right size
+	void Response(const cv::Mat_<float> &area_of_interest, cv::Mat_<float> &response, const cv::Mat_<float>& Sigma, CCNF_response_buffers& buffers) const;
+
+	// Precompute the Sigma and the neuron dfts for a particular window size, so that they are not computed during tracking
+	void WarmUp(const std::vector<cv::Mat_<float> >& sigma_components, int window_size);
+
+	// Helper function to compute the Sigma for a particular window size
+	void ComputeSigma(const std::vector<cv::Mat_<float> >& sigma_components, int window_size, cv::Mat_<float>& Sigma) const;
+
+	// Index of the precomputed Sigma for a window size (-1 if it has not been precomputed)
+	int GetSigmaIdx(int window_size) const;
+
+private:
 
-	// actual work (can pass in an image and a potential depth image, if the CCNF is trained with depth)
-	void Response(cv::Mat_<float> &area_of_interest, cv::Mat_<float> &response);
+	// Packing the neurons into the neuron bank after reading
+	void PackNeurons();
 
-	// Helper function to compute relevant sigmas
-	void ComputeSigmas(std::vector<cv::Mat_<float> > sigma_components, int window_size);
+	// The summed sigmoid responses of all the packed neurons in one pass (the neuron responses before multiplication with Sigma)
+	void NeuronBankResponse(const cv::Mat_<float> &area_of_interest, cv::Mat_<float> &response, CCNF_response_buffers& buffers) const;
 	
 };
   //===========================================================================
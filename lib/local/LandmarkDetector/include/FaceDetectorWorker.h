@@ -0,0 +1,134 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace: an open source facial behavior analysis toolkit
+//       Tadas Baltruaitis, Peter Robinson, and Louis-Philippe Morency
+//       in IEEE Winter Conference on Applications of Computer Vision, 2016  
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltruaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-speci?c normalisation for automatic Action Unit detection
+//       Tadas Baltruaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+//       Constrained Local Neural Fields for robust facial landmark detection in the wild.
+//       Tadas Baltruaitis, Peter Robinson, and Louis-Philippe Morency. 
+//       in IEEE Int. Conference on Computer Vision Workshops, 300 Faces in-the-Wild Challenge, 2013.    
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef __FACE_DETECTOR_WORKER_h_
+#define __FACE_DETECTOR_WORKER_h_
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+#include <opencv2/objdetect.hpp>
+
+// dlib includes
+#include <dlib/image_processing/frontal_face_detector.h>
+
+// System includes
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "LandmarkDetectorParameters.h"
+
+namespace LandmarkDetector
+{
+//===========================================================================
+/**
+	A face detector running on its own worker thread, so that the cost of face detection does not land on the tracking thread.
+
+	The tracking thread hands over frames with SubmitFrame (only the latest one is kept if the worker is still busy) and
+	collects the detections with GetDetections whenever it is ready for them, neither of these waits for a detection.
+	The detections can therefore be a few frames older than the frame being tracked.
+*/
+class FaceDetectorWorker
+{
+public:
+
+	// The detector used follows params.curr_face_detector (the HAAR cascade is loaded from params.face_detector_location)
+	FaceDetectorWorker(const FaceModelParameters& params);
+
+	// Stops the worker (waiting for the detection in progress to finish)
+	~FaceDetectorWorker();
+
+	// Hands a frame to the detector (it is copied), replacing any frame still waiting to be processed
+	void SubmitFrame(const cv::Mat_<uchar>& intensity, int frame_number = -1);
+
+	// As above, but only faces in the region of interest that are between min_width and max_width across are searched for (see the re-detection variants of DetectFaces)
+	void SubmitFrame(const cv::Mat_<uchar>& intensity, const cv::Rect_<double>& roi, double min_width, double max_width, int frame_number = -1);
+
+	// Collects the detections of the last processed frame if they have not been collected yet, returns false otherwise
+	bool GetDetections(std::vector<cv::Rect_<double> >& o_regions, std::vector<double>& o_confidences, int& o_frame_number);
+
+	// Drops the frame waiting to be processed and any detections not collected yet, once they are no longer wanted (so they can't be used much later)
+	void DiscardDetections();
+
+	// Is there a frame waiting or being processed
+	bool Busy();
+
+	// Picks a single face out of the detections, the one closest to the preference point if it is set, otherwise the most confident (or the biggest one for equal confidences)
+	static bool SelectSingleFace(cv::Rect_<double>& o_region, const std::vector<cv::Rect_<double> >& regions, const std::vector<double>& confidences, const cv::Point preference = cv::Point(-1,-1));
+
+private:
+
+	// The detection loop of the worker thread
+	void Run();
+
+	// The detectors are only used from the worker thread
+	FaceModelParameters::FaceDetector	detector_type;
+	double								min_face_size;
+	cv::CascadeClassifier				face_detector_HAAR;
+	dlib::frontal_face_detector			face_detector_HOG;
+
+	// Guards everything below
+	std::mutex					lock;
+	std::condition_variable		frame_available;
+
+	// The frame waiting to be processed
+	cv::Mat_<uchar>				pending_frame;
+	int							pending_frame_number;
+
+	// The region to search in the pending frame (empty for the whole frame) and the face size range for it
+	cv::Rect_<double>			pending_roi;
+	double						pending_min_width;
+	double						pending_max_width;
+	bool						frame_pending;
+	bool						processing;
+
+	// The latest detections
+	std::vector<cv::Rect_<double> >	detections;
+	std::vector<double>				detection_confidences;
+	int								detection_frame_number;
+	bool							detections_ready;
+
+	bool						stop;
+
+	std::thread					worker;
+
+	// The worker thread can't be copied
+	FaceDetectorWorker(const FaceDetectorWorker&);
+	FaceDetectorWorker& operator=(const FaceDetectorWorker&);
+
+};
+//===========================================================================
+}
+#endif
@@ -40,5 +40,7 @@
 #include "LandmarkDetectorFunc.h"
 #include "LandmarkDetectorParameters.h"
 #include "LandmarkDetectorUtils.h"
+#include "ModelBundle.h"
+#include "FaceDetectorWorker.h"
 
 #endif
\ No newline at end of file
@@ -75,13 +75,13 @@ public:
 	vector<double>  bs;
 
 	// SVR weights
-	vector<cv::Mat_<double> > ws;
+	vector<cv::Mat_<float> > ws;
 	
 	//==========================================
 	// Neural Network
 
 	// Neural net weights
-	vector<vector<cv::Mat_<double> > > ws_nn;
+	vector<vector<cv::Mat_<float> > > ws_nn;
 
 	// What type of activation or output functions are used
 	// 0 - sigmoid, 1 - tanh_opt, 2 - ReLU
@@ -94,8 +94,9 @@ public:
 	// CNN layers for each view
 	// view -> layer -> input maps -> kernels
 	vector<vector<vector<vector<cv::Mat_<float> > > > > cnn_convolutional_layers;
-	// Bit ugly with so much nesting, but oh well
-	vector<vector<vector<vector<pair<int, cv::Mat_<double> > > > > > cnn_convolutional_layers_dft;
+	// The same kernels packed for a matrix multiplication against unrolled input patches
+	// view -> layer -> (kernels x (input maps * kernel rows * kernel cols))
+	vector<vector<cv::Mat_<float> > > cnn_convolutional_layers_weights;
 	vector<vector<vector<float > > > cnn_convolutional_layers_bias;
 	vector< vector<int> > cnn_subsampling_layers;
 	vector< vector<cv::Mat_<float> > > cnn_fully_connected_layers;
@@ -105,9 +106,9 @@ public:
 	
 	//==========================================
 
-	// Normalisation for face validation
-	vector<cv::Mat_<double> > mean_images;
-	vector<cv::Mat_<double> > standard_deviations;
+	// Normalisation for face validation (the validator is applied in single precision, so the weights and normalisation are stored as floats)
+	vector<cv::Mat_<float> > mean_images;
+	vector<cv::Mat_<float> > standard_deviations;
 
 	// Default constructor
 	DetectionValidator(){;}
@@ -116,10 +117,14 @@ public:
 	DetectionValidator(const DetectionValidator& other);
 
 	// Given an image, orientation and detected landmarks output the result of the appropriate regressor
-	double Check(const cv::Vec3d& orientation, const cv::Mat_<uchar>& intensity_img, cv::Mat_<double>& detected_landmarks);
+	double Check(const cv::Vec3d& orientation, const cv::Mat_<uchar>& intensity_img, cv::Mat_<double>& detected_landmarks) const;
+
+	// Checking several faces in the same image at once, faces sharing a view are passed through the CNN together
+	void Check(const vector<cv::Vec3d>& orientations, const cv::Mat_<uchar>& intensity_img, const vector<cv::Mat_<double> >& detected_landmarks, vector<double>& decisions) const;
 
 	// Reading in the model
 	void Read(string location);
+
 			
 	// Getting the closest view center based on orientation
 	int GetViewId(const cv::Vec3d& orientation) const;
@@ -129,16 +134,19 @@ private:
 	// The actual regressor application on the image
 
 	// Support Vector Regression (linear kernel)
-	double CheckSVR(const cv::Mat_<double>& warped_img, int view_id);
+	double CheckSVR(const cv::Mat_<float>& warped_img, int view_id) const;
 
 	// Feed-forward Neural Network
-	double CheckNN(const cv::Mat_<double>& warped_img, int view_id);
+	double CheckNN(const cv::Mat_<float>& warped_img, int view_id) const;
 
 	// Convolutional Neural Network
-	double CheckCNN(const cv::Mat_<double>& warped_img, int view_id);
+	double CheckCNN(const cv::Mat_<float>& warped_img, int view_id) const;
+
+	// Convolutional Neural Network applied to a batch of warped faces of the same view
+	void CheckCNN(const vector<cv::Mat_<float> >& warped_imgs, int view_id, vector<double>& decisions) const;
 
 	// A normalisation helper
-	void NormaliseWarpedToVector(const cv::Mat_<double>& warped_img, cv::Mat_<double>& feature_vec, int view_id);
+	void NormaliseWarpedToVector(const cv::Mat_<float>& warped_img, cv::Mat_<float>& feature_vec, int view_id) const;
 
 };
 
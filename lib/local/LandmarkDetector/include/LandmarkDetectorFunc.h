@@ -44,6 +44,7 @@
 #include <LandmarkDetectorParameters.h>
 #include <LandmarkDetectorUtils.h>
 #include <LandmarkDetectorModel.h>
+#include <FaceDetectorWorker.h>
 
 using namespace std;
 
@@ -60,6 +61,11 @@ namespace LandmarkDetector
 	bool DetectLandmarksInVideo(const cv::Mat_<uchar> &grayscale_image, const cv::Rect_<double> bounding_box, CLNF& clnf_model, FaceModelParameters& params);
 	bool DetectLandmarksInVideo(const cv::Mat_<uchar> &grayscale_image, const cv::Mat_<float> &depth_image, const cv::Rect_<double> bounding_box, CLNF& clnf_model, FaceModelParameters& params);
 
+	// Versions that leave the face detection for (re)initialisation to a worker thread, the frame is handed to the worker and its latest detections are used
+	// whenever they are available, so detection never holds up tracking (the initialisation can be based on a detection that is a few frames old)
+	bool DetectLandmarksInVideo(const cv::Mat_<uchar> &grayscale_image, CLNF& clnf_model, FaceModelParameters& params, FaceDetectorWorker& face_detector);
+	bool DetectLandmarksInVideo(const cv::Mat_<uchar> &grayscale_image, const cv::Mat_<float> &depth_image, CLNF& clnf_model, FaceModelParameters& params, FaceDetectorWorker& face_detector);
+
 	//================================================================================================================
 	// Landmark detection in image, need to provide an image and optionally CLNF model together with parameters (default values work well)
 	// Optionally can provide a bounding box in which detection is performed (this is useful if multiple faces are to be detected in images)
@@ -39,6 +39,9 @@
 #include <opencv2/core/core.hpp>
 #include <opencv2/objdetect.hpp>
 
+// For sharing the model between trackers
+#include <memory>
+
 // dlib dependencies for face detection
 #include <dlib/image_processing/frontal_face_detector.h>
 #include <dlib/opencv.h>
@@ -53,11 +56,28 @@ using namespace std;
 namespace LandmarkDetector
 {
 
-// A main class containing all the modules required for landmark detection
+// Precalculated kernel density estimates of the mean shift for one response map size (the speedup described in Saragih 2011 RLMS paper)
+struct KDE_table
+{
+	// The Gaussian kernel exponent factor (-0.5/sigma^2) the table was built for
+	float a;
+
+	// Every row is the kernel evaluated over the response map for one sub-pixel landmark location (on a grid with KDE_table::step spacing)
+	cv::Mat_<float> kde;
+
+	// The spacing of the sub-pixel landmark locations
+	static const float step;
+
+	// Fills in the table for the given response map size
+	void Build(int resp_size, float a);
+};
+
+// The read-only part of the landmark detector, loaded once and shared between any number of trackers
 // Face shape model
 // Patch experts
-// Optimization techniques
-class CLNF{
+// Landmark detection validator
+// Hierarchical part models
+class CLNFModel{
 
 public:
 
@@ -65,10 +85,89 @@ public:
 	// Member variables that contain the model description
 
 	// The linear 3D Point Distribution Model
-    PDM					pdm;
+	PDM					pdm;
 	// The set of patch experts
 	Patch_experts		patch_experts;
 
+	// A collection of hierarchical CLNF models that can be used for refinement
+	vector<std::shared_ptr<CLNFModel> >	hierarchical_models;
+	vector<string>						hierarchical_model_names;
+	vector<vector<pair<int,int>>>		hierarchical_mapping;
+	vector<FaceModelParameters>			hierarchical_params;
+
+	// Validate if the detected landmarks are correct using an SVR regressor
+	DetectionValidator	landmark_validator; 
+
+	// Indicator if eye model is there for eye detection
+	bool				eye_model;
+
+	// the triangulation per each view (for drawing purposes only)
+	vector<cv::Mat_<int> >	triangulations;
+
+	// The mean shift KDE tables indexed by the response map size (built in WarmUp, empty for the sizes that are not used)
+	vector<KDE_table>		kde_tables;
+
+	// A default constructor
+	CLNFModel();
+
+	// Constructor from a model file
+	CLNFModel(string fname);
+
+	// Reading the model in
+	void Read(string name);
+
+	// Helper reading function
+	void Read_CLNF(string clnf_location);
+
+	// Precompute everything the patch experts need for the window sizes in the parameters (part models use their own parameters)
+	// After this the model is only read during fitting, so it can be safely shared between trackers running in parallel
+	// Not thread safe itself, call it before tracking starts (calling it again with other parameters adds to the precomputed data)
+	void WarmUp(const FaceModelParameters& params);
+
+	// Adapts the fitting parameters to the patch expert scale if params.refine_parameters is set (less regularisation, but a wider KDE and more weighting for larger scales)
+	// Only the reg_factor, sigma and weight_factor of scale_params are changed
+	void AdaptParameters(FaceModelParameters& scale_params, const FaceModelParameters& params, int scale) const;
+
+};
+
+// The preallocated single precision buffers of the fast NU-RLMS optimiser (see FaceModelParameters::fast_rlms), so that the fitting iterations do not allocate
+struct RLMS_workspace
+{
+	// Current local parameters and the shapes they describe (3D object space and 2D image space)
+	cv::Mat_<float> current_local;
+	cv::Mat_<float> shape_3D;
+	cv::Mat_<float> current_shape;
+	cv::Mat_<float> previous_shape;
+
+	// Response map locations of the current landmarks and their mean shifts
+	cv::Mat_<float> dxs;
+	cv::Mat_<float> dys;
+	cv::Mat_<float> mean_shifts;
+
+	// Per landmark weights of the least squares and the regularisation of the non-rigid parameters
+	cv::Mat_<float> weights;
+	cv::Mat_<float> regularisation;
+
+	// The Jacobian rows of the current vertex, and the normal equations (the Hessian is overwritten by its Cholesky decomposition and J_w_t_m by the parameter update)
+	cv::Mat_<float> jacobian_rows;
+	cv::Mat_<float> hessian;
+	cv::Mat_<float> J_w_t_m;
+
+	// Sizes the buffers for n landmarks and m modes of the PDM (does nothing if they are already of that size)
+	void Allocate(int n, int m);
+};
+
+// A main class containing all the modules required for landmark detection
+// The model description is shared (copies of CLNF refer to the same CLNFModel), while the rest of the class is the lightweight state of a single tracked face
+// Optimization techniques
+class CLNF{
+
+public:
+
+	//===========================================================================
+	// The shared model description (PDM, patch experts, validator and part models), is not modified during tracking
+	std::shared_ptr<CLNFModel>	model;
+
 	// The local and global parameters describing the current model instance (current landmark detections)
 
 	// Local parameters describing the non-rigid shape
@@ -77,11 +176,11 @@ public:
 	// Global parameters describing the rigid shape [scale, euler_x, euler_y, euler_z, tx, ty]
 	cv::Vec6d           params_global;
 
-	// A collection of hierarchical CLNF models that can be used for refinement
-	vector<CLNF>					hierarchical_models;
-	vector<string>					hierarchical_model_names;
-	vector<vector<pair<int,int>>>	hierarchical_mapping;
-	vector<FaceModelParameters>		hierarchical_params;
+	// The tracking state of the hierarchical part models (each refers to the corresponding model->hierarchical_models entry)
+	vector<CLNF>		hierarchical_models;
+
+	// Tracking states for the extra initialisation hypotheses fitted in parallel by DetectLandmarksInImage (created on first use and kept, not copied between trackers)
+	vector<CLNF>		hypothesis_trackers;
 
 	//==================== Helpers for face detection and landmark detection validation =========================================
 
@@ -92,10 +191,6 @@ public:
 	// A HOG SVM-struct based face detector
 	dlib::frontal_face_detector face_detector_HOG;
 
-
-	// Validate if the detected landmarks are correct using an SVR regressor
-	DetectionValidator	landmark_validator; 
-
 	// Indicating if landmark detection succeeded (based on SVR validator)
 	bool				detection_success; 
 
@@ -105,12 +200,6 @@ public:
 	// The actual output of the regressor (-1 is perfect detection 1 is worst detection)
 	double				detection_certainty; 
 
-	// Indicator if eye model is there for eye detection
-	bool				eye_model;
-
-	// the triangulation per each view (for drawing purposes only)
-	vector<cv::Mat_<int> >	triangulations;
-	
 	//===========================================================================
 	// Member variables that retain the state of the tracking (reflecting the state of the lastly tracked (detected) image
 
@@ -131,16 +220,31 @@ public:
 	// Useful when resetting or initialising the model closer to a specific location (when multiple faces are present)
 	cv::Point_<double> preference_det;
 
+	// The stages of the fitting that can be dropped to stay within the frame budget (FaceModelParameters::frame_budget)
+	enum DroppedStage{DROPPED_SCALES = 1, DROPPED_ITERATIONS = 2, DROPPED_HIERARCHICAL = 4, DROPPED_VALIDATION = 8};
+
+	// The stages dropped since the frame budget was last started (a combination of DroppedStage flags, 0 if the full fitting was done)
+	int dropped_stages;
+
+	// How many validations the temporal gating skipped since the last Reset (FaceModelParameters::validation_gate_every)
+	int skipped_validations;
+
 	// A default constructor
 	CLNF();
 
 	// Constructor from a model file
 	CLNF(string fname);
+
+	// Constructor from a model file, precomputing for the parameters the tracker will be used with
+	CLNF(string fname, const FaceModelParameters& params);
+
+	// Constructor of a new tracker from an already loaded model (the model is shared, not copied)
+	CLNF(std::shared_ptr<CLNFModel> model);
 	
-	// Copy constructor (makes a deep copy of the detector)
+	// Copy constructor (makes a deep copy of the tracking state, the model itself is shared)
 	CLNF(const CLNF& other);
 
-	// Assignment operator for lvalues (makes a deep copy of the detector)
+	// Assignment operator for lvalues (makes a deep copy of the tracking state, the model itself is shared)
 	CLNF & operator= (const CLNF& other);
 
 	// Empty Destructor	as the memory of every object will be managed by the corresponding libraries (no pointers)
@@ -168,33 +272,87 @@ public:
 	// Reset the model, choosing the face nearest (x,y) where x and y are between 0 and 1.
 	void Reset(double x, double y);
 
-	// Reading the model in
+	// Reading the model in (replaces the shared model this tracker refers to), precomputing for the default parameters
 	void Read(string name);
 
-	// Helper reading function
-	void Read_CLNF(string clnf_location);
-	
+	// Reading the model in, precomputing for the window sizes of the parameters it will be used with (other window sizes are computed on every fit)
+	void Read(string name, const FaceModelParameters& params);
+
+	// Starts the latency budget of a new frame if params.frame_budget is set, and clears dropped_stages
+	// Called by DetectLandmarksInVideo and DetectLandmarksInImage, call it before DetectLandmarks when using that directly
+	void StartFrameBudget(const FaceModelParameters& params);
+
+	// Continues the frame budget of another tracker fitting the same frame (the hypotheses of DetectLandmarksInImage), and clears dropped_stages
+	void JoinFrameBudget(const CLNF& other);
+
+	// A readable list of the dropped stages (empty if none were dropped)
+	string GetDroppedStages() const;
+
 private:
 
-	// the speedup of RLMS using precalculated KDE responses (described in Saragih 2011 RLMS paper)
-	map<int, cv::Mat_<float> >		kde_resp_precalc;
+	// Setting up the tracking state for the current model (including the part model trackers)
+	void InitialiseState();
+
+	// Scratch space of the single precision optimiser and of the patch expert responses (not copied between trackers)
+	RLMS_workspace		rlms_workspace;
+	Patch_response_workspace	patch_workspace;
+
+	// The end of the current frame budget in ticks (0 if there is no budget), and how long the optional stages took when they were last done
+	int64				frame_deadline;
+	int64				hierarchical_ticks;
+	int64				validation_ticks;
+
+	// Would a stage taking expected_ticks overrun the current frame budget
+	bool OverBudget(int64 expected_ticks = 0) const;
+
+	// The temporal validation gating state, the fit of the last validated frame and the frames tracked since, and the running mean and
+	// variance of the changes (likelihood drop, landmark motion and rotation) between successive successful validations
+	cv::Mat_<double>	gate_landmarks;
+	cv::Vec6d			gate_pose;
+	double				gate_likelihood;
+	int					gate_frames;
+	cv::Vec3d			gate_change_mean;
+	cv::Vec3d			gate_change_var;
+	int					gate_samples;
+
+	// The change of the current fit from the last validated one
+	cv::Vec3d ValidationGateChange() const;
+
+	// Can the validation of the current fit be skipped, given its change from the last validated one
+	bool SkipValidation(const FaceModelParameters& params, const cv::Vec3d& change) const;
+
+	// Record the outcome of a validation, has_change indicates if the change from a previously validated fit is known
+	void UpdateValidationGate(const cv::Vec3d& change, bool has_change, bool success);
+
+	// Forget the last validated fit
+	void ResetValidationGate();
 
 	// The model fitting: patch response computation and optimisation steps
     bool Fit(const cv::Mat_<uchar>& intensity_image, const cv::Mat_<float>& depth_image, const std::vector<int>& window_sizes, const FaceModelParameters& parameters);
 
-	// Mean shift computation that uses precalculated kernel density estimators (the one actually used)
-	void NonVectorisedMeanShift_precalc_kde(cv::Mat_<float>& out_mean_shifts, const vector<cv::Mat_<float> >& patch_expert_responses, const cv::Mat_<float> &dxs, const cv::Mat_<float> &dys, int resp_size, float a, int scale, int view_id, map<int, cv::Mat_<float> >& mean_shifts);
+	// Mean shift computation that uses the kernel density estimators precalculated in the model (the one actually used)
+	void MeanShift_precalc_kde(cv::Mat_<float>& out_mean_shifts, const vector<cv::Mat_<float> >& patch_expert_responses, const cv::Mat_<float> &dxs, const cv::Mat_<float> &dys, int resp_size, float a, int scale, int view_id);
 
 	// The actual model optimisation (update step), returns the model likelihood
     double NU_RLMS(cv::Vec6d& final_global, cv::Mat_<double>& final_local, const vector<cv::Mat_<float> >& patch_expert_responses, const cv::Vec6d& initial_global, const cv::Mat_<double>& initial_local,
 		          const cv::Mat_<double>& base_shape, const cv::Matx22d& sim_img_to_ref, const cv::Matx22f& sim_ref_to_img, int resp_size, int view_idx, bool rigid, int scale, cv::Mat_<double>& landmark_lhoods, const FaceModelParameters& parameters);
 
+	// Single precision version of NU_RLMS that works in the preallocated rlms_workspace, fuses the Jacobian and weight products and solves using an in-place Cholesky decomposition
+	double NU_RLMS_float(cv::Vec6d& final_global, cv::Mat_<double>& final_local, const vector<cv::Mat_<float> >& patch_expert_responses, const cv::Vec6d& initial_global, const cv::Mat_<double>& initial_local,
+		const cv::Mat_<double>& base_shape, const cv::Matx22d& sim_img_to_ref, const cv::Matx22f& sim_ref_to_img, int resp_size, int view_idx, bool rigid, int scale, cv::Mat_<double>& landmark_lhoods, const FaceModelParameters& parameters);
+
+	// The likelihoods of the landmarks at the locations of the last mean shift (a is the KDE kernel exponent), returns the combined log likelihood
+	double LandmarkLikelihoods(cv::Mat_<double>& landmark_lhoods, const vector<cv::Mat_<float> >& patch_expert_responses, const cv::Mat_<float> &dxs, const cv::Mat_<float> &dys, int resp_size, float a, int scale, int view_id);
+
 	// Removing background image from the depth
 	bool RemoveBackground(cv::Mat_<float>& out_depth_image, const cv::Mat_<float>& depth_image);
 
 	// Generating the weight matrix for the Weighted least squares
 	void GetWeightMatrix(cv::Mat_<float>& WeightMatrix, int scale, int view_id, const FaceModelParameters& parameters);
 
+	// The diagonal of the weight matrix, one weight per landmark (the same for x and y)
+	void GetLandmarkWeights(cv::Mat_<float>& weights, int scale, int view_id, const FaceModelParameters& parameters);
+
 	//=======================================================
 	// Legacy functions that are not used at the moment
 	//=======================================================
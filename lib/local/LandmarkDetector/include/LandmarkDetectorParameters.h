@@ -73,6 +73,9 @@ struct FaceModelParameters
 
 	// Where to load the model from
 	string model_location;
+
+	// An optional binary model bundle (see ModelBundle.h), if set it is mounted when the arguments are parsed and the model files are read from it
+	string bundle_location;
 	
 	// this is used for the smooting of response maps (KDE sigma)
 	double sigma;
@@ -82,10 +85,18 @@ struct FaceModelParameters
 
 	// should multiple views be considered during reinit
 	bool multi_view;
+
+	// With multi_view in DetectLandmarksInImage, the view hypotheses whose model likelihood after the first (coarsest) window size is lower than the best one by more than this
+	// are not fitted any further (set to negative to always fit all of them)
+	double hypothesis_pruning;
 	
 	// How often should face detection be used to attempt reinitialisation, every n frames (set to negative not to reinit)
 	int reinit_video_every;
 
+	// A lost face is first re-detected in a region around its last location and only at scales close to its last size, the whole image is
+	// scanned at all scales only on every n-th re-detection attempt (set to 1 or less to always scan the whole image)
+	int full_redetection_every;
+
 	// Determining which face detector to use for (re)initialisation, HAAR is quicker but provides more false positives and is not goot for in-the-wild conditions
 	// Also HAAR detector can detect smaller faces while HOG SVM is only capable of detecting faces at least 70px across
 	enum FaceDetector{HAAR_DETECTOR, HOG_SVM_DETECTOR};
@@ -93,6 +104,10 @@ struct FaceModelParameters
 	string face_detector_location;
 	FaceDetector curr_face_detector;
 
+	// The smallest face (in pixels across) the face detectors search for, the HOG detector does not even compute the features of the image pyramid levels
+	// that could only find smaller faces, which saves most of its time on high resolution images (0 for no limit)
+	double min_face_size;
+
 	// Should the results be visualised and reported to console
 	bool quiet_mode;
 
@@ -105,6 +120,20 @@ struct FaceModelParameters
 	// Using the brand new and experimental gaze tracker
 	bool track_gaze;
 
+	// Use the single precision, allocation free NU-RLMS optimiser instead of the reference (mixed precision) one
+	bool fast_rlms;
+
+	// An optional per frame latency budget for landmark detection in video (in milliseconds, 0 or less for no budget)
+	// When it would be exceeded the fitting degrades by dropping the last scales, optimisation iterations, the hierarchical refinement and the validation (see CLNF::dropped_stages)
+	double frame_budget;
+
+	// Temporal gating of the validation in video, if above 1 the validator is run at least every this many frames and skipped in between
+	// while the likelihood, landmarks and pose stay close to the last validated frame (see CLNF::skipped_validations), 0 validates every frame
+	int validation_gate_every;
+
+	// How close counts as close, in standard deviations of the changes seen between successful validations of the same tracker
+	double validation_gate_deviations;
+
 	FaceModelParameters();
 
 	FaceModelParameters(vector<string> &arguments);
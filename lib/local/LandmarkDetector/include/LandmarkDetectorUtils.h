@@ -66,7 +66,38 @@ namespace LandmarkDetector
 	// This is a modified version of openCV code that allows for precomputed dfts of templates and for precomputed dfts of an image
 	// _img is the input img, _img_dft it's dft (optional), _integral_img the images integral image (optional), squared integral image (optional), 
 	// templ is the template we are convolving with, templ_dfts it's dfts at varying windows sizes (optional),  _result - the output, method the type of convolution
-	void matchTemplate_m( const cv::Mat_<float>& input_img, cv::Mat_<double>& img_dft, cv::Mat& _integral_img, cv::Mat& _integral_img_sq, const cv::Mat_<float>&  templ, map<int, cv::Mat_<double> >& templ_dfts, cv::Mat_<float>& result, int method );
+	// If the templ_dfts does not contain the dft at the required size it is computed for this call only (use computeTemplateDFT_m to precompute it)
+	void matchTemplate_m( const cv::Mat_<float>& input_img, cv::Mat_<double>& img_dft, cv::Mat& _integral_img, cv::Mat& _integral_img_sq, const cv::Mat_<float>&  templ, const map<int, cv::Mat_<double> >& templ_dfts, cv::Mat_<float>& result, int method );
+
+	// Precomputing the dft of a template for correlation with images of img_size, stored in templ_dfts (does nothing if already computed)
+	void computeTemplateDFT_m( const cv::Mat_<float>& templ, const cv::Size& img_size, map<int, cv::Mat_<double> >& templ_dfts );
+
+	// Direct (not DFT based) correlation of an image with a template, corr is of size img - templ + 1
+	// Vectorised using OpenCV universal intrinsics (SSE or NEON), faster than the DFT for small templates and responses
+	void directCorr_m( const cv::Mat_<float>& img, const cv::Mat_<float>& templ, cv::Mat_<float>& corr );
+
+	// How matchTemplate_m computes the correlation, CORRELATION_AUTO picks direct or DFT per call based on the template and response sizes
+	enum CorrelationMethod { CORRELATION_AUTO = 0, CORRELATION_DIRECT = 1, CORRELATION_DFT = 2 };
+
+	// Selecting the correlation method at runtime (set it before tracking starts)
+	void SetCorrelationMethod(CorrelationMethod method);
+	CorrelationMethod GetCorrelationMethod();
+
+	// In CORRELATION_AUTO mode the direct correlation is used when response area * template area (the number of multiply-adds) is at most this
+	// The CorrelationBenchmark executable measures the crossover point on a particular machine
+	void SetDirectCorrelationThreshold(int max_multiply_adds);
+	int GetDirectCorrelationThreshold();
+
+	// Would matchTemplate_m use the direct correlation for this template and response size
+	bool UseDirectCorrelation(const cv::Size& templ_size, const cv::Size& result_size);
+
+	// Extracting the areas of interest around a number of centres using bilinear interpolation (border pixels are replicated), same as cvGetQuadrangleSubPix for every area
+	// The transform maps from the area of interest to image coordinates and is shared by all areas, the areas have to be allocated to the desired size (empty ones are skipped)
+	// The image can be of any single channel type (e.g. uchar grayscale image, float depth image or a precomputed float image)
+	void ExtractAreasOfInterest(const cv::Mat& image, const cv::Matx22f& transform, const vector<cv::Point2f>& centres, vector<cv::Mat_<float> >& areas);
+
+	// The same, but only for the areas with indices in [begin, end)
+	void ExtractAreasOfInterest(const cv::Mat& image, const cv::Matx22f& transform, const vector<cv::Point2f>& centres, vector<cv::Mat_<float> >& areas, int begin, int end);
 
 	//===========================================================================
 	// Point set and landmark manipulation functions
@@ -119,29 +150,41 @@ namespace LandmarkDetector
 	//============================================================================
 
 	// Face detection using Haar cascade classifier
+	// Faces narrower than min_width are not searched for (see FaceModelParameters::min_face_size)
 	bool DetectFaces(vector<cv::Rect_<double> >& o_regions, const cv::Mat_<uchar>& intensity);
-	bool DetectFaces(vector<cv::Rect_<double> >& o_regions, const cv::Mat_<uchar>& intensity, cv::CascadeClassifier& classifier);
+	bool DetectFaces(vector<cv::Rect_<double> >& o_regions, const cv::Mat_<uchar>& intensity, cv::CascadeClassifier& classifier, double min_width = 0);
 	// The preference point allows for disambiguation if multiple faces are present (pick the closest one), if it is not set the biggest face is chosen
-	bool DetectSingleFace(cv::Rect_<double>& o_region, const cv::Mat_<uchar>& intensity, cv::CascadeClassifier& classifier, const cv::Point preference = cv::Point(-1,-1));
+	bool DetectSingleFace(cv::Rect_<double>& o_region, const cv::Mat_<uchar>& intensity, cv::CascadeClassifier& classifier, const cv::Point preference = cv::Point(-1,-1), double min_width = 0);
+
+	// Re-detection variants only search the region of interest for faces between min_width and max_width across (in the corrected bounding box units),
+	// which is much cheaper than scanning the whole image at all scales when the rough location and size of the face are known
+	bool DetectFaces(vector<cv::Rect_<double> >& o_regions, const cv::Mat_<uchar>& intensity, cv::CascadeClassifier& classifier, const cv::Rect_<double>& roi, double min_width, double max_width);
 
-	// Face detection using HOG-SVM classifier
+	// Face detection using HOG-SVM classifier, the views of the detector are evaluated in parallel (with the same detections as running it serially)
+	// Faces narrower than min_width are not searched for, so the finest levels of the image pyramid are skipped altogether
 	bool DetectFacesHOG(vector<cv::Rect_<double> >& o_regions, const cv::Mat_<uchar>& intensity, std::vector<double>& confidences);
-	bool DetectFacesHOG(vector<cv::Rect_<double> >& o_regions, const cv::Mat_<uchar>& intensity, dlib::frontal_face_detector& classifier, std::vector<double>& confidences);
+	bool DetectFacesHOG(vector<cv::Rect_<double> >& o_regions, const cv::Mat_<uchar>& intensity, dlib::frontal_face_detector& classifier, std::vector<double>& confidences, double min_width = 0);
 	// The preference point allows for disambiguation if multiple faces are present (pick the closest one), if it is not set the biggest face is chosen
-	bool DetectSingleFaceHOG(cv::Rect_<double>& o_region, const cv::Mat_<uchar>& intensity, dlib::frontal_face_detector& classifier, double& confidence, const cv::Point preference = cv::Point(-1,-1));
+	bool DetectSingleFaceHOG(cv::Rect_<double>& o_region, const cv::Mat_<uchar>& intensity, dlib::frontal_face_detector& classifier, double& confidence, const cv::Point preference = cv::Point(-1,-1), double min_width = 0);
+	bool DetectFacesHOG(vector<cv::Rect_<double> >& o_regions, const cv::Mat_<uchar>& intensity, dlib::frontal_face_detector& classifier, std::vector<double>& confidences, const cv::Rect_<double>& roi, double min_width, double max_width);
 
 	//============================================================================
 	// Matrix reading functionality
 	//============================================================================
 
+	// The streams can be files on disk or entries of a model bundle (see ModelBundle.h), matrices from a bundle are not copied
+
 	// Reading a matrix written in a binary format
-	void ReadMatBin(std::ifstream& stream, cv::Mat &output_mat);
+	void ReadMatBin(std::istream& stream, cv::Mat &output_mat);
 
 	// Reading in a matrix from a stream
-	void ReadMat(std::ifstream& stream, cv::Mat& output_matrix);
+	void ReadMat(std::istream& stream, cv::Mat& output_matrix);
 
 	// Skipping comments (lines starting with # symbol)
-	void SkipComments(std::ifstream& stream);
+	void SkipComments(std::istream& stream);
+
+	// Reporting how long reading a model component took (start_ticks from cv::getTickCount), as components are read in parallel each report is a single line
+	void ReportLoadTime(const string& component, const string& location, int64 start_ticks);
 
 }
 #endif
@@ -0,0 +1,113 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace: an open source facial behavior analysis toolkit
+//       Tadas Baltruaitis, Peter Robinson, and Louis-Philippe Morency
+//       in IEEE Winter Conference on Applications of Computer Vision, 2016  
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltruaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-speci?c normalisation for automatic Action Unit detection
+//       Tadas Baltruaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+//       Constrained Local Neural Fields for robust facial landmark detection in the wild.
+//       Tadas Baltruaitis, Peter Robinson, and Louis-Philippe Morency. 
+//       in IEEE Int. Conference on Computer Vision Workshops, 300 Faces in-the-Wild Challenge, 2013.    
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef __MODEL_BUNDLE_h_
+#define __MODEL_BUNDLE_h_
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
+// System includes
+#include <istream>
+#include <memory>
+#include <string>
+
+namespace LandmarkDetector
+{
+//===========================================================================
+/**
+	A single file binary bundle of model files (landmark detector, validator, AU predictors etc.)
+
+	The bundle starts with a versioned header, followed by the file entries and a table of entries (name, offset and size).
+	Entries are stored under their location relative to the directory the bundle is in, so the model readers do not need
+	to know about bundles. When a file is in a mounted bundle it is read from there, otherwise from disk.
+
+	Every matrix inside an entry is stored in binary and aligned to 64 bytes, the matrices read from a mounted bundle
+	are headers around the memory mapped file rather than copies. The mapping is copy-on-write, so processes on the same
+	machine share the page cache, and the model matrices can still be modified (only the touched pages are copied).
+*/
+
+// The version of the bundle format, bundles of other versions are not read
+#define MODEL_BUNDLE_VERSION 1
+
+// Mounting a bundle, the model files it contains will be read from it (it stays mapped until the program exits)
+bool MountModelBundle(const std::string& bundle_location);
+
+// Check if a model file is available either in a mounted bundle or on disk
+bool ModelFileExists(const std::string& location);
+
+// Creating a bundle, start recording all of the model files (under the root directory) that are read in from disk,
+// load the models as usual, and write out the bundle
+void StartModelBundleRecording(const std::string& root_directory);
+bool WriteModelBundle(const std::string& bundle_location);
+
+//===========================================================================
+// Used by the matrix readers (ReadMat and ReadMatBin)
+
+// Read a binary matrix from a stream opened from a mounted bundle, returns false if the stream does not come from a bundle
+bool ReadBundledMat(std::istream& stream, cv::Mat& output_mat);
+
+// The current position of a stream that is being recorded into a bundle (-1 if it is not being recorded)
+std::streamoff BundleRecordingPosition(std::istream& stream);
+
+// Store the matrix that was read from a recorded stream (starting at start_position) in binary in the bundle
+void RecordBundledMat(std::istream& stream, std::streamoff start_position, const cv::Mat& mat);
+
+//===========================================================================
+// A stream for reading model files either from a mounted bundle or from disk (always in binary mode)
+class ModelStream : public std::istream
+{
+public:
+
+	ModelStream(const std::string& location);
+
+	~ModelStream();
+
+	bool is_open() const { return buffer != nullptr; }
+
+private:
+
+	// The location of the file (relative to the root when recording)
+	std::string location;
+
+	std::unique_ptr<std::streambuf> buffer;
+
+	// Not copyable
+	ModelStream(const ModelStream& other);
+	ModelStream & operator= (const ModelStream& other);
+
+};
+
+}
+#endif
@@ -64,9 +64,6 @@ public:
 	// Destination points (landmarks to be warped to)
 	cv::Mat_<double> destination_landmarks;
 
-	// Destination points (landmarks to be warped from)
-	cv::Mat_<double> source_landmarks;
-
 	// Triangulation, each triangle is warped using an affine transform
 	cv::Mat_<int> triangulation;
 
@@ -77,11 +74,6 @@ public:
 	cv::Mat_<uchar> pixel_mask;
 
 	// A number of precomputed coefficients that are helpful for quick warping
-	
-	// affine coefficients for all triangles (see Matthews and Baker 2004)
-	// 6 coefficients for each triangle (are computed from alpha and beta)
-	// This is computed during each warp based on source landmarks
-	cv::Mat_<double> coefficients;
 
 	// matrix of (c,x,y) coeffs for alpha
 	cv::Mat_<double> alpha;
@@ -89,12 +81,6 @@ public:
 	// matrix of (c,x,y) coeffs for alpha
 	cv::Mat_<double> beta;
 
-	// x-source of warped points
-	cv::Mat_<float> map_x;
-
-	// y-source of warped points
-	cv::Mat_<float> map_y;
-
 	// Default constructor
     PAW(){;}
 
@@ -107,16 +93,23 @@ public:
 	// Copy constructor
 	PAW(const PAW& other);
 
-	void Read(std::ifstream &s);
+	// The pixel_mask a warp constructed with the same arguments would have, rasterised triangle by triangle without building the rest of the warp
+	static void ComputeMask(cv::Mat_<uchar>& mask, const cv::Mat_<double>& destination_shape, const cv::Mat_<int>& triangulation, double in_min_x, double in_min_y, double in_max_x, double in_max_y);
+
+	void Read(std::istream &s);
 
-	// The actual warping
-    void Warp(const cv::Mat& image_to_warp, cv::Mat& destination_image, const cv::Mat_<double>& landmarks_to_warp);
+	// The actual warping (does not modify the PAW, so the same warp can be used from multiple threads)
+    void Warp(const cv::Mat& image_to_warp, cv::Mat& destination_image, const cv::Mat_<double>& landmarks_to_warp) const;
+
+	// As above, but into a float image, and only the region of the source image that is sampled from is converted (so the source can be an 8 bit frame)
+	void WarpFromROI(const cv::Mat& image_to_warp, cv::Mat_<float>& destination_image, const cv::Mat_<double>& landmarks_to_warp) const;
 	
-	// Compute coefficients needed for warping
-    void CalcCoeff();
+	// Compute the affine coefficients for all triangles (see Matthews and Baker 2004) from the source landmarks
+	// 6 coefficients for each triangle (are computed from alpha and beta)
+    void CalcCoeff(const cv::Mat_<double>& source_landmarks, cv::Mat_<double>& coefficients) const;
 
-	// Perform the actual warping
-    void WarpRegion(cv::Mat_<float>& map_x, cv::Mat_<float>& map_y);
+	// Compute the x and y source of the warped points
+    void WarpRegion(const cv::Mat_<double>& coefficients, cv::Mat_<float>& map_x, cv::Mat_<float>& map_y) const;
 
     inline int NumberOfLandmarks() const {return destination_landmarks.rows/2;} ;
     inline int NumberOfTriangles() const {return triangulation.rows;} ;
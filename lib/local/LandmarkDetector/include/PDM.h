@@ -59,6 +59,10 @@ class PDM{
 		// Eigenvalues (variances) corresponding to the bases
 		cv::Mat_<double> eigen_values;	
 
+		// Single precision copies of the mean shape and the principal components (used by the single precision optimiser)
+		cv::Mat_<float> mean_shape_f;
+		cv::Mat_<float> princ_comp_f;
+
 		PDM(){;}
 		
 		// A copy constructor
@@ -72,7 +76,7 @@ class PDM{
 		// Listing the number of modes of variation
 		inline int NumberOfModes() const {return princ_comp.cols;}
 
-		void Clamp(cv::Mat_<float>& params_local, cv::Vec6d& params_global, const FaceModelParameters& params);
+		void Clamp(cv::Mat_<float>& params_local, cv::Vec6d& params_global, const FaceModelParameters& params) const;
 
 		// Compute shape in object space (3D)
 		void CalcShape3D(cv::Mat_<double>& out_shape, const cv::Mat_<double>& params_local) const;
@@ -81,20 +85,28 @@ class PDM{
 		void CalcShape2D(cv::Mat_<double>& out_shape, const cv::Mat_<double>& params_local, const cv::Vec6d& params_global) const;
     
 		// provided the bounding box of a face and the local parameters (with optional rotation), generates the global parameters that can generate the face with the provided bounding box
-		void CalcParams(cv::Vec6d& out_params_global, const cv::Rect_<double>& bounding_box, const cv::Mat_<double>& params_local, const cv::Vec3d rotation = cv::Vec3d(0.0));
+		void CalcParams(cv::Vec6d& out_params_global, const cv::Rect_<double>& bounding_box, const cv::Mat_<double>& params_local, const cv::Vec3d rotation = cv::Vec3d(0.0)) const;
 
 		// Provided the landmark location compute global and local parameters best fitting it (can provide optional rotation for potentially better results)
-		void CalcParams(cv::Vec6d& out_params_global, const cv::Mat_<double>& out_params_local, const cv::Mat_<double>& landmark_locations, const cv::Vec3d rotation = cv::Vec3d(0.0));
+		void CalcParams(cv::Vec6d& out_params_global, const cv::Mat_<double>& out_params_local, const cv::Mat_<double>& landmark_locations, const cv::Vec3d rotation = cv::Vec3d(0.0)) const;
 
 		// provided the model parameters, compute the bounding box of a face
-		void CalcBoundingBox(cv::Rect& out_bounding_box, const cv::Vec6d& params_global, const cv::Mat_<double>& params_local);
+		void CalcBoundingBox(cv::Rect& out_bounding_box, const cv::Vec6d& params_global, const cv::Mat_<double>& params_local) const;
 
 		// Helpers for computing Jacobians, and Jacobians with the weight matrix
-		void ComputeRigidJacobian(const cv::Mat_<float>& params_local, const cv::Vec6d& params_global, cv::Mat_<float> &Jacob, const cv::Mat_<float> W, cv::Mat_<float> &Jacob_t_w);
-		void ComputeJacobian(const cv::Mat_<float>& params_local, const cv::Vec6d& params_global, cv::Mat_<float> &Jacobian, const cv::Mat_<float> W, cv::Mat_<float> &Jacob_t_w);
+		void ComputeRigidJacobian(const cv::Mat_<float>& params_local, const cv::Vec6d& params_global, cv::Mat_<float> &Jacob, const cv::Mat_<float> W, cv::Mat_<float> &Jacob_t_w) const;
+		void ComputeJacobian(const cv::Mat_<float>& params_local, const cv::Vec6d& params_global, cv::Mat_<float> &Jacobian, const cv::Mat_<float> W, cv::Mat_<float> &Jacob_t_w) const;
 
 		// Given the current parameters, and the computed delta_p compute the updated parameters
-		void UpdateModelParameters(const cv::Mat_<float>& delta_p, cv::Mat_<float>& params_local, cv::Vec6d& params_global);
+		void UpdateModelParameters(const cv::Mat_<float>& delta_p, cv::Mat_<float>& params_local, cv::Vec6d& params_global) const;
+
+		// Single precision version of CalcShape2D writing into preallocated buffers, shape_3D is the object space shape the 2D one is projected from
+		void CalcShape2D(cv::Mat_<float>& out_shape, cv::Mat_<float>& shape_3D, const cv::Mat_<float>& params_local, const cv::Vec6d& params_global) const;
+
+		// Accumulates the weighted normal equations (J'WJ and J'W * mean_shifts) straight from the Jacobian rows of every vertex, without forming the Jacobian itself
+		// Only the lower triangle of the Hessian is filled in, vertices with zero weight are skipped, rigid only uses the first 6 parameters
+		void ComputeNormalEquations(const cv::Mat_<float>& shape_3D, const cv::Vec6d& params_global, const cv::Mat_<float>& weights, const cv::Mat_<float>& mean_shifts, bool rigid,
+			cv::Mat_<float>& jacobian_rows, cv::Mat_<float>& hessian, cv::Mat_<float>& J_w_t_m) const;
 
   };
   //===========================================================================
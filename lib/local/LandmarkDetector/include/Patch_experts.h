@@ -45,6 +45,49 @@
 
 namespace LandmarkDetector
 {
+//===========================================================================
+// The scratch space of Patch_experts::Response, every tracker keeps its own so that the buffers are reused across frames
+// The contiguous buffers only grow, so after the largest window size has been seen nothing is allocated anymore
+struct Patch_response_workspace
+{
+	// The current landmark locations in the image and in the reference frame of the patch experts
+	cv::Mat_<double> landmark_locations;
+	cv::Mat_<double> reference_shape;
+
+	// The legal pixels of the depth image
+	cv::Mat_<uchar> mask;
+
+	// The size and the offset of every area of interest in the contiguous buffers (one more offset than there are landmarks)
+	vector<int> area_of_interest_widths;
+	vector<int> area_of_interest_heights;
+	vector<int> area_of_interest_offsets;
+	vector<cv::Point2f> centres;
+
+	// The contiguous intensity, depth and depth mask areas of interest, and the responses of all landmarks
+	cv::Mat_<float> areas_of_interest;
+	cv::Mat_<float> depth_areas_of_interest;
+	cv::Mat_<float> mask_areas_of_interest;
+	cv::Mat_<float> responses;
+
+	// The headers of the individual landmarks into the buffers above
+	vector<cv::Mat_<float> > areas;
+	vector<cv::Mat_<float> > depth_areas;
+	vector<cv::Mat_<float> > mask_areas;
+
+	// The depth responses of every landmark
+	vector<cv::Mat_<float> > depth_responses;
+
+	// The CCNF Sigmas that were not precomputed by WarmUp, computed once per landmark for a (scale, view, window size)
+	vector<cv::Mat_<float> > sigmas;
+	vector<cv::Vec3i> sigma_keys;
+
+	// The scratch buffers of the CCNF responses, one per block of landmarks evaluated in parallel
+	vector<CCNF_response_buffers> ccnf_buffers;
+
+	// Sizes the per landmark vectors for n landmarks and n_blocks blocks (does nothing if they are already of that size)
+	void Allocate(int n, int n_blocks);
+};
+
 //===========================================================================
 /** 
     Combined class for all of the patch experts
@@ -85,8 +128,13 @@ public:
 	// Additionally returns the transform from the image coordinates to the response coordinates (and vice versa).
 	// The computation also requires the current landmark locations to compute response around, the PDM corresponding to the desired model, and the parameters describing its instance
 	// Also need to provide the size of the area of interest and the desired scale of analysis
+	// The responses point into the workspace, so they are only valid until it is used again
 	void Response(vector<cv::Mat_<float> >& patch_expert_responses, cv::Matx22f& sim_ref_to_img, cv::Matx22d& sim_img_to_ref, const cv::Mat_<uchar>& grayscale_image, const cv::Mat_<float>& depth_image,
-							 const PDM& pdm, const cv::Vec6d& params_global, const cv::Mat_<double>& params_local, int window_size, int scale);
+							 const PDM& pdm, const cv::Vec6d& params_global, const cv::Mat_<double>& params_local, int window_size, int scale, Patch_response_workspace& workspace) const;
+
+	// Precompute the CCNF Sigmas and the weight dfts of all patch experts at a particular scale and window size, so that Response does not need to compute them
+	// Not thread safe, should be called before the patch experts are used for tracking
+	void WarmUp(int scale, int window_size);
 
 	// Getting the best view associated with the current orientation
 	int GetViewIdx(const cv::Vec6d& params_global, int scale) const;
@@ -101,8 +149,12 @@ public:
    
 
 private:
+	// Retrieve the CCNF sigma components for a particular window size (empty if not available)
+	vector<cv::Mat_<float> > GetSigmaComponents(int window_size) const;
+
 	void Read_SVR_patch_experts(string expert_location, std::vector<cv::Vec3d>& centers, std::vector<cv::Mat_<int> >& visibility, std::vector<std::vector<Multi_SVR_patch_expert> >& patches, double& scale);
-	void Read_CCNF_patch_experts(string patchesFileLocation, std::vector<cv::Vec3d>& centers, std::vector<cv::Mat_<int> >& visibility, std::vector<std::vector<CCNF_patch_expert> >& patches, double& patchScaling);
+	// The scales are read in parallel, so the sigma components are returned rather than stored in the member
+	void Read_CCNF_patch_experts(string patchesFileLocation, std::vector<cv::Vec3d>& centers, std::vector<cv::Mat_<int> >& visibility, std::vector<std::vector<CCNF_patch_expert> >& patches, double& patchScaling, vector<vector<cv::Mat_<float> > >& sigma_components);
 	
 
 };
@@ -64,7 +64,7 @@ class SVR_patch_expert{
 		// Support vector regression weights
 		cv::Mat_<float> weights;
 
-		// Discrete Fourier Transform of SVR weights, precalculated for speed (at different window sizes)
+		// Discrete Fourier Transform of SVR weights, precalculated for speed (at different window sizes, see PrecomputeDFT)
 		std::map<int, cv::Mat_<double> > weights_dfts;
 
 		// Confidence of the current patch expert (used for NU_RLMS optimisation)
@@ -76,11 +76,14 @@ class SVR_patch_expert{
 		SVR_patch_expert(const SVR_patch_expert& other);
 
 		// Reading in the patch expert
-		void Read(std::ifstream &stream);
+		void Read(std::istream &stream);
+
+		// Precompute the weight dft for an area of interest of a particular size
+		void PrecomputeDFT(const cv::Size& area_of_interest_size);
 
 		// The actual response computation from intensity or depth (for CLM-Z)
-		void Response(const cv::Mat_<float> &area_of_interest, cv::Mat_<float> &response);
-		void ResponseDepth(const cv::Mat_<float> &area_of_interest, cv::Mat_<float> &response);
+		void Response(const cv::Mat_<float> &area_of_interest, cv::Mat_<float> &response) const;
+		void ResponseDepth(const cv::Mat_<float> &area_of_interest, cv::Mat_<float> &response) const;
 
 };
 //===========================================================================
@@ -103,11 +106,14 @@ class Multi_SVR_patch_expert{
 		// Copy constructor				
 		Multi_SVR_patch_expert(const Multi_SVR_patch_expert& other);
 
-		void Read(std::ifstream &stream);
+		void Read(std::istream &stream);
+
+		// Precompute the dfts of all modalities for a particular window size, so that they are not computed during tracking
+		void WarmUp(int window_size);
 
 		// actual response computation from intensity of depth (for CLM-Z)
-		void Response(const cv::Mat_<float> &area_of_interest, cv::Mat_<float> &response);
-		void ResponseDepth(const cv::Mat_<float> &area_of_interest, cv::Mat_<float> &response);
+		void Response(const cv::Mat_<float> &area_of_interest, cv::Mat_<float> &response) const;
+		void ResponseDepth(const cv::Mat_<float> &area_of_interest, cv::Mat_<float> &response) const;
 
 };
 }
@@ -38,6 +38,7 @@
 
 // OpenCV includes
 #include <opencv2/core/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
 #include <opencv2/imgproc.hpp>
 
 // Local includes
@@ -61,7 +62,7 @@ CCNF_neuron::CCNF_neuron(const CCNF_neuron& other) : weights(other.weights.clone
 }
 
 // Copy constructor		
-CCNF_patch_expert::CCNF_patch_expert(const CCNF_patch_expert& other) : neurons(other.neurons), window_sizes(other.window_sizes), betas(other.betas)
+CCNF_patch_expert::CCNF_patch_expert(const CCNF_patch_expert& other) : neurons(other.neurons), window_sizes(other.window_sizes), betas(other.betas), neuron_bank(other.neuron_bank.clone()), neuron_bank_params(other.neuron_bank_params.clone())
 {
 	this->width = other.width;
 	this->height = other.height;
@@ -76,14 +77,51 @@ CCNF_patch_expert::CCNF_patch_expert(const CCNF_patch_expert& other) : neurons(o
 
 }
 
-// Compute sigmas for all landmarks for a particular view and window size
-void CCNF_patch_expert::ComputeSigmas(std::vector<cv::Mat_<float> > sigma_components, int window_size)
+// Precompute the sigma and the dfts of neurons for a particular window size
+void CCNF_patch_expert::WarmUp(const std::vector<cv::Mat_<float> >& sigma_components, int window_size)
+{
+	// Nothing to compute for empty patch experts (invisible landmarks)
+	if(neurons.empty())
+		return;
+
+	if(GetSigmaIdx(window_size) == -1)
+	{
+		cv::Mat_<float> Sigma;
+		ComputeSigma(sigma_components, window_size, Sigma);
+
+		window_sizes.push_back(window_size);
+		Sigmas.push_back(Sigma);
+	}
+
+	// The neuron bank computes its responses directly, but the per neuron path (and its dfts) is still used if the neurons could not be
+	// packed or the dft correlation is asked for (which can be set at any point), so the dfts are always precomputed to keep Response const
+	// The area of interest that will lead to a response of window size
+	cv::Size area_of_interest_size(window_size + width - 1, window_size + height - 1);
+
+	for(size_t i = 0; i < neurons.size(); i++)
+	{
+		// Only the neurons that contribute to the response are used
+		if(neurons[i].alpha > 1e-4)
+		{
+			neurons[i].PrecomputeDFT(area_of_interest_size);
+		}
+	}
+}
+
+// Find the precomputed sigma for a particular window size
+int CCNF_patch_expert::GetSigmaIdx(int window_size) const
 {
 	for(size_t i=0; i < window_sizes.size(); ++i)
 	{
 		if( window_sizes[i] == window_size)
-			return;
+			return (int)i;
 	}
+	return -1;
+}
+
+// Compute sigma for a particular window size
+void CCNF_patch_expert::ComputeSigma(const std::vector<cv::Mat_<float> >& sigma_components, int window_size, cv::Mat_<float>& Sigma) const
+{
 	// Each of the landmarks will have the same connections, hence constant number of sigma components
 	int n_betas = sigma_components.size();
 
@@ -111,13 +149,12 @@ void CCNF_patch_expert::ComputeSigmas(std::vector<cv::Mat_<float> > sigma_compon
 	cv::Mat Sigma_f;
 	cv::invert(SigmaInv, Sigma_f, cv::DECOMP_CHOLESKY);
 
-	window_sizes.push_back(window_size);
-	Sigmas.push_back(Sigma_f);
+	Sigma = Sigma_f;
 
 }
 
 //===========================================================================
-void CCNF_neuron::Read(ifstream &stream)
+void CCNF_neuron::Read(istream &stream)
 {
 	// Sanity check
 	int read_type;
@@ -134,7 +171,13 @@ void CCNF_neuron::Read(ifstream &stream)
 }
 
 //===========================================================================
-void CCNF_neuron::Response(cv::Mat_<float> &im, cv::Mat_<double> &im_dft, cv::Mat &integral_img, cv::Mat &integral_img_sq, cv::Mat_<float> &resp)
+void CCNF_neuron::PrecomputeDFT(const cv::Size& area_of_interest_size)
+{
+	LandmarkDetector::computeTemplateDFT_m(weights, area_of_interest_size, weights_dfts);
+}
+
+//===========================================================================
+void CCNF_neuron::Response(const cv::Mat_<float> &im, cv::Mat_<double> &im_dft, cv::Mat &integral_img, cv::Mat &integral_img_sq, cv::Mat_<float> &resp) const
 {
 
 	int h = im.rows - weights.rows + 1;
@@ -209,7 +252,7 @@ void CCNF_neuron::Response(cv::Mat_<float> &im, cv::Mat_<double> &im_dft, cv::Ma
 }
 
 //===========================================================================
-void CCNF_patch_expert::Read(ifstream &stream, std::vector<int> window_sizes, std::vector<std::vector<cv::Mat_<float> > > sigma_components)
+void CCNF_patch_expert::Read(istream &stream, std::vector<int> window_sizes, std::vector<std::vector<cv::Mat_<float> > > sigma_components)
 {
 
 	// Sanity check
@@ -256,57 +299,235 @@ void CCNF_patch_expert::Read(ifstream &stream, std::vector<int> window_sizes, st
 	// Read the patch confidence
 	stream.read ((char*)&patch_confidence, 8);
 
+	PackNeurons();
+
 }
 
 //===========================================================================
-void CCNF_patch_expert::Response(cv::Mat_<float> &area_of_interest, cv::Mat_<float> &response)
+void CCNF_patch_expert::PackNeurons()
 {
-	
-	int response_height = area_of_interest.rows - height + 1;
-	int response_width = area_of_interest.cols - width + 1;
+	neuron_bank = cv::Mat_<float>();
+	neuron_bank_params = cv::Mat_<float>();
 
-	if(response.rows != response_height || response.cols != response_width)
+	// Only the neurons that contribute to the response are packed (as in the per neuron response)
+	std::vector<int> packed;
+	for(size_t i = 0; i < neurons.size(); i++)
 	{
-		response.create(response_height, response_width);
+		if(neurons[i].alpha > 1e-4)
+		{
+			// Only raw intensity neurons share the normalisation of the area of interest
+			if(neurons[i].neuron_type != 0 || neurons[i].weights.rows != height || neurons[i].weights.cols != width)
+				return;
+
+			packed.push_back((int)i);
+		}
 	}
-		
-	response.setTo(0);
-	
-	// the placeholder for the DFT of the image, the integral image, and squared integral image so they don't get recalculated for every response
-	cv::Mat_<double> area_of_interest_dft;
-	cv::Mat integral_image, integral_image_sq;
-	
-	cv::Mat_<float> neuron_response;
 
-	// responses from the neural layers
-	for(size_t i = 0; i < neurons.size(); i++)
-	{		
-		// Do not bother with neuron response if the alpha is tiny and will not contribute much to overall result
-		if(neurons[i].alpha > 1e-4)
+	if(packed.empty())
+		return;
+
+	int num_packed = (int)packed.size();
+	int bank_width = ((num_packed + 3) / 4) * 4;
+
+	neuron_bank = cv::Mat_<float>::zeros(width * height, bank_width);
+	neuron_bank_params = cv::Mat_<float>::zeros(4, bank_width);
+
+	for(int n = 0; n < num_packed; ++n)
+	{
+		const CCNF_neuron& neuron = neurons[packed[n]];
+
+		// Correlating with the zero mean weights gives the numerator of the normalised correlation coefficient directly
+		cv::Scalar mean = cv::mean(neuron.weights);
+
+		double norm = 0;
+		for(int y = 0; y < height; ++y)
 		{
-			neurons[i].Response(area_of_interest, area_of_interest_dft, integral_image, integral_image_sq, neuron_response);
-			response = response + neuron_response;						
+			for(int x = 0; x < width; ++x)
+			{
+				float w = neuron.weights(y, x) - (float)mean[0];
+				neuron_bank(y * width + x, n) = w;
+				norm += (double)w * w;
+			}
 		}
+
+		neuron_bank_params(0, n) = (float)std::sqrt(norm);
+		neuron_bank_params(1, n) = (float)neuron.norm_weights;
+		neuron_bank_params(2, n) = (float)neuron.bias;
+		neuron_bank_params(3, n) = (float)(2 * neuron.alpha);
 	}
+}
 
-	int s_to_use = -1;
+//===========================================================================
+void CCNF_patch_expert::NeuronBankResponse(const cv::Mat_<float> &area_of_interest, cv::Mat_<float> &response, CCNF_response_buffers& buffers) const
+{
+	int response_height = area_of_interest.rows - height + 1;
+	int response_width = area_of_interest.cols - width + 1;
 
-	// Find the matching sigma
-	for(size_t i=0; i < window_sizes.size(); ++i)
+	int bank_width = neuron_bank.cols;
+	int num_taps = width * height;
+	double area = (double)num_taps;
+
+	const float* bank = neuron_bank.ptr<float>(0);
+	const float* templ_norms = neuron_bank_params.ptr<float>(0);
+	const float* norm_weights = neuron_bank_params.ptr<float>(1);
+	const float* biases = neuron_bank_params.ptr<float>(2);
+	const float* alphas = neuron_bank_params.ptr<float>(3);
+
+	// The window statistics are shared by all of the neurons
+	cv::Mat_<double>& sum = buffers.integral_img;
+	cv::Mat_<double>& sqsum = buffers.integral_img_sq;
+	cv::integral(area_of_interest, sum, sqsum, CV_64F);
+
+	// The correlations of the packed neurons at one location
+	std::vector<float>& correlations = buffers.correlations;
+	correlations.resize(bank_width);
+
+	for(int y = 0; y < response_height; ++y)
 	{
-		if(window_sizes[i] == response_height)
+		const double* s0 = sum.ptr<double>(y);
+		const double* s1 = sum.ptr<double>(y + height);
+		const double* q0 = sqsum.ptr<double>(y);
+		const double* q1 = sqsum.ptr<double>(y + height);
+
+		float* out = response.ptr<float>(y);
+
+		for(int x = 0; x < response_width; ++x)
 		{
-			// Found the correct sigma
-			s_to_use = i;			
-			break;
+			double wnd_sum = s0[x] - s0[x + width] - s1[x] + s1[x + width];
+			double wnd_sum_sq = q0[x] - q0[x + width] - q1[x] + q1[x + width];
+			double wnd_norm = std::sqrt(MAX(wnd_sum_sq - wnd_sum * wnd_sum / area, 0));
+
+			// All of the neuron correlations in one sweep over the template, four neurons per vector (up to 16 at a time in registers)
+			for(int n = 0; n < bank_width; n += 16)
+			{
+				int groups = MIN(bank_width - n, 16) / 4;
+#if CV_SIMD128
+				cv::v_float32x4 acc0 = cv::v_setzero_f32(), acc1 = cv::v_setzero_f32(), acc2 = cv::v_setzero_f32(), acc3 = cv::v_setzero_f32();
+
+				for(int ty = 0; ty < height; ++ty)
+				{
+					const float* img_row = area_of_interest.ptr<float>(y + ty) + x;
+					const float* bank_row = bank + ty * width * bank_width + n;
+
+					for(int tx = 0; tx < width; ++tx, bank_row += bank_width)
+					{
+						cv::v_float32x4 pixel = cv::v_setall_f32(img_row[tx]);
+						acc0 = acc0 + cv::v_load(bank_row) * pixel;
+						if(groups > 1)
+							acc1 = acc1 + cv::v_load(bank_row + 4) * pixel;
+						if(groups > 2)
+							acc2 = acc2 + cv::v_load(bank_row + 8) * pixel;
+						if(groups > 3)
+							acc3 = acc3 + cv::v_load(bank_row + 12) * pixel;
+					}
+				}
+
+				cv::v_store(&correlations[n], acc0);
+				if(groups > 1)
+					cv::v_store(&correlations[n + 4], acc1);
+				if(groups > 2)
+					cv::v_store(&correlations[n + 8], acc2);
+				if(groups > 3)
+					cv::v_store(&correlations[n + 12], acc3);
+#else
+				for(int k = n; k < n + groups * 4; ++k)
+				{
+					float corr = 0;
+					for(int t = 0; t < num_taps; ++t)
+					{
+						corr += area_of_interest(y + t / width, x + t % width) * bank[t * bank_width + k];
+					}
+					correlations[k] = corr;
+				}
+#endif
+			}
+
+			// Normalised correlation coefficient followed by the sigmoid of every neuron (same as matchTemplate_m with CV_TM_CCOEFF_NORMED)
+			float total = 0;
+			for(int k = 0; k < bank_width; ++k)
+			{
+				// The padding has no weight
+				if(alphas[k] == 0)
+					continue;
+
+				double num = correlations[k];
+				if(templ_norms[k] < DBL_EPSILON)
+				{
+					num = 1;
+				}
+				else
+				{
+					double t = wnd_norm * templ_norms[k];
+					if(fabs(num) < t)
+						num /= t;
+					else if(fabs(num) < t * 1.125)
+						num = num > 0 ? 1 : -1;
+					else
+						num = 0;
+				}
+
+				total += alphas[k] / (1.0f + std::exp(-((float)num * norm_weights[k] + biases[k])));
+			}
+			out[x] = total;
 		}
 	}
+}
+
+//===========================================================================
+void CCNF_patch_expert::Response(const cv::Mat_<float> &area_of_interest, cv::Mat_<float> &response, const cv::Mat_<float>& Sigma) const
+{
+	CCNF_response_buffers buffers;
+	Response(area_of_interest, response, Sigma, buffers);
+}
 
-	cv::Mat_<float> resp_vec_f = response.reshape(1, response_height * response_width);
+//===========================================================================
+void CCNF_patch_expert::Response(const cv::Mat_<float> &area_of_interest, cv::Mat_<float> &response, const cv::Mat_<float>& Sigma, CCNF_response_buffers& buffers) const
+{
+	
+	int response_height = area_of_interest.rows - height + 1;
+	int response_width = area_of_interest.cols - width + 1;
+
+	if(response.rows != response_height || response.cols != response_width)
+	{
+		response.create(response_height, response_width);
+	}
 
-	cv::Mat out = Sigmas[s_to_use] * resp_vec_f;
+	// The summed neuron responses
+	cv::Mat_<float>& neurons_response = buffers.neuron_response;
+	neurons_response.create(response_height, response_width);
+		
+	// All of the neurons in one pass, unless the DFT based correlation has been explicitly requested
+	if(!neuron_bank.empty() && GetCorrelationMethod() != CORRELATION_DFT)
+	{
+		NeuronBankResponse(area_of_interest, neurons_response, buffers);
+	}
+	else
+	{
+		neurons_response.setTo(0);
 	
-	response = out.reshape(1, response_height);
+		// the placeholder for the DFT of the image, the integral image, and squared integral image so they don't get recalculated for every response
+		cv::Mat_<double> area_of_interest_dft;
+		cv::Mat integral_image, integral_image_sq;
+	
+		cv::Mat_<float> neuron_response;
+
+		// responses from the neural layers
+		for(size_t i = 0; i < neurons.size(); i++)
+		{		
+			// Do not bother with neuron response if the alpha is tiny and will not contribute much to overall result
+			if(neurons[i].alpha > 1e-4)
+			{
+				neurons[i].Response(area_of_interest, area_of_interest_dft, integral_image, integral_image_sq, neuron_response);
+				neurons_response += neuron_response;						
+			}
+		}
+	}
+
+	// A single matrix vector product with the precomputed Sigma, written straight into the response
+	cv::Mat resp_vec_f = neurons_response.reshape(1, response_height * response_width);
+	cv::Mat out = response.reshape(1, response_height * response_width);
+
+	cv::gemm(Sigma, resp_vec_f, 1.0, cv::noArray(), 0.0, out);
 
 	// Making sure the response does not have negative numbers
 	double min;
@@ -314,7 +535,7 @@ void CCNF_patch_expert::Response(cv::Mat_<float> &area_of_interest, cv::Mat_<flo
 	minMaxIdx(response, &min, 0);
 	if(min < 0)
 	{
-		response = response - min;
+		response -= min;
 	}
 
 }
@@ -0,0 +1,237 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace: an open source facial behavior analysis toolkit
+//       Tadas Baltruaitis, Peter Robinson, and Louis-Philippe Morency
+//       in IEEE Winter Conference on Applications of Computer Vision, 2016  
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltruaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-speci?c normalisation for automatic Action Unit detection
+//       Tadas Baltruaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+//       Constrained Local Neural Fields for robust facial landmark detection in the wild.
+//       Tadas Baltruaitis, Peter Robinson, and Louis-Philippe Morency. 
+//       in IEEE Int. Conference on Computer Vision Workshops, 300 Faces in-the-Wild Challenge, 2013.    
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "stdafx.h"
+
+#include "FaceDetectorWorker.h"
+
+// Local includes
+#include "LandmarkDetectorUtils.h"
+
+using namespace LandmarkDetector;
+
+FaceDetectorWorker::FaceDetectorWorker(const FaceModelParameters& params) : detector_type(params.curr_face_detector), min_face_size(params.min_face_size), pending_frame_number(-1), pending_min_width(0), pending_max_width(0), frame_pending(false), processing(false),
+	detection_frame_number(-1), detections_ready(false), stop(false)
+{
+	if(detector_type == FaceModelParameters::HAAR_DETECTOR)
+	{
+		if(!face_detector_HAAR.load(params.face_detector_location))
+		{
+			cout << "Could not load the HAAR face detector from " << params.face_detector_location << endl;
+		}
+	}
+	else
+	{
+		face_detector_HOG = dlib::get_frontal_face_detector();
+	}
+
+	// Only start once everything the worker uses is set up
+	worker = std::thread(&FaceDetectorWorker::Run, this);
+}
+
+FaceDetectorWorker::~FaceDetectorWorker()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stop = true;
+	}
+	frame_available.notify_one();
+	worker.join();
+}
+
+void FaceDetectorWorker::SubmitFrame(const cv::Mat_<uchar>& intensity, int frame_number)
+{
+	SubmitFrame(intensity, cv::Rect_<double>(), 0, 0, frame_number);
+}
+
+void FaceDetectorWorker::SubmitFrame(const cv::Mat_<uchar>& intensity, const cv::Rect_<double>& roi, double min_width, double max_width, int frame_number)
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		// Reusing the buffer of any frame that was not processed
+		intensity.copyTo(pending_frame);
+		pending_frame_number = frame_number;
+		pending_roi = roi;
+		pending_min_width = min_width;
+		pending_max_width = max_width;
+		frame_pending = true;
+	}
+	frame_available.notify_one();
+}
+
+bool FaceDetectorWorker::GetDetections(std::vector<cv::Rect_<double> >& o_regions, std::vector<double>& o_confidences, int& o_frame_number)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	if(!detections_ready)
+	{
+		return false;
+	}
+
+	o_regions = detections;
+	o_confidences = detection_confidences;
+	o_frame_number = detection_frame_number;
+	detections_ready = false;
+
+	return true;
+}
+
+void FaceDetectorWorker::DiscardDetections()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	frame_pending = false;
+	detections_ready = false;
+}
+
+bool FaceDetectorWorker::Busy()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return frame_pending || processing;
+}
+
+void FaceDetectorWorker::Run()
+{
+	cv::Mat_<uchar> frame;
+
+	while(true)
+	{
+		int frame_number;
+		cv::Rect_<double> roi;
+		double min_width, max_width;
+
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			frame_available.wait(guard, [this]{ return frame_pending || stop; });
+
+			if(stop)
+			{
+				return;
+			}
+
+			// Take the frame over, so that a new one can be submitted while this one is processed
+			cv::swap(frame, pending_frame);
+			frame_number = pending_frame_number;
+			roi = pending_roi;
+			min_width = pending_min_width;
+			max_width = pending_max_width;
+			frame_pending = false;
+			processing = true;
+		}
+
+		std::vector<cv::Rect_<double> > regions;
+		std::vector<double> confidences;
+
+		bool full_frame = roi.area() == 0;
+
+		if(detector_type == FaceModelParameters::HOG_SVM_DETECTOR)
+		{
+			if(full_frame)
+			{
+				DetectFacesHOG(regions, frame, face_detector_HOG, confidences, min_face_size);
+			}
+			else
+			{
+				DetectFacesHOG(regions, frame, face_detector_HOG, confidences, roi, min_width, max_width);
+			}
+		}
+		else
+		{
+			if(full_frame)
+			{
+				DetectFaces(regions, frame, face_detector_HAAR, min_face_size);
+			}
+			else
+			{
+				DetectFaces(regions, frame, face_detector_HAAR, roi, min_width, max_width);
+			}
+
+			// The HAAR detector does not give confidences
+			confidences.assign(regions.size(), 0.0);
+		}
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+
+			detections.swap(regions);
+			detection_confidences.swap(confidences);
+			detection_frame_number = frame_number;
+			detections_ready = true;
+			processing = false;
+		}
+	}
+}
+
+bool FaceDetectorWorker::SelectSingleFace(cv::Rect_<double>& o_region, const std::vector<cv::Rect_<double> >& regions, const std::vector<double>& confidences, const cv::Point preference)
+{
+	if(regions.empty())
+	{
+		// if not detected
+		o_region = cv::Rect_<double>(0,0,0,0);
+		return false;
+	}
+
+	bool use_preferred = (preference.x != -1) && (preference.y != -1);
+
+	size_t best_index = 0;
+
+	for(size_t i = 1; i < regions.size(); ++i)
+	{
+		bool better;
+
+		if(use_preferred)
+		{
+			// Pick the face closest to the preferred point
+			cv::Point2d centre = (regions[i].tl() + regions[i].br()) * 0.5;
+			cv::Point2d best_centre = (regions[best_index].tl() + regions[best_index].br()) * 0.5;
+
+			better = cv::norm(centre - cv::Point2d(preference)) < cv::norm(best_centre - cv::Point2d(preference));
+		}
+		else
+		{
+			// Pick the most confident face, or the biggest one
+			better = confidences[i] > confidences[best_index] || (confidences[i] == confidences[best_index] && regions[i].width > regions[best_index].width);
+		}
+
+		if(better)
+		{
+			best_index = i;
+		}
+	}
+
+	o_region = regions[best_index];
+
+	return true;
+}
@@ -41,8 +41,11 @@
 #include <opencv2/imgproc.hpp>
 
 // System includes
+#include <algorithm>
 #include <fstream>
 
+#include <tbb/tbb.h>
+
 // Math includes
 #define _USE_MATH_DEFINES
 #include <cmath>
@@ -52,13 +55,47 @@
 #endif
 // Local includes
 #include "LandmarkDetectorUtils.h"
+#include "ModelBundle.h"
 
 using namespace LandmarkDetector;
 
+// The buffers of the CNN forward pass, kept per thread so that the validator can be shared by trackers running in parallel
+struct CNN_workspace
+{
+	// The maps of the current and the next layer, a row per map
+	cv::Mat_<float> maps;
+	cv::Mat_<float> next_maps;
+
+	// The unrolled patches of a convolutional layer or the concatenated maps of a fully connected one
+	cv::Mat_<float> columns;
+
+	// The fully connected layer output, a row per face
+	cv::Mat_<float> fully_connected;
+};
+
+static tbb::enumerable_thread_specific<CNN_workspace> cnn_workspaces;
+
+// In place sigmoid activation with a bias
+static void Sigmoid(float* values, int count, float bias)
+{
+	for(int i = 0; i < count; ++i)
+	{
+		values[i] = -values[i] - bias;
+	}
+
+	cv::Mat_<float> values_mat(1, count, values);
+	cv::exp(values_mat, values_mat);
+
+	for(int i = 0; i < count; ++i)
+	{
+		values[i] = 1.0f / (1.0f + values[i]);
+	}
+}
+
 // Copy constructor
 DetectionValidator::DetectionValidator(const DetectionValidator& other) : orientations(other.orientations), bs(other.bs), paws(other.paws),
 cnn_subsampling_layers(other.cnn_subsampling_layers), cnn_layer_types(other.cnn_layer_types), cnn_fully_connected_layers_bias(other.cnn_fully_connected_layers_bias),
-cnn_convolutional_layers_bias(other.cnn_convolutional_layers_bias), cnn_convolutional_layers_dft(other.cnn_convolutional_layers_dft)
+cnn_convolutional_layers_bias(other.cnn_convolutional_layers_bias)
 {
 
 	this->validator_type = other.validator_type;
@@ -108,6 +145,18 @@ cnn_convolutional_layers_bias(other.cnn_convolutional_layers_bias), cnn_convolut
 		}
 	}
 
+	this->cnn_convolutional_layers_weights.resize(other.cnn_convolutional_layers_weights.size());
+	for (size_t v = 0; v < other.cnn_convolutional_layers_weights.size(); ++v)
+	{
+		this->cnn_convolutional_layers_weights[v].resize(other.cnn_convolutional_layers_weights[v].size());
+
+		for (size_t l = 0; l < other.cnn_convolutional_layers_weights[v].size(); ++l)
+		{
+			// Make sure the matrix is copied.
+			this->cnn_convolutional_layers_weights[v][l] = other.cnn_convolutional_layers_weights[v][l].clone();
+		}
+	}
+
 	this->cnn_fully_connected_layers.resize(other.cnn_fully_connected_layers.size());
 	for (size_t v = 0; v < other.cnn_fully_connected_layers.size(); ++v)
 	{
@@ -141,7 +190,7 @@ cnn_convolutional_layers_bias(other.cnn_convolutional_layers_bias), cnn_convolut
 void DetectionValidator::Read(string location)
 {
 
-	ifstream detection_validator_stream (location, ios::in|ios::binary);
+	ModelStream detection_validator_stream(location);
 	if (detection_validator_stream.is_open())	
 	{				
 		detection_validator_stream.seekg (0, ios::beg);
@@ -186,7 +235,7 @@ void DetectionValidator::Read(string location)
 		else if(validator_type == 2)
 		{
 			cnn_convolutional_layers.resize(n);
-			cnn_convolutional_layers_dft.resize(n);
+			cnn_convolutional_layers_weights.resize(n);
 			cnn_subsampling_layers.resize(n);
 			cnn_fully_connected_layers.resize(n);
 			cnn_layer_types.resize(n);
@@ -202,19 +251,23 @@ void DetectionValidator::Read(string location)
 		for(int i = 0; i < n; i++)
 		{
 
-			// Read in the mean images
-			LandmarkDetector::ReadMatBin(detection_validator_stream, mean_images[i]);
-			mean_images[i] = mean_images[i].t();
+			// Read in the mean images (stored in double precision)
+			cv::Mat_<double> mean_image, standard_deviation;
+			LandmarkDetector::ReadMatBin(detection_validator_stream, mean_image);
+			cv::Mat_<float>(mean_image.t()).copyTo(mean_images[i]);
 	
-			LandmarkDetector::ReadMatBin(detection_validator_stream, standard_deviations[i]);
-			standard_deviations[i] = standard_deviations[i].t();
+			LandmarkDetector::ReadMatBin(detection_validator_stream, standard_deviation);
+			cv::Mat_<float>(standard_deviation.t()).copyTo(standard_deviations[i]);
 
 			// Model specifics
 			if(validator_type == 0)
 			{
 				// Reading in the biases and weights
 				detection_validator_stream.read ((char*)&bs[i], 8);
-				LandmarkDetector::ReadMatBin(detection_validator_stream, ws[i]);
+
+				cv::Mat_<double> weights;
+				LandmarkDetector::ReadMatBin(detection_validator_stream, weights);
+				weights.convertTo(ws[i], CV_32F);
 	
 			}
 			else if(validator_type == 1)
@@ -231,10 +284,11 @@ void DetectionValidator::Read(string location)
 				ws_nn[i].resize(num_depth_layers);
 				for(int layer = 0; layer < num_depth_layers; layer++)
 				{
-					LandmarkDetector::ReadMatBin(detection_validator_stream, ws_nn[i][layer]);
+					cv::Mat_<double> weights;
+					LandmarkDetector::ReadMatBin(detection_validator_stream, weights);
 
 					// Transpose for efficiency during multiplication
-					ws_nn[i][layer] = ws_nn[i][layer].t();
+					cv::Mat_<float>(weights.t()).copyTo(ws_nn[i][layer]);
 				}
 			}
 			else if(validator_type == 2)
@@ -266,10 +320,8 @@ void DetectionValidator::Read(string location)
 						detection_validator_stream.read ((char*)&num_kernels, 4);
 
 						vector<vector<cv::Mat_<float> > > kernels;
-						vector<vector<pair<int, cv::Mat_<double> > > > kernel_dfts;
 
 						kernels.resize(num_in_maps);
-						kernel_dfts.resize(num_in_maps);
 
 						vector<float> biases;
 						for (int k = 0; k < num_kernels; ++k)
@@ -285,7 +337,6 @@ void DetectionValidator::Read(string location)
 						for (int in = 0; in < num_in_maps; ++in)
 						{
 							kernels[in].resize(num_kernels);
-							kernel_dfts[in].resize(num_kernels);
 
 							// For every kernel on that input map
 							for (int k = 0; k < num_kernels; ++k)
@@ -297,8 +348,22 @@ void DetectionValidator::Read(string location)
 							}
 						}
 
+						// Pack the kernels for the matrix multiplication, a row per kernel holding it for every input map
+						int kernel_rows = kernels[0][0].rows;
+						int kernel_cols = kernels[0][0].cols;
+
+						cv::Mat_<float> weights(num_kernels, num_in_maps * kernel_rows * kernel_cols);
+						for (int in = 0; in < num_in_maps; ++in)
+						{
+							for (int k = 0; k < num_kernels; ++k)
+							{
+								cv::Mat_<float> kernel_row = kernels[in][k].clone().reshape(1, 1);
+								kernel_row.copyTo(weights(cv::Rect(in * kernel_rows * kernel_cols, k, kernel_rows * kernel_cols, 1)));
+							}
+						}
+
 						cnn_convolutional_layers[i].push_back(kernels);
-						cnn_convolutional_layers_dft[i].push_back(kernel_dfts);
+						cnn_convolutional_layers_weights[i].push_back(weights);
 					}
 					else if(layer_type == 1)
 					{
@@ -336,19 +401,15 @@ void DetectionValidator::Read(string location)
 
 //===========================================================================
 // Check if the fitting actually succeeded
-double DetectionValidator::Check(const cv::Vec3d& orientation, const cv::Mat_<uchar>& intensity_img, cv::Mat_<double>& detected_landmarks)
+double DetectionValidator::Check(const cv::Vec3d& orientation, const cv::Mat_<uchar>& intensity_img, cv::Mat_<double>& detected_landmarks) const
 {
 
 	int id = GetViewId(orientation);
 	
 	// The warped (cropped) image, corresponding to a face lying withing the detected lanmarks
-	cv::Mat_<double> warped;
-	
-	// the piece-wise affine image
-	cv::Mat_<double> intensity_img_double;
-	intensity_img.convertTo(intensity_img_double, CV_64F);
-
-	paws[id].Warp(intensity_img_double, warped, detected_landmarks);	
+	// Only the face region of the image is sampled from, so the whole frame does not need converting
+	cv::Mat_<float> warped;
+	paws[id].WarpFromROI(intensity_img, warped, detected_landmarks);	
 	
 	double dec;
 	if(validator_type == 0)
@@ -366,16 +427,68 @@ double DetectionValidator::Check(const cv::Vec3d& orientation, const cv::Mat_<uc
 	return dec;
 }
 
-double DetectionValidator::CheckNN(const cv::Mat_<double>& warped_img, int view_id)
+//===========================================================================
+// Check several faces, the ones closest to the same view are warped and passed through that view's CNN together
+void DetectionValidator::Check(const vector<cv::Vec3d>& face_orientations, const cv::Mat_<uchar>& intensity_img, const vector<cv::Mat_<double> >& detected_landmarks, vector<double>& decisions) const
+{
+	decisions.resize(detected_landmarks.size());
+
+	vector<vector<int> > view_faces(orientations.size());
+	for(size_t i = 0; i < detected_landmarks.size(); ++i)
+	{
+		view_faces[GetViewId(face_orientations[i])].push_back((int)i);
+	}
+
+	for(size_t view = 0; view < view_faces.size(); ++view)
+	{
+		if(view_faces[view].empty())
+		{
+			continue;
+		}
+
+		vector<cv::Mat_<float> > warped(view_faces[view].size());
+		for(size_t i = 0; i < view_faces[view].size(); ++i)
+		{
+			paws[view].WarpFromROI(intensity_img, warped[i], detected_landmarks[view_faces[view][i]]);
+		}
+
+		if(validator_type == 2)
+		{
+			vector<double> view_decisions;
+			CheckCNN(warped, (int)view, view_decisions);
+
+			for(size_t i = 0; i < view_faces[view].size(); ++i)
+			{
+				decisions[view_faces[view][i]] = view_decisions[i];
+			}
+		}
+		else
+		{
+			for(size_t i = 0; i < view_faces[view].size(); ++i)
+			{
+				if(validator_type == 0)
+				{
+					decisions[view_faces[view][i]] = CheckSVR(warped[i], (int)view);
+				}
+				else if(validator_type == 1)
+				{
+					decisions[view_faces[view][i]] = CheckNN(warped[i], (int)view);
+				}
+			}
+		}
+	}
+}
+
+double DetectionValidator::CheckNN(const cv::Mat_<float>& warped_img, int view_id) const
 {
-	cv::Mat_<double> feature_vec;
+	cv::Mat_<float> feature_vec;
 	NormaliseWarpedToVector(warped_img, feature_vec, view_id);
 	feature_vec = feature_vec.t();
 			
 	for(size_t layer = 0; layer < ws_nn[view_id].size(); ++layer)
 	{
 		// Add a bias term
-		cv::hconcat(cv::Mat_<double>(1,1, 1.0), feature_vec, feature_vec);
+		cv::hconcat(cv::Mat_<float>(1,1, 1.0f), feature_vec, feature_vec);
 		
 		// Apply the weights
 		feature_vec = feature_vec * ws_nn[view_id][layer];
@@ -398,13 +511,13 @@ double DetectionValidator::CheckNN(const cv::Mat_<double>& warped_img, int view_
 		}
 		else if(fun_type == 1)
 		{
-			cv::MatIterator_<double> q1 = feature_vec.begin(); // respone for each pixel
-			cv::MatIterator_<double> q2 = feature_vec.end();
+			cv::MatIterator_<float> q1 = feature_vec.begin(); // respone for each pixel
+			cv::MatIterator_<float> q2 = feature_vec.end();
 
 			// the logistic function (sigmoid) applied to the response
 			while(q1 != q2)
 			{
-				*q1 = 1.7159 * tanh((2.0/3.0) * (*q1));
+				*q1 = 1.7159f * tanh((2.0f/3.0f) * (*q1));
 				q1++;
 			}
 		}
@@ -413,16 +526,16 @@ double DetectionValidator::CheckNN(const cv::Mat_<double>& warped_img, int view_
 	}
 
 	// Turn it to -1, 1 range
-	double dec = (feature_vec.at<double>(0) - 0.5) * 2;
+	double dec = (feature_vec.at<float>(0) - 0.5) * 2;
 
 	return dec;
 
 }
 
-double DetectionValidator::CheckSVR(const cv::Mat_<double>& warped_img, int view_id)
+double DetectionValidator::CheckSVR(const cv::Mat_<float>& warped_img, int view_id) const
 {
 
-	cv::Mat_<double> feature_vec;
+	cv::Mat_<float> feature_vec;
 	NormaliseWarpedToVector(warped_img, feature_vec, view_id);
 		
 
@@ -433,202 +546,220 @@ double DetectionValidator::CheckSVR(const cv::Mat_<double>& warped_img, int view
 }
 
 // Convolutional Neural Network
-double DetectionValidator::CheckCNN(const cv::Mat_<double>& warped_img, int view_id)
+double DetectionValidator::CheckCNN(const cv::Mat_<float>& warped_img, int view_id) const
 {
+	vector<cv::Mat_<float> > warped_imgs(1, warped_img);
+	vector<double> decisions;
 
-	cv::Mat_<double> feature_vec;
-	NormaliseWarpedToVector(warped_img, feature_vec, view_id);
-	
-	// Create a normalised image from the crop vector
-	cv::Mat_<float> img(warped_img.size(), 0.0);
-	img = img.t();
+	CheckCNN(warped_imgs, view_id, decisions);
 
-	cv::Mat mask = paws[view_id].pixel_mask.t();
-	cv::MatIterator_<uchar>  mask_it = mask.begin<uchar>();
-	
-	cv::MatIterator_<double> feature_it = feature_vec.begin();
-	cv::MatIterator_<float> img_it = img.begin();		
+	return decisions[0];
+}
 
-	int wInt = img.cols;
-	int hInt = img.rows;
+// Convolutional Neural Network applied to a batch of faces, every map is stored as a row holding that map of all the faces side by side.
+// A convolutional layer is then one matrix multiplication of the packed kernels with the unrolled input patches, and a fully connected
+// layer one multiplication with the concatenated maps of each face
+void DetectionValidator::CheckCNN(const vector<cv::Mat_<float> >& warped_imgs, int view_id, vector<double>& decisions) const
+{
+	int num_faces = (int)warped_imgs.size();
+	decisions.resize(num_faces);
 
-	for(int i=0; i < wInt; ++i)
+	if(num_faces == 0)
+	{
+		return;
+	}
+
+	CNN_workspace& workspace = cnn_workspaces.local();
+
+	// The input is a single map, the normalised face placed within the mask
+	const cv::Mat_<uchar>& mask = paws[view_id].pixel_mask;
+
+	int num_maps = 1;
+	int map_rows = mask.rows;
+	int map_cols = mask.cols;
+
+	workspace.maps.create(1, num_faces * map_rows * map_cols);
+	workspace.maps.setTo(0);
+
+	for(int n = 0; n < num_faces; ++n)
 	{
-		for(int j=0; j < hInt; ++j, ++mask_it, ++img_it)
+		cv::Mat_<float> feature_vec;
+		NormaliseWarpedToVector(warped_imgs[n], feature_vec, view_id);
+
+		// The feature vector follows the mask column by column
+		const float* feature = feature_vec.ptr<float>();
+		float* face_map = workspace.maps.ptr<float>(0) + n * map_rows * map_cols;
+
+		for(int x = 0; x < map_cols; ++x)
 		{
-			// if is within mask
-			if(*mask_it)
+			for(int y = 0; y < map_rows; ++y)
 			{
-				// assign the feature to image if it is within the mask
-				*img_it = (float)*feature_it++;
+				if(mask(y, x))
+				{
+					face_map[y * map_cols + x] = *feature++;
+				}
 			}
 		}
 	}
-	img = img.t();
-	
+
 	int cnn_layer = 0;
 	int subsample_layer = 0;
 	int fully_connected_layer = 0;
 
-	vector<cv::Mat_<float> > input_maps;
-	input_maps.push_back(img);
-	
-	vector<cv::Mat_<float> > outputs;
-
 	for(size_t layer = 0; layer < cnn_layer_types[view_id].size(); ++layer)
 	{
 		// Determine layer type
 		int layer_type = cnn_layer_types[view_id][layer];
-		
-		
+
+		int map_size = map_rows * map_cols;
+
 		// Convolutional layer
 		if(layer_type == 0)
 		{
-			vector<cv::Mat_<float> > outputs_kern;
-			for(size_t in = 0; in < input_maps.size(); ++in)
-			{
-				cv::Mat_<float> input_image = input_maps[in];
+			const cv::Mat_<float>& weights = cnn_convolutional_layers_weights[view_id][cnn_layer];
 
-				// Useful precomputed data placeholders for quick correlation (convolution)
-				cv::Mat_<double> input_image_dft;
-				cv::Mat integral_image;
-				cv::Mat integral_image_sq;
+			int kernel_rows = cnn_convolutional_layers[view_id][cnn_layer][0][0].rows;
+			int kernel_cols = cnn_convolutional_layers[view_id][cnn_layer][0][0].cols;
 
-				for(size_t k = 0; k < cnn_convolutional_layers[view_id][cnn_layer][in].size(); ++k)
+			int out_rows = map_rows - kernel_rows + 1;
+			int out_cols = map_cols - kernel_cols + 1;
+			int out_size = out_rows * out_cols;
+
+			// Unroll the patches, a row per input map and kernel element, a column per output pixel (of every face)
+			workspace.columns.create(num_maps * kernel_rows * kernel_cols, num_faces * out_size);
+
+			for(int in = 0; in < num_maps; ++in)
+			{
+				for(int i = 0; i < kernel_rows; ++i)
 				{
-					cv::Mat_<float> kernel = cnn_convolutional_layers[view_id][cnn_layer][in][k];
-										
-					// The convolution (with precomputation)
-					cv::Mat_<float> output;
-					if(cnn_convolutional_layers_dft[view_id][cnn_layer][in][k].second.empty())
-					{
-						std::map<int, cv::Mat_<double> > precomputed_dft;
-						
-						LandmarkDetector::matchTemplate_m(input_image, input_image_dft, integral_image, integral_image_sq, kernel, precomputed_dft, output, CV_TM_CCORR);
-						
-						cnn_convolutional_layers_dft[view_id][cnn_layer][in][k].first = precomputed_dft.begin()->first;
-						cnn_convolutional_layers_dft[view_id][cnn_layer][in][k].second = precomputed_dft.begin()->second;
-					}
-					else
+					for(int j = 0; j < kernel_cols; ++j)
 					{
-						std::map<int, cv::Mat_<double> > precomputed_dft;
-						precomputed_dft[cnn_convolutional_layers_dft[view_id][cnn_layer][in][k].first] = cnn_convolutional_layers_dft[view_id][cnn_layer][in][k].second;
-						LandmarkDetector::matchTemplate_m(input_image, input_image_dft, integral_image, integral_image_sq, kernel,  precomputed_dft, output, CV_TM_CCORR);						
-					}
+						float* dst = workspace.columns.ptr<float>((in * kernel_rows + i) * kernel_cols + j);
 
-					// Combining the maps
-					if(in == 0)
-					{
-						outputs_kern.push_back(output);
-					}
-					else
-					{
-						outputs_kern[k] = outputs_kern[k] + output;
-					}
+						for(int n = 0; n < num_faces; ++n)
+						{
+							const float* src = workspace.maps.ptr<float>(in) + n * map_size + i * map_cols + j;
 
+							for(int y = 0; y < out_rows; ++y, dst += out_cols)
+							{
+								std::copy(src + y * map_cols, src + y * map_cols + out_cols, dst);
+							}
+						}
+					}
 				}
-								
 			}
-			
-			outputs.clear();
-			for(size_t k = 0; k < cnn_convolutional_layers[view_id][cnn_layer][0].size(); ++k)
-			{
-				// Apply the sigmoid
-				cv::exp(-outputs_kern[k] - cnn_convolutional_layers_bias[view_id][cnn_layer][k], outputs_kern[k]);
-				outputs_kern[k] = 1.0 /(1.0 + outputs_kern[k]);	
 
-				outputs.push_back(outputs_kern[k]);
+			// The correlation of every input map with every kernel, summed over the input maps
+			cv::gemm(weights, workspace.columns, 1.0, cv::noArray(), 0.0, workspace.next_maps);
 
-			}			
+			for(int k = 0; k < weights.rows; ++k)
+			{
+				Sigmoid(workspace.next_maps.ptr<float>(k), workspace.next_maps.cols, cnn_convolutional_layers_bias[view_id][cnn_layer][k]);
+			}
+
+			num_maps = weights.rows;
+			map_rows = out_rows;
+			map_cols = out_cols;
 
 			cnn_layer++;
-		}				
+		}
 		if(layer_type == 1)
 		{
-			// Subsampling layer
+			// Subsampling layer, the mean of a 2x2 neighbourhood (scaled by 1/scale in each direction) at every scale'th pixel,
+			// skipping the first row and column
 			int scale = cnn_subsampling_layers[view_id][subsample_layer];
-			
-			cv::Mat kx = cv::Mat::ones(2, 1, CV_32F)*1.0f/scale;
-			cv::Mat ky = cv::Mat::ones(1, 2, CV_32F)*1.0f/scale;
+			float k = 1.0f / scale;
 
-			vector<cv::Mat_<float>> outputs_sub;
-			for(size_t in = 0; in < input_maps.size(); ++in)
-			{
-
-				cv::Mat_<float> conv_out;
+			int res_rows = (map_rows - 1 + scale - 1) / scale;
+			int res_cols = (map_cols - 1 + scale - 1) / scale;
+			int res_size = res_rows * res_cols;
 
-				cv::sepFilter2D(input_maps[in], conv_out, CV_32F, kx, ky);
-				conv_out = conv_out(cv::Rect(1, 1, conv_out.cols - 1, conv_out.rows - 1));
+			workspace.next_maps.create(num_maps, num_faces * res_size);
 
-				int res_rows = conv_out.rows / scale;
-				int res_cols = conv_out.cols / scale;
-
-				if(conv_out.rows % scale != 0)
-				{
-					res_rows++;
-				}
-				if(conv_out.cols % scale != 0)
+			for(int in = 0; in < num_maps; ++in)
+			{
+				for(int n = 0; n < num_faces; ++n)
 				{
-					res_cols++;
-				}
+					const float* src = workspace.maps.ptr<float>(in) + n * map_size;
+					float* dst = workspace.next_maps.ptr<float>(in) + n * res_size;
 
-				cv::Mat_<float> sub_out(res_rows, res_cols);
-				for(int w = 0; w < conv_out.cols; w+=scale)
-				{
-					for(int h=0; h < conv_out.rows; h+=scale)
+					for(int h = 0; h < res_rows; ++h)
 					{
-						sub_out.at<float>(h/scale, w/scale) = conv_out(h, w);
+						const float* top = src + h * scale * map_cols;
+						const float* bottom = top + map_cols;
+
+						for(int w = 0; w < res_cols; ++w)
+						{
+							int x = w * scale;
+							*dst++ = (top[x] * k + top[x + 1] * k) * k + (bottom[x] * k + bottom[x + 1] * k) * k;
+						}
 					}
 				}
-				outputs_sub.push_back(sub_out);
 			}
-			outputs = outputs_sub;
-			subsample_layer++;
 
+			map_rows = res_rows;
+			map_cols = res_cols;
+
+			subsample_layer++;
 		}
 		if(layer_type == 2)
 		{
-			// Concatenate all the maps
-			cv::Mat_<float> input_concat = input_maps[0].t();
-			input_concat = input_concat.reshape(0, 1);
+			const cv::Mat_<float>& weights = cnn_fully_connected_layers[view_id][fully_connected_layer];
+
+			// Concatenate all the (transposed) maps of a face into a row
+			workspace.columns.create(num_faces, num_maps * map_size);
 
-			for(size_t in = 1; in < input_maps.size(); ++in)
+			for(int n = 0; n < num_faces; ++n)
 			{
-				cv::Mat_<float> add = input_maps[in].t();
-				add = add.reshape(0,1);
-				cv::hconcat(input_concat, add, input_concat);
+				float* dst = workspace.columns.ptr<float>(n);
+
+				for(int in = 0; in < num_maps; ++in)
+				{
+					const float* src = workspace.maps.ptr<float>(in) + n * map_size;
+
+					for(int x = 0; x < map_cols; ++x)
+					{
+						for(int y = 0; y < map_rows; ++y)
+						{
+							*dst++ = src[y * map_cols + x];
+						}
+					}
+				}
 			}
-						
-			input_concat = input_concat * cnn_fully_connected_layers[view_id][fully_connected_layer].t();
 
-			cv::exp(-input_concat - cnn_fully_connected_layers_bias[view_id][fully_connected_layer], input_concat);
-			input_concat = 1.0 /(1.0 + input_concat);		
+			cv::gemm(workspace.columns, weights, 1.0, cv::noArray(), 0.0, workspace.fully_connected, cv::GEMM_2_T);
+
+			Sigmoid(workspace.fully_connected.ptr<float>(), (int)workspace.fully_connected.total(), cnn_fully_connected_layers_bias[view_id][fully_connected_layer]);
+
+			// Every output is a 1x1 map
+			cv::transpose(workspace.fully_connected, workspace.next_maps);
 
-			outputs.clear();
-			outputs.push_back(input_concat);
+			num_maps = weights.rows;
+			map_rows = 1;
+			map_cols = 1;
 
 			fully_connected_layer++;
 		}
 		// Set the outputs of this layer to inputs of the next
-		input_maps = outputs;
-
+		std::swap(workspace.maps, workspace.next_maps);
 	}
-	
-	// Turn it to -1, 1 range
-	double dec = (outputs[0].at<float>(0) - 0.5) * 2.0;
 
-	return dec;
+	for(int n = 0; n < num_faces; ++n)
+	{
+		// Turn it to -1, 1 range
+		decisions[n] = (workspace.maps(0, n * map_rows * map_cols) - 0.5) * 2.0;
+	}
 }
 
-void DetectionValidator::NormaliseWarpedToVector(const cv::Mat_<double>& warped_img, cv::Mat_<double>& feature_vec, int view_id)
+void DetectionValidator::NormaliseWarpedToVector(const cv::Mat_<float>& warped_img, cv::Mat_<float>& feature_vec, int view_id) const
 {
-	cv::Mat_<double> warped_t = warped_img.t();
+	cv::Mat_<float> warped_t = warped_img.t();
 	
 	// the vector to be filled with paw values
-	cv::MatIterator_<double> vp;	
-	cv::MatIterator_<double>  cp;
+	cv::MatIterator_<float> vp;	
+	cv::MatIterator_<float>  cp;
 
-	cv::Mat_<double> vec(paws[view_id].number_of_pixels,1);
+	cv::Mat_<float> vec(paws[view_id].number_of_pixels,1);
 	vp = vec.begin();
 
 	cp = warped_t.begin();		
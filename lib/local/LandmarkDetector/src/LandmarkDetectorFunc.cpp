@@ -44,6 +44,9 @@
 // System includes
 #include <vector>
 
+// TBB includes
+#include <tbb/tbb.h>
+
 using namespace LandmarkDetector;
 
 // Getting a head pose estimate from the currently detected landmarks (rotation with respect to point camera)
@@ -121,7 +124,7 @@ cv::Vec6d LandmarkDetector::GetCorrectedPoseWorld(const CLNF& clnf_model, double
 
 		// 3D points
 		cv::Mat_<double> landmarks_3D;
-		clnf_model.pdm.CalcShape3D(landmarks_3D, clnf_model.params_local);
+		clnf_model.model->pdm.CalcShape3D(landmarks_3D, clnf_model.params_local);
 
 		landmarks_3D = landmarks_3D.reshape(1, 3).t();
 
@@ -162,7 +165,7 @@ cv::Vec6d LandmarkDetector::GetCorrectedPoseCamera(const CLNF& clnf_model, doubl
 
 		// 3D points
 		cv::Mat_<double> landmarks_3D;
-		clnf_model.pdm.CalcShape3D(landmarks_3D, clnf_model.params_local);
+		clnf_model.model->pdm.CalcShape3D(landmarks_3D, clnf_model.params_local);
 
 		landmarks_3D = landmarks_3D.reshape(1, 3).t();
 
@@ -207,7 +210,7 @@ cv::Vec6d LandmarkDetector::GetCorrectedPoseCamera(const CLNF& clnf_model, doubl
 void UpdateTemplate(const cv::Mat_<uchar> &grayscale_image, CLNF& clnf_model)
 {
 	cv::Rect bounding_box;
-	clnf_model.pdm.CalcBoundingBox(bounding_box, clnf_model.params_global, clnf_model.params_local);
+	clnf_model.model->pdm.CalcBoundingBox(bounding_box, clnf_model.params_global, clnf_model.params_local);
 	// Make sure the box is not out of bounds
 	bounding_box = bounding_box & cv::Rect(0, 0, grayscale_image.cols, grayscale_image.rows);
 
@@ -218,7 +221,7 @@ void UpdateTemplate(const cv::Mat_<uchar> &grayscale_image, CLNF& clnf_model)
 void CorrectGlobalParametersVideo(const cv::Mat_<uchar> &grayscale_image, CLNF& clnf_model, const FaceModelParameters& params)
 {
 	cv::Rect init_box;
-	clnf_model.pdm.CalcBoundingBox(init_box, clnf_model.params_global, clnf_model.params_local);
+	clnf_model.model->pdm.CalcBoundingBox(init_box, clnf_model.params_global, clnf_model.params_local);
 
 	cv::Rect roi(init_box.x - init_box.width/2, init_box.y - init_box.height/2, init_box.width * 2, init_box.height * 2);
 	roi = roi & cv::Rect(0, 0, grayscale_image.cols, grayscale_image.rows);
@@ -259,7 +262,41 @@ void CorrectGlobalParametersVideo(const cv::Mat_<uchar> &grayscale_image, CLNF&
 	
 }
 
-bool LandmarkDetector::DetectLandmarksInVideo(const cv::Mat_<uchar> &grayscale_image, const cv::Mat_<float> &depth_image, CLNF& clnf_model, FaceModelParameters& params)
+// A lost face is most likely still close to where it was last seen and of similar size, so re-detection first searches a region around the last
+// bounding box (growing with the number of failed attempts to allow for the motion since) at scales close to its size
+// Returns false when the whole image should be scanned instead, on every full_redetection_every'th attempt or when there is no face to search around
+static bool GetRedetectionRegion(cv::Rect_<double>& o_roi, double& o_min_width, double& o_max_width, const CLNF& clnf_model, const FaceModelParameters& params, const cv::Size& image_size)
+{
+	if(!clnf_model.tracking_initialised || params.full_redetection_every <= 1 || clnf_model.detected_landmarks.empty())
+	{
+		return false;
+	}
+
+	int attempt = clnf_model.failures_in_a_row / std::max(params.reinit_video_every, 1);
+	if((attempt + 1) % params.full_redetection_every == 0)
+	{
+		return false;
+	}
+
+	cv::Rect_<double> last_box = clnf_model.GetBoundingBox();
+	if(last_box.width <= 0 || last_box.height <= 0)
+	{
+		return false;
+	}
+
+	double margin = std::max(last_box.width, last_box.height) * (0.5 + 0.25 * attempt);
+	cv::Rect_<double> roi(last_box.x - margin, last_box.y - margin, last_box.width + 2 * margin, last_box.height + 2 * margin);
+	o_roi = roi & cv::Rect_<double>(0, 0, image_size.width, image_size.height);
+
+	o_min_width = 0.7 * last_box.width;
+	o_max_width = 1.4 * last_box.width;
+
+	// If the face has left the image there is nothing to find around it
+	return o_roi.width >= o_min_width && o_roi.height >= o_min_width;
+}
+
+// The landmark detection in video, the face detection is done here if face_detector is null, otherwise it is left to the worker
+static bool DetectLandmarksInVideo(const cv::Mat_<uchar> &grayscale_image, const cv::Mat_<float> &depth_image, CLNF& clnf_model, FaceModelParameters& params, FaceDetectorWorker* face_detector)
 {
 	// First need to decide if the landmarks should be "detected" or "tracked"
 	// Detected means running face detection and a larger search area, tracked means initialising from previous step
@@ -268,6 +305,9 @@ bool LandmarkDetector::DetectLandmarksInVideo(const cv::Mat_<uchar> &grayscale_i
 	// Indicating that this is a first detection in video sequence or after restart
 	bool initial_detection = !clnf_model.tracking_initialised;
 
+	// The latency budget (if any) covers all of the landmark detection done for this frame
+	clnf_model.StartFrameBudget(params);
+
 	// Only do it if there was a face detection at all
 	if(clnf_model.tracking_initialised)
 	{
@@ -304,14 +344,32 @@ bool LandmarkDetector::DetectLandmarksInVideo(const cv::Mat_<uchar> &grayscale_i
 
 	// This is used for both detection (if it the tracking has not been initialised yet) or if the tracking failed (however we do this every n frames, for speed)
 	// This also has the effect of an attempt to reinitialise just after the tracking has failed, which is useful during large motions
-	if((!clnf_model.tracking_initialised && (clnf_model.failures_in_a_row + 1) % (params.reinit_video_every * 6) == 0) 
-		|| (clnf_model.tracking_initialised && !clnf_model.detection_success && params.reinit_video_every > 0 && clnf_model.failures_in_a_row % params.reinit_video_every == 0))
+	// With the detection on a worker thread it costs nothing here, so its detections are picked up on every frame they are needed
+	bool reinitialise;
+	if(face_detector != 0)
+	{
+		reinitialise = !clnf_model.tracking_initialised || (!clnf_model.detection_success && params.reinit_video_every > 0);
+	}
+	else
+	{
+		reinitialise = (!clnf_model.tracking_initialised && (clnf_model.failures_in_a_row + 1) % (params.reinit_video_every * 6) == 0) 
+			|| (clnf_model.tracking_initialised && !clnf_model.detection_success && params.reinit_video_every > 0 && clnf_model.failures_in_a_row % params.reinit_video_every == 0);
+	}
+
+	// Detections of frames submitted before the face was found again (including the one in progress) are stale by the time
+	// the face is lost next, so they are dropped on every frame they are not needed
+	if(face_detector != 0 && !reinitialise)
+	{
+		face_detector->DiscardDetections();
+	}
+
+	if(reinitialise)
 	{
 
 		cv::Rect_<double> bounding_box;
 
 		// If the face detector has not been initialised read it in
-		if(clnf_model.face_detector_HAAR.empty())
+		if(face_detector == 0 && clnf_model.face_detector_HAAR.empty())
 		{
 			clnf_model.face_detector_HAAR.load(params.face_detector_location);
 			clnf_model.face_detector_location = params.face_detector_location;
@@ -322,18 +380,73 @@ bool LandmarkDetector::DetectLandmarksInVideo(const cv::Mat_<uchar> &grayscale_i
 		{
 			preference_det.x = clnf_model.preference_det.x * grayscale_image.cols;
 			preference_det.y = clnf_model.preference_det.y * grayscale_image.rows;
-			clnf_model.preference_det = cv::Point(-1, -1);
 		}
 
-		bool face_detection_success;
-		if(params.curr_face_detector == FaceModelParameters::HOG_SVM_DETECTOR)
+		// Unless a particular face was asked for, a lost face is first searched for around where it was last seen (preferring the closest detection to it)
+		cv::Rect_<double> redetection_roi;
+		double min_width = 0, max_width = 0;
+		bool restricted_search = preference_det.x == -1 && GetRedetectionRegion(redetection_roi, min_width, max_width, clnf_model, params, grayscale_image.size());
+
+		cv::Point last_face_centre(-1, -1);
+		if(restricted_search)
+		{
+			cv::Rect_<double> last_box = clnf_model.GetBoundingBox();
+			last_face_centre = cv::Point((int)(last_box.x + last_box.width / 2), (int)(last_box.y + last_box.height / 2));
+		}
+
+		bool face_detection_success = false;
+		if(face_detector != 0)
+		{
+			// Use the latest detections of the worker, and give it the current frame to work on next
+			vector<cv::Rect_<double> > detections;
+			vector<double> confidences;
+			int detection_frame;
+
+			// The preference is kept until there are detections to apply it to
+			if(face_detector->GetDetections(detections, confidences, detection_frame))
+			{
+				face_detection_success = FaceDetectorWorker::SelectSingleFace(bounding_box, detections, confidences, restricted_search ? last_face_centre : preference_det);
+				clnf_model.preference_det = cv::Point(-1, -1);
+			}
+
+			if(restricted_search)
+			{
+				face_detector->SubmitFrame(grayscale_image, redetection_roi, min_width, max_width);
+			}
+			else
+			{
+				face_detector->SubmitFrame(grayscale_image);
+			}
+		}
+		else if(restricted_search)
+		{
+			vector<cv::Rect_<double> > detections;
+			vector<double> confidences;
+
+			if(params.curr_face_detector == FaceModelParameters::HOG_SVM_DETECTOR)
+			{
+				LandmarkDetector::DetectFacesHOG(detections, grayscale_image, clnf_model.face_detector_HOG, confidences, redetection_roi, min_width, max_width);
+			}
+			else
+			{
+				LandmarkDetector::DetectFaces(detections, grayscale_image, clnf_model.face_detector_HAAR, redetection_roi, min_width, max_width);
+				confidences.assign(detections.size(), 0.0);
+			}
+
+			face_detection_success = FaceDetectorWorker::SelectSingleFace(bounding_box, detections, confidences, last_face_centre);
+		}
+		else if(params.curr_face_detector == FaceModelParameters::HOG_SVM_DETECTOR)
 		{
+			clnf_model.preference_det = cv::Point(-1, -1);
+
 			double confidence;
-			face_detection_success = LandmarkDetector::DetectSingleFaceHOG(bounding_box, grayscale_image, clnf_model.face_detector_HOG, confidence, preference_det);
+			face_detection_success = LandmarkDetector::DetectSingleFaceHOG(bounding_box, grayscale_image, clnf_model.face_detector_HOG, confidence, preference_det, params.min_face_size);
 		}
 		else if(params.curr_face_detector == FaceModelParameters::HAAR_DETECTOR)
 		{
-			face_detection_success = LandmarkDetector::DetectSingleFace(bounding_box, grayscale_image, clnf_model.face_detector_HAAR, preference_det);
+			clnf_model.preference_det = cv::Point(-1, -1);
+
+			face_detection_success = LandmarkDetector::DetectSingleFace(bounding_box, grayscale_image, clnf_model.face_detector_HAAR, preference_det, params.min_face_size);
 		}
 
 		// Attempt to detect landmarks using the detected face (if unseccessful the detection will be ignored)
@@ -351,7 +464,7 @@ bool LandmarkDetector::DetectLandmarksInVideo(const cv::Mat_<uchar> &grayscale_i
 
 			// Use the detected bounding box and empty local parameters
 			clnf_model.params_local.setTo(0);
-			clnf_model.pdm.CalcParams(clnf_model.params_global, bounding_box, clnf_model.params_local);		
+			clnf_model.model->pdm.CalcParams(clnf_model.params_global, bounding_box, clnf_model.params_local);		
 
 			// Make sure the search size is large
 			params.window_sizes_current = params.window_sizes_init;
@@ -368,7 +481,7 @@ bool LandmarkDetector::DetectLandmarksInVideo(const cv::Mat_<uchar> &grayscale_i
 				// Restore previous estimates
 				clnf_model.params_global = params_global_init;
 				clnf_model.params_local = params_local_init.clone();
-				clnf_model.pdm.CalcShape2D(clnf_model.detected_landmarks, clnf_model.params_local, clnf_model.params_global);
+				clnf_model.model->pdm.CalcShape2D(clnf_model.detected_landmarks, clnf_model.params_local, clnf_model.params_global);
 				clnf_model.model_likelihood = likelihood_init;
 				clnf_model.detected_landmarks = detected_landmarks_init.clone();
 				clnf_model.landmark_likelihoods = landmark_likelihoods_init.clone();
@@ -400,13 +513,28 @@ bool LandmarkDetector::DetectLandmarksInVideo(const cv::Mat_<uchar> &grayscale_i
 	
 }
 
+bool LandmarkDetector::DetectLandmarksInVideo(const cv::Mat_<uchar> &grayscale_image, const cv::Mat_<float> &depth_image, CLNF& clnf_model, FaceModelParameters& params)
+{
+	return ::DetectLandmarksInVideo(grayscale_image, depth_image, clnf_model, params, 0);
+}
+
+bool LandmarkDetector::DetectLandmarksInVideo(const cv::Mat_<uchar> &grayscale_image, const cv::Mat_<float> &depth_image, CLNF& clnf_model, FaceModelParameters& params, FaceDetectorWorker& face_detector)
+{
+	return ::DetectLandmarksInVideo(grayscale_image, depth_image, clnf_model, params, &face_detector);
+}
+
+bool LandmarkDetector::DetectLandmarksInVideo(const cv::Mat_<uchar> &grayscale_image, CLNF& clnf_model, FaceModelParameters& params, FaceDetectorWorker& face_detector)
+{
+	return DetectLandmarksInVideo(grayscale_image, cv::Mat_<float>(), clnf_model, params, face_detector);
+}
+
 bool LandmarkDetector::DetectLandmarksInVideo(const cv::Mat_<uchar> &grayscale_image, const cv::Mat_<float> &depth_image, const cv::Rect_<double> bounding_box, CLNF& clnf_model, FaceModelParameters& params)
 {
 	if(bounding_box.width > 0)
 	{
 		// calculate the local and global parameters from the generated 2D shape (mapping from the 2D to 3D because camera params are unknown)
 		clnf_model.params_local.setTo(0);
-		clnf_model.pdm.CalcParams(clnf_model.params_global, bounding_box, clnf_model.params_local);		
+		clnf_model.model->pdm.CalcParams(clnf_model.params_global, bounding_box, clnf_model.params_local);		
 
 		// indicate that face was detected so initialisation is not necessary
 		clnf_model.tracking_initialised = true;
@@ -435,6 +563,9 @@ bool LandmarkDetector::DetectLandmarksInVideo(const cv::Mat_<uchar> &grayscale_i
 bool LandmarkDetector::DetectLandmarksInImage(const cv::Mat_<uchar> &grayscale_image, const cv::Mat_<float> depth_image, const cv::Rect_<double> bounding_box, CLNF& clnf_model, FaceModelParameters& params)
 {
 
+	// The latency budget (if any) covers all of the hypotheses fitted for this image
+	clnf_model.StartFrameBudget(params);
+
 	// Can have multiple hypotheses
 	vector<cv::Vec3d> rotation_hypotheses;
 
@@ -456,23 +587,8 @@ bool LandmarkDetector::DetectLandmarksInImage(const cv::Mat_<uchar> &grayscale_i
 	
 	// Use the initialisation size for the landmark detection
 	params.window_sizes_current = params.window_sizes_init;
-	
-	// Store the current best estimate
-	double best_likelihood;
-	cv::Vec6d best_global_parameters;
-	cv::Mat_<double> best_local_parameters;
-	cv::Mat_<double> best_detected_landmarks;
-	cv::Mat_<double> best_landmark_likelihoods;
-	bool best_success;
-
-	// The hierarchical model parameters
-	vector<double> best_likelihood_h(clnf_model.hierarchical_models.size());
-	vector<cv::Vec6d> best_global_parameters_h(clnf_model.hierarchical_models.size());
-	vector<cv::Mat_<double>> best_local_parameters_h(clnf_model.hierarchical_models.size());
-	vector<cv::Mat_<double>> best_detected_landmarks_h(clnf_model.hierarchical_models.size());
-	vector<cv::Mat_<double>> best_landmark_likelihoods_h(clnf_model.hierarchical_models.size());
-
-	for(size_t hypothesis = 0; hypothesis < rotation_hypotheses.size(); ++hypothesis)
+
+	if(rotation_hypotheses.size() == 1)
 	{
 		// Reset the potentially set clnf_model parameters
 		clnf_model.params_local.setTo(0.0);
@@ -483,51 +599,133 @@ bool LandmarkDetector::DetectLandmarksInImage(const cv::Mat_<uchar> &grayscale_i
 		}
 
 		// calculate the local and global parameters from the generated 2D shape (mapping from the 2D to 3D because camera params are unknown)
-		clnf_model.pdm.CalcParams(clnf_model.params_global, bounding_box, clnf_model.params_local, rotation_hypotheses[hypothesis]);
+		clnf_model.model->pdm.CalcParams(clnf_model.params_global, bounding_box, clnf_model.params_local, rotation_hypotheses[0]);
 	
-		bool success = clnf_model.DetectLandmarks(grayscale_image, depth_image, params);	
+		return clnf_model.DetectLandmarks(grayscale_image, depth_image, params);
+	}
 
-		if(hypothesis == 0 || best_likelihood < clnf_model.model_likelihood)
+	// Every hypothesis is fitted on its own tracking state (sharing the model), the first one on clnf_model itself
+	if(clnf_model.hypothesis_trackers.size() != rotation_hypotheses.size() - 1 || (!clnf_model.hypothesis_trackers.empty() && clnf_model.hypothesis_trackers[0].model != clnf_model.model))
+	{
+		clnf_model.hypothesis_trackers.clear();
+		for(size_t hypothesis = 1; hypothesis < rotation_hypotheses.size(); ++hypothesis)
 		{
-			best_likelihood = clnf_model.model_likelihood;
-			best_global_parameters = clnf_model.params_global;
-			best_local_parameters = clnf_model.params_local.clone();
-			best_detected_landmarks = clnf_model.detected_landmarks.clone();
-			best_landmark_likelihoods = clnf_model.landmark_likelihoods.clone();
-			best_success = success;
+			clnf_model.hypothesis_trackers.push_back(CLNF(clnf_model.model));
 		}
+	}
 
-		for (size_t part = 0; part < clnf_model.hierarchical_models.size(); ++part)
+	vector<CLNF*> trackers(rotation_hypotheses.size());
+	trackers[0] = &clnf_model;
+	for(size_t hypothesis = 1; hypothesis < rotation_hypotheses.size(); ++hypothesis)
+	{
+		trackers[hypothesis] = &clnf_model.hypothesis_trackers[hypothesis - 1];
+		trackers[hypothesis]->JoinFrameBudget(clnf_model);
+	}
+
+	// The hypotheses are first fitted using only the first (coarsest) window size, without refinement or validation, and the rest of the window sizes are only used for the promising ones
+	FaceModelParameters coarse_params = params;
+	FaceModelParameters fine_params = params;
+	coarse_params.refine_hierarchical = false;
+	coarse_params.validate_detections = false;
+
+	for(size_t scale = 0; scale < params.window_sizes_init.size(); ++scale)
+	{
+		if(params.window_sizes_init[scale] > 0)
 		{
-			if (hypothesis == 0 || best_likelihood < clnf_model.hierarchical_models[part].model_likelihood)
-			{
-				best_likelihood_h[part] = clnf_model.hierarchical_models[part].model_likelihood;
-				best_global_parameters_h[part] = clnf_model.hierarchical_models[part].params_global;
-				best_local_parameters_h[part] = clnf_model.hierarchical_models[part].params_local.clone();
-				best_detected_landmarks_h[part] = clnf_model.hierarchical_models[part].detected_landmarks.clone();
-				best_landmark_likelihoods_h[part] = clnf_model.hierarchical_models[part].landmark_likelihoods.clone();
-			}
+			coarse_params.window_sizes_current = vector<int>(params.window_sizes_init.size(), 0);
+			coarse_params.window_sizes_current[scale] = params.window_sizes_init[scale];
+			fine_params.window_sizes_current[scale] = 0;
+			break;
 		}
+	}
+
+	// Written from the parallel fits, so not a vector<bool>
+	vector<int> successes(rotation_hypotheses.size(), 0);
+
+	tbb::parallel_for(0, (int)rotation_hypotheses.size(), [&](int hypothesis){
+
+		CLNF& tracker = *trackers[hypothesis];
 
+		// Reset the potentially set parameters
+		tracker.params_local.setTo(0.0);
+		tracker.model_likelihood = -10; // very low
+
+		for (size_t part = 0; part < tracker.hierarchical_models.size(); ++part)
+		{
+			tracker.hierarchical_models[part].params_local.setTo(0.0);
+		}
+
+		// calculate the local and global parameters from the generated 2D shape (mapping from the 2D to 3D because camera params are unknown)
+		tracker.model->pdm.CalcParams(tracker.params_global, bounding_box, tracker.params_local, rotation_hypotheses[hypothesis]);
+
+		// Each hypothesis works on its own copy of the parameters
+		FaceModelParameters hypothesis_params = coarse_params;
+		tracker.DetectLandmarks(grayscale_image, depth_image, hypothesis_params);
+	});
+
+	// Drop the hypotheses that are clearly worse than the best one so far
+	double leader_likelihood = trackers[0]->model_likelihood;
+	for(size_t hypothesis = 1; hypothesis < trackers.size(); ++hypothesis)
+	{
+		leader_likelihood = std::max(leader_likelihood, trackers[hypothesis]->model_likelihood);
+	}
+
+	vector<int> remaining;
+	for(size_t hypothesis = 0; hypothesis < trackers.size(); ++hypothesis)
+	{
+		if(params.hypothesis_pruning < 0 || trackers[hypothesis]->model_likelihood >= leader_likelihood - params.hypothesis_pruning)
+		{
+			remaining.push_back((int)hypothesis);
+		}
+	}
+
+	// Continue from the coarse fits with the remaining window sizes, the hierarchical refinement and validation
+	tbb::parallel_for(0, (int)remaining.size(), [&](int r){
+
+		FaceModelParameters hypothesis_params = fine_params;
+		successes[remaining[r]] = trackers[remaining[r]]->DetectLandmarks(grayscale_image, depth_image, hypothesis_params);
+	});
+
+	// Pick the best of the remaining hypotheses
+	int best = remaining[0];
+	for(size_t r = 1; r < remaining.size(); ++r)
+	{
+		if(trackers[best]->model_likelihood < trackers[remaining[r]]->model_likelihood)
+		{
+			best = remaining[r];
+		}
 	}
 
-	// Store the best estimates in the clnf_model
-	clnf_model.model_likelihood = best_likelihood;
-	clnf_model.params_global = best_global_parameters;
-	clnf_model.params_local = best_local_parameters.clone();
-	clnf_model.detected_landmarks = best_detected_landmarks.clone();
-	clnf_model.detection_success = best_success;
-	clnf_model.landmark_likelihoods = best_landmark_likelihoods.clone();
+	// Store the best estimates in the clnf_model (including the part models, which were refined from the same hypothesis)
+	if(best != 0)
+	{
+		const CLNF& best_tracker = *trackers[best];
+
+		clnf_model.model_likelihood = best_tracker.model_likelihood;
+		clnf_model.params_global = best_tracker.params_global;
+		clnf_model.params_local = best_tracker.params_local.clone();
+		clnf_model.detected_landmarks = best_tracker.detected_landmarks.clone();
+		clnf_model.detection_certainty = best_tracker.detection_certainty;
+		clnf_model.landmark_likelihoods = best_tracker.landmark_likelihoods.clone();
 
-	for (size_t part = 0; part < clnf_model.hierarchical_models.size(); ++part)
+		for (size_t part = 0; part < clnf_model.hierarchical_models.size(); ++part)
+		{
+			clnf_model.hierarchical_models[part].model_likelihood = best_tracker.hierarchical_models[part].model_likelihood;
+			clnf_model.hierarchical_models[part].params_global = best_tracker.hierarchical_models[part].params_global;
+			clnf_model.hierarchical_models[part].params_local = best_tracker.hierarchical_models[part].params_local.clone();
+			clnf_model.hierarchical_models[part].detected_landmarks = best_tracker.hierarchical_models[part].detected_landmarks.clone();
+			clnf_model.hierarchical_models[part].landmark_likelihoods = best_tracker.hierarchical_models[part].landmark_likelihoods.clone();
+		}
+	}
+	clnf_model.detection_success = successes[best] != 0;
+
+	// Report everything that was dropped for this image, whichever hypothesis it was dropped from
+	for(size_t hypothesis = 1; hypothesis < trackers.size(); ++hypothesis)
 	{
-		clnf_model.hierarchical_models[part].params_global = best_global_parameters_h[part];
-		clnf_model.hierarchical_models[part].params_local = best_local_parameters_h[part].clone();
-		clnf_model.hierarchical_models[part].detected_landmarks = best_detected_landmarks_h[part].clone();
-		clnf_model.hierarchical_models[part].landmark_likelihoods = best_landmark_likelihoods_h[part].clone();
+		clnf_model.dropped_stages |= trackers[hypothesis]->dropped_stages;
 	}
 
-	return best_success;
+	return clnf_model.detection_success;
 }
 
 bool LandmarkDetector::DetectLandmarksInImage(const cv::Mat_<uchar> &grayscale_image, const cv::Mat_<float> depth_image, CLNF& clnf_model, FaceModelParameters& params)
@@ -546,11 +744,11 @@ bool LandmarkDetector::DetectLandmarksInImage(const cv::Mat_<uchar> &grayscale_i
 	if(params.curr_face_detector == FaceModelParameters::HOG_SVM_DETECTOR)
 	{
 		double confidence;
-		LandmarkDetector::DetectSingleFaceHOG(bounding_box, grayscale_image, clnf_model.face_detector_HOG, confidence);
+		LandmarkDetector::DetectSingleFaceHOG(bounding_box, grayscale_image, clnf_model.face_detector_HOG, confidence, cv::Point(-1, -1), params.min_face_size);
 	}
 	else if(params.curr_face_detector == FaceModelParameters::HAAR_DETECTOR)
 	{
-		LandmarkDetector::DetectSingleFace(bounding_box, grayscale_image, clnf_model.face_detector_HAAR);
+		LandmarkDetector::DetectSingleFace(bounding_box, grayscale_image, clnf_model.face_detector_HAAR, cv::Point(-1, -1), params.min_face_size);
 	}
 
 	if(bounding_box.width == 0)
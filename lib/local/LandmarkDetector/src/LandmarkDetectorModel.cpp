@@ -36,6 +36,11 @@
 
 #include <LandmarkDetectorModel.h>
 
+#include <set>
+
+// OpenCV includes
+#include <opencv2/core/hal/intrin.hpp>
+
 // Boost includes
 #include <filesystem.hpp>
 #include <filesystem/fstream.hpp>
@@ -45,6 +50,7 @@
 
 // Local includes
 #include <LandmarkDetectorUtils.h>
+#include <ModelBundle.h>
 
 using namespace LandmarkDetector;
 
@@ -52,6 +58,19 @@ using namespace LandmarkDetector;
 //=============================================================================
 
 // Constructors
+// A default constructor
+CLNFModel::CLNFModel()
+{
+	FaceModelParameters parameters;
+	this->Read(parameters.model_location);
+}
+
+// Constructor from a model file
+CLNFModel::CLNFModel(string fname)
+{
+	this->Read(fname);
+}
+
 // A default constructor
 CLNF::CLNF()
 {
@@ -65,55 +84,61 @@ CLNF::CLNF(string fname)
 	this->Read(fname);
 }
 
-// Copy constructor (makes a deep copy of CLNF)
-CLNF::CLNF(const CLNF& other): pdm(other.pdm), params_local(other.params_local.clone()), params_global(other.params_global), detected_landmarks(other.detected_landmarks.clone()),
-	landmark_likelihoods(other.landmark_likelihoods.clone()), patch_experts(other.patch_experts), landmark_validator(other.landmark_validator), face_detector_location(other.face_detector_location),
-	hierarchical_mapping(other.hierarchical_mapping), hierarchical_models(other.hierarchical_models), hierarchical_model_names(other.hierarchical_model_names),
-	hierarchical_params(other.hierarchical_params), eye_model(other.eye_model)
+// Constructor from a model file, warming the model up for the parameters it will be used with
+CLNF::CLNF(string fname, const FaceModelParameters& params)
+{
+	this->Read(fname, params);
+}
+
+// Constructor of a tracker that shares an already loaded model
+CLNF::CLNF(std::shared_ptr<CLNFModel> model) : model(model)
+{
+	this->InitialiseState();
+}
+
+// Copy constructor (makes a deep copy of the tracking state, but shares the model)
+CLNF::CLNF(const CLNF& other): model(other.model), params_local(other.params_local.clone()), params_global(other.params_global), detected_landmarks(other.detected_landmarks.clone()),
+	landmark_likelihoods(other.landmark_likelihoods.clone()), face_detector_location(other.face_detector_location), hierarchical_models(other.hierarchical_models)
 {
 	this->detection_success = other.detection_success;
 	this->tracking_initialised = other.tracking_initialised;
 	this->detection_certainty = other.detection_certainty;
 	this->model_likelihood = other.model_likelihood;
 	this->failures_in_a_row = other.failures_in_a_row;
+	this->dropped_stages = other.dropped_stages;
+	this->frame_deadline = other.frame_deadline;
+	this->hierarchical_ticks = other.hierarchical_ticks;
+	this->validation_ticks = other.validation_ticks;
+	this->skipped_validations = other.skipped_validations;
+	this->gate_landmarks = other.gate_landmarks;
+	this->gate_pose = other.gate_pose;
+	this->gate_likelihood = other.gate_likelihood;
+	this->gate_frames = other.gate_frames;
+	this->gate_change_mean = other.gate_change_mean;
+	this->gate_change_var = other.gate_change_var;
+	this->gate_samples = other.gate_samples;
 	
 	// Load the CascadeClassifier (as it does not have a proper copy constructor)
 	if(!face_detector_location.empty())
 	{
 		this->face_detector_HAAR.load(face_detector_location);
 	}
-	// Make sure the matrices are allocated properly
-	this->triangulations.resize(other.triangulations.size());
-	for(size_t i = 0; i < other.triangulations.size(); ++i)
-	{
-		// Make sure the matrix is copied.
-		this->triangulations[i] = other.triangulations[i].clone();
-	}
-
-	// Make sure the matrices are allocated properly
-	for(std::map<int, cv::Mat_<float>>::const_iterator it = other.kde_resp_precalc.begin(); it!= other.kde_resp_precalc.end(); it++)
-	{
-		// Make sure the matrix is copied.
-		this->kde_resp_precalc.insert(std::pair<int, cv::Mat_<float>>(it->first, it->second.clone()));
-	}
 
 	this->face_detector_HOG = dlib::get_frontal_face_detector();
 
 }
 
-// Assignment operator for lvalues (makes a deep copy of CLNF)
+// Assignment operator for lvalues (makes a deep copy of the tracking state, but shares the model)
 CLNF & CLNF::operator= (const CLNF& other)
 {
 	if (this != &other) // protect against invalid self-assignment
 	{
-		pdm = PDM(other.pdm);
+		model = other.model;
 		params_local = other.params_local.clone();
 		params_global = other.params_global;
 		detected_landmarks = other.detected_landmarks.clone();
 		
 		landmark_likelihoods =other.landmark_likelihoods.clone();
-		patch_experts = Patch_experts(other.patch_experts);
-		landmark_validator = DetectionValidator(other.landmark_validator);
 		face_detector_location = other.face_detector_location;
 
 		this->detection_success = other.detection_success;
@@ -121,34 +146,27 @@ CLNF & CLNF::operator= (const CLNF& other)
 		this->detection_certainty = other.detection_certainty;
 		this->model_likelihood = other.model_likelihood;
 		this->failures_in_a_row = other.failures_in_a_row;
-
-		this->eye_model = other.eye_model;
+		this->dropped_stages = other.dropped_stages;
+		this->frame_deadline = other.frame_deadline;
+		this->hierarchical_ticks = other.hierarchical_ticks;
+		this->validation_ticks = other.validation_ticks;
+		this->skipped_validations = other.skipped_validations;
+		this->gate_landmarks = other.gate_landmarks;
+		this->gate_pose = other.gate_pose;
+		this->gate_likelihood = other.gate_likelihood;
+		this->gate_frames = other.gate_frames;
+		this->gate_change_mean = other.gate_change_mean;
+		this->gate_change_var = other.gate_change_var;
+		this->gate_samples = other.gate_samples;
 
 		// Load the CascadeClassifier (as it does not have a proper copy constructor)
 		if(!face_detector_location.empty())
 		{
 			this->face_detector_HAAR.load(face_detector_location);
 		}
-		// Make sure the matrices are allocated properly
-		this->triangulations.resize(other.triangulations.size());
-		for(size_t i = 0; i < other.triangulations.size(); ++i)
-		{
-			// Make sure the matrix is copied.
-			this->triangulations[i] = other.triangulations[i].clone();
-		}
 
-		// Make sure the matrices are allocated properly
-		for(std::map<int, cv::Mat_<float>>::const_iterator it = other.kde_resp_precalc.begin(); it!= other.kde_resp_precalc.end(); it++)
-		{
-			// Make sure the matrix is copied.
-			this->kde_resp_precalc.insert(std::pair<int, cv::Mat_<float>>(it->first, it->second.clone()));
-		}
-
-		// Copy over the hierarchical models
-		this->hierarchical_mapping = other.hierarchical_mapping;
+		// Copy over the state of the hierarchical models
 		this->hierarchical_models = other.hierarchical_models;
-		this->hierarchical_model_names = other.hierarchical_model_names;
-		this->hierarchical_params = other.hierarchical_params;
 	}
 
 	face_detector_HOG = dlib::get_frontal_face_detector();
@@ -164,30 +182,32 @@ CLNF::CLNF(const CLNF&& other)
 	this->detection_certainty = other.detection_certainty;
 	this->model_likelihood = other.model_likelihood;
 	this->failures_in_a_row = other.failures_in_a_row;
-
-	pdm = other.pdm;
+	this->dropped_stages = other.dropped_stages;
+	this->frame_deadline = other.frame_deadline;
+	this->hierarchical_ticks = other.hierarchical_ticks;
+	this->validation_ticks = other.validation_ticks;
+	this->skipped_validations = other.skipped_validations;
+	this->gate_landmarks = other.gate_landmarks;
+	this->gate_pose = other.gate_pose;
+	this->gate_likelihood = other.gate_likelihood;
+	this->gate_frames = other.gate_frames;
+	this->gate_change_mean = other.gate_change_mean;
+	this->gate_change_var = other.gate_change_var;
+	this->gate_samples = other.gate_samples;
+
+	model = other.model;
 	params_local = other.params_local;
 	params_global = other.params_global;
 	detected_landmarks = other.detected_landmarks;
 	landmark_likelihoods = other.landmark_likelihoods;
-	patch_experts = other.patch_experts;
-	landmark_validator = other.landmark_validator;
 	face_detector_location = other.face_detector_location;
 
 	face_detector_HAAR = other.face_detector_HAAR;
 
-	triangulations = other.triangulations;
-	kde_resp_precalc = other.kde_resp_precalc;
-
 	face_detector_HOG = dlib::get_frontal_face_detector();
 
-	// Copy over the hierarchical models
-	this->hierarchical_mapping = other.hierarchical_mapping;
+	// Copy over the state of the hierarchical models
 	this->hierarchical_models = other.hierarchical_models;
-	this->hierarchical_model_names = other.hierarchical_model_names;
-	this->hierarchical_params = other.hierarchical_params;
-
-	this->eye_model = other.eye_model;
 
 }
 
@@ -199,39 +219,41 @@ CLNF & CLNF::operator= (const CLNF&& other)
 	this->detection_certainty = other.detection_certainty;
 	this->model_likelihood = other.model_likelihood;
 	this->failures_in_a_row = other.failures_in_a_row;
-
-	pdm = other.pdm;
+	this->dropped_stages = other.dropped_stages;
+	this->frame_deadline = other.frame_deadline;
+	this->hierarchical_ticks = other.hierarchical_ticks;
+	this->validation_ticks = other.validation_ticks;
+	this->skipped_validations = other.skipped_validations;
+	this->gate_landmarks = other.gate_landmarks;
+	this->gate_pose = other.gate_pose;
+	this->gate_likelihood = other.gate_likelihood;
+	this->gate_frames = other.gate_frames;
+	this->gate_change_mean = other.gate_change_mean;
+	this->gate_change_var = other.gate_change_var;
+	this->gate_samples = other.gate_samples;
+
+	model = other.model;
 	params_local = other.params_local;
 	params_global = other.params_global;
 	detected_landmarks = other.detected_landmarks;
 	landmark_likelihoods = other.landmark_likelihoods;
-	patch_experts = other.patch_experts;
-	landmark_validator = other.landmark_validator;
 	face_detector_location = other.face_detector_location;
 
 	face_detector_HAAR = other.face_detector_HAAR;
 
-	triangulations = other.triangulations;
-	kde_resp_precalc = other.kde_resp_precalc;
-
 	face_detector_HOG = dlib::get_frontal_face_detector();
 
-	// Copy over the hierarchical models
-	this->hierarchical_mapping = other.hierarchical_mapping;
+	// Copy over the state of the hierarchical models
 	this->hierarchical_models = other.hierarchical_models;
-	this->hierarchical_model_names = other.hierarchical_model_names;
-	this->hierarchical_params = other.hierarchical_params;
-
-	this->eye_model = other.eye_model;
 
 	return *this;
 }
 
 
-void CLNF::Read_CLNF(string clnf_location)
+void CLNFModel::Read_CLNF(string clnf_location)
 {
 	// Location of modules
-	ifstream locations(clnf_location.c_str(), ios_base::in);
+	ModelStream locations(clnf_location);
 
 	if(!locations.is_open())
 	{
@@ -242,6 +264,8 @@ void CLNF::Read_CLNF(string clnf_location)
 
 	string line;
 	
+	string pdm_location;
+	string triangulation_location;
 	vector<string> intensity_expert_locations;
 	vector<string> depth_expert_locations;
 	vector<string> ccnf_expert_locations;
@@ -279,30 +303,11 @@ void CLNF::Read_CLNF(string clnf_location)
 				
 		if (module.compare("PDM") == 0) 
 		{            
-			cout << "Reading the PDM module from: " << location << "....";
-			pdm.Read(location);
-
-			cout << "Done" << endl;
+			pdm_location = location;
 		}
 		else if (module.compare("Triangulations") == 0) 
 		{       
-			cout << "Reading the Triangulations module from: " << location << "....";
-			ifstream triangulationFile(location.c_str(), ios_base::in);
-
-			LandmarkDetector::SkipComments(triangulationFile);
-
-			int numViews;
-			triangulationFile >> numViews;
-
-			// read in the triangulations
-			triangulations.resize(numViews);
-
-			for(int i = 0; i < numViews; ++i)
-			{
-				LandmarkDetector::SkipComments(triangulationFile);
-				LandmarkDetector::ReadMat(triangulationFile, triangulations[i]);
-			}
-			cout << "Done" << endl;
+			triangulation_location = location;
 		}
 		else if(module.compare("PatchesIntensity") == 0)
 		{
@@ -318,20 +323,57 @@ void CLNF::Read_CLNF(string clnf_location)
 		}
 	}
   
-	// Initialise the patch experts
-	patch_experts.Read(intensity_expert_locations, depth_expert_locations, ccnf_expert_locations);
+	// The modules are independent of each other, so read them in parallel
+	tbb::task_group module_readers;
 
-	// Read in a face detector
-	face_detector_HOG = dlib::get_frontal_face_detector();
+	if(!pdm_location.empty())
+	{
+		module_readers.run([&](){
+			int64 start_ticks = cv::getTickCount();
+			pdm.Read(pdm_location);
+			ReportLoadTime("PDM module", pdm_location, start_ticks);
+		});
+	}
+
+	if(!triangulation_location.empty())
+	{
+		module_readers.run([&](){
+			int64 start_ticks = cv::getTickCount();
+			ModelStream triangulationFile(triangulation_location);
+
+			LandmarkDetector::SkipComments(triangulationFile);
+
+			int numViews;
+			triangulationFile >> numViews;
+
+			// read in the triangulations
+			triangulations.resize(numViews);
+
+			for(int i = 0; i < numViews; ++i)
+			{
+				LandmarkDetector::SkipComments(triangulationFile);
+				LandmarkDetector::ReadMat(triangulationFile, triangulations[i]);
+			}
+			ReportLoadTime("Triangulations module", triangulation_location, start_ticks);
+		});
+	}
+
+	// Initialise the patch experts (each scale is read in parallel as well)
+	module_readers.run([&](){
+		patch_experts.Read(intensity_expert_locations, depth_expert_locations, ccnf_expert_locations);
+	});
+
+	module_readers.wait();
 
 }
 
-void CLNF::Read(string main_location)
+void CLNFModel::Read(string main_location)
 {
 
 	cout << "Reading the CLNF landmark detector/tracker from: " << main_location << endl;
+	int64 start_ticks = cv::getTickCount();
 	
-	ifstream locations(main_location.c_str(), ios_base::in);
+	ModelStream locations(main_location);
 	if(!locations.is_open())
 	{
 		cout << "Couldn't open the model file, aborting" << endl;
@@ -345,6 +387,11 @@ void CLNF::Read(string main_location)
 	// Assume no eye model, unless read-in
 	eye_model = false;
 
+	// The main file is only parsed here, the modules it refers to are read in parallel afterwards
+	string clnf_location;
+	string validator_location;
+	vector<string> part_locations;
+
 	// The main file contains the references to other files
 	while (!locations.eof())
 	{ 
@@ -371,16 +418,12 @@ void CLNF::Read(string main_location)
 		location = (root / location).string();
 		if (module.compare("LandmarkDetector") == 0) 
 		{ 
-			cout << "Reading the landmark detector module from: " << location << endl;
-
-			// The CLNF module includes the PDM and the patch experts
-			Read_CLNF(location);
+			clnf_location = location;
 		}
 		else if(module.compare("LandmarkDetector_part") == 0)
 		{
 			string part_name;
 			lineStream >> part_name;
-			cout << "Reading part based module...." << part_name << endl;
 
 			vector<pair<int, int>> mappings;
 			while(!lineStream.eof())
@@ -395,9 +438,9 @@ void CLNF::Read(string main_location)
 		
 			this->hierarchical_mapping.push_back(mappings);
 
-			CLNF part_model(location);
-
-			this->hierarchical_models.push_back(part_model);
+			// The part model itself is read in later together with the other modules
+			this->hierarchical_models.push_back(std::shared_ptr<CLNFModel>());
+			part_locations.push_back(location);
 
 			this->hierarchical_model_names.push_back(part_name);
 
@@ -498,18 +541,135 @@ void CLNF::Read(string main_location)
 			}
 
 			this->hierarchical_params.push_back(params);
-
-			cout << "Done" << endl;
 		}
 		else if (module.compare("DetectionValidator") == 0)
 		{            
-			cout << "Reading the landmark validation module....";
-			landmark_validator.Read(location);
-			cout << "Done" << endl;
+			validator_location = location;
+		}
+	}
+
+	// The main model, the part models and the validator do not depend on each other, so read them concurrently
+	tbb::task_group module_readers;
+
+	if(!clnf_location.empty())
+	{
+		module_readers.run([&](){
+			// The CLNF module includes the PDM and the patch experts
+			int64 module_start_ticks = cv::getTickCount();
+			Read_CLNF(clnf_location);
+			ReportLoadTime("landmark detector module", clnf_location, module_start_ticks);
+		});
+	}
+
+	for(size_t part = 0; part < part_locations.size(); ++part)
+	{
+		module_readers.run([&, part](){
+			int64 module_start_ticks = cv::getTickCount();
+			hierarchical_models[part] = std::shared_ptr<CLNFModel>(new CLNFModel(part_locations[part]));
+			ReportLoadTime("part based module " + hierarchical_model_names[part], part_locations[part], module_start_ticks);
+		});
+	}
+
+	if(!validator_location.empty())
+	{
+		module_readers.run([&](){
+			int64 module_start_ticks = cv::getTickCount();
+			landmark_validator.Read(validator_location);
+			ReportLoadTime("landmark validation module", validator_location, module_start_ticks);
+		});
+	}
+
+	module_readers.wait();
+
+	ReportLoadTime("CLNF landmark detector/tracker", main_location, start_ticks);
+}
+
+// Precomputing the Sigmas and dfts for every window size that can be used during fitting
+void CLNFModel::WarmUp(const FaceModelParameters& params)
+{
+	// The KDE table sizes that have been built or checked during this warm up
+	std::set<int> built_sizes;
+
+	for(size_t scale = 0; scale < patch_experts.patch_scaling.size(); ++scale)
+	{
+		// Collect the window sizes that could be used at this scale (0 means the scale is skipped)
+		vector<int> window_sizes;
+		if(scale < params.window_sizes_init.size())
+			window_sizes.push_back(params.window_sizes_init[scale]);
+		if(scale < params.window_sizes_small.size())
+			window_sizes.push_back(params.window_sizes_small[scale]);
+		if(scale < params.window_sizes_current.size())
+			window_sizes.push_back(params.window_sizes_current[scale]);
+
+		std::sort(window_sizes.begin(), window_sizes.end());
+		window_sizes.erase(std::unique(window_sizes.begin(), window_sizes.end()), window_sizes.end());
+
+		// The KDE of the mean shift depends on the sigma used at this scale
+		FaceModelParameters scale_params = params;
+		AdaptParameters(scale_params, params, (int)scale);
+		float a = -0.5/(scale_params.sigma * scale_params.sigma);
+
+		for(size_t w = 0; w < window_sizes.size(); ++w)
+		{
+			if(window_sizes[w] > 0)
+			{
+				patch_experts.WarmUp((int)scale, window_sizes[w]);
+
+				// The first scale to use a window size determines its table (as when fitting the scales are visited in the same order), unless the parameters changed since the last warm up
+				if(window_sizes[w] >= (int)kde_tables.size())
+				{
+					kde_tables.resize(window_sizes[w] + 1);
+				}
+				if(kde_tables[window_sizes[w]].kde.empty() || (built_sizes.count(window_sizes[w]) == 0 && kde_tables[window_sizes[w]].a != a))
+				{
+					kde_tables[window_sizes[w]].Build(window_sizes[w], a);
+				}
+				built_sizes.insert(window_sizes[w]);
+			}
 		}
 	}
- 
-	detected_landmarks.create(2 * pdm.NumberOfPoints(), 1);
+
+	for(size_t part = 0; part < hierarchical_models.size(); ++part)
+	{
+		hierarchical_models[part]->WarmUp(hierarchical_params[part]);
+	}
+}
+
+void CLNFModel::AdaptParameters(FaceModelParameters& scale_params, const FaceModelParameters& params, int scale) const
+{
+	if(params.refine_parameters == true)
+	{
+		// Adapt the parameters based on scale (wan't to reduce regularisation as scale increases, but increa sigma and tikhonov)
+		scale_params.reg_factor = params.reg_factor - 15 * log(patch_experts.patch_scaling[scale]/0.25)/log(2);
+			
+		if(scale_params.reg_factor <= 0)
+			scale_params.reg_factor = 0.001;
+
+		scale_params.sigma = params.sigma + 0.25 * log(patch_experts.patch_scaling[scale]/0.25)/log(2);
+		scale_params.weight_factor = params.weight_factor + 2 * params.weight_factor *  log(patch_experts.patch_scaling[scale]/0.25)/log(2);
+	}
+}
+
+// Reading the model in, the tracker will refer to a freshly loaded model
+void CLNF::Read(string main_location)
+{
+	this->Read(main_location, FaceModelParameters());
+}
+
+void CLNF::Read(string main_location, const FaceModelParameters& params)
+{
+	this->model = std::shared_ptr<CLNFModel>(new CLNFModel(main_location));
+
+	// Precompute for the window sizes the model will be fitted with
+	this->model->WarmUp(params);
+
+	this->InitialiseState();
+}
+
+// Initialising the tracking state to match the (already read in) model
+void CLNF::InitialiseState()
+{
+	detected_landmarks.create(2 * model->pdm.NumberOfPoints(), 1);
 	detected_landmarks.setTo(0);
 
 	detection_success = false;
@@ -520,7 +680,7 @@ void CLNF::Read(string main_location)
 	// Initialising default values for the rest of the variables
 
 	// local parameters (shape)
-	params_local.create(pdm.NumberOfModes(), 1);
+	params_local.create(model->pdm.NumberOfModes(), 1);
 	params_local.setTo(0.0);
 
 	// global parameters (pose) [scale, euler_x, euler_y, euler_z, tx, ty]
@@ -528,6 +688,29 @@ void CLNF::Read(string main_location)
 
 	failures_in_a_row = -1;
 
+	// No frame budget until one is started
+	dropped_stages = 0;
+	frame_deadline = 0;
+	hierarchical_ticks = 0;
+	validation_ticks = 0;
+
+	// Nothing validated yet
+	skipped_validations = 0;
+	gate_samples = 0;
+	gate_change_mean = cv::Vec3d(0, 0, 0);
+	gate_change_var = cv::Vec3d(0, 0, 0);
+	ResetValidationGate();
+
+	// Every part model gets its own tracking state, referring to the shared part model
+	hierarchical_models.clear();
+	for(size_t part = 0; part < model->hierarchical_models.size(); ++part)
+	{
+		hierarchical_models.push_back(CLNF(model->hierarchical_models[part]));
+	}
+
+	// Read in a face detector
+	face_detector_HOG = dlib::get_frontal_face_detector();
+
 }
 
 // Resetting the model (for a new video, or complet reinitialisation
@@ -548,6 +731,12 @@ void CLNF::Reset()
 
 	failures_in_a_row = -1;
 	face_template = cv::Mat_<uchar>();
+
+	skipped_validations = 0;
+	gate_samples = 0;
+	gate_change_mean = cv::Vec3d(0, 0, 0);
+	gate_change_var = cv::Vec3d(0, 0, 0);
+	ResetValidationGate();
 }
 
 // Resetting the model, choosing the face nearest (x,y)
@@ -563,6 +752,56 @@ void CLNF::Reset(double x, double y)
 
 }
 
+// Start timing a frame against params.frame_budget (no deadline if it is not set)
+void CLNF::StartFrameBudget(const FaceModelParameters& params)
+{
+	dropped_stages = 0;
+
+	if(params.frame_budget > 0)
+	{
+		frame_deadline = cv::getTickCount() + (int64)(params.frame_budget * cv::getTickFrequency() / 1000.0);
+	}
+	else
+	{
+		frame_deadline = 0;
+	}
+}
+
+// Share the deadline of another tracker working on the same frame
+void CLNF::JoinFrameBudget(const CLNF& other)
+{
+	dropped_stages = 0;
+	frame_deadline = other.frame_deadline;
+}
+
+// Would a stage expected to take expected_ticks overrun the deadline of the frame
+bool CLNF::OverBudget(int64 expected_ticks) const
+{
+	return frame_deadline != 0 && cv::getTickCount() + expected_ticks > frame_deadline;
+}
+
+string CLNF::GetDroppedStages() const
+{
+	string stages;
+
+	if(dropped_stages & DROPPED_SCALES)
+		stages += "scales, ";
+	if(dropped_stages & DROPPED_ITERATIONS)
+		stages += "iterations, ";
+	if(dropped_stages & DROPPED_HIERARCHICAL)
+		stages += "hierarchical refinement, ";
+	if(dropped_stages & DROPPED_VALIDATION)
+		stages += "validation, ";
+
+	// Remove the trailing separator
+	if(!stages.empty())
+	{
+		stages.resize(stages.size() - 2);
+	}
+
+	return stages;
+}
+
 // The main internal landmark detection call (should not be used externally?)
 bool CLNF::DetectLandmarks(const cv::Mat_<uchar> &image, const cv::Mat_<float> &depth, FaceModelParameters& params)
 {
@@ -571,24 +810,34 @@ bool CLNF::DetectLandmarks(const cv::Mat_<uchar> &image, const cv::Mat_<float> &
 	bool fit_success = Fit(image, depth, params.window_sizes_current, params);
 
 	// Store the landmarks converged on in detected_landmarks
-	pdm.CalcShape2D(detected_landmarks, params_local, params_global);	
+	model->pdm.CalcShape2D(detected_landmarks, params_local, params_global);	
 	
-	if(params.refine_hierarchical && hierarchical_models.size() > 0)
+	// The optional stages are skipped if they would overrun the frame budget (going by how long they took the last time)
+	bool refine_hierarchical = params.refine_hierarchical && hierarchical_models.size() > 0;
+	if(refine_hierarchical && OverBudget(hierarchical_ticks))
 	{
+		refine_hierarchical = false;
+		dropped_stages |= DROPPED_HIERARCHICAL;
+	}
+
+	if(refine_hierarchical)
+	{
+		int64 hierarchical_start = cv::getTickCount();
+
 		bool parts_used = false;		
 
 		// Do the hierarchical models in parallel
 		tbb::parallel_for(0, (int)hierarchical_models.size(), [&](int part_model){
 		{
 			// Only do the synthetic eye models if we're doing gaze
-			if (!((hierarchical_model_names[part_model].compare("right_eye_28") == 0 ||
-			hierarchical_model_names[part_model].compare("left_eye_28") == 0)
+			if (!((model->hierarchical_model_names[part_model].compare("right_eye_28") == 0 ||
+			model->hierarchical_model_names[part_model].compare("left_eye_28") == 0)
 			&& !params.track_gaze))
 			{
 
-				int n_part_points = hierarchical_models[part_model].pdm.NumberOfPoints();
+				int n_part_points = hierarchical_models[part_model].model->pdm.NumberOfPoints();
 
-				vector<pair<int, int>> mappings = this->hierarchical_mapping[part_model];
+				vector<pair<int, int>> mappings = model->hierarchical_mapping[part_model];
 
 				cv::Mat_<double> part_model_locs(n_part_points * 2, 1, 0.0);
 
@@ -596,26 +845,32 @@ bool CLNF::DetectLandmarks(const cv::Mat_<uchar> &image, const cv::Mat_<float> &
 				for (size_t mapping_ind = 0; mapping_ind < mappings.size(); ++mapping_ind)
 				{
 					part_model_locs.at<double>(mappings[mapping_ind].second) = detected_landmarks.at<double>(mappings[mapping_ind].first);
-					part_model_locs.at<double>(mappings[mapping_ind].second + n_part_points) = detected_landmarks.at<double>(mappings[mapping_ind].first + this->pdm.NumberOfPoints());
+					part_model_locs.at<double>(mappings[mapping_ind].second + n_part_points) = detected_landmarks.at<double>(mappings[mapping_ind].first + model->pdm.NumberOfPoints());
 				}
 
 				// Fit the part based model PDM
-				hierarchical_models[part_model].pdm.CalcParams(hierarchical_models[part_model].params_global, hierarchical_models[part_model].params_local, part_model_locs);
+				hierarchical_models[part_model].model->pdm.CalcParams(hierarchical_models[part_model].params_global, hierarchical_models[part_model].params_local, part_model_locs);
 
 				// Only do this if we don't need to upsample
-				if (params_global[0] > 0.9 * hierarchical_models[part_model].patch_experts.patch_scaling[0])
+				if (params_global[0] > 0.9 * hierarchical_models[part_model].model->patch_experts.patch_scaling[0])
 				{
 					parts_used = true;
 
-					this->hierarchical_params[part_model].window_sizes_current = this->hierarchical_params[part_model].window_sizes_init;
+					// The part parameters are shared as well, so work on a copy of them
+					FaceModelParameters part_params = model->hierarchical_params[part_model];
+					part_params.window_sizes_current = part_params.window_sizes_init;
+
+					// The parts share the frame budget of the main model
+					hierarchical_models[part_model].frame_deadline = frame_deadline;
+					hierarchical_models[part_model].dropped_stages = 0;
 
 					// Do the actual landmark detection
-					hierarchical_models[part_model].DetectLandmarks(image, depth, hierarchical_params[part_model]);
+					hierarchical_models[part_model].DetectLandmarks(image, depth, part_params);
 
 				}
 				else
 				{
-					hierarchical_models[part_model].pdm.CalcShape2D(hierarchical_models[part_model].detected_landmarks, hierarchical_models[part_model].params_local, hierarchical_models[part_model].params_global);
+					hierarchical_models[part_model].model->pdm.CalcShape2D(hierarchical_models[part_model].detected_landmarks, hierarchical_models[part_model].params_local, hierarchical_models[part_model].params_global);
 				}
 			}
 		}
@@ -627,35 +882,87 @@ bool CLNF::DetectLandmarks(const cv::Mat_<uchar> &image, const cv::Mat_<float> &
 
 			for (size_t part_model = 0; part_model < hierarchical_models.size(); ++part_model)
 			{
-				vector<pair<int, int>> mappings = this->hierarchical_mapping[part_model];
+				vector<pair<int, int>> mappings = model->hierarchical_mapping[part_model];
 
-				if (!((hierarchical_model_names[part_model].compare("right_eye_28") == 0 ||
-					hierarchical_model_names[part_model].compare("left_eye_28") == 0)
+				if (!((model->hierarchical_model_names[part_model].compare("right_eye_28") == 0 ||
+					model->hierarchical_model_names[part_model].compare("left_eye_28") == 0)
 					&& !params.track_gaze))
 				{
 					// Reincorporate the models into main tracker
 					for (size_t mapping_ind = 0; mapping_ind < mappings.size(); ++mapping_ind)
 					{
 						detected_landmarks.at<double>(mappings[mapping_ind].first) = hierarchical_models[part_model].detected_landmarks.at<double>(mappings[mapping_ind].second);
-						detected_landmarks.at<double>(mappings[mapping_ind].first + pdm.NumberOfPoints()) = hierarchical_models[part_model].detected_landmarks.at<double>(mappings[mapping_ind].second + hierarchical_models[part_model].pdm.NumberOfPoints());
+						detected_landmarks.at<double>(mappings[mapping_ind].first + model->pdm.NumberOfPoints()) = hierarchical_models[part_model].detected_landmarks.at<double>(mappings[mapping_ind].second + hierarchical_models[part_model].model->pdm.NumberOfPoints());
 					}
 				}
 			}
 
-			pdm.CalcParams(params_global, params_local, detected_landmarks);		
-			pdm.CalcShape2D(detected_landmarks, params_local, params_global);
+			model->pdm.CalcParams(params_global, params_local, detected_landmarks);		
+			model->pdm.CalcShape2D(detected_landmarks, params_local, params_global);
+
+			for (size_t part_model = 0; part_model < hierarchical_models.size(); ++part_model)
+			{
+				dropped_stages |= hierarchical_models[part_model].dropped_stages;
+			}
 		}
 
+		hierarchical_ticks = cv::getTickCount() - hierarchical_start;
+	}
+
+	// The change from the last validated fit, for the temporal gating of the validation
+	bool gate_reference = params.validation_gate_every > 1 && !gate_landmarks.empty();
+	cv::Vec3d gate_change;
+	if(gate_reference)
+	{
+		gate_change = ValidationGateChange();
+	}
+
+	bool validate = params.validate_detections && fit_success;
+	bool gated = validate && gate_reference && SkipValidation(params, gate_change);
+	if(gated)
+	{
+		validate = false;
+	}
+
+	bool validation_dropped = false;
+	if(validate && OverBudget(validation_ticks))
+	{
+		validate = false;
+		validation_dropped = true;
+		dropped_stages |= DROPPED_VALIDATION;
 	}
 
 	// Check detection correctness
-	if(params.validate_detections && fit_success)
+	if(validate)
 	{
+		int64 validation_start = cv::getTickCount();
+
 		cv::Vec3d orientation(params_global[1], params_global[2], params_global[3]);
 
-		detection_certainty = landmark_validator.Check(orientation, image, detected_landmarks);
+		detection_certainty = model->landmark_validator.Check(orientation, image, detected_landmarks);
 
 		detection_success = detection_certainty < params.validation_boundary;
+
+		validation_ticks = cv::getTickCount() - validation_start;
+
+		if(params.validation_gate_every > 1)
+		{
+			UpdateValidationGate(gate_change, gate_reference, detection_success);
+		}
+	}
+	else if(gated)
+	{
+		// The fit stayed close to the last validated one, so it keeps that certainty
+		detection_success = true;
+
+		gate_frames++;
+		skipped_validations++;
+	}
+	else if(validation_dropped)
+	{
+		// The fit was not validated to stay within the budget, so rather than reporting full confidence the last validated
+		// outcome (success together with its certainty) is kept, after a Reset that is a failure
+		gate_frames++;
 	}
 	else
 	{
@@ -667,13 +974,107 @@ bool CLNF::DetectLandmarks(const cv::Mat_<uchar> &image, const cv::Mat_<float> &
 		else
 		{
 			detection_certainty = 1;
+			ResetValidationGate();
 		}
 
+		gate_frames++;
 	}
 
 	return detection_success;
 }
 
+//=============================================================================
+// The temporal gating of the validation
+cv::Vec3d CLNF::ValidationGateChange() const
+{
+	int n = model->pdm.NumberOfPoints();
+
+	double motion = 0;
+	for(int i = 0; i < n; ++i)
+	{
+		double dx = detected_landmarks.at<double>(i) - gate_landmarks.at<double>(i);
+		double dy = detected_landmarks.at<double>(i + n) - gate_landmarks.at<double>(i + n);
+		motion += std::sqrt(dx * dx + dy * dy);
+	}
+
+	// The motion is measured in reference shape units, so that it does not depend on the size of the face
+	motion = motion / (n * params_global[0]);
+
+	double rotation = cv::norm(cv::Vec3d(params_global[1] - gate_pose[1], params_global[2] - gate_pose[2], params_global[3] - gate_pose[3]));
+
+	return cv::Vec3d(gate_likelihood - model_likelihood, motion, rotation);
+}
+
+bool CLNF::SkipValidation(const FaceModelParameters& params, const cv::Vec3d& change) const
+{
+	// Only gate a successfully tracked face in video
+	if(params.validation_gate_every <= 1 || !tracking_initialised || !detection_success || gate_landmarks.empty())
+	{
+		return false;
+	}
+
+	// Validate at least every validation_gate_every frames
+	if(gate_frames + 1 >= params.validation_gate_every)
+	{
+		return false;
+	}
+
+	// Until enough changes have been seen it is not known what is normal for this face
+	const int min_gate_samples = 10;
+	if(gate_samples < min_gate_samples)
+	{
+		return false;
+	}
+
+	// Any change outside the learned bounds is an anomaly that needs validating
+	for(int c = 0; c < 3; ++c)
+	{
+		if(change[c] > gate_change_mean[c] + params.validation_gate_deviations * std::sqrt(gate_change_var[c]))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void CLNF::UpdateValidationGate(const cv::Vec3d& change, bool has_change, bool success)
+{
+	if(!success)
+	{
+		ResetValidationGate();
+		return;
+	}
+
+	if(has_change)
+	{
+		// Running statistics, averaging the first changes equally and then following slow variations in the video
+		gate_samples++;
+		double alpha = 1.0 / std::min(gate_samples, 100);
+
+		for(int c = 0; c < 3; ++c)
+		{
+			double diff = change[c] - gate_change_mean[c];
+			gate_change_mean[c] += alpha * diff;
+			gate_change_var[c] = (1.0 - alpha) * (gate_change_var[c] + alpha * diff * diff);
+		}
+	}
+
+	gate_landmarks = detected_landmarks.clone();
+	gate_pose = params_global;
+	gate_likelihood = model_likelihood;
+	gate_frames = 0;
+}
+
+void CLNF::ResetValidationGate()
+{
+	// The learned statistics are kept, as they describe how the face moves in this video (Reset clears them)
+	gate_landmarks = cv::Mat_<double>();
+	gate_pose = cv::Vec6d(1, 0, 0, 0, 0, 0);
+	gate_likelihood = model_likelihood;
+	gate_frames = 0;
+}
+
 //=============================================================================
 bool CLNF::Fit(const cv::Mat_<uchar>& im, const cv::Mat_<float>& depthImg, const std::vector<int>& window_sizes, const FaceModelParameters& parameters)
 {
@@ -681,9 +1082,9 @@ bool CLNF::Fit(const cv::Mat_<uchar>& im, const cv::Mat_<float>& depthImg, const
 	assert(im.channels() == 1);	
 	
 	// Placeholder for the landmarks
-	cv::Mat_<double> current_shape(2 * pdm.NumberOfPoints() , 1, 0.0);
+	cv::Mat_<double> current_shape(2 * model->pdm.NumberOfPoints() , 1, 0.0);
 
-	int n = pdm.NumberOfPoints(); 
+	int n = model->pdm.NumberOfPoints(); 
 	
 	cv::Mat_<float> depth_img_no_background;
 	
@@ -699,7 +1100,7 @@ bool CLNF::Fit(const cv::Mat_<uchar>& im, const cv::Mat_<float>& depthImg, const
 		}
 	}
 
-	int num_scales = patch_experts.patch_scaling.size();
+	int num_scales = model->patch_experts.patch_scaling.size();
 
 	// Storing the patch expert response maps
 	vector<cv::Mat_<float> > patch_expert_responses(n);
@@ -710,49 +1111,50 @@ bool CLNF::Fit(const cv::Mat_<uchar>& im, const cv::Mat_<float>& depthImg, const
 
 	FaceModelParameters tmp_parameters = parameters;
 
+	// How long the last fitted scale took, to know if another one fits in the frame budget (the first one is always done)
+	int64 scale_ticks = -1;
+
 	// Optimise the model across a number of areas of interest (usually in descending window size and ascending scale size)
 	for(int scale = 0; scale < num_scales; scale++)
 	{
 
 		int window_size = window_sizes[scale];
 
-		if(window_size == 0 ||  0.9 * patch_experts.patch_scaling[scale] > params_global[0])
+		if(window_size == 0 ||  0.9 * model->patch_experts.patch_scaling[scale] > params_global[0])
 			continue;
 
+		if(scale_ticks >= 0 && OverBudget(scale_ticks))
+		{
+			dropped_stages |= DROPPED_SCALES;
+			break;
+		}
+
+		int64 scale_start = cv::getTickCount();
+
 		// The patch expert response computation
 		if(scale != window_sizes.size() - 1)
 		{
-			patch_experts.Response(patch_expert_responses, sim_ref_to_img, sim_img_to_ref, im, depth_img_no_background, pdm, params_global, params_local, window_size, scale);
+			model->patch_experts.Response(patch_expert_responses, sim_ref_to_img, sim_img_to_ref, im, depth_img_no_background, model->pdm, params_global, params_local, window_size, scale, patch_workspace);
 		}
 		else
 		{
 			// Do not use depth for the final iteration as it is not as accurate
-			patch_experts.Response(patch_expert_responses, sim_ref_to_img, sim_img_to_ref, im, cv::Mat(), pdm, params_global, params_local, window_size, scale);
+			model->patch_experts.Response(patch_expert_responses, sim_ref_to_img, sim_img_to_ref, im, cv::Mat(), model->pdm, params_global, params_local, window_size, scale, patch_workspace);
 		}
 		
-		if(parameters.refine_parameters == true)
-		{
-			// Adapt the parameters based on scale (wan't to reduce regularisation as scale increases, but increa sigma and tikhonov)
-			tmp_parameters.reg_factor = parameters.reg_factor - 15 * log(patch_experts.patch_scaling[scale]/0.25)/log(2);
-			
-			if(tmp_parameters.reg_factor <= 0)
-				tmp_parameters.reg_factor = 0.001;
-
-			tmp_parameters.sigma = parameters.sigma + 0.25 * log(patch_experts.patch_scaling[scale]/0.25)/log(2);
-			tmp_parameters.weight_factor = parameters.weight_factor + 2 * parameters.weight_factor *  log(patch_experts.patch_scaling[scale]/0.25)/log(2);
-		}
+		model->AdaptParameters(tmp_parameters, parameters, scale);
 
 		// Get the current landmark locations
-		pdm.CalcShape2D(current_shape, params_local, params_global);
+		model->pdm.CalcShape2D(current_shape, params_local, params_global);
 
 		// Get the view used by patch experts
-		int view_id = patch_experts.GetViewIdx(params_global, scale);
+		int view_id = model->patch_experts.GetViewIdx(params_global, scale);
 
 		// the actual optimisation step
-		this->NU_RLMS(params_global, params_local, patch_expert_responses, cv::Vec6d(params_global), params_local.clone(), current_shape, sim_img_to_ref, sim_ref_to_img, window_size, view_id, true, scale, this->landmark_likelihoods, tmp_parameters);
+		this->NU_RLMS(params_global, params_local, patch_expert_responses, cv::Vec6d(params_global), params_local, current_shape, sim_img_to_ref, sim_ref_to_img, window_size, view_id, true, scale, this->landmark_likelihoods, tmp_parameters);
 
 		// non-rigid optimisation
-		this->model_likelihood = this->NU_RLMS(params_global, params_local, patch_expert_responses, cv::Vec6d(params_global), params_local.clone(), current_shape, sim_img_to_ref, sim_ref_to_img, window_size, view_id, false, scale, this->landmark_likelihoods, tmp_parameters);
+		this->model_likelihood = this->NU_RLMS(params_global, params_local, patch_expert_responses, cv::Vec6d(params_global), params_local, current_shape, sim_img_to_ref, sim_ref_to_img, window_size, view_id, false, scale, this->landmark_likelihoods, tmp_parameters);
 		
 		// Can't track very small images reliably (less than ~30px across)
 		if(params_global[0] < 0.25)
@@ -760,63 +1162,141 @@ bool CLNF::Fit(const cv::Mat_<uchar>& im, const cv::Mat_<float>& depthImg, const
 			cout << "Face too small for landmark detection" << endl;
 			return false;
 		}
+
+		scale_ticks = cv::getTickCount() - scale_start;
 	}
 
 	return true;
 }
 
-void CLNF::NonVectorisedMeanShift_precalc_kde(cv::Mat_<float>& out_mean_shifts, const vector<cv::Mat_<float> >& patch_expert_responses, const cv::Mat_<float> &dxs, const cv::Mat_<float> &dys, int resp_size, float a, int scale, int view_id, map<int, cv::Mat_<float> >& kde_resp_precalc)
+const float KDE_table::step = 0.1f;
+
+void KDE_table::Build(int resp_size, float a)
 {
-	
-	int n = dxs.rows;
-	
-	cv::Mat_<float> kde_resp;
-	float step_size = 0.1;
+	this->a = a;
+
+	int bins = (int)(resp_size / step + 0.5); // Plus 0.5 is there, as C++ rounds down with int cast
+
+	kde.create(bins * bins, resp_size * resp_size);
 
-	// if this has not been precomputer, precompute it, otherwise use it
-	if(kde_resp_precalc.find(resp_size) == kde_resp_precalc.end())
-	{		
-		kde_resp = cv::Mat_<float>((int)((resp_size / step_size)*(resp_size/step_size)), resp_size * resp_size);
-		cv::MatIterator_<float> kde_it = kde_resp.begin();
+	// Every row is independent, so the sub-pixel x locations can be filled in parallel
+	tbb::parallel_for(0, bins, [&](int x){
 
-		for(int x = 0; x < resp_size/step_size; x++)
+		float dx = x * step;
+
+		cv::MatIterator_<float> kde_it = kde.begin() + kde.cols * x * bins;
+
+		for(int y = 0; y < bins; y++)
 		{
-			float dx = x * step_size;
-			for(int y = 0; y < resp_size/step_size; y++)
-			{
-				float dy = y * step_size;
+			float dy = y * step;
 
-				int ii,jj;
-				float v,vx,vy;
+			int ii,jj;
+			float v,vx,vy;
 			
-				for(ii = 0; ii < resp_size; ii++)
+			for(ii = 0; ii < resp_size; ii++)
+			{
+				vx = (dy-ii)*(dy-ii);
+				for(jj = 0; jj < resp_size; jj++)
 				{
-					vx = (dy-ii)*(dy-ii);
-					for(jj = 0; jj < resp_size; jj++)
-					{
-						vy = (dx-jj)*(dx-jj);
+					vy = (dx-jj)*(dx-jj);
 
-						// the KDE evaluation of that point
-						v = exp(a*(vx+vy));
+					// the KDE evaluation of that point
+					v = exp(a*(vx+vy));
 						
-						*kde_it++ = v;
-					}
+					*kde_it++ = v;
 				}
 			}
 		}
+	});
+}
 
-		kde_resp_precalc[resp_size] = kde_resp.clone();
+// Evaluating the KDE kernel centred at (dx, dy) over the response map directly, for when there is no suitable precalculated row
+static void KDEKernel(float* kernel, int resp_size, float dx, float dy, float a)
+{
+	for(int ii = 0; ii < resp_size; ii++)
+	{
+		float vx = (dy-ii)*(dy-ii);
+		for(int jj = 0; jj < resp_size; jj++)
+		{
+			float vy = (dx-jj)*(dx-jj);
+			*kernel++ = exp(a*(vx+vy));
+		}
 	}
-	else
+}
+
+// The sum of the response weighted by the kernel, and the same weighted by the column (mx) and row (my) coordinates
+static void KDEMoments(const cv::Mat_<float>& response, const float* kernel, float& sum, float& mx, float& my)
+{
+	int resp_size = response.cols;
+
+	sum = 0;
+	mx = 0;
+	my = 0;
+
+#if CV_SIMD128
+	cv::v_float32x4 v_sum = cv::v_setzero_f32(), v_mx = cv::v_setzero_f32(), v_my = cv::v_setzero_f32();
+	const cv::v_float32x4 v_four = cv::v_setall_f32(4.0f);
+#endif
+
+	for(int ii = 0; ii < response.rows; ii++, kernel += resp_size)
 	{
-		// use the precomputed version
-		kde_resp = kde_resp_precalc.find(resp_size)->second;
+		const float* p = response[ii];
+		int jj = 0;
+
+#if CV_SIMD128
+		cv::v_float32x4 v_jj(0.0f, 1.0f, 2.0f, 3.0f);
+		cv::v_float32x4 v_ii = cv::v_setall_f32((float)ii);
+
+		for(; jj <= resp_size - 4; jj += 4)
+		{
+			// the KDE evaluation of that point multiplied by the probability at the current, xi, yi
+			cv::v_float32x4 v = cv::v_load(p + jj) * cv::v_load(kernel + jj);
+
+			v_sum = v_sum + v;
+			v_mx = v_mx + v * v_jj;
+			v_my = v_my + v * v_ii;
+
+			v_jj = v_jj + v_four;
+		}
+#endif
+		for(; jj < resp_size; jj++)
+		{
+			float v = p[jj] * kernel[jj];
+
+			sum += v;
+			mx += v*jj;
+			my += v*ii;
+		}
 	}
 
+#if CV_SIMD128
+	sum += cv::v_reduce_sum(v_sum);
+	mx += cv::v_reduce_sum(v_mx);
+	my += cv::v_reduce_sum(v_my);
+#endif
+}
+
+void CLNF::MeanShift_precalc_kde(cv::Mat_<float>& out_mean_shifts, const vector<cv::Mat_<float> >& patch_expert_responses, const cv::Mat_<float> &dxs, const cv::Mat_<float> &dys, int resp_size, float a, int scale, int view_id)
+{
+	
+	int n = dxs.rows;
+	
+	float step_size = KDE_table::step;
+
+	// Use the table precalculated in WarmUp if it was built for this response size and kernel, otherwise the kernels are evaluated for this call only
+	const KDE_table* table = 0;
+	if(resp_size < (int)model->kde_tables.size() && !model->kde_tables[resp_size].kde.empty() && model->kde_tables[resp_size].a == a)
+	{
+		table = &model->kde_tables[resp_size];
+	}
+
+	// Only allocated if a kernel needs to be evaluated directly
+	cv::Mat_<float> kernel;
+
 	// for every point (patch) calculating mean-shift
 	for(int i = 0; i < n; i++)
 	{
-		if(patch_experts.visibilities[scale][view_id].at<int>(i,0) == 0)
+		if(model->patch_experts.visibilities[scale][view_id].at<int>(i,0) == 0)
 		{
 			out_mean_shifts.at<float>(i,0) = 0;
 			out_mean_shifts.at<float>(i+n,0) = 0;
@@ -837,37 +1317,27 @@ void CLNF::NonVectorisedMeanShift_precalc_kde(cv::Mat_<float>& out_mean_shifts,
 		if(dy > resp_size - step_size)
 			dy = resp_size - step_size;
 		
-		// Pick the row from precalculated kde that approximates the current dx, dy best		
-		int closest_col = (int)(dy /step_size + 0.5); // Plus 0.5 is there, as C++ rounds down with int cast
-		int closest_row = (int)(dx /step_size + 0.5); // Plus 0.5 is there, as C++ rounds down with int cast
-		
-		int idx = closest_row * ((int)(resp_size/step_size + 0.5)) + closest_col; // Plus 0.5 is there, as C++ rounds down with int cast
+		const float* kde;
 
-		cv::MatIterator_<float> kde_it = kde_resp.begin() + kde_resp.cols*idx;
+		if(table)
+		{
+			// Pick the row from precalculated kde that approximates the current dx, dy best		
+			int closest_col = (int)(dy /step_size + 0.5); // Plus 0.5 is there, as C++ rounds down with int cast
+			int closest_row = (int)(dx /step_size + 0.5); // Plus 0.5 is there, as C++ rounds down with int cast
 		
-		float mx=0.0;
-		float my=0.0;
-		float sum=0.0;
+			int idx = closest_row * ((int)(resp_size/step_size + 0.5)) + closest_col; // Plus 0.5 is there, as C++ rounds down with int cast
 
-		// Iterate over the patch responses here
-		cv::MatConstIterator_<float> p = patch_expert_responses[i].begin();
-			
-		for(int ii = 0; ii < resp_size; ii++)
+			kde = table->kde[idx];
+		}
+		else
 		{
-			for(int jj = 0; jj < resp_size; jj++)
-			{
-
-				// the KDE evaluation of that point multiplied by the probability at the current, xi, yi
-				float v = (*p++) * (*kde_it++);
-
-				sum += v;
-
-				// mean shift in x and y
-				mx += v*jj;
-				my += v*ii; 
-
-			}
+			kernel.create(resp_size, resp_size);
+			KDEKernel(kernel[0], resp_size, dx, dy, a);
+			kde = kernel[0];
 		}
+
+		float mx, my, sum;
+		KDEMoments(patch_expert_responses[i], kde, sum, mx, my);
 		
 		float msx = (mx/sum - dx);
 		float msy = (my/sum - dy);
@@ -881,42 +1351,62 @@ void CLNF::NonVectorisedMeanShift_precalc_kde(cv::Mat_<float>& out_mean_shifts,
 
 void CLNF::GetWeightMatrix(cv::Mat_<float>& WeightMatrix, int scale, int view_id, const FaceModelParameters& parameters)
 {
-	int n = pdm.NumberOfPoints();  
+	int n = model->pdm.NumberOfPoints();  
 
 	// Is the weight matrix needed at all
 	if(parameters.weight_factor > 0)
 	{
+		cv::Mat_<float> weights;
+		GetLandmarkWeights(weights, scale, view_id, parameters);
+
 		WeightMatrix = cv::Mat_<float>::zeros(n*2, n*2);
 
 		for (int p=0; p < n; p++)
 		{
-			if(!patch_experts.ccnf_expert_intensity.empty())
-			{
+			// the same weight for the x and y dimensions
+			WeightMatrix.at<float>(p,p) = weights.at<float>(p,0);
+			WeightMatrix.at<float>(p+n,p+n) = weights.at<float>(p,0);
+		}
+	}
+	else
+	{
+		WeightMatrix = cv::Mat_<float>::eye(n*2, n*2);
+	}
 
-				// for the x dimension
-				WeightMatrix.at<float>(p,p) = WeightMatrix.at<float>(p,p)  + patch_experts.ccnf_expert_intensity[scale][view_id][p].patch_confidence;
-				
-				// for they y dimension
-				WeightMatrix.at<float>(p+n,p+n) = WeightMatrix.at<float>(p,p);
+}
+
+void CLNF::GetLandmarkWeights(cv::Mat_<float>& weights, int scale, int view_id, const FaceModelParameters& parameters)
+{
+	int n = model->pdm.NumberOfPoints();  
+
+	// A no-op if already allocated
+	weights.create(n, 1);
+
+	// Is the weighting needed at all
+	if(parameters.weight_factor > 0)
+	{
+		for (int p=0; p < n; p++)
+		{
+			float confidence = 0;
 
+			if(!model->patch_experts.ccnf_expert_intensity.empty())
+			{
+				confidence = (float)model->patch_experts.ccnf_expert_intensity[scale][view_id][p].patch_confidence;
 			}
 			else
 			{
 				// Across the modalities add the confidences
-				for(size_t pc=0; pc < patch_experts.svr_expert_intensity[scale][view_id][p].svr_patch_experts.size(); pc++)
+				for(size_t pc=0; pc < model->patch_experts.svr_expert_intensity[scale][view_id][p].svr_patch_experts.size(); pc++)
 				{
-					// for the x dimension
-					WeightMatrix.at<float>(p,p) = WeightMatrix.at<float>(p,p)  + patch_experts.svr_expert_intensity[scale][view_id][p].svr_patch_experts.at(pc).confidence;
+					confidence = confidence + (float)model->patch_experts.svr_expert_intensity[scale][view_id][p].svr_patch_experts.at(pc).confidence;
 				}	
-				// for the y dimension
-				WeightMatrix.at<float>(p+n,p+n) = WeightMatrix.at<float>(p,p);
 			}
+			weights.at<float>(p,0) = (float)parameters.weight_factor * confidence;
 		}
-		WeightMatrix = parameters.weight_factor * WeightMatrix;
 	}
 	else
 	{
-		WeightMatrix = cv::Mat_<float>::eye(n*2, n*2);
+		weights.setTo(1);
 	}
 
 }
@@ -927,14 +1417,19 @@ double CLNF::NU_RLMS(cv::Vec6d& final_global, cv::Mat_<double>& final_local, con
 				  const FaceModelParameters& parameters)
 {		
 
-	int n = pdm.NumberOfPoints();  
+	if(parameters.fast_rlms)
+	{
+		return NU_RLMS_float(final_global, final_local, patch_expert_responses, initial_global, initial_local, base_shape, sim_img_to_ref, sim_ref_to_img, resp_size, view_id, rigid, scale, landmark_lhoods, parameters);
+	}
+
+	int n = model->pdm.NumberOfPoints();  
 	
 	// Mean, eigenvalues, eigenvectors
-	cv::Mat_<double> M = this->pdm.mean_shape;
-	cv::Mat_<double> E = this->pdm.eigen_values;
-	//Mat_<double> V = this->pdm.princ_comp;
+	cv::Mat_<double> M = model->pdm.mean_shape;
+	cv::Mat_<double> E = model->pdm.eigen_values;
+	//Mat_<double> V = model->pdm.princ_comp;
 
-	int m = pdm.NumberOfModes();
+	int m = model->pdm.NumberOfModes();
 	
 	cv::Vec6d current_global(initial_global);
 
@@ -967,13 +1462,20 @@ double CLNF::NU_RLMS(cv::Vec6d& final_global, cv::Mat_<double>& final_local, con
 	cv::Mat_<float> dxs, dys;
 	
 	// The preallocated memory for the mean shifts
-	cv::Mat_<float> mean_shifts(2 * pdm.NumberOfPoints(), 1, 0.0);
+	cv::Mat_<float> mean_shifts(2 * model->pdm.NumberOfPoints(), 1, 0.0);
 
 	// Number of iterations
 	for(int iter = 0; iter < parameters.num_optimisation_iteration; iter++)
 	{
+		// Out of the frame budget, keep the estimate of the iterations done so far
+		if(iter > 0 && OverBudget())
+		{
+			dropped_stages |= DROPPED_ITERATIONS;
+			break;
+		}
+
 		// get the current estimates of x
-		pdm.CalcShape2D(current_shape, current_local, current_global);
+		model->pdm.CalcShape2D(current_shape, current_local, current_global);
 		
 		if(iter > 0)
 		{
@@ -992,11 +1494,11 @@ double CLNF::NU_RLMS(cv::Vec6d& final_global, cv::Mat_<double>& final_local, con
 		// calculate the appropriate Jacobians in 2D, even though the actual behaviour is in 3D, using small angle approximation and oriented shape
 		if(rigid)
 		{
-			pdm.ComputeRigidJacobian(current_local, current_global, J, WeightMatrix, J_w_t);
+			model->pdm.ComputeRigidJacobian(current_local, current_global, J, WeightMatrix, J_w_t);
 		}
 		else
 		{
-			pdm.ComputeJacobian(current_local, current_global, J, WeightMatrix, J_w_t);
+			model->pdm.ComputeJacobian(current_local, current_global, J, WeightMatrix, J_w_t);
 		}
 		
 		// useful for mean shift calculation
@@ -1011,7 +1513,7 @@ double CLNF::NU_RLMS(cv::Vec6d& final_global, cv::Mat_<double>& final_local, con
 		dxs = offsets.col(0) + (resp_size-1)/2;
 		dys = offsets.col(1) + (resp_size-1)/2;
 		
-		NonVectorisedMeanShift_precalc_kde(mean_shifts, patch_expert_responses, dxs, dys, resp_size, a, scale, view_id, kde_resp_precalc);
+		MeanShift_precalc_kde(mean_shifts, patch_expert_responses, dxs, dys, resp_size, a, scale, view_id);
 
 		// Now transform the mean shifts to the the image reference frame, as opposed to one of ref shape (object space)
 		cv::Mat_<float> mean_shifts_2D = (mean_shifts.reshape(1, 2)).t();
@@ -1023,7 +1525,7 @@ double CLNF::NU_RLMS(cv::Vec6d& final_global, cv::Mat_<double>& final_local, con
 		for(int i = 0; i < n; ++i)
 		{
 			// if patch unavailable for current index
-			if(patch_experts.visibilities[scale][view_id].at<int>(i,0) == 0)
+			if(model->patch_experts.visibilities[scale][view_id].at<int>(i,0) == 0)
 			{				
 				cv::Mat Jx = J.row(i);
 				Jx = cvScalar(0);
@@ -1054,66 +1556,223 @@ double CLNF::NU_RLMS(cv::Vec6d& final_global, cv::Mat_<double>& final_local, con
 		cv::solve(Hessian, J_w_t_m, param_update, CV_CHOLESKY);
 		
 		// update the reference
-		pdm.UpdateModelParameters(param_update, current_local, current_global);		
+		model->pdm.UpdateModelParameters(param_update, current_local, current_global);		
 		
 		// clamp to the local parameters for valid expressions
-		pdm.Clamp(current_local, current_global, parameters);
+		model->pdm.Clamp(current_local, current_global, parameters);
 
 	}
 
 	// compute the log likelihood
+	float a = -0.5/(parameters.sigma * parameters.sigma);
+	double loglhood = LandmarkLikelihoods(landmark_lhoods, patch_expert_responses, dxs, dys, resp_size, a, scale, view_id);
+
+	final_global = current_global;
+	final_local = current_local;
+
+	return loglhood;
+
+}
+
+double CLNF::LandmarkLikelihoods(cv::Mat_<double>& landmark_lhoods, const vector<cv::Mat_<float> >& patch_expert_responses, const cv::Mat_<float> &dxs, const cv::Mat_<float> &dys, int resp_size, float a, int scale, int view_id)
+{
+
+	int n = model->pdm.NumberOfPoints();
+
 	double loglhood = 0;
 	
 	landmark_lhoods = cv::Mat_<double>(n, 1, -1e8);
+
+	// The kernel is evaluated at the exact offsets rather than taken from the KDE table, as the likelihoods are compared between fits
+	cv::Mat_<float> kernel(resp_size, resp_size);
 	
 	for(int i = 0; i < n; i++)
 	{
 
-		if(patch_experts.visibilities[scale][view_id].at<int>(i,0) == 0 )
+		if(model->patch_experts.visibilities[scale][view_id].at<int>(i,0) == 0 )
 		{
 			continue;
 		}
-		float dx = dxs.at<float>(i);
-		float dy = dys.at<float>(i);
 
-		int ii,jj;
-		float v,vx,vy,sum=0.0;
+		KDEKernel(kernel[0], resp_size, dxs.at<float>(i), dys.at<float>(i), a);
 
-		// Iterate over the patch responses here
-		cv::MatConstIterator_<float> p = patch_expert_responses[i].begin();
-			
-		for(ii = 0; ii < resp_size; ii++)
+		float sum, mx, my;
+		KDEMoments(patch_expert_responses[i], kernel[0], sum, mx, my);
+
+		landmark_lhoods.at<double>(i,0) = (double)sum;
+
+		// the offset is there for numerical stability
+		loglhood += log(sum + 1e-8);
+
+	}	
+	loglhood = loglhood/sum(model->patch_experts.visibilities[scale][view_id])[0];
+
+	return loglhood;
+
+}
+
+void RLMS_workspace::Allocate(int n, int m)
+{
+	current_local.create(m, 1);
+	shape_3D.create(3 * n, 1);
+	current_shape.create(2 * n, 1);
+	previous_shape.create(2 * n, 1);
+
+	dxs.create(n, 1);
+	dys.create(n, 1);
+	mean_shifts.create(2 * n, 1);
+
+	weights.create(n, 1);
+	regularisation.create(m, 1);
+
+	jacobian_rows.create(2, 6 + m);
+	hessian.create(6 + m, 6 + m);
+	J_w_t_m.create(6 + m, 1);
+}
+
+double CLNF::NU_RLMS_float(cv::Vec6d& final_global, cv::Mat_<double>& final_local, const vector<cv::Mat_<float> >& patch_expert_responses, const cv::Vec6d& initial_global, const cv::Mat_<double>& initial_local,
+	const cv::Mat_<double>& base_shape, const cv::Matx22d& sim_img_to_ref, const cv::Matx22f& sim_ref_to_img, int resp_size, int view_id, bool rigid, int scale, cv::Mat_<double>& landmark_lhoods,
+	const FaceModelParameters& parameters)
+{
+
+	const PDM& pdm = model->pdm;
+
+	int n = pdm.NumberOfPoints();
+	int m = pdm.NumberOfModes();
+
+	// The number of parameters being optimised
+	int d = rigid ? 6 : 6 + m;
+
+	// Only allocates on the first call (or if the model changed)
+	RLMS_workspace& ws = this->rlms_workspace;
+	ws.Allocate(n, m);
+
+	// The initial local parameters are copied first, so they are allowed to alias the final ones
+	cv::Vec6d current_global(initial_global);
+	initial_local.convertTo(ws.current_local, CV_32F);
+
+	// Setting the regularisation to the inverse of eigenvalues
+	if(!rigid)
+	{
+		for(int j = 0; j < m; ++j)
 		{
-			vx = (dy-ii)*(dy-ii);
-			for(jj = 0; jj < resp_size; jj++)
-			{
-				vy = (dx-jj)*(dx-jj);
+			ws.regularisation(j, 0) = (float)(parameters.reg_factor / pdm.eigen_values.at<double>(j));
+		}
+	}
 
-				// the probability at the current, xi, yi
-				v = *p++;
+	// The landmarks without a patch expert get a zero weight, which removes them from the normal equations
+	GetLandmarkWeights(ws.weights, scale, view_id, parameters);
 
-				// the KDE evaluation of that point
-				v *= exp(-0.5*(vx+vy)/(parameters.sigma * parameters.sigma));
+	for(int i = 0; i < n; ++i)
+	{
+		if(model->patch_experts.visibilities[scale][view_id].at<int>(i,0) == 0)
+		{
+			ws.weights(i, 0) = 0;
+		}
+	}
 
-				sum += v;
+	// useful for mean shift calculation
+	float a = -0.5/(parameters.sigma * parameters.sigma);
+
+	cv::Matx22f img_to_ref = sim_img_to_ref;
+	float half_resp = (float)((resp_size-1)/2);
+
+	const double* base_x = base_shape.ptr<double>();
+	const double* base_y = base_x + n;
+
+	float* dxs = ws.dxs[0];
+	float* dys = ws.dys[0];
+	float* ms_x = ws.mean_shifts[0];
+	float* ms_y = ms_x + n;
+
+	for(int iter = 0; iter < parameters.num_optimisation_iteration; iter++)
+	{
+		// Out of the frame budget, keep the estimate of the iterations done so far
+		if(iter > 0 && OverBudget())
+		{
+			dropped_stages |= DROPPED_ITERATIONS;
+			break;
+		}
+
+		// get the current estimates of x
+		pdm.CalcShape2D(ws.current_shape, ws.shape_3D, ws.current_local, current_global);
+
+		if(iter > 0)
+		{
+			// if the shape hasn't changed terminate
+			if(cv::norm(ws.current_shape, ws.previous_shape) < 0.01)
+			{				
+				break;
 			}
 		}
-		landmark_lhoods.at<double>(i,0) = (double)sum;
 
-		// the offset is there for numerical stability
-		loglhood += log(sum + 1e-8);
+		ws.current_shape.copyTo(ws.previous_shape);
 
-	}	
-	loglhood = loglhood/sum(patch_experts.visibilities[scale][view_id])[0];
+		// The locations of the current landmarks in the response maps
+		const float* shape_x = ws.current_shape[0];
+		const float* shape_y = shape_x + n;
+
+		for(int i = 0; i < n; ++i)
+		{
+			float off_x = shape_x[i] - (float)base_x[i];
+			float off_y = shape_y[i] - (float)base_y[i];
+
+			dxs[i] = img_to_ref(0,0) * off_x + img_to_ref(0,1) * off_y + half_resp;
+			dys[i] = img_to_ref(1,0) * off_x + img_to_ref(1,1) * off_y + half_resp;
+		}
+
+		MeanShift_precalc_kde(ws.mean_shifts, patch_expert_responses, ws.dxs, ws.dys, resp_size, a, scale, view_id);
+
+		// Now transform the mean shifts to the the image reference frame, as opposed to one of ref shape (object space)
+		for(int i = 0; i < n; ++i)
+		{
+			float msx = ms_x[i];
+			float msy = ms_y[i];
+
+			ms_x[i] = sim_ref_to_img(0,0) * msx + sim_ref_to_img(0,1) * msy;
+			ms_y[i] = sim_ref_to_img(1,0) * msx + sim_ref_to_img(1,1) * msy;
+		}
+
+		// The Hessian approximation J'WJ and the projection of the mean shifts J'W * v, accumulated without forming the Jacobian
+		pdm.ComputeNormalEquations(ws.shape_3D, current_global, ws.weights, ws.mean_shifts, rigid, ws.jacobian_rows, ws.hessian, ws.J_w_t_m);
+
+		// Add the regularisation term and the Tikhonov regularisation
+		if(!rigid)
+		{
+			for(int j = 0; j < m; ++j)
+			{
+				float reg = ws.regularisation(j, 0);
+				ws.J_w_t_m(6 + j, 0) -= reg * ws.current_local(j, 0);
+				ws.hessian(6 + j, 6 + j) += reg;
+			}
+		}
+
+		// Solve for the parameter update in place (only the lower triangle of the Hessian is used), the update is left in J_w_t_m
+		if(!cv::Cholesky(ws.hessian[0], ws.hessian.step, d, ws.J_w_t_m[0], ws.J_w_t_m.step, 1))
+		{
+			// Same as a zero update of the reference optimiser
+			break;
+		}
+
+		// update the reference
+		cv::Mat_<float> param_update = ws.J_w_t_m.rowRange(0, d);
+		pdm.UpdateModelParameters(param_update, ws.current_local, current_global);
+
+		// clamp to the local parameters for valid expressions
+		pdm.Clamp(ws.current_local, current_global, parameters);
+
+	}
+
+	// compute the log likelihood
+	double loglhood = LandmarkLikelihoods(landmark_lhoods, patch_expert_responses, ws.dxs, ws.dys, resp_size, a, scale, view_id);
 
 	final_global = current_global;
-	final_local = current_local;
+	ws.current_local.convertTo(final_local, CV_64F);
 
 	return loglhood;
 
 }
 
-
 bool CLNF::RemoveBackground(cv::Mat_<float>& out_depth_image, const cv::Mat_<float>& depth_image)
 {
 	// use the current estimate of the face location to determine what is foreground and background
@@ -1129,11 +1788,11 @@ bool CLNF::RemoveBackground(cv::Mat_<float>& out_depth_image, const cv::Mat_<flo
 
 	cv::Mat_<double> current_shape;
 
-	pdm.CalcShape2D(current_shape, params_local, params_global);
+	model->pdm.CalcShape2D(current_shape, params_local, params_global);
 
 	double min_x, max_x, min_y, max_y;
 
-	int n = this->pdm.NumberOfPoints();
+	int n = model->pdm.NumberOfPoints();
 
 	cv::minMaxLoc(current_shape(cv::Range(0, n), cv::Range(0,1)), &min_x, &max_x);
 	cv::minMaxLoc(current_shape(cv::Range(n, n*2), cv::Range(0,1)), &min_y, &max_y);
@@ -1209,7 +1868,7 @@ cv::Mat_<double> CLNF::GetShape(double fx, double fy, double cx, double cy) cons
 
 	cv::Mat_<double> shape3d(n*3, 1);
 
-	this->pdm.CalcShape3D(shape3d, this->params_local);
+	model->pdm.CalcShape3D(shape3d, this->params_local);
 	
 	// Need to rotate the shape to get the actual 3D representation
 	
@@ -1269,7 +1928,7 @@ void CLNF::NonVectorisedMeanShift(cv::Mat_<double>& out_mean_shifts, const vecto
 	for(int i = 0; i < n; i++)
 	{
 
-		if(patch_experts.visibilities[scale][view_id].at<int>(i,0) == 0  || sum(patch_expert_responses[i])[0] == 0)
+		if(model->patch_experts.visibilities[scale][view_id].at<int>(i,0) == 0  || sum(patch_expert_responses[i])[0] == 0)
 		{
 			out_mean_shifts.at<double>(i,0) = 0;
 			out_mean_shifts.at<double>(i+n,0) = 0;
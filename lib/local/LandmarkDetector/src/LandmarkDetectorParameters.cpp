@@ -35,6 +35,7 @@
 #include "stdafx.h"
 
 #include "LandmarkDetectorParameters.h"
+#include "ModelBundle.h"
 
 // Boost includes
 #include <filesystem.hpp>
@@ -83,6 +84,13 @@ FaceModelParameters::FaceModelParameters(vector<string> &arguments)
 			i++;
 
 		}
+		if (arguments[i].compare("-bundle") == 0)
+		{
+			bundle_location = arguments[i + 1];
+			valid[i] = false;
+			valid[i + 1] = false;
+			i++;
+		}
 		if (arguments[i].compare("-fdloc") ==0)
 		{
 			string face_detector_loc = arguments[i + 1];
@@ -128,6 +136,33 @@ FaceModelParameters::FaceModelParameters(vector<string> &arguments)
 			valid[i + 1] = false;
 			i++;
 		}
+		else if (arguments[i].compare("-hypothesis_pruning") == 0)
+		{
+			stringstream data(arguments[i + 1]);
+			data >> hypothesis_pruning;
+
+			valid[i] = false;
+			valid[i + 1] = false;
+			i++;
+		}
+		else if (arguments[i].compare("-min_face_size") == 0)
+		{
+			stringstream data(arguments[i + 1]);
+			data >> min_face_size;
+
+			valid[i] = false;
+			valid[i + 1] = false;
+			i++;
+		}
+		else if (arguments[i].compare("-full_redetection_every") == 0)
+		{
+			stringstream data(arguments[i + 1]);
+			data >> full_redetection_every;
+
+			valid[i] = false;
+			valid[i + 1] = false;
+			i++;
+		}
 		else if (arguments[i].compare("-validate_detections") == 0)
 		{
 			stringstream data(arguments[i + 1]);
@@ -155,6 +190,39 @@ FaceModelParameters::FaceModelParameters(vector<string> &arguments)
 			valid[i] = false;
 			i++;
 		}
+		else if (arguments[i].compare("-frame_budget") == 0)
+		{
+			stringstream data(arguments[i + 1]);
+			data >> frame_budget;
+
+			valid[i] = false;
+			valid[i + 1] = false;
+			i++;
+		}
+		else if (arguments[i].compare("-validation_gate_every") == 0)
+		{
+			stringstream data(arguments[i + 1]);
+			data >> validation_gate_every;
+
+			valid[i] = false;
+			valid[i + 1] = false;
+			i++;
+		}
+		else if (arguments[i].compare("-validation_gate_deviations") == 0)
+		{
+			stringstream data(arguments[i + 1]);
+			data >> validation_gate_deviations;
+
+			valid[i] = false;
+			valid[i + 1] = false;
+			i++;
+		}
+		else if (arguments[i].compare("-fast_rlms") == 0)
+		{
+			fast_rlms = true;
+
+			valid[i] = false;
+		}
 		else if (arguments[i].compare("-q") == 0)
 		{
 
@@ -189,19 +257,42 @@ FaceModelParameters::FaceModelParameters(vector<string> &arguments)
 		}
 	}
 
-	// Make sure model_location is valid
+	// The bundle has to be mounted before looking for the model, as the model might only be in the bundle
 	// First check working directory, then the executable's directory, then the config path set by the build process.
 	boost::filesystem::path config_path = boost::filesystem::path(CONFIG_DIR);
+	if (!bundle_location.empty())
+	{
+		boost::filesystem::path bundle_path = boost::filesystem::path(bundle_location);
+		if (boost::filesystem::exists(bundle_path))
+		{
+			bundle_location = bundle_path.string();
+		}
+		else if (boost::filesystem::exists(root/bundle_path))
+		{
+			bundle_location = (root/bundle_path).string();
+		}
+		else if (boost::filesystem::exists(config_path/bundle_path))
+		{
+			bundle_location = (config_path/bundle_path).string();
+		}
+
+		if (!LandmarkDetector::MountModelBundle(bundle_location))
+		{
+			std::cout << "Could not mount the model bundle, reading the model files from disk" << std::endl;
+		}
+	}
+
+	// Make sure model_location is valid
 	boost::filesystem::path model_path = boost::filesystem::path(model_location);
-	if (boost::filesystem::exists(model_path))
+	if (LandmarkDetector::ModelFileExists(model_path.string()))
 	{
 		model_location = model_path.string();
 	}
-	else if (boost::filesystem::exists(root/model_path))
+	else if (LandmarkDetector::ModelFileExists((root/model_path).string()))
 	{
 		model_location = (root/model_path).string();
 	}
-	else if (boost::filesystem::exists(config_path/model_path))
+	else if (LandmarkDetector::ModelFileExists((config_path/model_path).string()))
 	{
 		model_location = (config_path/model_path).string();
 	}
@@ -250,6 +341,9 @@ void FaceModelParameters::init()
 
 	model_location = "model/main_clnf_general.txt";
 
+	// No bundle by default, the model files are read from disk
+	bundle_location = "";
+
 	sigma = 1.5;
 	reg_factor = 25;
 	weight_factor = 0; // By default do not use NU-RLMS for videos as it does not work as well for them
@@ -259,7 +353,11 @@ void FaceModelParameters::init()
 	limit_pose = true;
 	multi_view = false;
 
+	// Only drop the view hypotheses that are clearly worse (the likelihood is the mean log KDE response over the landmarks)
+	hypothesis_pruning = 1.0;
+
 	reinit_video_every = 4;
+	full_redetection_every = 4;
 
 	// Face detection
 	face_detector_location = "classifiers/haarcascade_frontalface_alt.xml";
@@ -268,7 +366,20 @@ void FaceModelParameters::init()
 	// By default use HOG SVM
 	curr_face_detector = HOG_SVM_DETECTOR;
 
+	// Search for faces of all sizes
+	min_face_size = 0;
+
 	// The gaze tracking has to be explicitly initialised
 	track_gaze = false;
+
+	// The reference optimiser by default, so that the results of the single precision one can be compared against it
+	fast_rlms = false;
+
+	// No latency budget by default, always do the full fitting
+	frame_budget = 0;
+
+	// Validate every frame by default
+	validation_gate_every = 0;
+	validation_gate_deviations = 3.0;
 }
 
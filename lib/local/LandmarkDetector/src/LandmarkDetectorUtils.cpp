@@ -35,9 +35,11 @@
 #include "stdafx.h"
 
 #include <LandmarkDetectorUtils.h>
+#include <ModelBundle.h>
 
 // OpenCV includes
 #include <opencv2/core/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
 #include <opencv2/imgproc.hpp>
 #include <opencv2/calib3d.hpp>
 
@@ -45,6 +47,12 @@
 #include <filesystem.hpp>
 #include <filesystem/fstream.hpp>
 
+// For reporting from parallel model loading
+#include <mutex>
+
+// TBB includes
+#include <tbb/tbb.h>
+
 using namespace boost::filesystem;
 
 using namespace std;
@@ -472,7 +480,172 @@ void get_image_input_output_params(vector<string> &input_image_files, vector<str
 // Fast patch expert response computation (linear model across a ROI) using normalised cross-correlation
 //===========================================================================
 
-void crossCorr_m( const cv::Mat_<float>& img, cv::Mat_<double>& img_dft, const cv::Mat_<float>& _templ, map<int, cv::Mat_<double> >& _templ_dfts, cv::Mat_<float>& corr)
+// The runtime selection of the correlation method (see LandmarkDetectorUtils.h)
+// The default threshold covers the CCNF and SVR patch experts (11x11 templates with up to 15x15 responses), while the large validator convolutions still use the DFT
+static CorrelationMethod correlation_method = CORRELATION_AUTO;
+static int direct_correlation_threshold = 32768;
+
+void SetCorrelationMethod(CorrelationMethod method)
+{
+	correlation_method = method;
+}
+
+CorrelationMethod GetCorrelationMethod()
+{
+	return correlation_method;
+}
+
+void SetDirectCorrelationThreshold(int max_multiply_adds)
+{
+	direct_correlation_threshold = max_multiply_adds;
+}
+
+int GetDirectCorrelationThreshold()
+{
+	return direct_correlation_threshold;
+}
+
+bool UseDirectCorrelation(const cv::Size& templ_size, const cv::Size& result_size)
+{
+	if(correlation_method == CORRELATION_DIRECT)
+		return true;
+	if(correlation_method == CORRELATION_DFT)
+		return false;
+
+	return (double)templ_size.area() * result_size.area() <= direct_correlation_threshold;
+}
+
+// The sums over the template of templ(ty, tx) * img(y + ty, x + tx), for 16 (or 4) neighbouring responses starting at x in the output row y
+// The accumulators stay in registers for the whole template
+#if CV_SIMD128
+static inline void directCorrBlock16(const cv::Mat_<float>& img, const cv::Mat_<float>& templ, int y, int x, float* out)
+{
+	cv::v_float32x4 acc0 = cv::v_setzero_f32();
+	cv::v_float32x4 acc1 = cv::v_setzero_f32();
+	cv::v_float32x4 acc2 = cv::v_setzero_f32();
+	cv::v_float32x4 acc3 = cv::v_setzero_f32();
+
+	for(int ty = 0; ty < templ.rows; ++ty)
+	{
+		const float* t_row = templ.ptr<float>(ty);
+		const float* i_row = img.ptr<float>(y + ty) + x;
+
+		for(int tx = 0; tx < templ.cols; ++tx)
+		{
+			cv::v_float32x4 w = cv::v_setall_f32(t_row[tx]);
+			const float* src = i_row + tx;
+			acc0 = acc0 + cv::v_load(src) * w;
+			acc1 = acc1 + cv::v_load(src + 4) * w;
+			acc2 = acc2 + cv::v_load(src + 8) * w;
+			acc3 = acc3 + cv::v_load(src + 12) * w;
+		}
+	}
+	cv::v_store(out + x, acc0);
+	cv::v_store(out + x + 4, acc1);
+	cv::v_store(out + x + 8, acc2);
+	cv::v_store(out + x + 12, acc3);
+}
+
+static inline void directCorrBlock4(const cv::Mat_<float>& img, const cv::Mat_<float>& templ, int y, int x, float* out)
+{
+	cv::v_float32x4 acc = cv::v_setzero_f32();
+
+	for(int ty = 0; ty < templ.rows; ++ty)
+	{
+		const float* t_row = templ.ptr<float>(ty);
+		const float* i_row = img.ptr<float>(y + ty) + x;
+
+		for(int tx = 0; tx < templ.cols; ++tx)
+		{
+			acc = acc + cv::v_load(i_row + tx) * cv::v_setall_f32(t_row[tx]);
+		}
+	}
+	cv::v_store(out + x, acc);
+}
+#endif
+
+void directCorr_m( const cv::Mat_<float>& img, const cv::Mat_<float>& templ, cv::Mat_<float>& corr )
+{
+	corr.create(img.rows - templ.rows + 1, img.cols - templ.cols + 1);
+
+	for(int y = 0; y < corr.rows; ++y)
+	{
+		float* out = corr.ptr<float>(y);
+		int x = 0;
+
+#if CV_SIMD128
+		for(; x <= corr.cols - 16; x += 16)
+		{
+			directCorrBlock16(img, templ, y, x, out);
+		}
+		for(; x <= corr.cols - 4; x += 4)
+		{
+			directCorrBlock4(img, templ, y, x, out);
+		}
+		// The remaining responses are covered by a block overlapping the already computed ones (recomputing the same values)
+		if(x < corr.cols && corr.cols >= 4)
+		{
+			directCorrBlock4(img, templ, y, corr.cols - 4, out);
+			x = corr.cols;
+		}
+#endif
+		for(; x < corr.cols; ++x)
+		{
+			float sum = 0;
+			for(int ty = 0; ty < templ.rows; ++ty)
+			{
+				const float* t_row = templ.ptr<float>(ty);
+				const float* i_row = img.ptr<float>(y + ty) + x;
+				for(int tx = 0; tx < templ.cols; ++tx)
+				{
+					sum += t_row[tx] * i_row[tx];
+				}
+			}
+			out[x] = sum;
+		}
+	}
+}
+
+// Computing the dft of a template, padded to dftsize
+void templateDFT_m( const cv::Mat_<float>& _templ, const cv::Size& dftsize, cv::Mat_<double>& dftTempl)
+{
+	dftTempl.create(dftsize.height, dftsize.width);
+
+	cv::Mat_<float> src = _templ;
+
+	cv::Mat_<double> dst(dftTempl, cv::Rect(0, 0, dftsize.width, dftsize.height));
+		
+	cv::Mat_<double> dst1(dftTempl, cv::Rect(0, 0, _templ.cols, _templ.rows));
+			
+	if( dst1.data != src.data )
+		src.convertTo(dst1, dst1.depth());
+
+	if( dst.cols > _templ.cols )
+	{
+		cv::Mat_<double> part(dst, cv::Range(0, _templ.rows), cv::Range(_templ.cols, dst.cols));
+		part.setTo(0);
+	}
+
+	// Perform DFT of the template
+	dft(dst, dst, 0, _templ.rows);
+}
+
+void computeTemplateDFT_m( const cv::Mat_<float>& templ, const cv::Size& img_size, map<int, cv::Mat_<double> >& templ_dfts )
+{
+	// The correlation is of size img_size - templ.size + 1, so this matches the dft size in crossCorr_m
+	cv::Size dftsize;
+	dftsize.width = cv::getOptimalDFTSize(img_size.width);
+	dftsize.height = cv::getOptimalDFTSize(img_size.height);
+
+	if(templ_dfts.find(dftsize.width) == templ_dfts.end())
+	{
+		cv::Mat_<double> dftTempl;
+		templateDFT_m(templ, dftsize, dftTempl);
+		templ_dfts[dftsize.width] = dftTempl;
+	}
+}
+
+void crossCorr_m( const cv::Mat_<float>& img, cv::Mat_<double>& img_dft, const cv::Mat_<float>& _templ, const map<int, cv::Mat_<double> >& _templ_dfts, cv::Mat_<float>& corr)
 {
 	// Our model will always be under min block size so can ignore this
     //const double blockScale = 4.5;
@@ -494,31 +667,10 @@ void crossCorr_m( const cv::Mat_<float>& img, cv::Mat_<double>& img_dft, const c
 	
 	cv::Mat_<double> dftTempl;
 
-	// if this has not been precomputed, precompute it, otherwise use it
+	// if this has not been precomputed, compute it just for this correlation, otherwise use it
 	if(_templ_dfts.find(dftsize.width) == _templ_dfts.end())
 	{
-		dftTempl.create(dftsize.height, dftsize.width);
-
-		cv::Mat_<float> src = _templ;
-
-		cv::Mat_<double> dst(dftTempl, cv::Rect(0, 0, dftsize.width, dftsize.height));
-		
-		cv::Mat_<double> dst1(dftTempl, cv::Rect(0, 0, _templ.cols, _templ.rows));
-			
-		if( dst1.data != src.data )
-			src.convertTo(dst1, dst1.depth());
-
-		if( dst.cols > _templ.cols )
-		{
-			cv::Mat_<double> part(dst, cv::Range(0, _templ.rows), cv::Range(_templ.cols, dst.cols));
-			part.setTo(0);
-		}
-
-		// Perform DFT of the template
-		dft(dst, dst, 0, _templ.rows);
-		
-		_templ_dfts[dftsize.width] = dftTempl;
-
+		templateDFT_m(_templ, dftsize, dftTempl);
 	}
 	else
 	{
@@ -566,9 +718,148 @@ void crossCorr_m( const cv::Mat_<float>& img, cv::Mat_<double>& img_dft, const c
 
 }
 
+// Extracting a single area of interest from an image of a particular type
+template<typename T>
+static void ExtractAreaOfInterest(const cv::Mat& image, const cv::Matx22f& transform, const cv::Point2f& centre, cv::Mat_<float>& area)
+{
+	float a11 = transform(0,0);
+	float a12 = transform(0,1);
+	float a21 = transform(1,0);
+	float a22 = transform(1,1);
+
+	// The centre of the area of interest is mapped to the centre point
+	float a13 = centre.x - a11 * (area.cols - 1) * 0.5f - a12 * (area.rows - 1) * 0.5f;
+	float a23 = centre.y - a21 * (area.cols - 1) * 0.5f - a22 * (area.rows - 1) * 0.5f;
+
+	int width = image.cols;
+	int height = image.rows;
+
+	for(int y = 0; y < area.rows; ++y)
+	{
+		float* out = area.ptr<float>(y);
+
+		// Image coordinates of the start and the end of the row
+		float xs = a12 * y + a13;
+		float ys = a22 * y + a23;
+		float xe = xs + a11 * (area.cols - 1);
+		float ye = ys + a21 * (area.cols - 1);
+
+		// If the whole row is inside the image no border handling is needed
+		bool inside = MIN(xs, xe) >= 0 && MAX(xs, xe) < width - 1 && MIN(ys, ye) >= 0 && MAX(ys, ye) < height - 1;
+
+		int x = 0;
+		if(inside)
+		{
+#if CV_SIMD128
+			cv::v_float32x4 v_xs = cv::v_setall_f32(xs), v_ys = cv::v_setall_f32(ys);
+			cv::v_float32x4 v_a11 = cv::v_setall_f32(a11), v_a21 = cv::v_setall_f32(a21);
+			cv::v_float32x4 v_offsets(0, 1, 2, 3);
+
+			int ixs[4], iys[4];
+			float p00[4], p01[4], p10[4], p11[4];
+
+			for(; x <= area.cols - 4; x += 4)
+			{
+				cv::v_float32x4 v_x = cv::v_setall_f32((float)x) + v_offsets;
+				cv::v_float32x4 sx = v_xs + v_a11 * v_x;
+				cv::v_float32x4 sy = v_ys + v_a21 * v_x;
+
+				cv::v_int32x4 ix = cv::v_floor(sx);
+				cv::v_int32x4 iy = cv::v_floor(sy);
+				cv::v_float32x4 fa = sx - cv::v_cvt_f32(ix);
+				cv::v_float32x4 fb = sy - cv::v_cvt_f32(iy);
+
+				cv::v_store(ixs, ix);
+				cv::v_store(iys, iy);
+
+				// Gathering the four neighbours of every sample
+				for(int k = 0; k < 4; ++k)
+				{
+					const T* row0 = image.ptr<T>(iys[k]) + ixs[k];
+					const T* row1 = image.ptr<T>(iys[k] + 1) + ixs[k];
+					p00[k] = (float)row0[0];
+					p01[k] = (float)row0[1];
+					p10[k] = (float)row1[0];
+					p11[k] = (float)row1[1];
+				}
+
+				cv::v_float32x4 top = cv::v_load(p00) + (cv::v_load(p01) - cv::v_load(p00)) * fa;
+				cv::v_float32x4 bottom = cv::v_load(p10) + (cv::v_load(p11) - cv::v_load(p10)) * fa;
+				cv::v_store(out + x, top + (bottom - top) * fb);
+			}
+#endif
+			for(; x < area.cols; ++x)
+			{
+				float sx = xs + a11 * x;
+				float sy = ys + a21 * x;
+				int ix = cvFloor(sx);
+				int iy = cvFloor(sy);
+				float fa = sx - ix;
+				float fb = sy - iy;
+
+				const T* row0 = image.ptr<T>(iy) + ix;
+				const T* row1 = image.ptr<T>(iy + 1) + ix;
+				float top = row0[0] + (row0[1] - (float)row0[0]) * fa;
+				float bottom = row1[0] + (row1[1] - (float)row1[0]) * fa;
+				out[x] = top + (bottom - top) * fb;
+			}
+		}
+
+		// The samples near the border of the image replicate the border pixels
+		for(; x < area.cols; ++x)
+		{
+			float sx = xs + a11 * x;
+			float sy = ys + a21 * x;
+			int ix = cvFloor(sx);
+			int iy = cvFloor(sy);
+			float fa = sx - ix;
+			float fb = sy - iy;
+
+			int x0 = MIN(MAX(ix, 0), width - 1);
+			int x1 = MIN(MAX(ix + 1, 0), width - 1);
+			int y0 = MIN(MAX(iy, 0), height - 1);
+			int y1 = MIN(MAX(iy + 1, 0), height - 1);
+
+			const T* row0 = image.ptr<T>(y0);
+			const T* row1 = image.ptr<T>(y1);
+			float top = row0[x0] + (row0[x1] - (float)row0[x0]) * fa;
+			float bottom = row1[x0] + (row1[x1] - (float)row1[x0]) * fa;
+			out[x] = top + (bottom - top) * fb;
+		}
+	}
+}
+
+void ExtractAreasOfInterest(const cv::Mat& image, const cv::Matx22f& transform, const vector<cv::Point2f>& centres, vector<cv::Mat_<float> >& areas)
+{
+	ExtractAreasOfInterest(image, transform, centres, areas, 0, (int)areas.size());
+}
+
+void ExtractAreasOfInterest(const cv::Mat& image, const cv::Matx22f& transform, const vector<cv::Point2f>& centres, vector<cv::Mat_<float> >& areas, int begin, int end)
+{
+	assert(image.channels() == 1 && centres.size() == areas.size() && 0 <= begin && end <= (int)areas.size());
+
+	for(int i = begin; i < end; ++i)
+	{
+		if(areas[i].empty())
+			continue;
+
+		switch(image.depth())
+		{
+			case CV_8U: ExtractAreaOfInterest<uchar>(image, transform, centres[i], areas[i]); break;
+			case CV_16U: ExtractAreaOfInterest<ushort>(image, transform, centres[i], areas[i]); break;
+			case CV_32S: ExtractAreaOfInterest<int>(image, transform, centres[i], areas[i]); break;
+			case CV_32F: ExtractAreaOfInterest<float>(image, transform, centres[i], areas[i]); break;
+			case CV_64F: ExtractAreaOfInterest<double>(image, transform, centres[i], areas[i]); break;
+			default:
+				cout << "Unsupported image type for extracting the areas of interest" << endl;
+				return;
+		}
+	}
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void matchTemplate_m(  const cv::Mat_<float>& input_img, cv::Mat_<double>& img_dft, cv::Mat& _integral_img, cv::Mat& _integral_img_sq, const cv::Mat_<float>&  templ, map<int, cv::Mat_<double> >& templ_dfts, cv::Mat_<float>& result, int method )
+void matchTemplate_m(  const cv::Mat_<float>& input_img, cv::Mat_<double>& img_dft, cv::Mat& _integral_img, cv::Mat& _integral_img_sq, const cv::Mat_<float>&  templ, const map<int, cv::Mat_<double> >& templ_dfts, cv::Mat_<float>& result, int method )
 {
 
         int numType = method == CV_TM_CCORR || method == CV_TM_CCORR_NORMED ? 0 :
@@ -583,7 +874,16 @@ void matchTemplate_m(  const cv::Mat_<float>& input_img, cv::Mat_<double>& img_d
 		cv::Size corrSize(input_img.cols - templ.cols + 1, input_img.rows - templ.rows + 1);
 		result.create(corrSize);
 	}
-    LandmarkDetector::crossCorr_m( input_img, img_dft, templ, templ_dfts, result);
+
+	// Small correlations are faster to compute directly, this also avoids computing the image dft altogether
+	if(UseDirectCorrelation(templ.size(), result.size()))
+	{
+		LandmarkDetector::directCorr_m( input_img, templ, result);
+	}
+	else
+	{
+	    LandmarkDetector::crossCorr_m( input_img, img_dft, templ, templ_dfts, result);
+	}
 
     if( method == CV_TM_CCORR )
         return;
@@ -1040,10 +1340,10 @@ vector<cv::Point2d> CalculateLandmarks(cv::Mat img, const cv::Mat_<double>& shap
 vector<cv::Point2d> CalculateLandmarks(CLNF& clnf_model)
 {
 
-	int idx = clnf_model.patch_experts.GetViewIdx(clnf_model.params_global, 0);
+	int idx = clnf_model.model->patch_experts.GetViewIdx(clnf_model.params_global, 0);
 
 	// Because we only draw visible points, need to find which points patch experts consider visible at a certain orientation
-	return CalculateLandmarks(clnf_model.detected_landmarks, clnf_model.patch_experts.visibilities[0][idx]);
+	return CalculateLandmarks(clnf_model.detected_landmarks, clnf_model.model->patch_experts.visibilities[0][idx]);
 
 }
 
@@ -1163,17 +1463,17 @@ void Draw(cv::Mat img, const cv::Mat_<double>& shape2D)
 void Draw(cv::Mat img, const CLNF& clnf_model)
 {
 
-	int idx = clnf_model.patch_experts.GetViewIdx(clnf_model.params_global, 0);
+	int idx = clnf_model.model->patch_experts.GetViewIdx(clnf_model.params_global, 0);
 
 	// Because we only draw visible points, need to find which points patch experts consider visible at a certain orientation
 	//face landmarks
-	Draw(img, clnf_model.detected_landmarks, clnf_model.patch_experts.visibilities[0][idx]);
+	Draw(img, clnf_model.detected_landmarks, clnf_model.model->patch_experts.visibilities[0][idx]);
 
 	// If the model has hierarchical updates draw those too
 	// Eye Landmarks
 	for(size_t i = 0; i < clnf_model.hierarchical_models.size(); ++i)
 	{
-		if(clnf_model.hierarchical_models[i].pdm.NumberOfPoints() != clnf_model.hierarchical_mapping[i].size())
+		if(clnf_model.hierarchical_models[i].model->pdm.NumberOfPoints() != clnf_model.model->hierarchical_mapping[i].size())
 		{
 			Draw(img, clnf_model.hierarchical_models[i]);
 			//cout << i << " ";
@@ -1292,12 +1592,12 @@ bool DetectFaces(vector<cv::Rect_<double> >& o_regions, const cv::Mat_<uchar>& i
 
 }
 
-bool DetectFaces(vector<cv::Rect_<double> >& o_regions, const cv::Mat_<uchar>& intensity, cv::CascadeClassifier& classifier)
-{
-		
-	vector<cv::Rect> face_detections;
-	classifier.detectMultiScale(intensity, face_detections, 1.2, 2, 0, cv::Size(50, 50));
+// The width of the corrected bounding box relative to the one returned by the Haar cascade
+static const double haar_width_correction = 0.8924;
 
+// Convert the Haar cascade detections (found in an image starting at offset) to the bounding boxes expected by CLNF
+static void CorrectDetectionsHAAR(vector<cv::Rect_<double> >& o_regions, const vector<cv::Rect>& face_detections, const cv::Point& offset)
+{
 	// Convert from int bounding box do a double one with corrections
 	o_regions.resize(face_detections.size());
 
@@ -1309,25 +1609,61 @@ bool DetectFaces(vector<cv::Rect_<double> >& o_regions, const cv::Mat_<uchar>& i
 		// The scalings were learned using the Face Detections on LFPW, Helen, AFW and iBUG datasets, using ground truth and detections from openCV
 
 		// Correct for scale
-		o_regions[face].width = face_detections[face].width * 0.8924; 
+		o_regions[face].width = face_detections[face].width * haar_width_correction; 
 		o_regions[face].height = face_detections[face].height * 0.8676;
 
 		// Move the face slightly to the right (as the width was made smaller)
-		o_regions[face].x = face_detections[face].x + 0.0578 * face_detections[face].width;
+		o_regions[face].x = offset.x + face_detections[face].x + 0.0578 * face_detections[face].width;
 		// Shift face down as OpenCV Haar Cascade detects the forehead as well, and we're not interested
-		o_regions[face].y = face_detections[face].y + face_detections[face].height * 0.2166;
+		o_regions[face].y = offset.y + face_detections[face].y + face_detections[face].height * 0.2166;
 		
 		
 	}
+}
+
+bool DetectFaces(vector<cv::Rect_<double> >& o_regions, const cv::Mat_<uchar>& intensity, cv::CascadeClassifier& classifier, double min_width)
+{
+	// The cascade scale range is expressed in the size of its own (uncorrected) detections
+	int min_size = std::max(50, (int)(min_width / haar_width_correction));
+
+	vector<cv::Rect> face_detections;
+	classifier.detectMultiScale(intensity, face_detections, 1.2, 2, 0, cv::Size(min_size, min_size));
+
+	CorrectDetectionsHAAR(o_regions, face_detections, cv::Point(0, 0));
+
+	return o_regions.size() > 0;
+}
+
+bool DetectFaces(vector<cv::Rect_<double> >& o_regions, const cv::Mat_<uchar>& intensity, cv::CascadeClassifier& classifier, const cv::Rect_<double>& roi, double min_width, double max_width)
+{
+	o_regions.clear();
+
+	cv::Rect roi_int = cv::Rect(roi) & cv::Rect(0, 0, intensity.cols, intensity.rows);
+
+	// The cascade scale range is expressed in the size of its own (uncorrected) detections
+	int min_size = (int)(min_width / haar_width_correction);
+	int max_size = (int)(max_width / haar_width_correction + 0.5);
+
+	if(roi_int.width < min_size || roi_int.height < min_size)
+	{
+		return false;
+	}
+
+	// Only the scales between the minimum and maximum face size are searched
+	vector<cv::Rect> face_detections;
+	classifier.detectMultiScale(intensity(roi_int), face_detections, 1.2, 2, 0, cv::Size(min_size, min_size), cv::Size(max_size, max_size));
+
+	CorrectDetectionsHAAR(o_regions, face_detections, roi_int.tl());
+
 	return o_regions.size() > 0;
 }
 
-bool DetectSingleFace(cv::Rect_<double>& o_region, const cv::Mat_<uchar>& intensity_image, cv::CascadeClassifier& classifier, cv::Point preference)
+bool DetectSingleFace(cv::Rect_<double>& o_region, const cv::Mat_<uchar>& intensity_image, cv::CascadeClassifier& classifier, cv::Point preference, double min_width)
 {
 	// The tracker can return multiple faces
 	vector<cv::Rect_<double> > face_detections;
 				
-	bool detect_success = LandmarkDetector::DetectFaces(face_detections, intensity_image, classifier);
+	bool detect_success = LandmarkDetector::DetectFaces(face_detections, intensity_image, classifier, min_width);
 					
 	if(detect_success)
 	{
@@ -1389,20 +1725,108 @@ bool DetectFacesHOG(vector<cv::Rect_<double> >& o_regions, const cv::Mat_<uchar>
 
 }
 
-bool DetectFacesHOG(vector<cv::Rect_<double> >& o_regions, const cv::Mat_<uchar>& intensity, dlib::frontal_face_detector& detector, std::vector<double>& o_confidences)
+// The width of the corrected bounding box relative to the one returned by the HOG detector, and the smallest face the detector finds (its window size)
+static const double hog_width_correction = 0.9611;
+static const double hog_window_size = 80;
+
+// Runs the HOG detector, giving the same detections as detector(image, o_detections, adjust_threshold), but with the filters of the different
+// views (frontal, left, right...) applied in parallel rather than one after another
+// The pyramid levels that can only find faces narrower than min_face_size (in image pixels) are skipped, without computing their features
+static void RunDetectorHOG(std::vector<dlib::full_detection>& o_detections, const cv::Mat_<uchar>& image, const dlib::frontal_face_detector& detector, double adjust_threshold, double min_face_size)
 {
-		
-	cv::Mat_<uchar> upsampled_intensity;
+	typedef dlib::frontal_face_detector::image_scanner_type scanner_type;
 
-	double scaling = 1.3;
+	scanner_type::pyramid_type pyr;
 
-	cv::resize(intensity, upsampled_intensity, cv::Size((int)(intensity.cols * scaling), (int)(intensity.rows * scaling)));
+	// All the detections on a pyramid level are the size of the detection window scaled up to the image from it
+	const scanner_type& detector_scanner = detector.get_scanner();
+	dlib::rectangle window(detector_scanner.get_detection_window_width(), detector_scanner.get_detection_window_height());
+	dlib::rectangle image_rect(image.cols, image.rows);
+
+	unsigned int skipped_levels = 0;
+	while(pyr.rect_up(window, skipped_levels).width() < min_face_size && pyr.rect_down(image_rect, skipped_levels + 1).width() >= window.width() 
+		&& pyr.rect_down(image_rect, skipped_levels + 1).height() >= window.height())
+	{
+		++skipped_levels;
+	}
 
-	dlib::cv_image<uchar> cv_grayscale(upsampled_intensity);
+	// The detector itself is not thread safe (it holds the features of the last image), so the features are kept in a scanner of our own
+	scanner_type scanner;
+	scanner.copy_configuration(detector_scanner);
 
-	std::vector<dlib::full_detection> face_detections;
-	detector(cv_grayscale, face_detections, -0.2);
+	dlib::cv_image<uchar> cv_grayscale(image);
+	if(skipped_levels == 0)
+	{
+		scanner.load(cv_grayscale);
+	}
+	else
+	{
+		// The same pyramid dlib builds, starting from the first level that is searched
+		dlib::array2d<uchar> level_image, temp;
+		pyr(cv_grayscale, level_image);
+		for(unsigned int level = 1; level < skipped_levels; ++level)
+		{
+			pyr(level_image, temp);
+			dlib::swap(level_image, temp);
+		}
+		scanner.load(level_image);
+	}
+
+	const int num_views = (int)detector.num_detectors();
+	vector<vector<std::pair<double, dlib::rectangle> > > view_detections(num_views);
+	vector<double> view_thresholds(num_views);
+
+	tbb::parallel_for(0, num_views, [&](int view){
+		view_thresholds[view] = detector.get_processed_w(view).w(scanner.get_num_dimensions());
+		scanner.detect(detector.get_processed_w(view).get_detect_argument(), view_detections[view], view_thresholds[view] + adjust_threshold);
+	});
+
+	// Gather the detections in the order dlib does, so that the non-maximum suppression below keeps the same ones
+	vector<dlib::rect_detection> detections;
+	for(int view = 0; view < num_views; ++view)
+	{
+		for(size_t i = 0; i < view_detections[view].size(); ++i)
+		{
+			dlib::rect_detection detection;
+			detection.detection_confidence = view_detections[view][i].first - view_thresholds[view];
+			detection.weight_index = view;
+			detection.rect = skipped_levels == 0 ? view_detections[view][i].second : pyr.rect_up(view_detections[view][i].second, skipped_levels);
+			detections.push_back(detection);
+		}
+	}
+
+	if(num_views > 1)
+	{
+		std::sort(detections.rbegin(), detections.rend());
+	}
+
+	vector<dlib::rect_detection> kept;
+	for(size_t i = 0; i < detections.size(); ++i)
+	{
+		bool overlaps = false;
+		for(size_t k = 0; k < kept.size() && !overlaps; ++k)
+		{
+			overlaps = detector.get_overlap_tester()(kept[k].rect, detections[i].rect);
+		}
+
+		if(!overlaps)
+		{
+			kept.push_back(detections[i]);
+		}
+	}
+
+	o_detections.resize(kept.size());
+	for(size_t i = 0; i < kept.size(); ++i)
+	{
+		o_detections[i].detection_confidence = kept[i].detection_confidence;
+		o_detections[i].weight_index = kept[i].weight_index;
+		o_detections[i].rect = dlib::full_object_detection(kept[i].rect);
+	}
+}
 
+// Convert the HOG detections (found in an image starting at offset and rescaled by scaling) to the bounding boxes expected by CLNF
+static void CorrectDetectionsHOG(vector<cv::Rect_<double> >& o_regions, std::vector<double>& o_confidences, const std::vector<dlib::full_detection>& face_detections, double scaling, const cv::Point& offset)
+{
 	// Convert from int bounding box do a double one with corrections
 	o_regions.resize(face_detections.size());
 	o_confidences.resize(face_detections.size());
@@ -1414,28 +1838,88 @@ bool DetectFacesHOG(vector<cv::Rect_<double> >& o_regions, const cv::Mat_<uchar>
 		// The scalings were learned using the Face Detections on LFPW and Helen using ground truth and detections from the HOG detector
 
 		// Move the face slightly to the right (as the width was made smaller)
-		o_regions[face].x = (face_detections[face].rect.get_rect().tl_corner().x() + 0.0389 * face_detections[face].rect.get_rect().width())/scaling;
+		o_regions[face].x = offset.x + (face_detections[face].rect.get_rect().tl_corner().x() + 0.0389 * face_detections[face].rect.get_rect().width())/scaling;
 		// Shift face down as OpenCV Haar Cascade detects the forehead as well, and we're not interested
-		o_regions[face].y = (face_detections[face].rect.get_rect().tl_corner().y() + 0.1278 * face_detections[face].rect.get_rect().height())/scaling;
+		o_regions[face].y = offset.y + (face_detections[face].rect.get_rect().tl_corner().y() + 0.1278 * face_detections[face].rect.get_rect().height())/scaling;
 
 		// Correct for scale
-		o_regions[face].width = (face_detections[face].rect.get_rect().width() * 0.9611)/scaling; 
+		o_regions[face].width = (face_detections[face].rect.get_rect().width() * hog_width_correction)/scaling; 
 		o_regions[face].height = (face_detections[face].rect.get_rect().height() * 0.9388)/scaling;
 
 		o_confidences[face] = face_detections[face].detection_confidence;
 		
 		
 	}
+}
+
+bool DetectFacesHOG(vector<cv::Rect_<double> >& o_regions, const cv::Mat_<uchar>& intensity, dlib::frontal_face_detector& detector, std::vector<double>& o_confidences, double min_width)
+{
+		
+	cv::Mat_<uchar> upsampled_intensity;
+
+	double scaling = 1.3;
+
+	cv::resize(intensity, upsampled_intensity, cv::Size((int)(intensity.cols * scaling), (int)(intensity.rows * scaling)));
+
+	std::vector<dlib::full_detection> face_detections;
+	RunDetectorHOG(face_detections, upsampled_intensity, detector, -0.2, min_width * scaling / hog_width_correction);
+
+	CorrectDetectionsHOG(o_regions, o_confidences, face_detections, scaling, cv::Point(0, 0));
+
+	return o_regions.size() > 0;
+}
+
+bool DetectFacesHOG(vector<cv::Rect_<double> >& o_regions, const cv::Mat_<uchar>& intensity, dlib::frontal_face_detector& detector, std::vector<double>& o_confidences, const cv::Rect_<double>& roi, double min_width, double max_width)
+{
+	o_regions.clear();
+	o_confidences.clear();
+
+	cv::Rect roi_int = cv::Rect(roi) & cv::Rect(0, 0, intensity.cols, intensity.rows);
+
+	if(roi_int.area() == 0 || min_width <= 0)
+	{
+		return false;
+	}
+
+	// The detector has a fixed window and scans an image pyramid going down from the given image, so rescale the region of interest
+	// for the smallest expected face to just fit the window, which leaves only the few pyramid levels covering the expected sizes
+	double scaling = hog_window_size * hog_width_correction / min_width;
+
+	cv::Mat_<uchar> scaled_intensity;
+	cv::resize(intensity(roi_int), scaled_intensity, cv::Size((int)(roi_int.width * scaling), (int)(roi_int.height * scaling)));
+
+	if(scaled_intensity.cols < hog_window_size || scaled_intensity.rows < hog_window_size)
+	{
+		return false;
+	}
+
+	std::vector<dlib::full_detection> face_detections;
+	RunDetectorHOG(face_detections, scaled_intensity, detector, -0.2, 0);
+
+	vector<cv::Rect_<double> > regions;
+	vector<double> confidences;
+	CorrectDetectionsHOG(regions, confidences, face_detections, scaling, roi_int.tl());
+
+	// The pyramid can still find bigger faces than expected
+	for(size_t face = 0; face < regions.size(); ++face)
+	{
+		if(regions[face].width <= max_width)
+		{
+			o_regions.push_back(regions[face]);
+			o_confidences.push_back(confidences[face]);
+		}
+	}
+
 	return o_regions.size() > 0;
 }
 
-bool DetectSingleFaceHOG(cv::Rect_<double>& o_region, const cv::Mat_<uchar>& intensity_img, dlib::frontal_face_detector& detector, double& confidence, cv::Point preference)
+bool DetectSingleFaceHOG(cv::Rect_<double>& o_region, const cv::Mat_<uchar>& intensity_img, dlib::frontal_face_detector& detector, double& confidence, cv::Point preference, double min_width)
 {
 	// The tracker can return multiple faces
 	vector<cv::Rect_<double> > face_detections;
 	vector<double> confidences;
 
-	bool detect_success = LandmarkDetector::DetectFacesHOG(face_detections, intensity_img, detector, confidences);
+	bool detect_success = LandmarkDetector::DetectFacesHOG(face_detections, intensity_img, detector, confidences, min_width);
 					
 	if(detect_success)
 	{
@@ -1499,8 +1983,16 @@ bool DetectSingleFaceHOG(cv::Rect_<double>& o_region, const cv::Mat_<uchar>& int
 //============================================================================
 
 // Reading in a matrix from a stream
-void ReadMat(std::ifstream& stream, cv::Mat &output_mat)
+void ReadMat(std::istream& stream, cv::Mat &output_mat)
 {
+	// Matrices in a model bundle are stored in binary
+	if(ReadBundledMat(stream, output_mat))
+	{
+		return;
+	}
+
+	std::streamoff start_position = BundleRecordingPosition(stream);
+
 	// Read in the number of rows, columns and the data type
 	int row,col,type;
 	
@@ -1557,10 +2049,21 @@ void ReadMat(std::ifstream& stream, cv::Mat &output_mat)
 
 
 	}
+
+	// If a bundle is being created, the matrix will be stored in binary
+	RecordBundledMat(stream, start_position, output_mat);
 }
 
-void ReadMatBin(std::ifstream& stream, cv::Mat &output_mat)
+void ReadMatBin(std::istream& stream, cv::Mat &output_mat)
 {
+	// Matrices in a model bundle are used without copying
+	if(ReadBundledMat(stream, output_mat))
+	{
+		return;
+	}
+
+	std::streamoff start_position = BundleRecordingPosition(stream);
+
 	// Read in the number of rows, columns and the data type
 	int row, col, type;
 	
@@ -1572,10 +2075,12 @@ void ReadMatBin(std::ifstream& stream, cv::Mat &output_mat)
 	int size = output_mat.rows * output_mat.cols * output_mat.elemSize();
 	stream.read((char *)output_mat.data, size);
 
+	// If a bundle is being created, the matrix will be stored aligned
+	RecordBundledMat(stream, start_position, output_mat);
 }
 
 // Skipping lines that start with # (together with empty lines)
-void SkipComments(std::ifstream& stream)
+void SkipComments(std::istream& stream)
 {	
 	while(stream.peek() == '#' || stream.peek() == '\n'|| stream.peek() == ' ' || stream.peek() == '\r')
 	{
@@ -1584,4 +2089,15 @@ void SkipComments(std::ifstream& stream)
 	}
 }
 
+void ReportLoadTime(const string& component, const string& location, int64 start_ticks)
+{
+	double time_ms = 1000.0 * (cv::getTickCount() - start_ticks) / cv::getTickFrequency();
+
+	// Keep the lines from different loading threads from interleaving
+	static std::mutex report_mutex;
+	std::lock_guard<std::mutex> lock(report_mutex);
+
+	cout << "Read the " << component << " from: " << location << " in " << cvRound(time_ms) << " ms" << endl;
+}
+
 }
@@ -0,0 +1,692 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2017, Carnegie Mellon University and University of Cambridge,
+// all rights reserved.
+//
+// ACADEMIC OR NON-PROFIT ORGANIZATION NONCOMMERCIAL RESEARCH USE ONLY
+//
+// BY USING OR DOWNLOADING THE SOFTWARE, YOU ARE AGREEING TO THE TERMS OF THIS LICENSE AGREEMENT.  
+// IF YOU DO NOT AGREE WITH THESE TERMS, YOU MAY NOT USE OR DOWNLOAD THE SOFTWARE.
+//
+// License can be found in OpenFace-license.txt
+//
+//     * Any publications arising from the use of this software, including but
+//       not limited to academic journal and conference publications, technical
+//       reports and manuals, must cite at least one of the following works:
+//
+//       OpenFace: an open source facial behavior analysis toolkit
+//       Tadas Baltruaitis, Peter Robinson, and Louis-Philippe Morency
+//       in IEEE Winter Conference on Applications of Computer Vision, 2016  
+//
+//       Rendering of Eyes for Eye-Shape Registration and Gaze Estimation
+//       Erroll Wood, Tadas Baltruaitis, Xucong Zhang, Yusuke Sugano, Peter Robinson, and Andreas Bulling 
+//       in IEEE International. Conference on Computer Vision (ICCV),  2015 
+//
+//       Cross-dataset learning and person-speci?c normalisation for automatic Action Unit detection
+//       Tadas Baltruaitis, Marwa Mahmoud, and Peter Robinson 
+//       in Facial Expression Recognition and Analysis Challenge, 
+//       IEEE International Conference on Automatic Face and Gesture Recognition, 2015 
+//
+//       Constrained Local Neural Fields for robust facial landmark detection in the wild.
+//       Tadas Baltruaitis, Peter Robinson, and Louis-Philippe Morency. 
+//       in IEEE Int. Conference on Computer Vision Workshops, 300 Faces in-the-Wild Challenge, 2013.    
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "stdafx.h"
+
+#include "ModelBundle.h"
+
+// System includes
+#include <cstdint>
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+
+// Memory mapping
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace LandmarkDetector
+{
+
+// The entries in the bundle and the matrix data in them are aligned to this many bytes
+static const size_t BUNDLE_ALIGNMENT = 64;
+
+// Identifying the bundle file ("OFBUNDLE") and each of the matrices in it ("OFMT")
+static const char BUNDLE_MAGIC[8] = {'O', 'F', 'B', 'U', 'N', 'D', 'L', 'E'};
+static const uint32_t BUNDLED_MAT_MAGIC = 0x544D464F;
+
+// The bundle header (magic, version, number of entries, table offset and reserved space)
+static const size_t BUNDLE_HEADER_SIZE = 64;
+
+// The matrix header (magic, rows, cols, type, offset of data from the start of the header)
+static const size_t BUNDLED_MAT_HEADER_SIZE = 20;
+
+//===========================================================================
+// Stream buffers used for reading model files from memory
+//===========================================================================
+
+// A read only stream buffer over a block of memory
+class MemoryBuffer : public std::streambuf
+{
+public:
+
+	// The current position from the start of the buffer
+	std::streamoff Position() const { return gptr() - eback(); }
+
+	// Direct access to the memory at the current position
+	const char* Current() const { return gptr(); }
+	size_t Remaining() const { return egptr() - gptr(); }
+
+	// Skipping the bytes that were read directly from memory
+	void Advance(size_t bytes)
+	{
+		if(bytes > Remaining())
+		{
+			bytes = Remaining();
+		}
+		setg(eback(), gptr() + bytes, egptr());
+	}
+
+protected:
+
+	void SetBuffer(const char* data, size_t size)
+	{
+		// The buffer is only used for reading so the const_cast is safe
+		char* begin = const_cast<char*>(data);
+		setg(begin, begin, begin + size);
+	}
+
+	std::streampos seekoff(std::streamoff off, std::ios_base::seekdir dir, std::ios_base::openmode /*which*/)
+	{
+		std::streamoff new_position = off;
+
+		if(dir == std::ios_base::cur)
+		{
+			new_position = Position() + off;
+		}
+		else if(dir == std::ios_base::end)
+		{
+			new_position = (egptr() - eback()) + off;
+		}
+
+		if(new_position < 0 || new_position > egptr() - eback())
+		{
+			return std::streampos(std::streamoff(-1));
+		}
+
+		setg(eback(), eback() + new_position, egptr());
+		return std::streampos(new_position);
+	}
+
+	std::streampos seekpos(std::streampos pos, std::ios_base::openmode /*which*/)
+	{
+		return seekoff(std::streamoff(pos), std::ios_base::beg, std::ios_base::in);
+	}
+
+};
+
+// A buffer over an entry of a mounted bundle (the memory belongs to the bundle)
+class MappedBuffer : public MemoryBuffer
+{
+public:
+	MappedBuffer(const char* data, size_t size) { SetBuffer(data, size); }
+};
+
+// A matrix read from a recorded file, the bytes [start, end) of the file are replaced by the binary matrix in the bundle
+struct RecordedMat
+{
+	std::streamoff start;
+	std::streamoff end;
+	cv::Mat mat;
+};
+
+// The contents of a recorded file, together with the matrices read from it
+struct RecordedFile
+{
+	vector<char> data;
+	vector<RecordedMat> mats;
+};
+
+// A buffer over a whole file read in from disk, keeping track of the matrices read from it
+class RecordingBuffer : public MemoryBuffer
+{
+public:
+	RecordingBuffer(vector<char>& file_data)
+	{
+		file.data.swap(file_data);
+		SetBuffer(file.data.data(), file.data.size());
+	}
+
+	RecordedFile file;
+};
+
+//===========================================================================
+// Mounted bundles
+//===========================================================================
+class MappedBundle
+{
+public:
+
+	// The directory relative to which the entries are named
+	string root;
+
+	// The entry name and its (offset, size) in the bundle
+	map<string, pair<size_t, size_t> > entries;
+
+	const char* data;
+	size_t size;
+
+	MappedBundle() : data(nullptr), size(0)
+	{
+#ifdef _WIN32
+		file = INVALID_HANDLE_VALUE;
+		mapping = NULL;
+#endif
+	}
+
+	~MappedBundle()
+	{
+#ifdef _WIN32
+		if(data != nullptr)
+			UnmapViewOfFile(data);
+		if(mapping != NULL)
+			CloseHandle(mapping);
+		if(file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+#else
+		if(data != nullptr)
+			munmap((void*)data, size);
+#endif
+	}
+
+	// Map the file in (copy-on-write, so the pages are shared between processes until something writes to them)
+	bool Map(const string& location)
+	{
+#ifdef _WIN32
+		file = CreateFileA(location.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if(file == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER file_size;
+		if(!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+			return false;
+		size = (size_t)file_size.QuadPart;
+
+		mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+		if(mapping == NULL)
+			return false;
+
+		data = (const char*)MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+		return data != nullptr;
+#else
+		int fd = open(location.c_str(), O_RDONLY);
+		if(fd < 0)
+			return false;
+
+		struct stat file_stat;
+		if(fstat(fd, &file_stat) != 0 || file_stat.st_size == 0)
+		{
+			close(fd);
+			return false;
+		}
+		size = (size_t)file_stat.st_size;
+
+		void* mapped = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		close(fd);
+
+		if(mapped == MAP_FAILED)
+			return false;
+
+		data = (const char*)mapped;
+		return true;
+#endif
+	}
+
+	// Reading the header and the table of entries
+	bool ReadTable()
+	{
+		if(size < BUNDLE_HEADER_SIZE || memcmp(data, BUNDLE_MAGIC, sizeof(BUNDLE_MAGIC)) != 0)
+		{
+			cout << "The file is not a model bundle" << endl;
+			return false;
+		}
+
+		uint32_t version, num_entries;
+		uint64_t table_offset;
+		memcpy(&version, data + 8, 4);
+		memcpy(&num_entries, data + 12, 4);
+		memcpy(&table_offset, data + 16, 8);
+
+		if(version != MODEL_BUNDLE_VERSION)
+		{
+			cout << "Model bundle version " << version << " is not supported (expecting " << MODEL_BUNDLE_VERSION << "), recreate the bundle" << endl;
+			return false;
+		}
+
+		size_t pos = (size_t)table_offset;
+		for(uint32_t i = 0; i < num_entries; ++i)
+		{
+			uint32_t name_length;
+			if(pos + 4 > size)
+				return false;
+			memcpy(&name_length, data + pos, 4);
+			pos += 4;
+
+			if(pos + name_length + 16 > size)
+				return false;
+			string name(data + pos, name_length);
+			pos += name_length;
+
+			uint64_t offset, entry_size;
+			memcpy(&offset, data + pos, 8);
+			memcpy(&entry_size, data + pos + 8, 8);
+			pos += 16;
+
+			if(offset + entry_size > size)
+				return false;
+
+			entries[name] = pair<size_t, size_t>((size_t)offset, (size_t)entry_size);
+		}
+		return true;
+	}
+
+private:
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#endif
+
+};
+
+// Bundles and recordings can be accessed from multiple threads (if models are read in parallel)
+static std::mutex bundle_mutex;
+
+// Mounted bundles are never unmapped, as the matrices read from them refer to their memory
+static vector<std::unique_ptr<MappedBundle> > mounted_bundles;
+
+// The bundle being recorded
+static bool recording = false;
+static string recording_root;
+static map<string, RecordedFile> recorded_files;
+
+//===========================================================================
+// Helper functions
+//===========================================================================
+
+// Absolute path with the . and .. removed, so that the same file always has the same name
+static string NormalisePath(const string& location)
+{
+	boost::filesystem::path path(location);
+	if(path.empty())
+	{
+		path = ".";
+	}
+	path = boost::filesystem::absolute(path);
+
+	boost::filesystem::path normalised;
+	for(boost::filesystem::path::iterator it = path.begin(); it != path.end(); ++it)
+	{
+		if(it->string() == ".")
+		{
+			continue;
+		}
+		else if(it->string() == "..")
+		{
+			normalised.remove_filename();
+		}
+		else
+		{
+			normalised /= *it;
+		}
+	}
+	return normalised.generic_string();
+}
+
+// The name of a file relative to the root directory, returns false if the file is not under the root
+static bool RelativeName(const string& root, const string& location, string& name)
+{
+	string normalised = NormalisePath(location);
+
+	string prefix = root;
+	if(prefix.empty() || prefix[prefix.size() - 1] != '/')
+	{
+		prefix += '/';
+	}
+
+	if(normalised.compare(0, prefix.size(), prefix) != 0)
+	{
+		return false;
+	}
+
+	name = normalised.substr(prefix.size());
+	return true;
+}
+
+// Looking for a file in the mounted bundles (the last mounted bundle takes precedence)
+static bool FindBundleEntry(const string& location, const char*& data, size_t& size)
+{
+	std::lock_guard<std::mutex> lock(bundle_mutex);
+
+	for(int i = (int)mounted_bundles.size() - 1; i >= 0; --i)
+	{
+		string name;
+		if(RelativeName(mounted_bundles[i]->root, location, name))
+		{
+			map<string, pair<size_t, size_t> >::const_iterator entry = mounted_bundles[i]->entries.find(name);
+			if(entry != mounted_bundles[i]->entries.end())
+			{
+				data = mounted_bundles[i]->data + entry->second.first;
+				size = entry->second.second;
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+static bool IsRecording()
+{
+	std::lock_guard<std::mutex> lock(bundle_mutex);
+	return recording;
+}
+
+template<typename T>
+static void Append(vector<char>& out, const T& value)
+{
+	const char* bytes = (const char*)&value;
+	out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+static size_t AlignUp(size_t position)
+{
+	return ((position + BUNDLE_ALIGNMENT - 1) / BUNDLE_ALIGNMENT) * BUNDLE_ALIGNMENT;
+}
+
+// Replace the matrices in a recorded file with their aligned binary versions (the entry itself will be aligned in the bundle)
+static void SerialiseEntry(const RecordedFile& file, vector<char>& out)
+{
+	std::streamoff cursor = 0;
+
+	for(size_t i = 0; i < file.mats.size(); ++i)
+	{
+		const RecordedMat& recorded = file.mats[i];
+
+		// The bytes before the matrix are kept as they are
+		out.insert(out.end(), file.data.begin() + cursor, file.data.begin() + recorded.start);
+
+		size_t record_start = out.size();
+		size_t data_start = AlignUp(record_start + BUNDLED_MAT_HEADER_SIZE);
+
+		Append(out, BUNDLED_MAT_MAGIC);
+		Append(out, (int32_t)recorded.mat.rows);
+		Append(out, (int32_t)recorded.mat.cols);
+		Append(out, (int32_t)recorded.mat.type());
+		Append(out, (uint32_t)(data_start - record_start));
+		out.resize(data_start, 0);
+
+		const char* mat_data = (const char*)recorded.mat.data;
+		out.insert(out.end(), mat_data, mat_data + recorded.mat.total() * recorded.mat.elemSize());
+
+		cursor = recorded.end;
+	}
+
+	out.insert(out.end(), file.data.begin() + cursor, file.data.end());
+}
+
+//===========================================================================
+// Mounting and checking for files
+//===========================================================================
+bool MountModelBundle(const string& bundle_location)
+{
+	std::unique_ptr<MappedBundle> bundle(new MappedBundle());
+
+	if(!bundle->Map(bundle_location) || !bundle->ReadTable())
+	{
+		cout << "Couldn't read the model bundle: " << bundle_location << endl;
+		return false;
+	}
+
+	bundle->root = NormalisePath(boost::filesystem::path(bundle_location).parent_path().string());
+
+	std::lock_guard<std::mutex> lock(bundle_mutex);
+	mounted_bundles.push_back(std::move(bundle));
+
+	return true;
+}
+
+bool ModelFileExists(const string& location)
+{
+	const char* data;
+	size_t size;
+
+	if(FindBundleEntry(location, data, size))
+	{
+		return true;
+	}
+
+	return boost::filesystem::exists(boost::filesystem::path(location));
+}
+
+//===========================================================================
+// Recording and writing bundles
+//===========================================================================
+void StartModelBundleRecording(const string& root_directory)
+{
+	std::lock_guard<std::mutex> lock(bundle_mutex);
+
+	recording = true;
+	recording_root = NormalisePath(root_directory);
+	recorded_files.clear();
+}
+
+bool WriteModelBundle(const string& bundle_location)
+{
+	std::lock_guard<std::mutex> lock(bundle_mutex);
+
+	if(!recording || recorded_files.empty())
+	{
+		cout << "No model files were recorded, not writing a bundle" << endl;
+		return false;
+	}
+
+	vector<char> bundle(BUNDLE_HEADER_SIZE, 0);
+
+	// The table of entries (name, offset, size)
+	vector<char> table;
+
+	for(map<string, RecordedFile>::const_iterator it = recorded_files.begin(); it != recorded_files.end(); ++it)
+	{
+		bundle.resize(AlignUp(bundle.size()), 0);
+		size_t offset = bundle.size();
+
+		SerialiseEntry(it->second, bundle);
+
+		Append(table, (uint32_t)it->first.size());
+		table.insert(table.end(), it->first.begin(), it->first.end());
+		Append(table, (uint64_t)offset);
+		Append(table, (uint64_t)(bundle.size() - offset));
+	}
+
+	bundle.resize(AlignUp(bundle.size()), 0);
+	uint64_t table_offset = bundle.size();
+	bundle.insert(bundle.end(), table.begin(), table.end());
+
+	// Fill in the header
+	uint32_t version = MODEL_BUNDLE_VERSION;
+	uint32_t num_entries = (uint32_t)recorded_files.size();
+	memcpy(&bundle[0], BUNDLE_MAGIC, sizeof(BUNDLE_MAGIC));
+	memcpy(&bundle[8], &version, 4);
+	memcpy(&bundle[12], &num_entries, 4);
+	memcpy(&bundle[16], &table_offset, 8);
+
+	ofstream bundle_file(bundle_location.c_str(), ios::out | ios::binary);
+	if(!bundle_file.is_open())
+	{
+		cout << "Couldn't open the model bundle for writing: " << bundle_location << endl;
+		return false;
+	}
+	bundle_file.write(bundle.data(), bundle.size());
+
+	cout << "Written " << num_entries << " model files to " << bundle_location << endl;
+
+	recording = false;
+	recorded_files.clear();
+
+	return true;
+}
+
+//===========================================================================
+// Reading matrices
+//===========================================================================
+bool ReadBundledMat(std::istream& stream, cv::Mat& output_mat)
+{
+	MappedBuffer* mapped = dynamic_cast<MappedBuffer*>(stream.rdbuf());
+	if(mapped == nullptr)
+	{
+		return false;
+	}
+
+	const char* record = mapped->Current();
+
+	uint32_t magic = 0, data_offset = 0;
+	int32_t rows = 0, cols = 0, type = 0;
+
+	if(mapped->Remaining() >= BUNDLED_MAT_HEADER_SIZE)
+	{
+		memcpy(&magic, record, 4);
+		memcpy(&rows, record + 4, 4);
+		memcpy(&cols, record + 8, 4);
+		memcpy(&type, record + 12, 4);
+		memcpy(&data_offset, record + 16, 4);
+	}
+
+	size_t data_size = (size_t)max(rows, 0) * (size_t)max(cols, 0) * CV_ELEM_SIZE(type);
+
+	if(magic != BUNDLED_MAT_MAGIC || data_offset + data_size > mapped->Remaining())
+	{
+		cout << "ERROR: the model bundle is corrupt, expected a matrix" << endl;
+		stream.setstate(ios::failbit);
+		output_mat = cv::Mat();
+		return true;
+	}
+
+	if(data_size == 0)
+	{
+		output_mat = cv::Mat(max(rows, 0), max(cols, 0), type);
+	}
+	else
+	{
+		// No copy, the matrix refers to the mapped memory
+		output_mat = cv::Mat(rows, cols, type, (void*)(record + data_offset));
+	}
+
+	mapped->Advance(data_offset + data_size);
+
+	return true;
+}
+
+std::streamoff BundleRecordingPosition(std::istream& stream)
+{
+	RecordingBuffer* recording_buffer = dynamic_cast<RecordingBuffer*>(stream.rdbuf());
+	if(recording_buffer == nullptr)
+	{
+		return -1;
+	}
+	return recording_buffer->Position();
+}
+
+void RecordBundledMat(std::istream& stream, std::streamoff start_position, const cv::Mat& mat)
+{
+	RecordingBuffer* recording_buffer = dynamic_cast<RecordingBuffer*>(stream.rdbuf());
+	if(recording_buffer == nullptr || start_position < 0)
+	{
+		return;
+	}
+
+	RecordedMat recorded;
+	recorded.start = start_position;
+	recorded.end = recording_buffer->Position();
+	// A copy, as the reader might modify the matrix after reading it
+	recorded.mat = mat.clone();
+
+	recording_buffer->file.mats.push_back(recorded);
+}
+
+//===========================================================================
+// Model stream
+//===========================================================================
+ModelStream::ModelStream(const string& location) : std::istream(nullptr), location(location)
+{
+	const char* data;
+	size_t size;
+
+	if(FindBundleEntry(location, data, size))
+	{
+		buffer.reset(new MappedBuffer(data, size));
+	}
+	else
+	{
+		std::unique_ptr<std::filebuf> file_buffer(new std::filebuf());
+		if(file_buffer->open(location.c_str(), ios::in | ios::binary))
+		{
+			if(IsRecording())
+			{
+				// The whole file is kept in memory, so that the matrices can be replaced when writing the bundle
+				vector<char> file_data((istreambuf_iterator<char>(file_buffer.get())), istreambuf_iterator<char>());
+				buffer.reset(new RecordingBuffer(file_data));
+			}
+			else
+			{
+				buffer = std::move(file_buffer);
+			}
+		}
+	}
+
+	if(buffer)
+	{
+		rdbuf(buffer.get());
+	}
+	else
+	{
+		setstate(ios::failbit);
+	}
+}
+
+ModelStream::~ModelStream()
+{
+	RecordingBuffer* recording_buffer = dynamic_cast<RecordingBuffer*>(buffer.get());
+
+	if(recording_buffer != nullptr)
+	{
+		std::lock_guard<std::mutex> lock(bundle_mutex);
+
+		string name;
+		if(!recording)
+		{
+			return;
+		}
+		else if(!RelativeName(recording_root, location, name))
+		{
+			cout << "Model file " << location << " is not under " << recording_root << ", it will not be in the bundle" << endl;
+		}
+		else if(recorded_files.find(name) == recorded_files.end())
+		{
+			// Files read more than once (e.g. shared between models) are only stored once
+			recorded_files[name] = recording_buffer->file;
+		}
+	}
+}
+
+}
@@ -40,13 +40,21 @@
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc.hpp>
 
+// System includes
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
 #include "LandmarkDetectorUtils.h"
 
 using namespace LandmarkDetector;
 
+// The point in triangle test (defined with the other triangle helpers below)
+bool pointInTriangle(double x0, double y0, double x1, double y1, double x2, double y2, double x3, double y3);
+
 // Copy constructor
-PAW::PAW(const PAW& other) : destination_landmarks(other.destination_landmarks.clone()), source_landmarks(other.source_landmarks.clone()), triangulation(other.triangulation.clone()),
-triangle_id(other.triangle_id.clone()), pixel_mask(other.pixel_mask.clone()), coefficients(other.coefficients.clone()), alpha(other.alpha.clone()), beta(other.beta.clone()), map_x(other.map_x.clone()), map_y(other.map_y.clone())
+PAW::PAW(const PAW& other) : destination_landmarks(other.destination_landmarks.clone()), triangulation(other.triangulation.clone()),
+triangle_id(other.triangle_id.clone()), pixel_mask(other.pixel_mask.clone()), alpha(other.alpha.clone()), beta(other.beta.clone())
 {
 	this->number_of_pixels = other.number_of_pixels;
 	this->min_x = other.min_x;
@@ -152,10 +160,6 @@ PAW::PAW(const cv::Mat_<double>& destination_shape, const cv::Mat_<int>& triangu
 		}
 	}
     	
-	// Preallocate maps and coefficients
-	coefficients.create(num_tris, 6);
-	map_x.create(pixel_mask.rows,pixel_mask.cols);
-	map_y.create(pixel_mask.rows,pixel_mask.cols);
 
 
 }
@@ -262,15 +266,77 @@ PAW::PAW(const cv::Mat_<double>& destination_shape, const cv::Mat_<int>& triangu
 		}
 	}    	
 
-	// Preallocate maps and coefficients
-	coefficients.create(num_tris, 6);
-	map_x.create(pixel_mask.rows,pixel_mask.cols);
-	map_y.create(pixel_mask.rows,pixel_mask.cols);
 
 }
 
 //===========================================================================
-void PAW::Read(std::ifstream& stream)
+// Only the pixels within the bounding box of each triangle are tested, using the same point in triangle test as findTriangle,
+// so the pixels outside the face are not checked against every triangle
+void PAW::ComputeMask(cv::Mat_<uchar>& mask, const cv::Mat_<double>& destination_shape, const cv::Mat_<int>& triangulation, double in_min_x, double in_min_y, double in_max_x, double in_max_y)
+{
+	int num_points = destination_shape.rows/2;
+
+	int w = (int)(in_max_x - in_min_x + 1.5);
+	int h = (int)(in_max_y - in_min_y + 1.5);
+
+	mask.create(h, w);
+	mask.setTo(0);
+
+	for (int tri = 0; tri < triangulation.rows; ++tri)
+	{
+		int j = triangulation.at<int>(tri, 0);
+		int k = triangulation.at<int>(tri, 1);
+		int l = triangulation.at<int>(tri, 2);
+
+		double x1 = destination_shape.at<double>(j);
+		double y1 = destination_shape.at<double>(j + num_points);
+		double x2 = destination_shape.at<double>(k);
+		double y2 = destination_shape.at<double>(k + num_points);
+		double x3 = destination_shape.at<double>(l);
+		double y3 = destination_shape.at<double>(l + num_points);
+
+		double tri_min_x = std::min(x1, std::min(x2, x3));
+		double tri_max_x = std::max(x1, std::max(x2, x3));
+		double tri_min_y = std::min(y1, std::min(y2, y3));
+		double tri_max_y = std::max(y1, std::max(y2, y3));
+
+		// The pixels that can be within the bounding box (the exact check is done below, as in findTriangle)
+		int x_start = std::max(0, (int)std::floor(tri_min_x - in_min_x));
+		int x_end = std::min(w - 1, (int)std::ceil(tri_max_x - in_min_x));
+		int y_start = std::max(0, (int)std::floor(tri_min_y - in_min_y));
+		int y_end = std::min(h - 1, (int)std::ceil(tri_max_y - in_min_y));
+
+		for (int y = y_start; y <= y_end; ++y)
+		{
+			double y0 = y + in_min_y;
+
+			if (tri_max_y < y0 || tri_min_y > y0)
+			{
+				continue;
+			}
+
+			uchar* mask_row = mask.ptr<uchar>(y);
+
+			for (int x = x_start; x <= x_end; ++x)
+			{
+				double x0 = x + in_min_x;
+
+				if (mask_row[x] || tri_max_x < x0 || tri_min_x > x0)
+				{
+					continue;
+				}
+
+				if (pointInTriangle(x0, y0, x1, y1, x2, y2, x3, y3))
+				{
+					mask_row[x] = 1;
+				}
+			}
+		}
+	}
+}
+
+//===========================================================================
+void PAW::Read(std::istream& stream)
 {
 
 	stream.read ((char*)&number_of_pixels, 4);
@@ -290,41 +356,91 @@ void PAW::Read(std::ifstream& stream)
 	LandmarkDetector::ReadMatBin(stream, alpha);
 
 	LandmarkDetector::ReadMatBin(stream, beta);
-
-	map_x.create(pixel_mask.rows,pixel_mask.cols);
-	map_y.create(pixel_mask.rows,pixel_mask.cols);
-
-	coefficients.create(this->NumberOfTriangles(),6);
-	
-	source_landmarks = destination_landmarks;
 }
 
 //=============================================================================
 // cropping from the source image to the destination image using the shape in s, used to determine if shape fitting converged successfully
-void PAW::Warp(const cv::Mat& image_to_warp, cv::Mat& destination_image, const cv::Mat_<double>& landmarks_to_warp)
+void PAW::Warp(const cv::Mat& image_to_warp, cv::Mat& destination_image, const cv::Mat_<double>& landmarks_to_warp) const
 {
   
-	// set the current shape
-	source_landmarks = landmarks_to_warp.clone();
-
 	// prepare the mapping coefficients using the current shape
-	this->CalcCoeff();
+	cv::Mat_<double> coefficients;
+	this->CalcCoeff(landmarks_to_warp, coefficients);
 
 	// Do the actual mapping computation (where to warp from)
-	this->WarpRegion(map_x, map_y);
+	cv::Mat_<float> map_x, map_y;
+	this->WarpRegion(coefficients, map_x, map_y);
   	
 	// Do the actual warp (with bi-linear interpolation)
 	remap(image_to_warp, destination_image, map_x, map_y, CV_INTER_LINEAR);
   
 }
 
+void PAW::WarpFromROI(const cv::Mat& image_to_warp, cv::Mat_<float>& destination_image, const cv::Mat_<double>& landmarks_to_warp) const
+{
+	// prepare the mapping coefficients using the current shape
+	cv::Mat_<double> coefficients;
+	this->CalcCoeff(landmarks_to_warp, coefficients);
+
+	// Do the actual mapping computation (where to warp from)
+	cv::Mat_<float> map_x, map_y;
+	this->WarpRegion(coefficients, map_x, map_y);
+
+	// The bounding box of the sampled locations (the pixels outside of the mask are not sampled)
+	float min_map_x = FLT_MAX, min_map_y = FLT_MAX, max_map_x = -FLT_MAX, max_map_y = -FLT_MAX;
+	for(int y = 0; y < pixel_mask.rows; ++y)
+	{
+		const uchar* mp = pixel_mask.ptr<uchar>(y);
+		const float* xp = map_x.ptr<float>(y);
+		const float* yp = map_y.ptr<float>(y);
+
+		for(int x = 0; x < pixel_mask.cols; ++x)
+		{
+			if(mp[x])
+			{
+				min_map_x = std::min(min_map_x, xp[x]);
+				max_map_x = std::max(max_map_x, xp[x]);
+				min_map_y = std::min(min_map_y, yp[x]);
+				max_map_y = std::max(max_map_y, yp[x]);
+			}
+		}
+	}
+
+	// The bi-linear interpolation also reads the pixels to the right and below a sample, a pixel of margin is added on top of that
+	// Where the region is clipped by the image it keeps the border behaviour of warping the whole image
+	cv::Rect roi;
+	if(min_map_x <= max_map_x)
+	{
+		int x0 = (int)std::floor(min_map_x) - 1;
+		int y0 = (int)std::floor(min_map_y) - 1;
+		roi = cv::Rect(x0, y0, (int)std::floor(max_map_x) + 3 - x0, (int)std::floor(max_map_y) + 3 - y0) & cv::Rect(0, 0, image_to_warp.cols, image_to_warp.rows);
+	}
+
+	if(roi.area() == 0)
+	{
+		// Nothing of the face is in the image
+		destination_image = cv::Mat_<float>::zeros(pixel_mask.rows, pixel_mask.cols);
+		return;
+	}
+
+	cv::Mat_<float> roi_image;
+	image_to_warp(roi).convertTo(roi_image, CV_32F);
+
+	map_x -= roi.x;
+	map_y -= roi.y;
+
+	remap(roi_image, destination_image, map_x, map_y, CV_INTER_LINEAR);
+}
+
 
 //=============================================================================
 // Calculate the warping coefficients
-void PAW::CalcCoeff()
+void PAW::CalcCoeff(const cv::Mat_<double>& source_landmarks, cv::Mat_<double>& coefficients) const
 {
 	int p = this->NumberOfLandmarks();
 
+	coefficients.create(this->NumberOfTriangles(), 6);
+
 	for(int l = 0; l < this->NumberOfTriangles(); l++)
 	{
 	  
@@ -343,8 +459,8 @@ void PAW::CalcCoeff()
 		double *coeff = coefficients.ptr<double>(l);
 
 		// Extract the relevant alphas and betas
-		double *c_alpha = alpha.ptr<double>(l);
-		double *c_beta  = beta.ptr<double>(l);
+		const double *c_alpha = alpha.ptr<double>(l);
+		const double *c_beta  = beta.ptr<double>(l);
 
 		coeff[0] = c1 + c2 * c_alpha[0] + c3 * c_beta[0];
 		coeff[1] =      c2 * c_alpha[1] + c3 * c_beta[1];
@@ -357,16 +473,18 @@ void PAW::CalcCoeff()
 
 //======================================================================
 // Compute the mapping coefficients
-void PAW::WarpRegion(cv::Mat_<float>& mapx, cv::Mat_<float>& mapy)
+void PAW::WarpRegion(const cv::Mat_<double>& coefficients, cv::Mat_<float>& mapx, cv::Mat_<float>& mapy) const
 {
-	
+	mapx.create(pixel_mask.rows, pixel_mask.cols);
+	mapy.create(pixel_mask.rows, pixel_mask.cols);
+
 	cv::MatIterator_<float> xp = mapx.begin();
 	cv::MatIterator_<float> yp = mapy.begin();
-	cv::MatIterator_<uchar> mp = pixel_mask.begin();
-	cv::MatIterator_<int>   tp = triangle_id.begin();
+	cv::MatConstIterator_<uchar> mp = pixel_mask.begin();
+	cv::MatConstIterator_<int>   tp = triangle_id.begin();
 	
 	// The coefficients corresponding to the current triangle
-	double * a;
+	const double * a;
 
 	// Current triangle being processed	
 	int k=-1;
@@ -399,7 +517,7 @@ void PAW::WarpRegion(cv::Mat_<float>& mapx, cv::Mat_<float>& mapy)
 				}  	
 
 				//ap is now the pointer to the coefficients
-				double *ap = a;							
+				const double *ap = a;							
 
 				//look at the first coefficient (and increment). first coefficient is an x offset
 				double xo = *ap++;						
@@ -49,6 +49,7 @@
 #endif
 
 #include <LandmarkDetectorUtils.h>
+#include <ModelBundle.h>
 
 using namespace LandmarkDetector;
 //===========================================================================
@@ -81,11 +82,13 @@ PDM::PDM(const PDM& other) {
 	this->mean_shape = other.mean_shape.clone();
 	this->princ_comp = other.princ_comp.clone();
 	this->eigen_values = other.eigen_values.clone();
+	this->mean_shape_f = other.mean_shape_f.clone();
+	this->princ_comp_f = other.princ_comp_f.clone();
 }
 
 //===========================================================================
 // Clamping the parameter values to be within 3 standard deviations
-void PDM::Clamp(cv::Mat_<float>& local_params, cv::Vec6d& params_global, const FaceModelParameters& parameters)
+void PDM::Clamp(cv::Mat_<float>& local_params, cv::Vec6d& params_global, const FaceModelParameters& parameters) const
 {
 	double n_sigmas = 3;
 	cv::MatConstIterator_<double> e_it  = this->eigen_values.begin();
@@ -176,7 +179,7 @@ void PDM::CalcShape2D(cv::Mat_<double>& out_shape, const cv::Mat_<double>& param
 //===========================================================================
 // provided the bounding box of a face and the local parameters (with optional rotation), generates the global parameters that can generate the face with the provided bounding box
 // This all assumes that the bounding box describes face from left outline to right outline of the face and chin to eyebrows
-void PDM::CalcParams(cv::Vec6d& out_params_global, const cv::Rect_<double>& bounding_box, const cv::Mat_<double>& params_local, const cv::Vec3d rotation)
+void PDM::CalcParams(cv::Vec6d& out_params_global, const cv::Rect_<double>& bounding_box, const cv::Mat_<double>& params_local, const cv::Vec3d rotation) const
 {
 
 	// get the shape instance based on local params
@@ -219,7 +222,7 @@ void PDM::CalcParams(cv::Vec6d& out_params_global, const cv::Rect_<double>& boun
 //===========================================================================
 // provided the model parameters, compute the bounding box of a face
 // The bounding box describes face from left outline to right outline of the face and chin to eyebrows
-void PDM::CalcBoundingBox(cv::Rect& out_bounding_box, const cv::Vec6d& params_global, const cv::Mat_<double>& params_local)
+void PDM::CalcBoundingBox(cv::Rect& out_bounding_box, const cv::Vec6d& params_global, const cv::Mat_<double>& params_local) const
 {
 	
 	// get the shape instance based on local params
@@ -243,7 +246,7 @@ void PDM::CalcBoundingBox(cv::Rect& out_bounding_box, const cv::Vec6d& params_gl
 
 //===========================================================================
 // Calculate the PDM's Jacobian over rigid parameters (rotation, translation and scaling), the additional input W represents trust for each of the landmarks and is part of Non-Uniform RLMS 
-void PDM::ComputeRigidJacobian(const cv::Mat_<float>& p_local, const cv::Vec6d& params_global, cv::Mat_<float> &Jacob, const cv::Mat_<float> W, cv::Mat_<float> &Jacob_t_w)
+void PDM::ComputeRigidJacobian(const cv::Mat_<float>& p_local, const cv::Vec6d& params_global, cv::Mat_<float> &Jacob, const cv::Mat_<float> W, cv::Mat_<float> &Jacob_t_w) const
 {
   	
 	// number of verts
@@ -339,7 +342,7 @@ void PDM::ComputeRigidJacobian(const cv::Mat_<float>& p_local, const cv::Vec6d&
 
 //===========================================================================
 // Calculate the PDM's Jacobian over all parameters (rigid and non-rigid), the additional input W represents trust for each of the landmarks and is part of Non-Uniform RLMS
-void PDM::ComputeJacobian(const cv::Mat_<float>& params_local, const cv::Vec6d& params_global, cv::Mat_<float> &Jacobian, const cv::Mat_<float> W, cv::Mat_<float> &Jacob_t_w)
+void PDM::ComputeJacobian(const cv::Mat_<float>& params_local, const cv::Vec6d& params_global, cv::Mat_<float> &Jacobian, const cv::Mat_<float> W, cv::Mat_<float> &Jacob_t_w) const
 { 
 	
 	// number of vertices
@@ -450,7 +453,7 @@ void PDM::ComputeJacobian(const cv::Mat_<float>& params_local, const cv::Vec6d&
 
 //===========================================================================
 // Updating the parameters (more details in my thesis)
-void PDM::UpdateModelParameters(const cv::Mat_<float>& delta_p, cv::Mat_<float>& params_local, cv::Vec6d& params_global)
+void PDM::UpdateModelParameters(const cv::Mat_<float>& delta_p, cv::Mat_<float>& params_local, cv::Vec6d& params_global) const
 {
 
 	// The scaling and translation parameters can be just added
@@ -493,7 +496,155 @@ void PDM::UpdateModelParameters(const cv::Mat_<float>& delta_p, cv::Mat_<float>&
 
 }
 
-void PDM::CalcParams(cv::Vec6d& out_params_global, const cv::Mat_<double>& out_params_local, const cv::Mat_<double>& landmark_locations, const cv::Vec3d rotation)
+void PDM::CalcShape2D(cv::Mat_<float>& out_shape, cv::Mat_<float>& shape_3D, const cv::Mat_<float>& params_local, const cv::Vec6d& params_global) const
+{
+
+	int n = this->NumberOfPoints();
+	int m = this->NumberOfModes();
+
+	float s = (float) params_global[0]; // scaling factor
+	float tx = (float) params_global[4]; // x offset
+	float ty = (float) params_global[5]; // y offset
+
+	// get the rotation matrix from the euler angles
+	cv::Vec3d euler(params_global[1], params_global[2], params_global[3]);
+	cv::Matx33f currRot = Euler2RotationMatrix(euler);
+
+	// These are no-ops once the buffers have been allocated
+	shape_3D.create(3 * n, 1);
+	out_shape.create(2 * n, 1);
+
+	const float* p = params_local.ptr<float>();
+
+	// get the 3D shape of the object
+	for(int i = 0; i < 3 * n; ++i)
+	{
+		const float* V = princ_comp_f[i];
+		float v = mean_shape_f(i, 0);
+		for(int j = 0; j < m; ++j)
+		{
+			v += V[j] * p[j];
+		}
+		shape_3D(i, 0) = v;
+	}
+
+	const float* X = shape_3D[0];
+	const float* Y = X + n;
+	const float* Z = Y + n;
+
+	float* x = out_shape[0];
+	float* y = x + n;
+
+	// Transform this using the weak-perspective mapping to 2D from 3D
+	for(int i = 0; i < n; ++i)
+	{
+		x[i] = s * (currRot(0,0) * X[i] + currRot(0,1) * Y[i] + currRot(0,2) * Z[i]) + tx;
+		y[i] = s * (currRot(1,0) * X[i] + currRot(1,1) * Y[i] + currRot(1,2) * Z[i]) + ty;
+	}
+}
+
+void PDM::ComputeNormalEquations(const cv::Mat_<float>& shape_3D, const cv::Vec6d& params_global, const cv::Mat_<float>& weights, const cv::Mat_<float>& mean_shifts, bool rigid,
+	cv::Mat_<float>& jacobian_rows, cv::Mat_<float>& hessian, cv::Mat_<float>& J_w_t_m) const
+{
+
+	int n = this->NumberOfPoints();
+	int m = this->NumberOfModes();
+
+	// The number of parameters being optimised
+	int d = rigid ? 6 : 6 + m;
+
+	// These are no-ops once the buffers have been allocated
+	jacobian_rows.create(2, 6 + m);
+	hessian.create(6 + m, 6 + m);
+	J_w_t_m.create(6 + m, 1);
+
+	hessian.setTo(0);
+	J_w_t_m.setTo(0);
+
+	float s = (float) params_global[0];
+
+	cv::Vec3d euler(params_global[1], params_global[2], params_global[3]);
+	cv::Matx33f currRot = Euler2RotationMatrix(euler);
+
+	float r11 = currRot(0,0);
+	float r12 = currRot(0,1);
+	float r13 = currRot(0,2);
+	float r21 = currRot(1,0);
+	float r22 = currRot(1,1);
+	float r23 = currRot(1,2);
+
+	const float* X = shape_3D[0];
+	const float* Y = X + n;
+	const float* Z = Y + n;
+
+	float* Jx = jacobian_rows[0];
+	float* Jy = jacobian_rows[1];
+	float* J_w_t_m_ptr = J_w_t_m[0];
+
+	for(int i = 0; i < n; ++i)
+	{
+		float w = weights(i, 0);
+
+		if(w == 0)
+		{
+			continue;
+		}
+
+		// The Jacobian rows of this vertex, same as in ComputeJacobian (small angle approximation of the rotation)
+
+		// scaling term
+		Jx[0] = (X[i] * r11 + Y[i] * r12 + Z[i] * r13);
+		Jy[0] = (X[i] * r21 + Y[i] * r22 + Z[i] * r23);
+
+		// rotation terms
+		Jx[1] = (s * (Y[i] * r13 - Z[i] * r12));
+		Jy[1] = (s * (Y[i] * r23 - Z[i] * r22));
+		Jx[2] = (-s * (X[i] * r13 - Z[i] * r11));
+		Jy[2] = (-s * (X[i] * r23 - Z[i] * r21));
+		Jx[3] = (s * (X[i] * r12 - Y[i] * r11));
+		Jy[3] = (s * (X[i] * r22 - Y[i] * r21));
+
+		// translation terms
+		Jx[4] = 1.0f;
+		Jy[4] = 0.0f;
+		Jx[5] = 0.0f;
+		Jy[5] = 1.0f;
+
+		if(!rigid)
+		{
+			const float* Vx = princ_comp_f[i];
+			const float* Vy = princ_comp_f[i + n];
+			const float* Vz = princ_comp_f[i + 2 * n];
+
+			// How much the change of the non-rigid parameters (when object is rotated) affect 2D motion
+			for(int j = 0; j < m; ++j)
+			{
+				Jx[6 + j] = s * (r11 * Vx[j] + r12 * Vy[j] + r13 * Vz[j]);
+				Jy[6 + j] = s * (r21 * Vx[j] + r22 * Vy[j] + r23 * Vz[j]);
+			}
+		}
+
+		float msx = mean_shifts(i, 0);
+		float msy = mean_shifts(i + n, 0);
+
+		// Add the contribution of both rows to J'W * mean_shifts and to the lower triangle of J'WJ
+		for(int r = 0; r < d; ++r)
+		{
+			float wx = w * Jx[r];
+			float wy = w * Jy[r];
+
+			J_w_t_m_ptr[r] += wx * msx + wy * msy;
+
+			float* H = hessian[r];
+			for(int c = 0; c <= r; ++c)
+			{
+				H[c] += wx * Jx[c] + wy * Jy[c];
+			}
+		}
+	}
+}
+
+void PDM::CalcParams(cv::Vec6d& out_params_global, const cv::Mat_<double>& out_params_local, const cv::Mat_<double>& landmark_locations, const cv::Vec3d rotation) const
 {
 		
 	int m = this->NumberOfModes();
@@ -528,11 +679,11 @@ void PDM::CalcParams(cv::Vec6d& out_params_global, const cv::Mat_<double>& out_p
 		}
 	}
 
-	cv::Mat_<double> m_old = this->mean_shape.clone();
-	cv::Mat_<double> v_old = this->princ_comp.clone();
-
-	this->mean_shape = M;
-	this->princ_comp = V;
+	// Fit using a subsampled copy of the model rather than swapping out our own bases, so that the PDM stays untouched and can be shared
+	PDM subset_pdm;
+	subset_pdm.mean_shape = M;
+	subset_pdm.princ_comp = V;
+	subset_pdm.eigen_values = this->eigen_values;
 
 	// The new number of points
 	n  = M.rows / 3;
@@ -552,17 +703,17 @@ void PDM::CalcParams(cv::Vec6d& out_params_global, const cv::Mat_<double>& out_p
 	// Compute the initial global parameters
 	double min_x;
 	double max_x;
-	cv::minMaxLoc(landmark_locations(cv::Rect(0, 0, 1, this->NumberOfPoints())), &min_x, &max_x);
+	cv::minMaxLoc(landmark_locations(cv::Rect(0, 0, 1, subset_pdm.NumberOfPoints())), &min_x, &max_x);
 
 	double min_y;
 	double max_y;
-	cv::minMaxLoc(landmark_locations(cv::Rect(0, this->NumberOfPoints(), 1, this->NumberOfPoints())), &min_y, &max_y);
+	cv::minMaxLoc(landmark_locations(cv::Rect(0, subset_pdm.NumberOfPoints(), 1, subset_pdm.NumberOfPoints())), &min_y, &max_y);
 
 	double width = abs(min_x - max_x);
 	double height = abs(min_y - max_y);
 
 	cv::Rect model_bbox;
-	CalcBoundingBox(model_bbox, cv::Vec6d(1.0, 0.0, 0.0, 0.0, 0.0, 0.0), cv::Mat_<double>(this->NumberOfModes(), 1, 0.0));
+	subset_pdm.CalcBoundingBox(model_bbox, cv::Vec6d(1.0, 0.0, 0.0, 0.0, 0.0, 0.0), cv::Mat_<double>(subset_pdm.NumberOfModes(), 1, 0.0));
 
 	cv::Rect bbox((int)min_x, (int)min_y, (int)width, (int)height);
 
@@ -572,7 +723,7 @@ void PDM::CalcParams(cv::Vec6d& out_params_global, const cv::Mat_<double>& out_p
 	cv::Matx33d R = Euler2RotationMatrix(rotation_init);
 	cv::Vec2d translation((min_x + max_x) / 2.0, (min_y + max_y) / 2.0);
     
-	cv::Mat_<float> loc_params(this->NumberOfModes(),1, 0.0);
+	cv::Mat_<float> loc_params(subset_pdm.NumberOfModes(),1, 0.0);
 	cv::Vec6d glob_params(scaling, rotation_init[0], rotation_init[1], rotation_init[2], translation[0], translation[1]);
 
 	// get the 3D shape of the object
@@ -626,7 +777,7 @@ void PDM::CalcParams(cv::Vec6d& out_params_global, const cv::Mat_<double>& out_p
 		cv::Mat(landmark_locs_vis - curr_shape_2D).convertTo(error_resid, CV_32F);
         
 		cv::Mat_<float> J, J_w_t;
-		this->ComputeJacobian(loc_params, glob_params, J, WeightMatrix, J_w_t);
+		subset_pdm.ComputeJacobian(loc_params, glob_params, J, WeightMatrix, J_w_t);
         
 		// projection of the meanshifts onto the jacobians (using the weighted Jacobian, see Baltrusaitis 2013)
 		cv::Mat_<float> J_w_t_m = J_w_t * error_resid;
@@ -646,7 +797,7 @@ void PDM::CalcParams(cv::Vec6d& out_params_global, const cv::Mat_<double>& out_p
 		// To not overshoot, have the gradient decent rate a bit smaller
 		param_update = 0.5 * param_update;
 
-		UpdateModelParameters(param_update, loc_params, glob_params);		
+		subset_pdm.UpdateModelParameters(param_update, loc_params, glob_params);		
         
         scaling = glob_params[0];
 		rotation_init[0] = glob_params[1];
@@ -684,9 +835,6 @@ void PDM::CalcParams(cv::Vec6d& out_params_global, const cv::Mat_<double>& out_p
 
 	out_params_global = glob_params;
 	loc_params.convertTo(out_params_local, CV_64F);
-    	
-	this->mean_shape = m_old;
-	this->princ_comp = v_old;
 
 
 }
@@ -694,7 +842,7 @@ void PDM::CalcParams(cv::Vec6d& out_params_global, const cv::Mat_<double>& out_p
 void PDM::Read(string location)
 {
   	
-	ifstream pdmLoc(location, ios_base::in);
+	ModelStream pdmLoc(location);
 
 	LandmarkDetector::SkipComments(pdmLoc);
 
@@ -711,4 +859,7 @@ void PDM::Read(string location)
 	// Reading eigenvalues	
 	LandmarkDetector::ReadMat(pdmLoc,eigen_values);
 
+	mean_shape.convertTo(mean_shape_f, CV_32F);
+	princ_comp.convertTo(princ_comp_f, CV_32F);
+
 }
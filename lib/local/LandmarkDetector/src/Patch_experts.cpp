@@ -37,8 +37,7 @@
 #include "Patch_experts.h"
 
 // OpenCV includes
-#include <opencv2/core/core_c.h>
-#include <opencv2/imgproc/imgproc_c.h>
+#include <opencv2/core/core.hpp>
 
 // TBB includes
 #include <tbb/tbb.h>
@@ -52,6 +51,7 @@
 #endif
 
 #include "LandmarkDetectorUtils.h"
+#include "ModelBundle.h"
 
 using namespace LandmarkDetector;
 
@@ -86,24 +86,57 @@ Patch_experts::Patch_experts(const Patch_experts& other) : patch_scaling(other.p
 	}
 }
 
+void Patch_response_workspace::Allocate(int n, int n_blocks)
+{
+	area_of_interest_widths.resize(n);
+	area_of_interest_heights.resize(n);
+	area_of_interest_offsets.resize(n + 1);
+	centres.resize(n);
+
+	areas.resize(n);
+	depth_areas.resize(n);
+	mask_areas.resize(n);
+
+	depth_responses.resize(n);
+	sigmas.resize(n);
+	sigma_keys.resize(n, cv::Vec3i(-1, -1, -1));
+
+	ccnf_buffers.resize(n_blocks);
+}
+
+// Make sure a contiguous buffer can hold at least size elements (it is never shrunk)
+static void ReserveBuffer(cv::Mat_<float>& buffer, int size)
+{
+	if(buffer.cols < size)
+	{
+		buffer.create(1, size);
+	}
+}
+
 // Returns the patch expert responses given a grayscale and an optional depth image.
 // Additionally returns the transform from the image coordinates to the response coordinates (and vice versa).
 // The computation also requires the current landmark locations to compute response around, the PDM corresponding to the desired model, and the parameters describing its instance
 // Also need to provide the size of the area of interest and the desired scale of analysis
 void Patch_experts::Response(vector<cv::Mat_<float> >& patch_expert_responses, cv::Matx22f& sim_ref_to_img, cv::Matx22d& sim_img_to_ref, const cv::Mat_<uchar>& grayscale_image, const cv::Mat_<float>& depth_image,
-							 const PDM& pdm, const cv::Vec6d& params_global, const cv::Mat_<double>& params_local, int window_size, int scale)
+							 const PDM& pdm, const cv::Vec6d& params_global, const cv::Mat_<double>& params_local, int window_size, int scale, Patch_response_workspace& workspace) const
 {
 
 	int view_id = GetViewIdx(params_global, scale);		
 
 	int n = pdm.NumberOfPoints();
+
+	// The landmarks are evaluated in blocks with scratch buffers shared within the block, this keeps the tasks big enough for the scheduling overhead not to matter
+	const int landmark_block_size = 8;
+
+	Patch_response_workspace& ws = workspace;
+	ws.Allocate(n, (n + landmark_block_size - 1) / landmark_block_size);
 		
 	// Compute the current landmark locations (around which responses will be computed)
-	cv::Mat_<double> landmark_locations;
+	cv::Mat_<double>& landmark_locations = ws.landmark_locations;
 
 	pdm.CalcShape2D(landmark_locations, params_local, params_global);
 
-	cv::Mat_<double> reference_shape;
+	cv::Mat_<double>& reference_shape = ws.reference_shape;
 		
 	// Initialise the reference shape on which we'll be warping
 	cv::Vec6d global_ref(patch_scaling[scale], 0, 0, 0, 0, 0);
@@ -126,154 +159,245 @@ void Patch_experts::Response(vector<cv::Mat_<float> >& patch_expert_responses, c
 	sim_ref_to_img(1,0) = (float)sim_ref_to_img_d(1,0);
 	sim_ref_to_img(1,1) = (float)sim_ref_to_img_d(1,1);
 
+	// The depth and the legal depth pixel areas for CLM-Z
+	bool use_depth = !svr_expert_depth.empty() && !depth_image.empty();
+
 	// Indicates the legal pixels in a depth image, if available (used for CLM-Z area of interest (window) interpolation)
-	cv::Mat_<uchar> mask;
-	if(!depth_image.empty())
+	cv::Mat_<uchar>& mask = ws.mask;
+	if(use_depth)
 	{
-		mask = depth_image > 0;			
-		mask = mask / 255;
+		cv::compare(depth_image, 0, mask, cv::CMP_GT);
+		mask /= 255;
 	}		
 	
-
 	bool use_ccnf = !this->ccnf_expert_intensity.empty();
 
-	// If using CCNF patch experts might need to precalculate Sigmas
-	if(use_ccnf)
+	// All of the areas of interest and responses are stored in contiguous buffers with the landmarks laid out one after another,
+	// the area of interest sizes can differ between landmarks as they depend on the patch expert support
+	vector<int>& area_of_interest_widths = ws.area_of_interest_widths;
+	vector<int>& area_of_interest_heights = ws.area_of_interest_heights;
+	vector<int>& area_of_interest_offsets = ws.area_of_interest_offsets;
+
+	bool visibility_known = visibilities[scale][view_id].rows == n;
+
+	for(int i = 0; i < n; ++i)
 	{
-		vector<cv::Mat_<float> > sigma_components;
+		area_of_interest_widths[i] = 0;
+		area_of_interest_heights[i] = 0;
 
-		// Retrieve the correct sigma component size
-		for( size_t w_size = 0; w_size < this->sigma_components.size(); ++w_size)
+		if(visibility_known && visibilities[scale][view_id].at<int>(i,0) != 0)
 		{
-			if(!this->sigma_components[w_size].empty())
+			// Work out how big the area of interest has to be to get a response of window size
+			if(use_ccnf)
 			{
-				if(window_size*window_size == this->sigma_components[w_size][0].rows)
-				{
-					sigma_components = this->sigma_components[w_size];
-				}
+				area_of_interest_widths[i] = window_size + ccnf_expert_intensity[scale][view_id][i].width - 1; 
+				area_of_interest_heights[i] = window_size + ccnf_expert_intensity[scale][view_id][i].height - 1;				
 			}
-		}			
-
-		// Go through all of the landmarks and compute the Sigma for each
-		for( int lmark = 0; lmark < n; lmark++)
-		{
-			// Only for visible landmarks
-			if(visibilities[scale][view_id].at<int>(lmark,0))
+			else
 			{
-				// Precompute sigmas if they are not computed yet
-				ccnf_expert_intensity[scale][view_id][lmark].ComputeSigmas(sigma_components, window_size);
+				area_of_interest_widths[i] = window_size + svr_expert_intensity[scale][view_id][i].width - 1; 
+				area_of_interest_heights[i] = window_size + svr_expert_intensity[scale][view_id][i].height - 1;
 			}
 		}
+		area_of_interest_offsets[i + 1] = area_of_interest_offsets[i] + area_of_interest_widths[i] * area_of_interest_heights[i];
+	}
 
+	ReserveBuffer(ws.areas_of_interest, area_of_interest_offsets[n]);
+	if(use_depth)
+	{
+		ReserveBuffer(ws.depth_areas_of_interest, area_of_interest_offsets[n]);
+		ReserveBuffer(ws.mask_areas_of_interest, area_of_interest_offsets[n]);
 	}
 
-	// calculate the patch responses for every landmark, Actual work happens here. If openMP is turned on it is possible to do this in parallel,
-	// this might work well on some machines, while potentially have an adverse effect on others
-#ifdef _OPENMP
-#pragma omp parallel for
-#endif
-	tbb::parallel_for(0, (int)n, [&](int i){
-	//for(int i = 0; i < n; i++)
+	// The response of every landmark is a part of one buffer (the invisible ones stay at zero)
+	int response_size = window_size * window_size;
+	ReserveBuffer(ws.responses, n * response_size);
+	cv::Mat_<float>(1, n * response_size, ws.responses.ptr<float>(0)).setTo(0);
+	for(int i = 0; i < n; ++i)
 	{
-			
-		if(visibilities[scale][view_id].rows == n)
+		patch_expert_responses[i] = cv::Mat_<float>(window_size, window_size, ws.responses.ptr<float>(0) + i * response_size);
+	}
+
+	// scale and rotate to mean shape to reference frame, the same for all of the landmarks
+	cv::Matx22f sim((float)a1, (float)-b1, (float)b1, (float)a1);
+
+	// The regions of interest around the current landmark locations, they are extracted block by block in the parallel loop below
+	for(int i = 0; i < n; ++i)
+	{
+		ws.centres[i] = cv::Point2f((float)landmark_locations.at<double>(i,0), (float)landmark_locations.at<double>(i+n,0));
+
+		ws.areas[i].release();
+		ws.depth_areas[i].release();
+		ws.mask_areas[i].release();
+
+		if(area_of_interest_widths[i] != 0)
 		{
-			if(visibilities[scale][view_id].at<int>(i,0) != 0)
+			ws.areas[i] = cv::Mat_<float>(area_of_interest_heights[i], area_of_interest_widths[i], ws.areas_of_interest.ptr<float>(0) + area_of_interest_offsets[i]);
+			if(use_depth)
 			{
+				ws.depth_areas[i] = cv::Mat_<float>(area_of_interest_heights[i], area_of_interest_widths[i], ws.depth_areas_of_interest.ptr<float>(0) + area_of_interest_offsets[i]);
+				ws.mask_areas[i] = cv::Mat_<float>(area_of_interest_heights[i], area_of_interest_widths[i], ws.mask_areas_of_interest.ptr<float>(0) + area_of_interest_offsets[i]);
+			}
+		}
+	}
+
+	tbb::parallel_for(tbb::blocked_range<int>(0, n, landmark_block_size), [&](const tbb::blocked_range<int>& block){
+
+		CCNF_response_buffers& buffers = ws.ccnf_buffers[block.begin() / landmark_block_size];
+
+		// Extract the areas of interest of this block
+		ExtractAreasOfInterest(grayscale_image, sim, ws.centres, ws.areas, block.begin(), block.end());
+
+		if(use_depth)
+		{
+			ExtractAreasOfInterest(depth_image, sim, ws.centres, ws.depth_areas, block.begin(), block.end());
+			ExtractAreasOfInterest(mask, sim, ws.centres, ws.mask_areas, block.begin(), block.end());
+		}
+
+		for(int i = block.begin(); i < block.end(); ++i)
+		{
+			if(area_of_interest_widths[i] == 0)
+				continue;
+
+			const cv::Mat_<float>& area_of_interest = ws.areas[i];
 
-				// Work out how big the area of interest has to be to get a response of window size
-				int area_of_interest_width;
-				int area_of_interest_height;
+			// Get intensity response either from the SVR or CCNF patch experts (prefer CCNF)
+			if(use_ccnf)
+			{				
+				const CCNF_patch_expert& expert = ccnf_expert_intensity[scale][view_id][i];
 
-				if(use_ccnf)
+				int sigma_idx = expert.GetSigmaIdx(window_size);
+				if(sigma_idx != -1)
 				{
-					area_of_interest_width = window_size + ccnf_expert_intensity[scale][view_id][i].width - 1; 
-					area_of_interest_height = window_size + ccnf_expert_intensity[scale][view_id][i].height - 1;				
+					expert.Response(area_of_interest, patch_expert_responses[i], expert.Sigmas[sigma_idx], buffers);
 				}
 				else
 				{
-					area_of_interest_width = window_size + svr_expert_intensity[scale][view_id][i].width - 1; 
-					area_of_interest_height = window_size + svr_expert_intensity[scale][view_id][i].height - 1;
+					// The Sigma was not precomputed in WarmUp, so compute it once for this tracker
+					cv::Vec3i sigma_key(scale, view_id, window_size);
+					if(ws.sigma_keys[i] != sigma_key)
+					{
+						expert.ComputeSigma(GetSigmaComponents(window_size), window_size, ws.sigmas[i]);
+						ws.sigma_keys[i] = sigma_key;
+					}
+					expert.Response(area_of_interest, patch_expert_responses[i], ws.sigmas[i], buffers);
 				}
-			
-				// scale and rotate to mean shape to reference frame
-				cv::Mat sim = (cv::Mat_<float>(2,3) << a1, -b1, landmark_locations.at<double>(i,0), b1, a1, landmark_locations.at<double>(i+n,0));
-
-				// Extract the region of interest around the current landmark location
-				cv::Mat_<float> area_of_interest(area_of_interest_height, area_of_interest_width);
+			}
+			else
+			{
+				svr_expert_intensity[scale][view_id][i].Response(area_of_interest, patch_expert_responses[i]);
+			}
 
-				// Using C style openCV as it does what we need
-				CvMat area_of_interest_o = area_of_interest;
-				CvMat sim_o = sim;
-				IplImage im_o = grayscale_image;			
-				cvGetQuadrangleSubPix(&im_o, &area_of_interest_o, &sim_o);
-			
-				// get the correct size response window			
-				patch_expert_responses[i] = cv::Mat_<float>(window_size, window_size);
+			// if we have a corresponding depth patch and it is visible		
+			if(use_depth)
+			{
 
-				// Get intensity response either from the SVR or CCNF patch experts (prefer CCNF)
-				if(!ccnf_expert_intensity.empty())
-				{				
+				cv::Mat_<float>& dProb = ws.depth_responses[i];
 
-					ccnf_expert_intensity[scale][view_id][i].Response(area_of_interest, patch_expert_responses[i]);
-				}
-				else
+				// Only the legal depth pixels are used
+				cv::Mat_<float>& depthWindow = ws.depth_areas[i];
+				const cv::Mat_<float>& maskWindow = ws.mask_areas[i];
+				for(int y = 0; y < depthWindow.rows; ++y)
 				{
-					svr_expert_intensity[scale][view_id][i].Response(area_of_interest, patch_expert_responses[i]);
+					float* depth_row = depthWindow.ptr<float>(y);
+					const float* mask_row = maskWindow.ptr<float>(y);
+					for(int x = 0; x < depthWindow.cols; ++x)
+					{
+						if(mask_row[x] < 1)
+						{
+							depth_row[x] = 0;
+						}
+					}
 				}
-			
-				// if we have a corresponding depth patch and it is visible		
-				if(!svr_expert_depth.empty() && !depth_image.empty() && visibilities[scale][view_id].at<int>(i,0))
-				{
 
-					cv::Mat_<float> dProb = patch_expert_responses[i].clone();
-					cv::Mat_<float> depthWindow(area_of_interest_height, area_of_interest_width);
-			
+				svr_expert_depth[scale][view_id][i].ResponseDepth(depthWindow, dProb);
+						
+				// Sum to one
+				double sum = cv::sum(patch_expert_responses[i])[0];
 
-					CvMat dimg_o = depthWindow;
-					cv::Mat maskWindow(area_of_interest_height, area_of_interest_width, CV_32F);
-					CvMat mimg_o = maskWindow;
+				// To avoid division by 0 issues
+				if(sum == 0)
+				{
+					sum = 1;
+				}
 
-					IplImage d_o = depth_image;
-					IplImage m_o = mask;
+				patch_expert_responses[i] /= sum;
 
-					cvGetQuadrangleSubPix(&d_o,&dimg_o,&sim_o);
-				
-					cvGetQuadrangleSubPix(&m_o,&mimg_o,&sim_o);
+				// Sum to one
+				sum = cv::sum(dProb)[0];
+				// To avoid division by 0 issues
+				if(sum == 0)
+				{
+					sum = 1;
+				}
 
-					depthWindow.setTo(0, maskWindow < 1);
+				dProb /= sum;
 
-					svr_expert_depth[scale][view_id][i].ResponseDepth(depthWindow, dProb);
-							
-					// Sum to one
-					double sum = cv::sum(patch_expert_responses[i])[0];
+				// Added in place, so the response stays in the workspace
+				patch_expert_responses[i] += dProb;
 
-					// To avoid division by 0 issues
-					if(sum == 0)
-					{
-						sum = 1;
-					}
+			}
+		}
+	});
 
-					patch_expert_responses[i] /= sum;
+}
 
-					// Sum to one
-					sum = cv::sum(dProb)[0];
-					// To avoid division by 0 issues
-					if(sum == 0)
-					{
-						sum = 1;
-					}
+//=============================================================================
+vector<cv::Mat_<float> > Patch_experts::GetSigmaComponents(int window_size) const
+{
+	vector<cv::Mat_<float> > sigma_components;
 
-					dProb /= sum;
+	// Retrieve the correct sigma component size
+	for( size_t w_size = 0; w_size < this->sigma_components.size(); ++w_size)
+	{
+		if(!this->sigma_components[w_size].empty())
+		{
+			if(window_size*window_size == this->sigma_components[w_size][0].rows)
+			{
+				sigma_components = this->sigma_components[w_size];
+			}
+		}
+	}
+	return sigma_components;
+}
 
-					patch_expert_responses[i] = patch_expert_responses[i] + dProb;
+//=============================================================================
+void Patch_experts::WarmUp(int scale, int window_size)
+{
+	if(!ccnf_expert_intensity.empty() && scale < (int)ccnf_expert_intensity.size())
+	{
+		vector<cv::Mat_<float> > sigma_components = GetSigmaComponents(window_size);
 
-				}
+		for(size_t view = 0; view < ccnf_expert_intensity[scale].size(); ++view)
+		{
+			for(size_t lmark = 0; lmark < ccnf_expert_intensity[scale][view].size(); ++lmark)
+			{
+				ccnf_expert_intensity[scale][view][lmark].WarmUp(sigma_components, window_size);
+			}
+		}
+	}
+
+	if(scale < (int)svr_expert_intensity.size())
+	{
+		for(size_t view = 0; view < svr_expert_intensity[scale].size(); ++view)
+		{
+			for(size_t lmark = 0; lmark < svr_expert_intensity[scale][view].size(); ++lmark)
+			{
+				svr_expert_intensity[scale][view][lmark].WarmUp(window_size);
 			}
 		}
 	}
-	});
 
+	if(scale < (int)svr_expert_depth.size())
+	{
+		for(size_t view = 0; view < svr_expert_depth[scale].size(); ++view)
+		{
+			for(size_t lmark = 0; lmark < svr_expert_depth[scale][view].size(); ++lmark)
+			{
+				svr_expert_depth[scale][view][lmark].WarmUp(window_size);
+			}
+		}
+	}
 }
 
 //=============================================================================
@@ -314,13 +438,13 @@ void Patch_experts::Read(vector<string> intensity_svr_expert_locations, vector<s
 	
 	svr_expert_intensity.resize(num_intensity_svr);
 	
-	// Reading in SVR intensity patch experts for each scales it is defined in
-	for(int scale = 0; scale < num_intensity_svr; ++scale)
-	{		
+	// Reading in SVR intensity patch experts for each scales it is defined in (the scales are independent so they are read in parallel)
+	tbb::parallel_for(0, num_intensity_svr, [&](int scale){
 		string location = intensity_svr_expert_locations[scale];
-		cout << "Reading the intensity SVR patch experts from: " << location << "....";
+		int64 start_ticks = cv::getTickCount();
 		Read_SVR_patch_experts(location,  centers[scale], visibilities[scale], svr_expert_intensity[scale], patch_scaling[scale]);
-	}
+		ReportLoadTime("intensity SVR patch experts", location, start_ticks);
+	});
 
 	// Initialise and read CCNF patch experts (currently only intensity based), 
 	int num_intensity_ccnf = intensity_ccnf_expert_locations.size();
@@ -334,11 +458,19 @@ void Patch_experts::Read(vector<string> intensity_svr_expert_locations, vector<s
 		ccnf_expert_intensity.resize(num_intensity_ccnf);
 	}
 
-	for(int scale = 0; scale < num_intensity_ccnf; ++scale)
-	{		
+	vector<vector<vector<cv::Mat_<float> > > > sigma_components_per_scale(num_intensity_ccnf);
+
+	tbb::parallel_for(0, num_intensity_ccnf, [&](int scale){
 		string location = intensity_ccnf_expert_locations[scale];
-		cout << "Reading the intensity CCNF patch experts from: " << location << "....";
-		Read_CCNF_patch_experts(location,  centers[scale], visibilities[scale], ccnf_expert_intensity[scale], patch_scaling[scale]);
+		int64 start_ticks = cv::getTickCount();
+		Read_CCNF_patch_experts(location,  centers[scale], visibilities[scale], ccnf_expert_intensity[scale], patch_scaling[scale], sigma_components_per_scale[scale]);
+		ReportLoadTime("intensity CCNF patch experts", location, start_ticks);
+	});
+
+	// As when reading serially, the sigma components of the last scale are kept
+	if(num_intensity_ccnf > 0)
+	{
+		this->sigma_components = sigma_components_per_scale[num_intensity_ccnf - 1];
 	}
 
 
@@ -359,13 +491,16 @@ void Patch_experts::Read(vector<string> intensity_svr_expert_locations, vector<s
 	
 	svr_expert_depth.resize(num_depth_scales);	
 
-	// Reading in SVR intensity patch experts for each scales it is defined in
-	for(int scale = 0; scale < num_depth_scales; ++scale)
-	{		
+	// Reading in SVR depth patch experts for each scales it is defined in
+	tbb::parallel_for(0, num_depth_scales, [&](int scale){
 		string location = depth_svr_expert_locations[scale];
-		cout << "Reading the depth SVR patch experts from: " << location << "....";
+		int64 start_ticks = cv::getTickCount();
 		Read_SVR_patch_experts(location,  centers_depth[scale], visibilities_depth[scale], svr_expert_depth[scale], patch_scaling_depth[scale]);
+		ReportLoadTime("depth SVR patch experts", location, start_ticks);
+	});
 
+	for(int scale = 0; scale < num_depth_scales; ++scale)
+	{
 		// Check if the scales are identical
 		if(patch_scaling_depth[scale] != patch_scaling[scale])
 		{
@@ -401,7 +536,7 @@ void Patch_experts::Read(vector<string> intensity_svr_expert_locations, vector<s
 void Patch_experts::Read_SVR_patch_experts(string expert_location, std::vector<cv::Vec3d>& centers, std::vector<cv::Mat_<int> >& visibility, std::vector<std::vector<Multi_SVR_patch_expert> >& patches, double& scale)
 {
 
-	ifstream patchesFile(expert_location.c_str(), ios_base::in);
+	ModelStream patchesFile(expert_location);
 
 	if(patchesFile.is_open())
 	{
@@ -455,20 +590,18 @@ void Patch_experts::Read_SVR_patch_experts(string expert_location, std::vector<c
 				patches[i][j].Read(patchesFile);
 			}
 		}
-	
-		cout << "Done" << endl;
 	}
 	else
 	{
-		cout << "Can't find/open the patches file" << endl;
+		cout << "Can't find/open the patches file: " << expert_location << endl;
 	}
 }
 
 //======================= Reading the CCNF patch experts =========================================//
-void Patch_experts::Read_CCNF_patch_experts(string patchesFileLocation, std::vector<cv::Vec3d>& centers, std::vector<cv::Mat_<int> >& visibility, std::vector<std::vector<CCNF_patch_expert> >& patches, double& patchScaling)
+void Patch_experts::Read_CCNF_patch_experts(string patchesFileLocation, std::vector<cv::Vec3d>& centers, std::vector<cv::Mat_<int> >& visibility, std::vector<std::vector<CCNF_patch_expert> >& patches, double& patchScaling, vector<vector<cv::Mat_<float> > >& sigma_components)
 {
 
-	ifstream patchesFile(patchesFileLocation.c_str(), ios::in | ios::binary);
+	ModelStream patchesFile(patchesFileLocation);
 
 	if(patchesFile.is_open())
 	{
@@ -507,7 +640,7 @@ void Patch_experts::Read_CCNF_patch_experts(string patchesFileLocation, std::vec
 		vector<int> windows;
 		windows.resize(num_win_sizes);
 
-		vector<vector<cv::Mat_<float> > > sigma_components;
+		sigma_components.clear();
 		sigma_components.resize(num_win_sizes);
 
 		for (int w=0; w < num_win_sizes; ++w)
@@ -523,8 +656,7 @@ void Patch_experts::Read_CCNF_patch_experts(string patchesFileLocation, std::vec
 				LandmarkDetector::ReadMatBin(patchesFile, sigma_components[w][s]);
 			}
 		}
-		
-		this->sigma_components = sigma_components;
+
 
 		// read the patches themselves
 		for(size_t i = 0; i < patches.size(); i++)
@@ -537,11 +669,10 @@ void Patch_experts::Read_CCNF_patch_experts(string patchesFileLocation, std::vec
 				patches[i][j].Read(patchesFile, windows, sigma_components);
 			}
 		}
-		cout << "Done" << endl;
 	}
 	else
 	{
-		cout << "Can't find/open the patches file" << endl;
+		cout << "Can't find/open the patches file: " << patchesFileLocation << endl;
 	}
 }
 
@@ -114,7 +114,7 @@ SVR_patch_expert::SVR_patch_expert(const SVR_patch_expert& other) : weights(othe
 }
 
 //===========================================================================
-void SVR_patch_expert::Read(ifstream &stream)
+void SVR_patch_expert::Read(istream &stream)
 {
 
 	// A sanity check when reading patch experts
@@ -131,7 +131,13 @@ void SVR_patch_expert::Read(ifstream &stream)
 }
 
 //===========================================================================
-void SVR_patch_expert::Response(const cv::Mat_<float>& area_of_interest, cv::Mat_<float>& response)
+void SVR_patch_expert::PrecomputeDFT(const cv::Size& area_of_interest_size)
+{
+	LandmarkDetector::computeTemplateDFT_m(weights, area_of_interest_size, weights_dfts);
+}
+
+//===========================================================================
+void SVR_patch_expert::Response(const cv::Mat_<float>& area_of_interest, cv::Mat_<float>& response) const
 {
 
 	int response_height = area_of_interest.rows - weights.rows + 1;
@@ -195,7 +201,7 @@ void SVR_patch_expert::Response(const cv::Mat_<float>& area_of_interest, cv::Mat
 
 }
 
-void SVR_patch_expert::ResponseDepth(const cv::Mat_<float>& area_of_interest, cv::Mat_<float> &response)
+void SVR_patch_expert::ResponseDepth(const cv::Mat_<float>& area_of_interest, cv::Mat_<float> &response) const
 {
 
 	// How big the response map will be
@@ -269,7 +275,7 @@ Multi_SVR_patch_expert::Multi_SVR_patch_expert(const Multi_SVR_patch_expert& oth
 }
 
 //===========================================================================
-void Multi_SVR_patch_expert::Read(ifstream &stream)
+void Multi_SVR_patch_expert::Read(istream &stream)
 {
 	// A sanity check when reading patch experts
 	int type;
@@ -287,7 +293,19 @@ void Multi_SVR_patch_expert::Read(ifstream &stream)
 
 }
 //===========================================================================
-void Multi_SVR_patch_expert::Response(const cv::Mat_<float> &area_of_interest, cv::Mat_<float> &response)
+void Multi_SVR_patch_expert::WarmUp(int window_size)
+{
+	// The area of interest that will lead to a response of window size
+	cv::Size area_of_interest_size(window_size + width - 1, window_size + height - 1);
+
+	for(size_t i = 0; i < svr_patch_experts.size(); i++)
+	{
+		svr_patch_experts[i].PrecomputeDFT(area_of_interest_size);
+	}
+}
+
+//===========================================================================
+void Multi_SVR_patch_expert::Response(const cv::Mat_<float> &area_of_interest, cv::Mat_<float> &response) const
 {
 	
 	int response_height = area_of_interest.rows - height + 1;
@@ -321,7 +339,7 @@ void Multi_SVR_patch_expert::Response(const cv::Mat_<float> &area_of_interest, c
 
 }
 
-void Multi_SVR_patch_expert::ResponseDepth(const cv::Mat_<float>& area_of_interest, cv::Mat_<float>& response)
+void Multi_SVR_patch_expert::ResponseDepth(const cv::Mat_<float>& area_of_interest, cv::Mat_<float>& response) const
 {
 	int response_height = area_of_interest.rows - height + 1;
 	int response_width = area_of_interest.cols - width + 1;
@@ -130,11 +130,11 @@ namespace OSC_Funcs
 		int part_right = -1;
 		for (size_t i = 0; i < face_model.hierarchical_models.size(); ++i)
 		{
-			if (face_model.hierarchical_model_names[i].compare("left_eye_28") == 0)
+			if (face_model.model->hierarchical_model_names[i].compare("left_eye_28") == 0)
 			{
 				part_left = i;
 			}
-			if (face_model.hierarchical_model_names[i].compare("right_eye_28") == 0)
+			if (face_model.model->hierarchical_model_names[i].compare("right_eye_28") == 0)
 			{
 				part_right = i;
 			}